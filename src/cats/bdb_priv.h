@@ -64,8 +64,10 @@ protected:
 
 public:
    /* methods */
-   B_DB_PRIV() {};
+   B_DB_PRIV() { m_allow_transactions = false; m_transaction = false; };
    virtual ~B_DB_PRIV() {};
+   bool in_transaction(void) { return m_transaction; };
+   bool is_private(void) { return m_allow_transactions; }; /* mult_db_connections */
 
    int sql_num_rows(void) { return m_num_rows; };
    void sql_field_seek(int field) { m_field_number = field; };
@@ -247,6 +247,764 @@ char *bvfs_basename_dir(char *path)
    return p;
 }
 
+/* 
+ * Director resident path hierarchy
+ *
+ * Computing PathHierarchy and PathVisibility with SQL costs a round
+ * trip per missing parent and one INSERT ... SELECT per directory
+ * level, the first browse of a big job can take minutes.  When
+ * bvfs_enable_path_cache() has been called (the Director does it if
+ * "Bvfs Path Cache Jobs" is set), we keep for each catalog a tree of
+ * the PathIds in memory and, for the last Jobs used, the sorted list
+ * of the directories that are visible in them.
+ *
+ * The tree is fed at the end of the batch insert of a Job (all its
+ * paths are in the batch table at that time), or for the other Jobs
+ * by a single query on File the first time they are browsed.
+ * .bvfs_lsdirs is then answered from memory, and the catalog tables
+ * are only written when .bvfs_update asks for them (or when a query
+ * needs them), so that the other tools still find them.  A Job whose
+ * files are purged is evicted from the tree.
+ *
+ * The catalog is never used with tree_mutex held: the paths are read
+ * first, then put in the tree.  tree_mutex can be taken with the
+ * catalog locked, not the opposite.
+ */
+struct bvfs_node {
+   hlink id_link;                     /* hash link on PathId */
+   hlink path_link;                   /* hash link on Path */
+   uint32_t PathId;
+   uint32_t index;                    /* in bvfs_tree::nodes */
+   bvfs_node *parent;
+   bvfs_node *child;                  /* first sub directory */
+   bvfs_node *sibling;                /* next sub directory of parent */
+   bool saved;                        /* PathHierarchy record written */
+   char *path;
+};
+
+struct bvfs_job {
+   dlink link;                        /* tree LRU list */
+   JobId_t JobId;
+   uint32_t serial;                   /* of the tree of the dirs */
+   uint32_t nb;                       /* number of visible directories */
+   uint32_t *dirs;                    /* their node index, sorted */
+   bool saved;                        /* PathVisibility records written */
+};
+
+#define BVFS_NITEMS 100000
+
+class bvfs_tree: public SMARTALLOC {
+public:
+   dlink link;                        /* list of catalogs */
+   char *key;                         /* catalog, see bvfs_db_key() */
+   uint32_t serial;                   /* unique for each tree */
+   uint32_t evict_gen;                /* incremented at each eviction */
+   htable *ids;                       /* PathId => bvfs_node */
+   htable *paths;                     /* Path => bvfs_node */
+   dlist *jobs;                       /* bvfs_job, most recently used first */
+   uint32_t nb_jobs;
+   bvfs_node **nodes;                 /* index => bvfs_node */
+   uint32_t nb_nodes;
+   uint32_t max_nodes;
+
+   bvfs_tree(const char *name, uint32_t serial);
+   ~bvfs_tree();
+
+   bvfs_node *get_node(uint32_t PathId) {
+      return (bvfs_node *)ids->lookup(PathId);
+   }
+   bvfs_node *get_node(const char *path) {
+      return (bvfs_node *)paths->lookup((char *)path);
+   }
+   bvfs_job *get_job(JobId_t JobId);
+   bvfs_node *add_node(uint32_t PathId, const char *path);
+   void link_node(bvfs_node *node);
+   bvfs_job *add_job(JobId_t JobId, class bvfs_paths *lp);
+   void keep_job(bvfs_job *job, uint32_t max_jobs);
+   void forget_job(JobId_t JobId);
+   uint8_t *get_visibility(char *jobids, alist *temp, uint32_t *size);
+private:
+   bvfs_tree(const bvfs_tree &);               /* prohibit pass by value */
+   bvfs_tree &operator= (const bvfs_tree &);   /* prohibit class assignment */
+};
+
+/* A path read from the catalog, before it goes in a tree */
+struct bvfs_path {
+   hlink link;
+   uint32_t PathId;
+   bvfs_node *node;                   /* once in the tree */
+   char *path;
+};
+
+/* The paths of a Job read from the catalog, and their missing parents */
+class bvfs_paths: public SMARTALLOC {
+public:
+   htable *paths;                     /* Path => bvfs_path */
+   alist *rows;                       /* paths of the Job */
+   alist *parents;                    /* the parents that are not */
+
+   bvfs_paths() {
+      bvfs_path *p = NULL;
+      paths = New(htable(p, &p->link, 1000, 16));
+      rows = New(alist(1000, not_owned_by_alist));
+      parents = New(alist(10, not_owned_by_alist));
+   }
+   ~bvfs_paths() {
+      delete parents;
+      delete rows;
+      delete paths;
+   }
+   void add(alist *list, uint32_t PathId, const char *path);
+};
+
+static pthread_mutex_t tree_mutex = PTHREAD_MUTEX_INITIALIZER;
+static dlist *trees = NULL;           /* one bvfs_tree per catalog */
+static uint32_t tree_serial = 0;
+static bool bvfs_path_cache_enabled = false;
+static uint32_t bvfs_max_jobs = 0;    /* Jobs kept in each tree */
+
+static inline void bvfs_set_visible(uint8_t *bits, uint32_t index)
+{
+   bits[index >> 3] |= 1 << (index & 7);
+}
+
+static inline bool bvfs_is_visible(uint8_t *bits, uint32_t size, bvfs_node *node)
+{
+   return (node->index >> 3) < size && (bits[node->index >> 3] & (1 << (node->index & 7)));
+}
+
+static void free_bvfs_job(bvfs_job *job)
+{
+   if (job->dirs) {
+      free(job->dirs);
+   }
+   free(job);
+}
+
+static void free_bvfs_jobs(alist *list)
+{
+   bvfs_job *job;
+   foreach_alist(job, list) {
+      free_bvfs_job(job);
+   }
+}
+
+/* Identify a catalog, two databases may have the same name */
+static void bvfs_db_key(B_DB *mdb, POOL_MEM &key)
+{
+   Mmsg(key, "%s@%s:%d", mdb->get_db_name(), NPRTB(mdb->get_db_address()),
+        mdb->get_db_port());
+}
+
+bvfs_tree::bvfs_tree(const char *name, uint32_t tree_serial)
+{
+   bvfs_node *node = NULL;
+   bvfs_job *job = NULL;
+   key = bstrdup(name);
+   serial = tree_serial;
+   evict_gen = 0;
+   ids = New(htable(node, &node->id_link, BVFS_NITEMS, 64));
+   paths = New(htable(node, &node->path_link, BVFS_NITEMS, 64));
+   jobs = New(dlist(job, &job->link));
+   nb_jobs = 0;
+   max_nodes = BVFS_NITEMS;
+   nodes = (bvfs_node **)malloc(max_nodes * sizeof(bvfs_node *));
+   nb_nodes = 0;
+}
+
+bvfs_tree::~bvfs_tree()
+{
+   bvfs_job *job;
+   while ((job = (bvfs_job *)jobs->first())) {
+      jobs->remove(job);
+      free_bvfs_job(job);
+   }
+   delete jobs;
+   delete paths;
+   delete ids;
+   free(nodes);
+   free(key);
+}
+
+/* Find a Job, and move it at the head of the LRU list */
+bvfs_job *bvfs_tree::get_job(JobId_t JobId)
+{
+   bvfs_job *job;
+   foreach_dlist(job, jobs) {
+      if (job->JobId == JobId) {
+         if (job != jobs->first()) {
+            jobs->remove(job);
+            jobs->prepend(job);
+         }
+         return job;
+      }
+   }
+   return NULL;
+}
+
+/* Add a directory to the tree, it is not yet linked to its parent */
+bvfs_node *bvfs_tree::add_node(uint32_t PathId, const char *path)
+{
+   bvfs_node *node = get_node(PathId);
+   if (node) {
+      return node;
+   }
+   int len = strlen(path);
+   node = (bvfs_node *)ids->hash_malloc(sizeof(bvfs_node));
+   memset(node, 0, sizeof(bvfs_node));
+   node->path = paths->hash_malloc(len + 1);
+   memcpy(node->path, path, len + 1);
+   node->PathId = PathId;
+   if (nb_nodes == max_nodes) {
+      max_nodes *= 2;
+      nodes = (bvfs_node **)realloc(nodes, max_nodes * sizeof(bvfs_node *));
+   }
+   node->index = nb_nodes;
+   nodes[nb_nodes++] = node;
+   ids->insert(node->PathId, node);
+   paths->insert(node->path, node);
+   return node;
+}
+
+/*
+ * Link a directory and its ancestors to their parent, the parents
+ *  must be in the tree (see bvfs_read_paths()).
+ */
+void bvfs_tree::link_node(bvfs_node *node)
+{
+   POOL_MEM parent_path;
+   bvfs_node *parent;
+
+   /* The root "" has no parent */
+   while (!node->parent && *node->path) {
+      pm_strcpy(parent_path, node->path);
+      bvfs_parent_dir(parent_path.c_str());
+      if (!(parent = get_node(parent_path.c_str()))) {
+         break;
+      }
+      node->parent = parent;
+      node->sibling = parent->child;
+      parent->child = node;
+      node = parent;
+   }
+}
+
+static int bvfs_uint32_cmp(const void *a, const void *b)
+{
+   uint32_t ia = *(uint32_t *)a, ib = *(uint32_t *)b;
+   return ia < ib ? -1 : (ia > ib ? 1 : 0);
+}
+
+/*
+ * Put the paths of a Job in the tree, and return the Job with its
+ *  visible directories, the caller keeps it in the tree or not.
+ */
+bvfs_job *bvfs_tree::add_job(JobId_t JobId, bvfs_paths *lp)
+{
+   bvfs_path *p;
+   bvfs_node *node;
+   bvfs_job *job;
+   uint8_t *bits;
+   uint32_t max = 64;
+
+   foreach_alist(p, lp->parents) {
+      p->node = add_node(p->PathId, p->path);
+   }
+   foreach_alist(p, lp->rows) {
+      p->node = add_node(p->PathId, p->path);
+   }
+   foreach_alist(p, lp->rows) {
+      link_node(p->node);
+   }
+
+   job = (bvfs_job *)malloc(sizeof(bvfs_job));
+   memset(job, 0, sizeof(bvfs_job));
+   job->JobId = JobId;
+   job->serial = serial;
+   job->dirs = (uint32_t *)malloc(max * sizeof(uint32_t));
+   /* A directory is visible with all its ancestors, list them once */
+   bits = (uint8_t *)malloc((nb_nodes >> 3) + 1);
+   memset(bits, 0, (nb_nodes >> 3) + 1);
+   foreach_alist(p, lp->rows) {
+      for (node = p->node; node && !bvfs_is_visible(bits, (nb_nodes >> 3) + 1, node);
+           node = node->parent) {
+         bvfs_set_visible(bits, node->index);
+         if (job->nb == max) {
+            max *= 2;
+            job->dirs = (uint32_t *)realloc(job->dirs, max * sizeof(uint32_t));
+         }
+         job->dirs[job->nb++] = node->index;
+      }
+   }
+   free(bits);
+   qsort(job->dirs, job->nb, sizeof(uint32_t), bvfs_uint32_cmp);
+   Dmsg3(dbglevel, "JobId %d has %d dirs, tree has %d nodes\n", (int)JobId,
+         job->nb, nb_nodes);
+   return job;
+}
+
+/* Keep a Job in the tree, the least recently used go over max_jobs */
+void bvfs_tree::keep_job(bvfs_job *job, uint32_t max_jobs)
+{
+   bvfs_job *old;
+
+   if (get_job(job->JobId)) {
+      free_bvfs_job(job);             /* loaded twice */
+      return;
+   }
+   jobs->prepend(job);
+   nb_jobs++;
+   while (nb_jobs > max_jobs && (old = (bvfs_job *)jobs->last())) {
+      Dmsg1(dbglevel, "Drop JobId %d from the path cache\n", (int)old->JobId);
+      jobs->remove(old);
+      free_bvfs_job(old);
+      nb_jobs--;
+   }
+}
+
+/* Remove a Job from the tree, its directories stay */
+void bvfs_tree::forget_job(JobId_t JobId)
+{
+   bvfs_job *job = get_job(JobId);
+   evict_gen++;
+   if (job) {
+      Dmsg1(dbglevel, "Forget JobId %d\n", (int)JobId);
+      jobs->remove(job);
+      free_bvfs_job(job);
+      nb_jobs--;
+   }
+}
+
+/* 
+ * Return the union of the visible directories of a list of Jobs,
+ *  the Jobs that are not kept in the tree are looked up in temp.
+ */
+uint8_t *bvfs_tree::get_visibility(char *jobids, alist *temp, uint32_t *size)
+{
+   uint8_t *bits;
+   bvfs_job *job;
+   JobId_t JobId;
+   char *p;
+
+   *size = (nb_nodes >> 3) + 1;
+   bits = (uint8_t *)malloc(*size);
+   memset(bits, 0, *size);
+   for (p=jobids; get_next_jobid_from_list(&p, &JobId) > 0; ) {
+      if (!(job = get_job(JobId))) {
+         foreach_alist(job, temp) {
+            if (job->JobId == JobId && job->serial == serial) {
+               break;
+            }
+         }
+      }
+      for (uint32_t i = 0; job && i < job->nb; i++) {
+         if (job->dirs[i] < nb_nodes) {
+            bvfs_set_visible(bits, job->dirs[i]);
+         }
+      }
+   }
+   return bits;
+}
+
+/* Return the tree of a catalog, must be called with tree_mutex */
+static bvfs_tree *get_tree(const char *key)
+{
+   bvfs_tree *tree = NULL;
+   if (!trees) {
+      trees = New(dlist(tree, &tree->link));
+   }
+   foreach_dlist(tree, trees) {
+      if (strcmp(tree->key, key) == 0) {
+         return tree;
+      }
+   }
+   tree = New(bvfs_tree(key, ++tree_serial));
+   trees->append(tree);
+   return tree;
+}
+
+/* PathId of a path already in the tree of the catalog */
+static bool bvfs_known_path(const char *key, const char *path, uint32_t *PathId)
+{
+   bvfs_node *node = NULL;
+
+   P(tree_mutex);
+   if (bvfs_path_cache_enabled) {
+      node = get_tree(key)->get_node(path);
+      if (node) {
+         *PathId = node->PathId;
+      }
+   }
+   V(tree_mutex);
+   return node != NULL;
+}
+
+void bvfs_paths::add(alist *list, uint32_t PathId, const char *path)
+{
+   bvfs_path *p = (bvfs_path *)paths->lookup((char *)path);
+   int len;
+
+   if (p) {
+      return;
+   }
+   len = strlen(path);
+   p = (bvfs_path *)paths->hash_malloc(sizeof(bvfs_path));
+   memset(p, 0, sizeof(bvfs_path));
+   p->PathId = PathId;
+   p->path = paths->hash_malloc(len + 1);
+   memcpy(p->path, path, len + 1);
+   paths->insert(p->path, p);
+   list->append(p);
+}
+
+/* Called for each (PathId, Path) of a Job */
+static int bvfs_paths_handler(void *ctx, int fields, char **row)
+{
+   bvfs_paths *lp = (bvfs_paths *)ctx;
+   if (row[0] && row[1]) {
+      lp->add(lp->rows, str_to_int64(row[0]), row[1]);
+   }
+   return 0;
+}
+
+/*
+ * Read the (PathId, Path) of a Job with query, and the parents that
+ *  are neither among them nor in the tree, generally the few
+ *  directories above the FileSet top.  Must be called without
+ *  tree_mutex.
+ *  Returns: NULL on error
+ */
+static bvfs_paths *bvfs_read_paths(JCR *jcr, B_DB *mdb, const char *key,
+                                   const char *query)
+{
+   POOL_MEM parent_path;
+   bvfs_paths *lp = New(bvfs_paths());
+   bvfs_path *p;
+   ATTR_DBR ar;
+   char *bkp;
+   int nrows, i;
+   bool ok = true;
+
+   db_lock(mdb);
+   if (!db_sql_query(mdb, query, bvfs_paths_handler, lp)) {
+      Dmsg1(dbglevel, "Can't load paths ERR=%s\n", mdb->errmsg);
+      db_unlock(mdb);
+      delete lp;
+      return NULL;
+   }
+   bkp = mdb->path;
+   nrows = lp->rows->size();
+   /* The parents list grows as we walk it */
+   for (i = 0; ok && i < nrows + lp->parents->size(); i++) {
+      p = (bvfs_path *)(i < nrows ? lp->rows->get(i) : lp->parents->get(i - nrows));
+      if (!*p->path) {
+         continue;                    /* the root "" has no parent */
+      }
+      pm_strcpy(parent_path, p->path);
+      bvfs_parent_dir(parent_path.c_str());
+      if (lp->paths->lookup(parent_path.c_str()) ||
+          bvfs_known_path(key, parent_path.c_str(), &ar.PathId)) {
+         continue;                    /* the tree links it */
+      }
+      mdb->path = parent_path.c_str();
+      mdb->pnl = strlen(mdb->path);
+      ok = db_create_path_record(jcr, mdb, &ar);
+      mdb->path = bkp;
+      if (ok) {
+         lp->add(lp->parents, ar.PathId, parent_path.c_str());
+      }
+   }
+   mdb->path = bkp;
+   mdb->fnl = 0;
+   db_unlock(mdb);
+   return lp;
+}
+
+/*
+ * Load the Jobs of jobids that are not in the tree of the catalog
+ *  from the File table.  The terminated ones are kept in the tree,
+ *  the others are appended to temp, the caller must free them.
+ *  Must be called without tree_mutex.
+ */
+static void bvfs_load_jobs(JCR *jcr, B_DB *mdb, char *jobids, alist *temp)
+{
+   POOL_MEM key, query, missing;
+   bvfs_paths *lp;
+   bvfs_tree *tree;
+   bvfs_job *job;
+   uint32_t serial, gen, terminated;
+   JobId_t JobId;
+   char jobid[50];
+   char *p;
+
+   bvfs_db_key(mdb, key);
+   P(tree_mutex);
+   tree = get_tree(key.c_str());
+   serial = tree->serial;
+   gen = tree->evict_gen;
+   for (p=jobids; get_next_jobid_from_list(&p, &JobId) > 0; ) {
+      if (!tree->get_job(JobId)) {
+         pm_strcat(missing, *missing.c_str() ? "," : "");
+         pm_strcat(missing, edit_uint64(JobId, jobid));
+      }
+   }
+   V(tree_mutex);
+
+   for (p=missing.c_str(); get_next_jobid_from_list(&p, &JobId) > 0; ) {
+      edit_uint64(JobId, jobid);
+      Mmsg(query,
+           "SELECT DISTINCT PathId, Path FROM File JOIN Path USING (PathId) "
+            "WHERE JobId = %s "
+           "UNION "
+           "SELECT DISTINCT F.PathId, Path.Path "
+             "FROM BaseFiles JOIN File AS F USING (FileId) "
+                            "JOIN Path ON (F.PathId = Path.PathId) "
+            "WHERE BaseFiles.JobId = %s", jobid, jobid);
+      if (!(lp = bvfs_read_paths(jcr, mdb, key.c_str(), query.c_str()))) {
+         continue;
+      }
+      /* Records of a running Job may still come, don't keep it */
+      Mmsg(query, "SELECT COUNT(1) FROM Job WHERE JobId = %s "
+                   "AND JobStatus IN ('T','W','E','e','f','A')", jobid);
+      terminated = 0;
+      db_sql_query(mdb, query.c_str(), db_int_handler, &terminated);
+
+      P(tree_mutex);
+      tree = get_tree(key.c_str());
+      job = tree->add_job(JobId, lp);
+      /* Not if the Job was purged or the tree cleared meanwhile */
+      if (terminated && bvfs_path_cache_enabled &&
+          tree->serial == serial && tree->evict_gen == gen) {
+         tree->keep_job(job, bvfs_max_jobs);
+      } else {
+         temp->append(job);
+      }
+      V(tree_mutex);
+      delete lp;
+   }
+}
+
+/*
+ * Write the PathHierarchy and PathVisibility records of a Job kept
+ *  in the tree.  What is needed is copied with tree_mutex, the
+ *  catalog is written without it.
+ */
+static bool bvfs_save_job(JCR *jcr, B_DB *mdb, JobId_t JobId)
+{
+   POOL_MEM key, query, values, tmp;
+   bvfs_tree *tree;
+   bvfs_job *job;
+   bvfs_node *node;
+   uint32_t *hier = NULL, *vis = NULL, nb_hier = 0, nb_vis = 0, serial;
+   char jobid[50];
+   int nb = 0;
+   bool ok = true;
+
+   bvfs_db_key(mdb, key);
+   P(tree_mutex);
+   tree = get_tree(key.c_str());
+   serial = tree->serial;
+   job = tree->get_job(JobId);
+   if (!job || job->saved) {
+      V(tree_mutex);
+      return true;
+   }
+   vis = (uint32_t *)malloc((job->nb + 1) * sizeof(uint32_t));
+   hier = (uint32_t *)malloc((job->nb + 1) * 2 * sizeof(uint32_t));
+   for (uint32_t i = 0; i < job->nb; i++) {
+      node = tree->nodes[job->dirs[i]];
+      vis[nb_vis++] = node->PathId;
+      if (!node->saved && node->parent) {
+         hier[nb_hier * 2] = node->PathId;
+         hier[nb_hier * 2 + 1] = node->parent->PathId;
+         nb_hier++;
+      }
+   }
+   V(tree_mutex);
+
+   edit_uint64(JobId, jobid);
+   db_lock(mdb);
+   db_start_transaction(jcr, mdb);
+
+   /* New PathHierarchy records, 400 at a time (SQLite compound select limit) */
+   for (uint32_t i = 0; ok && i < nb_hier; i++) {
+      Mmsg(tmp, "%sSELECT %u AS PathId, %u AS PPathId ", nb ? "UNION ALL " : "",
+           hier[i * 2], hier[i * 2 + 1]);
+      pm_strcat(values, tmp.c_str());
+      nb++;
+      if (nb == 400 || i == nb_hier - 1) {
+         Mmsg(query, 
+              "INSERT INTO PathHierarchy (PathId, PPathId) "
+              "SELECT PathId, PPathId FROM (%s) AS T "
+               "WHERE NOT EXISTS (SELECT 1 FROM PathHierarchy AS H "
+                                  "WHERE H.PathId = T.PathId)", values.c_str());
+         ok = db_sql_query(mdb, query.c_str(), NULL, NULL);
+         pm_strcpy(values, "");
+         nb = 0;
+      }
+   }
+
+   Mmsg(query, "DELETE FROM PathVisibility WHERE JobId = %s", jobid);
+   ok = ok && db_sql_query(mdb, query.c_str(), NULL, NULL);
+
+   for (uint32_t i = 0; ok && i < nb_vis; i++) {
+      Mmsg(tmp, "%sSELECT %u, %s ", nb ? "UNION ALL " : "", vis[i], jobid);
+      pm_strcat(values, tmp.c_str());
+      nb++;
+      if (nb == 400 || i == nb_vis - 1) {
+         Mmsg(query, "INSERT INTO PathVisibility (PathId, JobId) %s", values.c_str());
+         ok = db_sql_query(mdb, query.c_str(), NULL, NULL);
+         pm_strcpy(values, "");
+         nb = 0;
+      }
+   }
+
+   if (ok) {
+      Mmsg(query, "UPDATE Job SET HasCache=1 WHERE JobId=%s", jobid);
+      ok = db_sql_query(mdb, query.c_str(), NULL, NULL);
+   }
+   db_end_transaction(jcr, mdb);
+   if (!ok) {
+      Dmsg2(dbglevel, "Can't save cache of JobId %s ERR=%s\n", jobid, mdb->errmsg);
+   }
+   db_unlock(mdb);
+
+   /* The records are only there if the whole transaction went through */
+   if (ok) {
+      P(tree_mutex);
+      tree = get_tree(key.c_str());
+      if (tree->serial == serial) {
+         for (uint32_t i = 0; i < nb_hier; i++) {
+            if ((node = tree->get_node(hier[i * 2]))) {
+               node->saved = true;
+            }
+         }
+         if ((job = tree->get_job(JobId))) {
+            job->saved = true;
+         }
+      }
+      V(tree_mutex);
+   }
+   free(hier);
+   free(vis);
+   return ok;
+}
+
+/*
+ * The purge of the files of Jobs, called with the catalog locked
+ */
+void bvfs_evict_jobs(B_DB *mdb, char *jobids)
+{
+   POOL_MEM key;
+   bvfs_tree *tree;
+   JobId_t JobId;
+   char *p;
+
+   if (!bvfs_path_cache_enabled) {
+      return;
+   }
+   bvfs_db_key(mdb, key);
+   P(tree_mutex);
+   if (trees) {
+      foreach_dlist(tree, trees) {
+         if (strcmp(tree->key, key.c_str()) == 0) {
+            for (p=jobids; get_next_jobid_from_list(&p, &JobId) > 0; ) {
+               tree->forget_job(JobId);
+            }
+            break;
+         }
+      }
+   }
+   V(tree_mutex);
+}
+
+/* Keep the directories of up to max_jobs Jobs per catalog in memory */
+void bvfs_enable_path_cache(uint32_t max_jobs)
+{
+   P(tree_mutex);
+   bvfs_max_jobs = max_jobs;
+   bvfs_path_cache_enabled = max_jobs > 0;
+   V(tree_mutex);
+}
+
+/* Release all path caches at shutdown */
+void bvfs_term_path_cache()
+{
+   bvfs_tree *tree;
+   P(tree_mutex);
+   bvfs_path_cache_enabled = false;
+   if (trees) {
+      while ((tree = (bvfs_tree *)trees->first())) {
+         trees->remove(tree);
+         delete tree;
+      }
+      delete trees;
+      trees = NULL;
+   }
+   V(tree_mutex);
+}
+
+/*
+ * Called at the end of the batch insert of a Job, before the batch
+ *  table is dropped, to put its directories in the path cache.
+ */
+void bvfs_cache_batch_paths(JCR *jcr, B_DB *mdb)
+{
+   POOL_MEM key;
+   bvfs_paths *lp;
+   bvfs_tree *tree;
+   uint32_t serial, gen;
+   bool known;
+
+   /* The Base Files are not in the batch */
+   if (!bvfs_path_cache_enabled || jcr->HasBase) {
+      return;
+   }
+   bvfs_db_key(mdb, key);
+   P(tree_mutex);
+   tree = get_tree(key.c_str());
+   serial = tree->serial;
+   gen = tree->evict_gen;
+   known = tree->get_job(jcr->JobId) != NULL;
+   V(tree_mutex);
+   if (known) {
+      return;
+   }
+   lp = bvfs_read_paths(jcr, mdb, key.c_str(),
+      "SELECT DISTINCT Path.PathId, Path.Path "
+        "FROM batch JOIN Path ON (batch.Path = Path.Path)");
+   if (!lp) {
+      return;
+   }
+   P(tree_mutex);
+   tree = get_tree(key.c_str());
+   if (bvfs_path_cache_enabled && tree->serial == serial && tree->evict_gen == gen) {
+      tree->keep_job(tree->add_job(jcr->JobId, lp), bvfs_max_jobs);
+   }
+   V(tree_mutex);
+   delete lp;
+}
+
+/* Forget the path cache of a catalog */
+static void bvfs_clear_path_cache(B_DB *mdb)
+{
+   POOL_MEM key;
+   bvfs_tree *tree;
+
+   bvfs_db_key(mdb, key);
+   P(tree_mutex);
+   if (trees) {
+      foreach_dlist(tree, trees) {
+         if (strcmp(tree->key, key.c_str()) == 0) {
+            trees->remove(tree);
+            delete tree;
+            break;
+         }
+      }
+   }
+   V(tree_mutex);
+}
+
 static void build_path_hierarchy(JCR *jcr, B_DB *mdb, 
                                  pathid_cache &ppathid_cache, 
                                  char *org_pathid, char *path)
@@ -311,6 +1069,43 @@ bail_out:
    mdb->fnl = 0;
 }
 
+/*
+ * Write the PathHierarchy and PathVisibility records of a Job from
+ *  the Director path cache
+ *  Returns: false if the Job can't be kept in the cache
+ */
+static bool save_path_hierarchy_cache(JCR *jcr, B_DB *mdb, JobId_t JobId)
+{
+   POOL_MEM query, key;
+   alist temp(5, not_owned_by_alist);
+   uint32_t has_cache = 0;
+   char jobid[50];
+   bool kept;
+
+   edit_uint64(JobId, jobid);
+   db_lock(mdb);
+   Mmsg(query, "SELECT COUNT(1) FROM Job WHERE JobId = %s AND HasCache=1", jobid);
+   if (!db_sql_query(mdb, query.c_str(), db_int_handler, &has_cache) || has_cache) {
+      Dmsg1(dbglevel, "already computed %d\n", (uint32_t)JobId);
+      db_unlock(mdb);
+      return true;
+   }
+   db_unlock(mdb);
+
+   bvfs_load_jobs(jcr, mdb, jobid, &temp);
+   free_bvfs_jobs(&temp);
+
+   bvfs_db_key(mdb, key);
+   P(tree_mutex);
+   kept = get_tree(key.c_str())->get_job(JobId) != NULL;
+   V(tree_mutex);
+   if (!kept) {
+      return false;
+   }
+   bvfs_save_job(jcr, mdb, JobId);
+   return true;
+}
+
 /* 
  * Internal function to update path_hierarchy cache with a shared pathid cache
  */
@@ -324,6 +1119,10 @@ static void update_path_hierarchy_cache(JCR *jcr,
    uint32_t num;
    char jobid[50];
    edit_uint64(JobId, jobid);
+
+   if (bvfs_path_cache_enabled && save_path_hierarchy_cache(jcr, mdb, JobId)) {
+      return;
+   }
  
    db_lock(mdb);
    db_start_transaction(jcr, mdb);
@@ -630,6 +1429,27 @@ void Bvfs::ls_special_dirs()
    /* Will fetch directories  */
    *prev_dir = 0;
 
+   if (bvfs_path_cache_enabled) {
+      POOL_MEM key;
+      alist temp(5, not_owned_by_alist);
+      bvfs_node *node;
+      uint32_t ids[2];
+      const char *names[2] = { ".", ".." };
+      int nb = 1;
+
+      bvfs_load_jobs(jcr, db, jobids, &temp);
+      free_bvfs_jobs(&temp);
+      bvfs_db_key(db, key);
+      ids[0] = pwd_id;
+      P(tree_mutex);
+      if ((node = get_tree(key.c_str())->get_node(pwd_id)) && node->parent) {
+         ids[nb++] = node->parent->PathId;
+      }
+      V(tree_mutex);
+      send_dirs(ids, names, nb);
+      return;
+   }
+
    POOL_MEM query;
    Mmsg(query, 
 "(SELECT PPathId AS PathId, '..' AS Path "
@@ -675,6 +1495,14 @@ bool Bvfs::ls_dirs()
       get_dir_filenameid();
    }
 
+   if (bvfs_path_cache_enabled) {
+      if (!*pattern) {
+         return ls_dirs_from_cache();
+      }
+      /* The query below needs the tables */
+      bvfs_update_path_hierarchy_cache(jcr, db, jobids);
+   }
+
    /* the sql query displays same directory multiple time, take the first one */
    *prev_dir = 0;
 
@@ -728,6 +1556,171 @@ bool Bvfs::ls_dirs()
    return nb_record == limit;
 }
 
+struct bvfs_dir_attr {
+   uint32_t PathId;
+   char *row[3];                      /* JobId, LStat, FileId */
+};
+
+static int bvfs_dir_attr_cmp(const void *a, const void *b)
+{
+   uint32_t ida = ((bvfs_dir_attr *)a)->PathId;
+   uint32_t idb = ((bvfs_dir_attr *)b)->PathId;
+   return ida < idb ? -1 : (ida > idb ? 1 : 0);
+}
+
+struct bvfs_dir_attr_ctx {
+   bvfs_dir_attr *attrs;
+   int nb;
+};
+
+/* Called with PathId, JobId, LStat, FileId of each directory */
+static int bvfs_dir_attr_handler(void *ctx, int fields, char **row)
+{
+   bvfs_dir_attr_ctx *ac = (bvfs_dir_attr_ctx *)ctx;
+   bvfs_dir_attr key, *attr;
+
+   key.PathId = str_to_int64(row[0]);
+   attr = (bvfs_dir_attr *)bsearch(&key, ac->attrs, ac->nb, sizeof(bvfs_dir_attr),
+                                   bvfs_dir_attr_cmp);
+   /* Rows come with the most recent Job first, keep it */
+   if (attr && !attr->row[0]) {
+      for (int i = 0; i < 3; i++) {
+         attr->row[i] = bstrdup(NPRTB(row[i+1]));
+      }
+   }
+   return 0;
+}
+
+/*
+ * Send the records of a list of directories with their attributes
+ *  when they are in the File table, like the ls_dirs query does.
+ *  Must be called without tree_mutex.
+ */
+int Bvfs::send_dirs(uint32_t *ids, const char **names, int nb)
+{
+   POOL_MEM query, pathids;
+   bvfs_dir_attr_ctx ac;
+   bvfs_dir_attr key, *attr;
+   char ed1[50], ed2[50];
+   char *row[7];
+
+   if (nb == 0) {
+      return 0;
+   }
+   ac.nb = nb;
+   ac.attrs = (bvfs_dir_attr *)malloc(nb * sizeof(bvfs_dir_attr));
+   memset(ac.attrs, 0, nb * sizeof(bvfs_dir_attr));
+   for (int i = 0; i < nb; i++) {
+      ac.attrs[i].PathId = ids[i];
+      pm_strcat(pathids, i ? "," : "");
+      pm_strcat(pathids, edit_uint64(ids[i], ed1));
+   }
+   qsort(ac.attrs, nb, sizeof(bvfs_dir_attr), bvfs_dir_attr_cmp);
+
+   Mmsg(query, "SELECT PathId, JobId, LStat, FileId FROM File "
+                "WHERE FilenameId = %s AND JobId IN (%s) AND PathId IN (%s) "
+                "ORDER BY PathId, JobId DESC",
+        edit_uint64(dir_filenameid, ed2), jobids, pathids.c_str());
+   Dmsg1(dbglevel_sql, "q=%s\n", query.c_str());
+   db_sql_query(db, query.c_str(), bvfs_dir_attr_handler, &ac);
+
+   for (int i = 0; i < nb; i++) {
+      key.PathId = ids[i];
+      attr = (bvfs_dir_attr *)bsearch(&key, ac.attrs, nb, sizeof(bvfs_dir_attr),
+                                      bvfs_dir_attr_cmp);
+      row[BVFS_Type] = (char *)"D";
+      row[BVFS_PathId] = edit_uint64(ids[i], ed1);
+      row[BVFS_FilenameId] = (char *)"0";
+      row[BVFS_Name] = (char *)names[i];
+      row[BVFS_JobId] = attr->row[0];
+      row[BVFS_LStat] = attr->row[1];
+      row[BVFS_FileId] = attr->row[2];
+      list_entries(user_data, 7, row);
+   }
+   for (int i = 0; i < nb; i++) {
+      for (int j = 0; j < 3; j++) {
+         if (ac.attrs[i].row[j]) {
+            free(ac.attrs[i].row[j]);
+         }
+      }
+   }
+   free(ac.attrs);
+   return nb;
+}
+
+static int bvfs_node_cmp(const void *a, const void *b)
+{
+   return strcmp((*(bvfs_node **)a)->path, (*(bvfs_node **)b)->path);
+}
+
+/* ls_dirs() answered with the Director path cache */
+bool Bvfs::ls_dirs_from_cache()
+{
+   POOL_MEM key;
+   alist temp(5, not_owned_by_alist);
+   bvfs_tree *tree;
+   bvfs_node *node, *child, **dirs = NULL;
+   uint32_t size, *ids = NULL;
+   const char **names = NULL;
+   uint8_t *bits;
+   int nb = 0, first, last;
+
+   bvfs_load_jobs(jcr, db, jobids, &temp);
+   bvfs_db_key(db, key);
+
+   /* The names are copied, the File query is done without tree_mutex */
+   P(tree_mutex);
+   tree = get_tree(key.c_str());
+   bits = tree->get_visibility(jobids, &temp, &size);
+   node = tree->get_node(pwd_id);
+   if (node) {
+      for (child = node->child; child; child = child->sibling) {
+         if (bvfs_is_visible(bits, size, child)) {
+            nb++;
+         }
+      }
+   }
+   if (nb > 0) {
+      dirs = (bvfs_node **)malloc(nb * sizeof(bvfs_node *));
+      nb = 0;
+      for (child = node->child; child; child = child->sibling) {
+         if (bvfs_is_visible(bits, size, child)) {
+            dirs[nb++] = child;
+         }
+      }
+      qsort(dirs, nb, sizeof(bvfs_node *), bvfs_node_cmp);
+   }
+   first = MIN((int)offset, nb);
+   last = MIN((int)(offset + limit), nb);
+   if (last > first) {
+      ids = (uint32_t *)malloc((last - first) * sizeof(uint32_t));
+      names = (const char **)malloc((last - first) * sizeof(char *));
+      for (int i = first; i < last; i++) {
+         ids[i - first] = dirs[i]->PathId;
+         names[i - first] = bstrdup(dirs[i]->path);
+      }
+   }
+   V(tree_mutex);
+   free_bvfs_jobs(&temp);
+
+   nb_record = send_dirs(ids, names, last - first);
+
+   for (int i = 0; i < last - first; i++) {
+      free((void *)names[i]);
+   }
+   if (names) {
+      free(names);
+   }
+   if (dirs) {
+      free(dirs);
+   }
+   if (ids) {
+      free(ids);
+   }
+   free(bits);
+   return nb_record == limit;
+}
+
 void build_ls_files_query(B_DB *db, POOL_MEM &query, 
                           const char *JobId, const char *PathId,  
                           const char *filter, int64_t limit, int64_t offset)
@@ -836,6 +1829,7 @@ static bool check_temp(char *output_table)
 
 void Bvfs::clear_cache()
 {
+   bvfs_clear_path_cache(db);
    db_sql_query(db, "BEGIN",                     NULL, NULL);
    db_sql_query(db, "UPDATE Job SET HasCache=0", NULL, NULL);
    db_sql_query(db, "TRUNCATE PathHierarchy",    NULL, NULL);
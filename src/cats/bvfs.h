@@ -188,6 +188,9 @@ private:
 
    DBId_t get_dir_filenameid();
 
+   bool ls_dirs_from_cache();
+   int send_dirs(uint32_t *ids, const char **names, int nb);
+
    DB_RESULT_HANDLER *list_entries;
    void *user_data;
 };
@@ -199,6 +202,10 @@ private:
 
 void bvfs_update_path_hierarchy_cache(JCR *jcr, B_DB *mdb, char *jobids);
 void bvfs_update_cache(JCR *jcr, B_DB *mdb);
+void bvfs_enable_path_cache(uint32_t max_jobs);
+void bvfs_term_path_cache();
+void bvfs_cache_batch_paths(JCR *jcr, B_DB *mdb);
+void bvfs_evict_jobs(B_DB *mdb, char *jobids);
 char *bvfs_parent_dir(char *path);
 
 /* Return the basename of the with the trailing /  (update the given string)
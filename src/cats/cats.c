@@ -69,6 +69,17 @@ B_DB *B_DB::db_clone_database_connection(JCR *jcr, bool mult_db_connections)
       return this;
    }
 
+   /*
+    * A connection leased from a pool takes its extra connection from
+    *  the batch connections of the same pool.
+    */
+   if (m_pool) {
+      B_DB *mdb = db_pool_acquire_batch(jcr, m_pool);
+      if (mdb) {
+         return mdb;
+      }
+   }
+
    /*
     * A bit more to do here just open a new session to the database.
     */
@@ -157,4 +168,371 @@ void B_DB::print_lock_info(FILE *fp)
    }
 }
 
+/*
+ * Catalog connection pool.
+ *
+ * A pool is defined for a catalog (driver, name, user, address, port) by
+ *  db_pool_init(). From then on, db_pool_acquire() leases one of its
+ *  connections for the exclusive use of a job or a console, and
+ *  db_close_database() gives it back. When all the connections are
+ *  leased, the caller waits for one to be released.
+ *
+ * Batch insert connections (jcr->db_batch) come from a second, smaller,
+ *  set of connections of the same pool, so that attribute spooling
+ *  cannot starve the catalog updates done by the running jobs and a
+ *  job never waits on itself.
+ *
+ * A lease never sees the state of the previous user. The transaction
+ *  is committed when the connection is given back, as a close would
+ *  do, and a connection left with uncommitted changes, a batch insert
+ *  in progress or an error is closed rather than kept for the next one.
+ *
+ * If nothing is released within DB_POOL_MAX_WAIT, a connection over
+ *  the limit is opened with a warning rather than risking a dead
+ *  lock between jobs that hold a lease and wait for each other
+ *  (control job of a Copy or a Migration for example).
+ */
+#define DB_POOL_MAX_WAIT 60            /* seconds */
+
+enum {
+   DB_POOL_JOB = 0,
+   DB_POOL_BATCH = 1
+};
+
+struct DB_POOL_SET {
+   alist *idle;                        /* connections ready to be leased */
+   uint32_t max;                       /* maximum number of connections */
+   uint32_t nb;                        /* connections opened */
+   uint32_t in_use;                    /* connections leased */
+   uint64_t nb_lease;                  /* number of leases */
+   uint64_t nb_wait;                   /* leases that had to wait */
+   uint64_t nb_over;                   /* connections opened over the limit */
+   btime_t wait_time;                  /* total wait time in usec */
+   btime_t max_wait_time;              /* longest wait in usec */
+};
+
+class B_DB_POOL {
+public:
+   dlink link;
+   char *name;                         /* Catalog resource name */
+   char *db_driver;
+   char *db_name;
+   char *db_user;
+   char *db_password;
+   char *db_address;
+   char *db_socket;
+   int db_port;
+   bool disable_batch_insert;
+   DB_POOL_SET set[2];                 /* DB_POOL_JOB and DB_POOL_BATCH */
+};
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+static dlist *pool_list = NULL;
+
+static char *pool_strdup(const char *str)
+{
+   return str ? bstrdup(str) : NULL;
+}
+
+static void pool_free(char *str)
+{
+   if (str) {
+      free(str);
+   }
+}
+
+static B_DB_POOL *find_pool(const char *db_driver, const char *db_name,
+                            const char *db_user, const char *db_address, int db_port)
+{
+   B_DB_POOL *pool = NULL;
+
+   if (!pool_list) {
+      return NULL;
+   }
+   foreach_dlist(pool, pool_list) {
+      if ((!db_driver ||
+           (pool->db_driver && strcasecmp(pool->db_driver, db_driver) == 0)) &&
+          bstrcmp(pool->db_name, db_name) &&
+          bstrcmp(pool->db_user, db_user) &&
+          bstrcmp(pool->db_address, db_address) &&
+          pool->db_port == db_port) {
+         return pool;
+      }
+   }
+   return NULL;
+}
+
+/*
+ * Define (or redefine after a reload) the pool of a catalog.
+ *  max_conn is the number of job/console connections, max_batch
+ *  the number of batch insert connections.
+ */
+void db_pool_init(const char *name, const char *db_driver, const char *db_name,
+                  const char *db_user, const char *db_password,
+                  const char *db_address, int db_port, const char *db_socket,
+                  bool disable_batch_insert, uint32_t max_conn, uint32_t max_batch)
+{
+   B_DB_POOL *pool = NULL;
+
+   P(pool_mutex);
+   if (!pool_list) {
+      pool_list = New(dlist(pool, &pool->link));
+   }
+   pool = find_pool(db_driver, db_name, db_user, db_address, db_port);
+   if (!pool) {
+      pool = (B_DB_POOL *)malloc(sizeof(B_DB_POOL));
+      memset(pool, 0, sizeof(B_DB_POOL));
+      pool->name = pool_strdup(name);
+      pool->db_driver = pool_strdup(db_driver);
+      pool->db_name = pool_strdup(db_name);
+      pool->db_user = pool_strdup(db_user);
+      pool->db_password = pool_strdup(db_password);
+      pool->db_address = pool_strdup(db_address);
+      pool->db_socket = pool_strdup(db_socket);
+      pool->db_port = db_port;
+      pool->disable_batch_insert = disable_batch_insert;
+      for (int i = 0; i < 2; i++) {
+         pool->set[i].idle = New(alist(10, not_owned_by_alist));
+      }
+      pool_list->append(pool);
+   }
+   pool->set[DB_POOL_JOB].max = max_conn;
+   pool->set[DB_POOL_BATCH].max = max_batch;
+   Dmsg4(100, "Catalog pool %s: %s max=%u batch=%u\n", name, db_name,
+         max_conn, max_batch);
+   pthread_cond_broadcast(&pool_cond);
+   V(pool_mutex);
+}
+
+/*
+ * Lease a connection of the given set. Called with pool_mutex
+ *  locked, which is released while waiting and while opening a
+ *  new connection.
+ */
+static B_DB *pool_lease(JCR *jcr, B_DB_POOL *pool, int kind)
+{
+   DB_POOL_SET *set = &pool->set[kind];
+   B_DB *mdb = NULL;
+   btime_t start = 0;
+   bool over = false;
+   struct timespec timeout;
+   struct timeval tv;
+
+   while (set->idle->empty() && set->nb >= set->max) {
+      if (!start) {
+         start = get_current_btime();
+         gettimeofday(&tv, NULL);
+         timeout.tv_sec = tv.tv_sec + DB_POOL_MAX_WAIT;
+         timeout.tv_nsec = tv.tv_usec * 1000;
+         set->nb_wait++;
+         Dmsg3(100, "Wait for a %s connection of catalog pool %s (%u leased)\n",
+               kind == DB_POOL_JOB ? "job" : "batch", pool->name, set->in_use);
+      }
+      if (pthread_cond_timedwait(&pool_cond, &pool_mutex, &timeout) == ETIMEDOUT) {
+         over = true;
+         break;
+      }
+   }
+   if (start) {
+      btime_t wait = get_current_btime() - start;
+      set->wait_time += wait;
+      if (wait > set->max_wait_time) {
+         set->max_wait_time = wait;
+      }
+   }
+   if (!set->idle->empty()) {
+      mdb = (B_DB *)set->idle->pop();
+   } else {
+      /* Open a new one, the slot is reserved while we do it */
+      set->nb++;
+      if (over) {
+         set->nb_over++;
+      }
+      V(pool_mutex);
+      if (over) {
+         Jmsg(jcr, M_WARNING, 0, _("No catalog connection released in %d seconds, "
+              "opening one over the limit of %u of Catalog \"%s\".\n"),
+              DB_POOL_MAX_WAIT, set->max, pool->name);
+      }
+      mdb = db_init_database(jcr, pool->db_driver, pool->db_name, pool->db_user,
+                             pool->db_password, pool->db_address, pool->db_port,
+                             pool->db_socket, true /* mult_db_connections */,
+                             pool->disable_batch_insert);
+      if (mdb && !db_open_database(jcr, mdb)) {
+         Dmsg2(100, "Cannot open connection for catalog pool %s: %s",
+               pool->name, db_strerror(mdb));
+         db_close_database(jcr, mdb);
+         mdb = NULL;
+      }
+      P(pool_mutex);
+      if (!mdb) {
+         set->nb--;
+         pthread_cond_broadcast(&pool_cond);
+         return NULL;
+      }
+      mdb->set_pool(pool, kind);
+   }
+   set->in_use++;
+   set->nb_lease++;
+   return mdb;
+}
+
+/*
+ * Lease a connection from the pool defined for this catalog.
+ *
+ * Returns: an opened connection
+ *          NULL if there is no pool for this catalog, or if
+ *            no connection could be opened.
+ */
+B_DB *db_pool_acquire(JCR *jcr, const char *db_driver, const char *db_name,
+                      const char *db_user, const char *db_address, int db_port)
+{
+   B_DB_POOL *pool;
+   B_DB *mdb = NULL;
+
+   P(pool_mutex);
+   pool = find_pool(db_driver, db_name, db_user, db_address, db_port);
+   if (pool && pool->set[DB_POOL_JOB].max > 0) {
+      mdb = pool_lease(jcr, pool, DB_POOL_JOB);
+   }
+   V(pool_mutex);
+   return mdb;
+}
+
+/*
+ * Lease a batch insert connection from a pool.
+ *
+ * Returns: NULL if the pool has no batch connections.
+ */
+B_DB *db_pool_acquire_batch(JCR *jcr, B_DB_POOL *pool)
+{
+   B_DB *mdb = NULL;
+
+   P(pool_mutex);
+   if (pool->set[DB_POOL_BATCH].max > 0) {
+      mdb = pool_lease(jcr, pool, DB_POOL_BATCH);
+   }
+   V(pool_mutex);
+   return mdb;
+}
+
+/*
+ * Give back a leased connection. Called by db_close_database().
+ */
+void db_pool_release(JCR *jcr, B_DB *mdb)
+{
+   B_DB_POOL *pool = mdb->get_pool();
+   DB_POOL_SET *set = &pool->set[mdb->get_pool_set()];
+   bool dirty, close_it;
+
+   /* A connection cloned without mult_db_connections is shared */
+   if (mdb->get_refcount() > 1) {
+      mdb->decrement_refcount();
+      return;
+   }
+
+   /*
+    * The batch table, an error or uncommitted changes must not be
+    *  seen by the next user, such a connection is not reused.
+    */
+   dirty = !mdb->is_connected() || *mdb->errmsg ||
+           (jcr && jcr->batch_started && jcr->db_batch == mdb) ||
+           (((B_DB_PRIV *)mdb)->in_transaction() && mdb->changes > 0);
+
+   /* Terminate the transaction as db_close_database() does */
+   db_end_transaction(jcr, mdb);
+   mdb->changes = 0;
+   *mdb->errmsg = 0;
+
+   P(pool_mutex);
+   set->in_use--;
+   /* Connections over the limit (or after a reload lowered it) go away */
+   close_it = dirty || set->nb > set->max;
+   if (dirty) {
+      Dmsg1(100, "Close a used connection of catalog pool %s\n", pool->name);
+   }
+   if (close_it) {
+      set->nb--;
+   } else {
+      set->idle->push(mdb);
+   }
+   pthread_cond_broadcast(&pool_cond);
+   V(pool_mutex);
+
+   if (close_it) {
+      mdb->set_pool(NULL, 0);
+      db_close_database(jcr, mdb);
+   }
+}
+
+/*
+ * Close all idle connections and free the pools. Called at exit
+ *  when no job is running anymore.
+ */
+void db_pool_term()
+{
+   B_DB_POOL *pool;
+   B_DB *mdb;
+
+   P(pool_mutex);
+   if (!pool_list) {
+      V(pool_mutex);
+      return;
+   }
+   foreach_dlist(pool, pool_list) {
+      for (int i = 0; i < 2; i++) {
+         while ((mdb = (B_DB *)pool->set[i].idle->pop())) {
+            mdb->set_pool(NULL, 0);
+            db_close_database(NULL, mdb);
+         }
+         delete pool->set[i].idle;
+      }
+      pool_free(pool->name);
+      pool_free(pool->db_driver);
+      pool_free(pool->db_name);
+      pool_free(pool->db_user);
+      pool_free(pool->db_password);
+      pool_free(pool->db_address);
+      pool_free(pool->db_socket);
+   }
+   pool_list->destroy();              /* frees the pools */
+   delete pool_list;
+   pool_list = NULL;
+   V(pool_mutex);
+}
+
+/*
+ * Send one line per pool and set with the lease statistics.
+ */
+void db_pool_list_stats(DB_LIST_HANDLER *sendit, void *ctx)
+{
+   B_DB_POOL *pool;
+   POOL_MEM msg;
+   char b1[35], b2[35], b3[35];
+
+   P(pool_mutex);
+   if (pool_list) {
+      foreach_dlist(pool, pool_list) {
+         for (int i = 0; i < 2; i++) {
+            DB_POOL_SET *set = &pool->set[i];
+            if (set->max == 0) {
+               continue;
+            }
+            Mmsg(msg, _(" Catalog %s %s: max=%u open=%u leased=%u leases=%s "
+                        "waits=%s over=%s wait avg=%ums max=%ums\n"),
+                 pool->name, i == DB_POOL_JOB ? _("pool") : _("batch pool"),
+                 set->max, set->nb, set->in_use,
+                 edit_uint64_with_commas(set->nb_lease, b1),
+                 edit_uint64_with_commas(set->nb_wait, b2),
+                 edit_uint64_with_commas(set->nb_over, b3),
+                 set->nb_wait ? (uint32_t)(set->wait_time / set->nb_wait / 1000) : 0,
+                 (uint32_t)(set->max_wait_time / 1000));
+            sendit(ctx, msg.c_str());
+         }
+      }
+   }
+   V(pool_mutex);
+}
+
 #endif /* HAVE_SQLITE3 || HAVE_MYSQL || HAVE_POSTGRESQL || HAVE_INGRES || HAVE_DBI */
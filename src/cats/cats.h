@@ -438,7 +438,9 @@ typedef int (DB_RESULT_HANDLER)(void *, int, char **);
 #define db_unlock(mdb) mdb->_db_unlock(__FILE__, __LINE__)
 
 /* Current database version number for all drivers */
-#define BDB_VERSION 14
+#define BDB_VERSION 15
+
+class B_DB_POOL;
 
 class B_DB: public SMARTALLOC {
 protected:
@@ -458,6 +460,9 @@ protected:
    char *m_db_password;                   /* database password */
    int m_db_port;                         /* port for host name address */
    bool m_disabled_batch_insert;          /* explicitly disabled batch insert mode ? */
+   uint32_t m_file_partition_size;        /* JobIds per File partition, 0 if none */
+   B_DB_POOL *m_pool;                     /* pool we are leased from, if any */
+   int m_pool_set;                        /* set of the pool we belong to */
 
 public:
    POOLMEM *errmsg;                       /* nicely edited error message */
@@ -465,6 +470,7 @@ public:
    POOLMEM *cached_path;                  /* cached path name */
    int cached_path_len;                   /* length of cached path */
    uint32_t cached_path_id;               /* cached path id */
+   int64_t cached_file_partition;         /* last File partition created, -1 if none */
    int changes;                           /* changes during transaction */
    POOLMEM *fname;                        /* Filename only */
    POOLMEM *path;                         /* Path only */
@@ -475,13 +481,21 @@ public:
    int pnl;                               /* path name length */
 
    /* methods */
-   B_DB() {};
+   B_DB() { m_file_partition_size = 0; cached_file_partition = -1; m_pool = NULL; m_pool_set = 0; };
    virtual ~B_DB() {};
    const char *get_db_name(void) { return m_db_name; };
    const char *get_db_user(void) { return m_db_user; };
+   const char *get_db_address(void) { return m_db_address; };
+   int get_db_port(void) { return m_db_port; };
    bool is_connected(void) { return m_connected; };
    bool batch_insert_available(void) { return m_have_batch_insert; };
+   uint32_t file_partition_size(void) { return m_file_partition_size; };
    void increment_refcount(void) { m_ref_count++; };
+   void decrement_refcount(void) { m_ref_count--; };
+   int get_refcount(void) { return m_ref_count; };
+   B_DB_POOL *get_pool(void) { return m_pool; };
+   int get_pool_set(void) { return m_pool_set; };
+   void set_pool(B_DB_POOL *pool, int set) { m_pool = pool; m_pool_set = set; };
 
    /* low level methods */
    bool db_match_database(const char *db_driver, const char *db_name,
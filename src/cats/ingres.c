@@ -1081,7 +1081,9 @@ B_DB *db_init_database(JCR *jcr, const char *db_driver, const char *db_name, con
        * Look to see if DB already open
        */
       foreach_dlist(mdb, db_list) {
-         if (mdb->db_match_database(db_driver, db_name, db_address, db_port)) {
+         /* Private and pooled connections are never shared */
+         if (!((B_DB_PRIV *)mdb)->is_private() &&
+             mdb->db_match_database(db_driver, db_name, db_address, db_port)) {
             Dmsg1(100, "DB REopen %s\n", db_name);
             mdb->increment_refcount();
             goto bail_out;
@@ -190,6 +190,7 @@ bool B_DB_POSTGRESQL::db_open_database(JCR *jcr)
 {
    bool retval = false;
    int errstat;
+   uint32_t have_partitions = 0;
    char buf[10], *port;
 
    P(mutex);
@@ -262,6 +263,16 @@ bool B_DB_POSTGRESQL::db_open_database(JCR *jcr)
     */
    pgsql_check_database_encoding(jcr, this);
 
+   /*
+    * See if the File table is partitioned by JobId range
+    */
+   m_file_partition_size = 0;
+   if (db_sql_query(file_partition_exists_query, db_int_handler, &have_partitions) &&
+       have_partitions > 0) {
+      db_sql_query(file_partition_size_query, db_int_handler, &m_file_partition_size);
+      Dmsg1(50, "File table partitioned by %u JobIds\n", m_file_partition_size);
+   }
+
    retval = true;
 
 bail_out:
@@ -1103,7 +1114,9 @@ B_DB *db_init_database(JCR *jcr, const char *db_driver, const char *db_name,
        * Look to see if DB already open
        */
       foreach_dlist(mdb, db_list) {
-         if (mdb->db_match_database(db_driver, db_name, db_address, db_port)) {
+         /* Private and pooled connections are never shared */
+         if (!((B_DB_PRIV *)mdb)->is_private() &&
+             mdb->db_match_database(db_driver, db_name, db_address, db_port)) {
             Dmsg1(100, "DB REopen %s\n", db_name);
             mdb->increment_refcount();
             goto bail_out;
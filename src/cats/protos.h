@@ -40,6 +40,18 @@
 
 /* Database prototypes */
 
+/* cats.c */
+void db_pool_init(const char *name, const char *db_driver, const char *db_name,
+                  const char *db_user, const char *db_password,
+                  const char *db_address, int db_port, const char *db_socket,
+                  bool disable_batch_insert, uint32_t max_conn, uint32_t max_batch);
+B_DB *db_pool_acquire(JCR *jcr, const char *db_driver, const char *db_name,
+                      const char *db_user, const char *db_address, int db_port);
+B_DB *db_pool_acquire_batch(JCR *jcr, B_DB_POOL *pool);
+void db_pool_release(JCR *jcr, B_DB *mdb);
+void db_pool_term();
+void db_pool_list_stats(DB_LIST_HANDLER *sendit, void *ctx);
+
 /* sql.c */
 bool db_open_batch_connexion(JCR *jcr, B_DB *mdb);
 char *db_strerror(B_DB *mdb);
@@ -69,10 +81,13 @@ bool db_create_restore_object_record(JCR *jcr, B_DB *mdb, ROBJECT_DBR *ar);
 bool db_create_base_file_attributes_record(JCR *jcr, B_DB *mdb, ATTR_DBR *ar);
 bool db_commit_base_file_attributes_record(JCR *jcr, B_DB *mdb);
 bool db_create_base_file_list(JCR *jcr, B_DB *mdb, char *jobids);
+bool db_create_base_file_references(JCR *jcr, B_DB *mdb, char *jobids);
 
 /* sql_delete.c */
 int db_delete_pool_record(JCR *jcr, B_DB *db, POOL_DBR *pool_dbr);
 int db_delete_media_record(JCR *jcr, B_DB *mdb, MEDIA_DBR *mr);
+int db_prune_file_partitions(JCR *jcr, B_DB *mdb);
+int db_purge_file_partitions(JCR *jcr, B_DB *mdb, char *jobids);
 
 /* sql_find.c */
 bool db_find_last_job_start_time(JCR *jcr, B_DB *mdb, JOB_DBR *jr, POOLMEM **stime, char *job, int JobLevel);
@@ -106,6 +121,10 @@ bool db_get_query_dbids(JCR *jcr, B_DB *mdb, POOL_MEM &query, dbid_list &ids);
 bool db_get_file_list(JCR *jcr, B_DB *mdb, char *jobids,
                       bool use_md5, bool use_delta,
                       DB_RESULT_HANDLER *result_handler, void *ctx);
+bool db_get_file_list_part(JCR *jcr, B_DB *mdb, char *jobids,
+                           bool use_md5, bool use_delta,
+                           int part, int nb_parts,
+                           DB_RESULT_HANDLER *result_handler, void *ctx);
 bool db_get_base_jobid(JCR *jcr, B_DB *mdb, JOB_DBR *jr, JobId_t *jobid);
 bool db_accurate_get_jobids(JCR *jcr, B_DB *mdb, JOB_DBR *jr, db_list_ctx *jobids);
 bool db_get_used_base_jobids(JCR *jcr, B_DB *mdb, POOLMEM *jobids, db_list_ctx *result);
@@ -269,6 +269,9 @@ const char *uar_jobid_fileindex_from_table =
  *
  * With PostgreSQL, we can use DISTINCT ON(), but with Mysql or Sqlite,
  * we need an extra join using JobTDate. 
+ *
+ * Arguments: jobids, filter, jobids, filter, jobids, jobids where filter
+ *  is "" or an extra condition on File (see db_get_file_list_part()).
  */
 const char *select_recent_version_with_basejob_default = 
 "SELECT FileId, Job.JobId AS JobId, FileIndex, File.PathId AS PathId, "
@@ -279,13 +282,13 @@ const char *select_recent_version_with_basejob_default =
       "FROM ( "
         "SELECT JobTDate, PathId, FilenameId "   /* Get all normal files */
           "FROM File JOIN Job USING (JobId) "    /* from selected backup */
-         "WHERE File.JobId IN (%s) "
+         "WHERE File.JobId IN (%s) %s"
           "UNION ALL "
         "SELECT JobTDate, PathId, FilenameId "   /* Get all files from */ 
           "FROM BaseFiles "                      /* BaseJob */
                "JOIN File USING (FileId) "
                "JOIN Job  ON    (BaseJobId = Job.JobId) "
-         "WHERE BaseFiles.JobId IN (%s) "        /* Use Max(JobTDate) to find */
+         "WHERE BaseFiles.JobId IN (%s) %s"      /* Use Max(JobTDate) to find */
        ") AS tmp "
        "GROUP BY PathId, FilenameId "            /* the latest file version */
     ") AS T1 "
@@ -306,12 +309,12 @@ const char *select_recent_version_with_basejob[] = {
          "FileIndex, PathId, FilenameId, LStat, MD5, DeltaSeq "
    "FROM "
      "(SELECT FileId, JobId, PathId, FilenameId, FileIndex, LStat, MD5, DeltaSeq "
-         "FROM File WHERE JobId IN (%s) "
+         "FROM File WHERE JobId IN (%s) %s"
         "UNION ALL "
        "SELECT File.FileId, File.JobId, PathId, FilenameId, "
               "File.FileIndex, LStat, MD5, DeltaSeq "
          "FROM BaseFiles JOIN File USING (FileId) "
-        "WHERE BaseFiles.JobId IN (%s) "
+        "WHERE BaseFiles.JobId IN (%s) %s"
        ") AS T JOIN Job USING (JobId) "
    "ORDER BY FilenameId, PathId, JobTDate DESC ",
 
@@ -346,13 +349,13 @@ const char *select_recent_version_with_basejob_and_delta_default =
       "FROM ( "
        "SELECT JobTDate, PathId, FilenameId, DeltaSeq " /*Get all normal files*/
          "FROM File JOIN Job USING (JobId) "          /* from selected backup */
-        "WHERE File.JobId IN (%s) "
+        "WHERE File.JobId IN (%s) %s"
          "UNION ALL "
        "SELECT JobTDate, PathId, FilenameId, DeltaSeq " /*Get all files from */ 
          "FROM BaseFiles "                            /* BaseJob */
               "JOIN File USING (FileId) "
               "JOIN Job  ON    (BaseJobId = Job.JobId) "
-        "WHERE BaseFiles.JobId IN (%s) "        /* Use Max(JobTDate) to find */
+        "WHERE BaseFiles.JobId IN (%s) %s"      /* Use Max(JobTDate) to find */
        ") AS tmp "
        "GROUP BY PathId, FilenameId, DeltaSeq "    /* the latest file version */
     ") AS T1 "
@@ -373,12 +376,12 @@ const char *select_recent_version_with_basejob_and_delta[] = {
          "FileIndex, PathId, FilenameId, LStat, MD5, DeltaSeq "
    "FROM "
     "(SELECT FileId, JobId, PathId, FilenameId, FileIndex, LStat, MD5,DeltaSeq "
-         "FROM File WHERE JobId IN (%s) "
+         "FROM File WHERE JobId IN (%s) %s"
         "UNION ALL "
        "SELECT File.FileId, File.JobId, PathId, FilenameId, "
               "File.FileIndex, LStat, MD5, DeltaSeq "
          "FROM BaseFiles JOIN File USING (FileId) "
-        "WHERE BaseFiles.JobId IN (%s) "
+        "WHERE BaseFiles.JobId IN (%s) %s"
        ") AS T JOIN Job USING (JobId) "
    "ORDER BY FilenameId, PathId, DeltaSeq, JobTDate DESC ",
 
@@ -1015,3 +1018,62 @@ const char *match_query[] = {
    /* Ingres */
    "~"
 };
+
+/*
+ * Optional partitioned File table (PostgreSQL only).
+ *
+ *  The layout is enabled by creating a FilePartition table holding
+ *  the number of JobIds per partition (see make_postgresql_tables).
+ *  File rows of JobId N then go to the child table File_<N/size>,
+ *  which inherits File, so every existing query on File still sees
+ *  them.  A purge drops a whole child table as soon as no Job in its
+ *  JobId range has File records left, and deletes the rows of the
+ *  purged Jobs from the other ones, so the readers never see them.
+ */
+const char *file_partition_exists_query =
+   "SELECT COUNT(1) FROM pg_tables WHERE tablename='filepartition'";
+
+const char *file_partition_size_query =
+   "SELECT PartitionSize FROM FilePartition";
+
+/*
+ * Partition number, first JobId, last JobId + 1.  This is a single
+ *  statement, so it runs in the transaction of the caller if one is
+ *  open, and in its own otherwise.
+ */
+const char *create_file_partition_query =
+   "DO $$BEGIN "
+   "LOCK TABLE FilePartition IN EXCLUSIVE MODE; "
+   "CREATE TABLE IF NOT EXISTS File_%s ("
+      "CHECK (JobId >= %s AND JobId < %s), "
+      "PRIMARY KEY (FileId)) INHERITS (File); "
+   "CREATE INDEX IF NOT EXISTS file_%s_jpfid_idx ON File_%s (JobId, PathId, FilenameId); "
+   "END$$";
+
+const char *list_file_partitions_query =
+   "SELECT c.relname FROM pg_inherits AS i "
+     "JOIN pg_class AS c ON (c.oid = i.inhrelid) "
+     "JOIN pg_class AS p ON (p.oid = i.inhparent) "
+    "WHERE p.relname = 'file' "
+    "ORDER BY c.relname";
+
+/*
+ * First JobId, last JobId + 1.  A partition can go when the JobId range
+ *  is closed (a later Job exists) and no Job of the range that writes
+ *  File records still has them.
+ */
+const char *file_partition_in_use_query =
+   "SELECT (SELECT COUNT(1) FROM Job "
+            "WHERE JobId >= %s AND JobId < %s AND PurgedFiles = 0 "
+              "AND Type NOT IN ('R','D','U','I','c','g')) "
+        "+ (SELECT CASE WHEN MAX(JobId) >= %s THEN 0 ELSE 1 END FROM Job)";
+
+const char *drop_file_partition_query =
+   "DROP TABLE File_%s";
+
+const char *file_partition_table_exists_query =
+   "SELECT COUNT(1) FROM pg_tables WHERE tablename='file_%s'";
+
+/* Partition number, JobIds */
+const char *delete_file_partition_query =
+   "DELETE FROM File_%s WHERE JobId IN (%s)";
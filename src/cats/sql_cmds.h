@@ -84,3 +84,12 @@ extern const char CATS_IMP_EXP *batch_unlock_tables_query[];
 extern const char CATS_IMP_EXP *batch_fill_path_query[];
 extern const char CATS_IMP_EXP *batch_fill_filename_query[];
 extern const char CATS_IMP_EXP *match_query[];
+
+extern const char CATS_IMP_EXP *file_partition_exists_query;
+extern const char CATS_IMP_EXP *file_partition_size_query;
+extern const char CATS_IMP_EXP *create_file_partition_query;
+extern const char CATS_IMP_EXP *list_file_partitions_query;
+extern const char CATS_IMP_EXP *file_partition_in_use_query;
+extern const char CATS_IMP_EXP *drop_file_partition_query;
+extern const char CATS_IMP_EXP *file_partition_table_exists_query;
+extern const char CATS_IMP_EXP *delete_file_partition_query;
@@ -41,6 +41,7 @@ static const int dbglevel = 100;
 #include "cats.h"
 #include "bdb_priv.h"
 #include "sql_glue.h"
+#include "bvfs.h"
 
 /* -----------------------------------------------------------------------
  *
@@ -770,6 +771,45 @@ bool db_create_fileset_record(JCR *jcr, B_DB *mdb, FILESET_DBR *fsr)
  *  };
  */
 
+/**
+ * Return in table the name of the table that receives the File
+ *  records of JobId.  When the catalog File table is partitioned,
+ *  this is the partition covering JobId, created here if it does
+ *  not exist yet, otherwise it is simply File.
+ *
+ * Returns: false on failure (error in mdb->errmsg)
+ *          true  on success
+ */
+static bool db_get_file_table(JCR *jcr, B_DB *mdb, JobId_t JobId, POOL_MEM &table)
+{
+   POOL_MEM query(PM_MESSAGE);
+   uint32_t size = db_get_file_partition_size(mdb);
+   char ed1[50], ed2[50], ed3[50];
+
+   if (size == 0) {
+      Mmsg(table, "File");
+      return true;
+   }
+   edit_uint64(JobId / size, ed1);
+   edit_uint64((uint64_t)(JobId / size) * size, ed2);
+   edit_uint64((uint64_t)(JobId / size + 1) * size, ed3);
+   Mmsg(table, "File_%s", ed1);
+
+   /* Partitions are only created once per JobId range */
+   if (mdb->cached_file_partition == (int64_t)(JobId / size)) {
+      return true;
+   }
+   Mmsg(query, create_file_partition_query, ed1, ed2, ed3, ed1, ed1);
+   if (!db_sql_query(mdb, query.c_str(), NULL, NULL)) {
+      Mmsg2(&mdb->errmsg, _("Create File partition %s failed. ERR=%s"),
+            table.c_str(), sql_strerror(mdb));
+      return false;
+   }
+   mdb->cached_file_partition = JobId / size;
+   Dmsg2(dbglevel, "JobId=%u File records go to %s\n", JobId, table.c_str());
+   return true;
+}
+
 /**
  * All sql_batch_* functions are used to do bulk batch insert in File/Filename/Path
  *  tables.
@@ -790,6 +830,9 @@ bool db_write_batch_file_records(JCR *jcr)
 {
    bool retval = false;
    int JobStatus = jcr->JobStatus;
+   POOL_MEM table(PM_NAME);
+   POOL_MEM query(PM_MESSAGE);
+   btime_t start = get_current_btime();
 
    if (!jcr->batch_started) {         /* no files to backup ? */
       Dmsg0(50,"db_create_file_record : no files\n");
@@ -848,25 +891,38 @@ bool db_write_batch_file_records(JCR *jcr)
       goto bail_out;
    }
    
-   if (!db_sql_query(jcr->db_batch, 
-"INSERT INTO File (FileIndex, JobId, PathId, FilenameId, LStat, MD5, DeltaSeq) "
+   /*
+    * All records of the batch belong to this Job, so they all go
+    *  to the same File partition.
+    */
+   if (!db_get_file_table(jcr, jcr->db_batch, jcr->JobId, table)) {
+      Jmsg1(jcr, M_FATAL, 0, "%s\n", jcr->db_batch->errmsg);
+      goto bail_out;
+   }
+
+   Mmsg(query,
+"INSERT INTO %s (FileIndex, JobId, PathId, FilenameId, LStat, MD5, DeltaSeq) "
     "SELECT batch.FileIndex, batch.JobId, Path.PathId, "
            "Filename.FilenameId,batch.LStat, batch.MD5, batch.DeltaSeq "
       "FROM batch "
       "JOIN Path ON (batch.Path = Path.Path) "
-      "JOIN Filename ON (batch.Name = Filename.Name)",
-                     NULL, NULL))
-   {
+      "JOIN Filename ON (batch.Name = Filename.Name)", table.c_str());
+
+   if (!db_sql_query(jcr->db_batch, query.c_str(), NULL, NULL)) {
       Jmsg1(jcr, M_FATAL, 0, "Fill File table %s\n", jcr->db_batch->errmsg);
       goto bail_out;
    }
 
+   /* Feed the Bvfs path cache while the batch is still there */
+   bvfs_cache_batch_paths(jcr, jcr->db_batch);
+
    jcr->JobStatus = JobStatus;         /* reset entry status */
    retval = true;
 
 bail_out:
    db_sql_query(jcr->db_batch, "DROP TABLE batch", NULL,NULL);
    jcr->batch_started = false;
+   jcr->add_stage(JOB_STAGE_CATALOG, start, 0);
 
    return retval;
 }
@@ -971,6 +1027,7 @@ static int db_create_file_record(JCR *jcr, B_DB *mdb, ATTR_DBR *ar)
    int stat;
    static const char *no_digest = "0";
    const char *digest;
+   POOL_MEM table(PM_NAME);
 
    ASSERT(ar->JobId);
    ASSERT(ar->PathId);
@@ -982,11 +1039,16 @@ static int db_create_file_record(JCR *jcr, B_DB *mdb, ATTR_DBR *ar)
       digest = ar->Digest;
    }
 
+   if (!db_get_file_table(jcr, mdb, ar->JobId, table)) {
+      Jmsg(jcr, M_FATAL, 0, "%s\n", mdb->errmsg);
+      return 0;
+   }
+
    /* Must create it */
    Mmsg(mdb->cmd,
-        "INSERT INTO File (FileIndex,JobId,PathId,FilenameId,"
+        "INSERT INTO %s (FileIndex,JobId,PathId,FilenameId,"
         "LStat,MD5,DeltaSeq) VALUES (%u,%u,%u,%u,'%s','%s',%u)",
-        ar->FileIndex, ar->JobId, ar->PathId, ar->FilenameId,
+        table.c_str(), ar->FileIndex, ar->JobId, ar->PathId, ar->FilenameId,
         ar->attr, digest, ar->DeltaSeq);
 
    ar->FileId = sql_insert_autokey_record(mdb, mdb->cmd, NT_("File"));
@@ -1052,6 +1114,7 @@ static int db_create_filename_record(JCR *jcr, B_DB *mdb, ATTR_DBR *ar)
 bool db_create_attributes_record(JCR *jcr, B_DB *mdb, ATTR_DBR *ar)
 {
    bool ret;
+   btime_t start = get_current_btime();
 
    /*
     * Make sure we have an acceptable attributes record.
@@ -1074,6 +1137,7 @@ bool db_create_attributes_record(JCR *jcr, B_DB *mdb, ATTR_DBR *ar)
       Jmsg0(jcr, M_FATAL, 0, _("Cannot Copy/Migrate job using BaseJob"));
       ret = true;               /* in copy/migration what do we do ? */
    }
+   jcr->add_stage(JOB_STAGE_CATALOG, start, 0);
 
    return ret;
 }
@@ -1179,6 +1243,43 @@ bail_out:
    return ret;
 }
 
+/**
+ * Make the current Job reference the last version of each file of
+ *  the jobids list through the BaseFiles table, the data stays in the
+ *  Volumes of the original Jobs.  Used by Virtual Full by reference.
+ *
+ * Returns the number of files referenced in jcr->nb_base_files_used
+ */
+bool db_create_base_file_references(JCR *jcr, B_DB *mdb, char *jobids)
+{
+   POOL_MEM buf(PM_MESSAGE);
+   bool ret=false;
+   char ed1[50];
+
+   db_lock(mdb);
+
+   if (!*jobids) {
+      Mmsg(mdb->errmsg, _("ERR=JobIds are empty\n"));
+      goto bail_out;
+   }
+
+   Mmsg(buf, select_recent_version_with_basejob_and_delta[db_get_type_index(mdb)],
+        jobids, "", jobids, "", jobids, jobids);
+   Mmsg(mdb->cmd,
+  "INSERT INTO BaseFiles (BaseJobId, JobId, FileId, FileIndex) "
+   "SELECT T1.JobId AS BaseJobId, %s AS JobId, T1.FileId, T1.FileIndex "
+     "FROM ( %s ) AS T1 "
+    "WHERE T1.FileIndex > 0 "           /* skip deleted files */
+    "ORDER BY T1.FileId",
+        edit_uint64(jcr->JobId, ed1), buf.c_str());
+   ret = db_sql_query(mdb, mdb->cmd, NULL, NULL);
+   jcr->nb_base_files_used = ret ? sql_affected_rows(mdb) : 0;
+
+bail_out:
+   db_unlock(mdb);
+   return ret;
+}
+
 /**
  * Create Restore Object record in B_DB
  *
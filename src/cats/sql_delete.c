@@ -240,5 +240,178 @@ int db_purge_media_record(JCR *jcr, B_DB *mdb, MEDIA_DBR *mr)
    return 1;
 }
 
+/*
+ * Called here for each child table of File
+ */
+static int file_partition_handler(void *ctx, int num_fields, char **row)
+{
+   alist *parts = (alist *)ctx;
+
+   if (row[0]) {
+      parts->append(bstrdup(row[0]));
+   }
+   return 0;
+}
+
+/*
+ * True if some Job of the JobId range of the partition may still
+ *  have File records, or if the range is not closed yet.
+ */
+static bool file_partition_in_use(B_DB *mdb, uint64_t part, uint32_t size)
+{
+   POOL_MEM query(PM_MESSAGE);
+   uint32_t in_use = 1;
+   char ed1[50], ed2[50];
+
+   edit_uint64(part * size, ed1);
+   edit_uint64((part + 1) * size, ed2);
+   Mmsg(query, file_partition_in_use_query, ed1, ed2, ed2);
+   if (!db_sql_query(mdb, query.c_str(), db_int_handler, &in_use)) {
+      return true;
+   }
+   return in_use != 0;
+}
+
+/* Drop a File partition, called with the db locked */
+static bool drop_file_partition(JCR *jcr, B_DB *mdb, uint64_t part)
+{
+   POOL_MEM query(PM_MESSAGE);
+   char ed1[50];
+
+   Mmsg(query, drop_file_partition_query, edit_uint64(part, ed1));
+   if (!db_sql_query(mdb, query.c_str(), NULL, NULL)) {
+      Jmsg(jcr, M_ERROR, 0, _("Drop of File partition File_%s failed. ERR=%s"),
+           ed1, mdb->errmsg);
+      return false;
+   }
+   Dmsg1(50, "Dropped File partition File_%s\n", ed1);
+   if (mdb->cached_file_partition == (int64_t)part) {
+      mdb->cached_file_partition = -1;
+   }
+   return true;
+}
+
+static int jobid_compare(const void *a, const void *b)
+{
+   JobId_t ja = *(JobId_t *)a, jb = *(JobId_t *)b;
+
+   return ja < jb ? -1 : (ja > jb ? 1 : 0);
+}
+
+/*
+ * Remove the File records of the Jobs of the jobids list from the
+ *  File partitions. The Jobs must already be marked PurgedFiles=1.
+ *  A partition left without File records of any Job is dropped,
+ *  the records of the Jobs are deleted from the other ones, so the
+ *  readers (restore, bvfs, accurate) never see purged records.
+ *  Only the partitions of the Jobs are looked at.
+ *
+ *  Returns: number of partitions dropped
+ */
+int db_purge_file_partitions(JCR *jcr, B_DB *mdb, char *jobids)
+{
+   POOL_MEM query(PM_MESSAGE), list(PM_MESSAGE);
+   uint32_t size = db_get_file_partition_size(mdb);
+   uint32_t exists;
+   JobId_t *ids, JobId;
+   uint64_t part;
+   char *p;
+   char ed1[50], ed2[50];
+   int nids = 0, max_ids = 1, i, j, stat;
+   int ndropped = 0;
+
+   if (size == 0) {
+      return 0;
+   }
+   for (p = jobids; *p; p++) {
+      if (*p == ',') {
+         max_ids++;
+      }
+   }
+   ids = (JobId_t *)malloc(max_ids * sizeof(JobId_t));
+   p = jobids;
+   while (nids < max_ids && (stat = get_next_jobid_from_list(&p, &JobId)) != 0) {
+      if (stat < 0) {
+         break;
+      }
+      ids[nids++] = JobId;
+   }
+   qsort(ids, nids, sizeof(JobId_t), jobid_compare);
+
+   db_lock(mdb);
+   for (i = 0; i < nids; i = j) {
+      part = ids[i] / size;
+      pm_strcpy(list, "");
+      for (j = i; j < nids && ids[j] / size == part; j++) {
+         if (j > i) {
+            pm_strcat(list, ",");
+         }
+         pm_strcat(list, edit_uint64(ids[j], ed2));
+      }
+      edit_uint64(part, ed1);
+      exists = 0;
+      Mmsg(query, file_partition_table_exists_query, ed1);
+      if (!db_sql_query(mdb, query.c_str(), db_int_handler, &exists) || !exists) {
+         continue;
+      }
+      if (!file_partition_in_use(mdb, part, size)) {
+         if (drop_file_partition(jcr, mdb, part)) {
+            ndropped++;
+         }
+         continue;
+      }
+      Mmsg(query, delete_file_partition_query, ed1, list.c_str());
+      if (!db_sql_query(mdb, query.c_str(), NULL, NULL)) {
+         Jmsg(jcr, M_ERROR, 0, _("Purge of File partition File_%s failed. ERR=%s"),
+              ed1, mdb->errmsg);
+      }
+   }
+   db_unlock(mdb);
+   free(ids);
+   return ndropped;
+}
+
+/*
+ * Drop the File partitions whose JobId range is closed and no
+ *  longer holds File records of any Job.  This is the sweep of the
+ *  prune pass, a range is often closed after the purge of its last
+ *  Job, the partition then goes away here with a single DROP TABLE.
+ *
+ *  Returns: number of partitions dropped
+ */
+int db_prune_file_partitions(JCR *jcr, B_DB *mdb)
+{
+   alist parts(10, owned_by_alist);
+   uint32_t size = db_get_file_partition_size(mdb);
+   uint64_t part;
+   char *name;
+   int ndropped = 0;
+
+   if (size == 0) {
+      return 0;
+   }
+
+   db_lock(mdb);
+   if (!db_sql_query(mdb, list_file_partitions_query, file_partition_handler, &parts)) {
+      Dmsg1(50, "Listing File partitions failed: %s", mdb->errmsg);
+      goto bail_out;
+   }
+   foreach_alist(name, &parts) {
+      if (strncasecmp(name, "file_", 5) != 0 || !is_a_number(name + 5)) {
+         continue;             /* not one of ours */
+      }
+      part = str_to_uint64(name + 5);
+      if (file_partition_in_use(mdb, part, size)) {
+         continue;
+      }
+      if (drop_file_partition(jcr, mdb, part)) {
+         ndropped++;
+      }
+   }
+
+bail_out:
+   db_unlock(mdb);
+   return ndropped;
+}
 
 #endif /* HAVE_SQLITE3 || HAVE_MYSQL || HAVE_POSTGRESQL || HAVE_INGRES */
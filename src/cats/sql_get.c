@@ -1133,6 +1133,26 @@ bool db_get_file_list(JCR *jcr, B_DB *mdb, char *jobids,
                       bool use_md5, bool use_delta,
                       DB_RESULT_HANDLER *result_handler, void *ctx)
 {
+   return db_get_file_list_part(jcr, mdb, jobids, use_md5, use_delta,
+                                0, 1, result_handler, ctx);
+}
+
+/**
+ * Same as db_get_file_list(), but only return files where
+ *  PathId % nb_parts == part. As all versions of a file share
+ *  the same PathId, each part can be computed on its own
+ *  catalog connection, and the union of the parts is exactly the
+ *  result of db_get_file_list(), with the same order for each
+ *  file. The condition is in the innermost queries, so that each
+ *  part only looks for the latest versions of its own files.
+ */
+bool db_get_file_list_part(JCR *jcr, B_DB *mdb, char *jobids,
+                           bool use_md5, bool use_delta,
+                           int part, int nb_parts,
+                           DB_RESULT_HANDLER *result_handler, void *ctx)
+{
+   char filter[100];
+
    if (!*jobids) {
       db_lock(mdb);
       Mmsg(mdb->errmsg, _("ERR=JobIds are empty\n"));
@@ -1141,13 +1161,20 @@ bool db_get_file_list(JCR *jcr, B_DB *mdb, char *jobids,
    }
    POOL_MEM buf(PM_MESSAGE);
    POOL_MEM buf2(PM_MESSAGE);
+
+   filter[0] = 0;
+   if (nb_parts > 1) {
+      bsnprintf(filter, sizeof(filter), "AND File.PathId %% %d = %d ",
+                nb_parts, part);
+   }
+
    if (use_delta) {
       Mmsg(buf2, select_recent_version_with_basejob_and_delta[db_get_type_index(mdb)], 
-           jobids, jobids, jobids, jobids);
+           jobids, filter, jobids, filter, jobids, jobids);
 
    } else {
       Mmsg(buf2, select_recent_version_with_basejob[db_get_type_index(mdb)], 
-           jobids, jobids, jobids, jobids);
+           jobids, filter, jobids, filter, jobids, jobids);
    }
 
    /* bsr code is optimized for JobId sorted, with Delta, we need to get
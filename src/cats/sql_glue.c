@@ -67,6 +67,11 @@ int db_get_type_index(B_DB *mdb)
    return mdb->db_get_type_index();
 }
 
+uint32_t db_get_file_partition_size(B_DB *mdb)
+{
+   return mdb->file_partition_size();
+}
+
 bool db_open_database(JCR *jcr, B_DB *mdb)
 {
    return mdb->db_open_database(jcr);
@@ -75,7 +80,11 @@ bool db_open_database(JCR *jcr, B_DB *mdb)
 void db_close_database(JCR *jcr, B_DB *mdb)
 {
    if (mdb) {
-      mdb->db_close_database(jcr);
+      if (mdb->get_pool()) {
+         db_pool_release(jcr, mdb);     /* leased, give it back */
+      } else {
+         mdb->db_close_database(jcr);
+      }
    }
 }
 
@@ -111,19 +120,45 @@ void db_end_transaction(JCR *jcr, B_DB *mdb)
    mdb->db_end_transaction(jcr);
 }
 
+static pthread_once_t query_stat_once = PTHREAD_ONCE_INIT;
+static int query_stat = -1;
+
+static void register_query_stat()
+{
+   query_stat = bstat_register("catalog.query", BSTAT_HISTOGRAM);
+}
+
+/*
+ * Account the time of a catalog query in the daemon statistics
+ */
+static void observe_query(btime_t start)
+{
+   pthread_once(&query_stat_once, register_query_stat);
+   bstat_observe(query_stat, get_current_btime() - start);
+}
+
 bool db_sql_query(B_DB *mdb, const char *query, int flags)
 {
-   return mdb->db_sql_query(query, flags);
+   btime_t start = get_current_btime();
+   bool ret = mdb->db_sql_query(query, flags);
+   observe_query(start);
+   return ret;
 }
 
 bool db_sql_query(B_DB *mdb, const char *query, DB_RESULT_HANDLER *result_handler, void *ctx)
 {
-   return mdb->db_sql_query(query, result_handler, ctx);
+   btime_t start = get_current_btime();
+   bool ret = mdb->db_sql_query(query, result_handler, ctx);
+   observe_query(start);
+   return ret;
 }
 
 bool db_big_sql_query(B_DB *mdb, const char *query, DB_RESULT_HANDLER *result_handler, void *ctx)
 {
-   return mdb->db_big_sql_query(query, result_handler, ctx);
+   btime_t start = get_current_btime();
+   bool ret = mdb->db_big_sql_query(query, result_handler, ctx);
+   observe_query(start);
+   return ret;
 }
 
 void sql_free_result(B_DB *mdb)
@@ -138,7 +173,10 @@ SQL_ROW sql_fetch_row(B_DB *mdb)
 
 bool sql_query(B_DB *mdb, const char *query, int flags)
 {
-   return ((B_DB_PRIV *)mdb)->sql_query(query, flags);
+   btime_t start = get_current_btime();
+   bool ret = ((B_DB_PRIV *)mdb)->sql_query(query, flags);
+   observe_query(start);
+   return ret;
 }
 
 const char *sql_strerror(B_DB *mdb)
@@ -37,6 +37,7 @@ bool db_match_database(B_DB *mdb, const char *db_driver, const char *db_name,
 B_DB *db_clone_database_connection(B_DB *mdb, JCR *jcr, bool mult_db_connections);
 int db_get_type_index(B_DB *mdb);
 const char *db_get_type(B_DB *mdb);
+uint32_t db_get_file_partition_size(B_DB *mdb);
 B_DB *db_init_database(JCR *jcr, const char *db_driver, const char *db_name,
               const char *db_user, const char *db_password,
               const char *db_address, int db_port,
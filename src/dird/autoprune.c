@@ -40,41 +40,332 @@
 #include "ua.h"
 
 /* Forward referenced functions */
+static void *prune_worker(void *arg);
 
+/*
+ * Background prune service.
+ *
+ *  When the Director "Background Prune" directive is set, the end of
+ *  job autoprune only queues a request here and the job terminates
+ *  at once.  A single worker thread runs the requests, merging the
+ *  ones that are queued for the same Client, Pool and Job type, and
+ *  pauses "Prune Interval" between two of them to limit the catalog
+ *  load.  Volume recycling can still run the pending requests of its
+ *  Pool synchronously when it needs a Volume (see prune_volumes()).
+ */
+struct PRUNE_REQ {
+   dlink link;
+   char client[MAX_NAME_LENGTH];
+   char pool[MAX_NAME_LENGTH];
+   int32_t JobType;
+   int32_t flags;                     /* PRUNE_JOBS and/or PRUNE_FILES */
+   time_t queued_time;
+};
+
+enum {
+   PRUNE_JOBS  = 1 << 0,
+   PRUNE_FILES = 1 << 1
+};
+
+static pthread_mutex_t prune_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t prune_cond = PTHREAD_COND_INITIALIZER;
+static dlist *prune_queue = NULL;
+static pthread_t prune_tid;
+static bool prune_quit = false;
+static PRUNE_REQ *prune_running = NULL;  /* request being run by the worker */
+static uint64_t prune_num_queued = 0;
+static uint64_t prune_num_merged = 0;
+static uint64_t prune_num_done = 0;
+static time_t prune_last_time = 0;
 
 /*
- * Auto Prune Jobs and Files. This is called at the end of every
- *   Job.  We do not prune volumes here.
+ * Run one prune request with the given UA context
  */
-void do_autoprune(JCR *jcr)
+static void run_prune_request(UAContext *ua, CLIENT *client, POOL *pool,
+                              int JobType, int flags)
+{
+   if (flags & PRUNE_JOBS) {
+      prune_jobs(ua, client, pool, JobType);
+   }
+   if (flags & PRUNE_FILES) {
+      prune_files(ua, client, pool);
+   }
+}
+
+/*
+ * Start the background prune worker if it is enabled
+ */
+void init_prune_worker()
+{
+   int status;
+
+   if (!director->BackgroundPrune) {
+      return;
+   }
+   PRUNE_REQ *req = NULL;
+   prune_queue = New(dlist(req, &req->link));
+   prune_quit = false;
+   if ((status = pthread_create(&prune_tid, NULL, prune_worker, NULL)) != 0) {
+      berrno be;
+      Emsg1(M_ERROR, 0, _("Cannot create prune thread: %s\n"), be.bstrerror(status));
+      delete prune_queue;
+      prune_queue = NULL;
+   }
+}
+
+/*
+ * Stop the worker, requests still queued are dropped, they
+ *  will be queued again at the end of the next job.
+ */
+void term_prune_worker()
+{
+   if (!prune_queue) {
+      return;
+   }
+   P(prune_mutex);
+   prune_quit = true;
+   pthread_cond_broadcast(&prune_cond);
+   V(prune_mutex);
+   pthread_join(prune_tid, NULL);
+   delete prune_queue;
+   prune_queue = NULL;
+}
+
+/*
+ * Queue a request for the worker, merging it with a pending
+ *  one for the same Client, Pool and Job type.
+ *
+ * Returns: false if there is no worker
+ */
+static bool queue_prune_request(JCR *jcr, int flags)
+{
+   PRUNE_REQ *req;
+   const char *pool = jcr->pool ? jcr->pool->name() : "";
+
+   P(prune_mutex);
+   if (!prune_queue || prune_quit) {
+      V(prune_mutex);
+      return false;
+   }
+   foreach_dlist(req, prune_queue) {
+      if (req->JobType == jcr->getJobType() &&
+          strcmp(req->client, jcr->client->name()) == 0 &&
+          strcmp(req->pool, pool) == 0) {
+         req->flags |= flags;
+         prune_num_merged++;
+         Dmsg2(100, "Merged prune request Client=%s Pool=%s\n", req->client, req->pool);
+         V(prune_mutex);
+         return true;
+      }
+   }
+   req = (PRUNE_REQ *)malloc(sizeof(PRUNE_REQ));
+   memset(req, 0, sizeof(PRUNE_REQ));
+   bstrncpy(req->client, jcr->client->name(), sizeof(req->client));
+   bstrncpy(req->pool, pool, sizeof(req->pool));
+   req->JobType = jcr->getJobType();
+   req->flags = flags;
+   req->queued_time = time(NULL);
+   prune_queue->append(req);
+   prune_num_queued++;
+   Dmsg2(100, "Queued prune request Client=%s Pool=%s\n", req->client, req->pool);
+   pthread_cond_signal(&prune_cond);
+   V(prune_mutex);
+   return true;
+}
+
+/*
+ * Run a queued request in the worker.  The resources are looked
+ *  up again by name because a reload may have happened since the
+ *  request was queued.
+ */
+static void do_prune_request(UAContext *ua, PRUNE_REQ *req)
 {
-   UAContext *ua;
    CLIENT *client;
    POOL *pool;
-   bool pruned;
 
-   if (!jcr->client) {                /* temp -- remove me */
+   LockRes();
+   client = GetClientResWithName(req->client);
+   pool = req->pool[0] ? GetPoolResWithName(req->pool) : NULL;
+   UnlockRes();
+   if (!client) {
+      Dmsg1(100, "Client %s gone, prune request dropped\n", req->client);
+      return;
+   }
+   if (ua->catalog != client->catalog) {
+      close_db(ua);
+      ua->catalog = client->catalog;
+   }
+   if (!open_db(ua)) {
+      Jmsg(ua->jcr, M_ERROR, 0, _("Background prune for Client \"%s\" skipped, "
+           "could not open catalog.\n"), req->client);
       return;
    }
+   run_prune_request(ua, client, pool, req->JobType, req->flags);
+}
+
+/*
+ * The worker thread
+ */
+static void *prune_worker(void *arg)
+{
+   JCR *jcr;
+   UAContext *ua;
+   PRUNE_REQ *req;
+   struct timespec timeout;
 
+   jcr = new_control_jcr("*AutoPrune*", JT_SYSTEM);
    ua = new_ua_context(jcr);
-   client = jcr->client;
-   pool = jcr->pool;
 
-   if (jcr->job->PruneJobs || jcr->client->AutoPrune) {
-      prune_jobs(ua, client, pool, jcr->getJobType());
-      pruned = true;
+   P(prune_mutex);
+   for ( ;; ) {
+      while (!prune_quit && prune_queue->empty()) {
+         pthread_cond_wait(&prune_cond, &prune_mutex);
+      }
+      if (prune_quit) {
+         break;
+      }
+      req = (PRUNE_REQ *)prune_queue->first();
+      prune_queue->remove(req);
+      prune_running = req;
+      V(prune_mutex);
+
+      Dmsg2(100, "Run prune request Client=%s Pool=%s\n", req->client, req->pool);
+      do_prune_request(ua, req);
+
+      P(prune_mutex);
+      prune_running = NULL;
+      prune_num_done++;
+      prune_last_time = time(NULL);
+      free(req);
+
+      /* Rate limit the catalog load */
+      if (director->PruneInterval > 0 && !prune_quit) {
+         timeout.tv_sec = time(NULL) + director->PruneInterval;
+         timeout.tv_nsec = 0;
+         while (!prune_quit &&
+                pthread_cond_timedwait(&prune_cond, &prune_mutex, &timeout) != ETIMEDOUT) {
+         }
+      }
+   }
+   V(prune_mutex);
+
+   free_ua_context(ua);
+   free_jcr(jcr);
+   return NULL;
+}
+
+/*
+ * Run now, in the caller's thread, the pending prune requests of
+ *  the given Pool.  Called when a Volume is needed so that the
+ *  recycling code sees every Job that is due to be pruned.
+ */
+static void flush_prune_requests(JCR *jcr, POOL *pool)
+{
+   PRUNE_REQ *req, *next;
+   UAContext *ua;
+   dlist *todo;
+
+   P(prune_mutex);
+   if (!prune_queue) {
+      V(prune_mutex);
+      return;
+   }
+   /*
+    * We do not wait for the request the worker may be running, the
+    *  caller holds the catalog lock that the worker needs.
+    */
+   req = NULL;
+   todo = New(dlist(req, &req->link));
+   for (req = (PRUNE_REQ *)prune_queue->first(); req; req = next) {
+      next = (PRUNE_REQ *)prune_queue->next(req);
+      if (strcmp(req->pool, pool->name()) == 0) {
+         prune_queue->remove(req);
+         todo->append(req);
+      }
+   }
+   V(prune_mutex);
+
+   if (todo->size() > 0) {
+      Dmsg2(100, "Flush %d prune requests for Pool=%s\n", todo->size(), pool->name());
+      ua = new_ua_context(jcr);
+      foreach_dlist(req, todo) {
+         CLIENT *client;
+         LockRes();
+         client = GetClientResWithName(req->client);
+         UnlockRes();
+         if (client) {
+            run_prune_request(ua, client, pool, req->JobType, req->flags);
+         }
+      }
+      free_ua_context(ua);
+      P(prune_mutex);
+      prune_num_done += todo->size();
+      prune_last_time = time(NULL);
+      V(prune_mutex);
+   }
+   delete todo;                       /* frees the requests */
+}
+
+/*
+ * Display the state of the background prune service
+ */
+void list_prune_status(UAContext *ua)
+{
+   char dt[MAX_TIME_LENGTH];
+   char b1[35], b2[35], b3[35];
+
+   if (!prune_queue) {
+      return;
+   }
+   P(prune_mutex);
+   if (prune_last_time) {
+      bstrftime_nc(dt, sizeof(dt), prune_last_time);
    } else {
-      pruned = false;
+      bstrncpy(dt, _("never"), sizeof(dt));
+   }
+   ua->send_msg(_(" Prune: pending=%d done=%s queued=%s merged=%s last=%s\n"),
+                prune_queue->size(),
+                edit_uint64_with_commas(prune_num_done, b1),
+                edit_uint64_with_commas(prune_num_queued, b2),
+                edit_uint64_with_commas(prune_num_merged, b3), dt);
+   if (prune_running) {
+      ua->send_msg(_("   Pruning Client=%s Pool=%s\n"), prune_running->client,
+                   prune_running->pool[0] ? prune_running->pool : "*none*");
+   }
+   V(prune_mutex);
+}
+
+/*
+ * Auto Prune Jobs and Files. This is called at the end of every
+ *   Job.  We do not prune volumes here.
+ */
+void do_autoprune(JCR *jcr)
+{
+   UAContext *ua;
+   int flags = 0;
+
+   if (!jcr->client) {                /* temp -- remove me */
+      return;
    }
 
+   if (jcr->job->PruneJobs || jcr->client->AutoPrune) {
+      flags |= PRUNE_JOBS;
+   }
    if (jcr->job->PruneFiles || jcr->client->AutoPrune) {
-      prune_files(ua, client, pool);
-      pruned = true;
+      flags |= PRUNE_FILES;
    }
-   if (pruned) {
-      Jmsg(jcr, M_INFO, 0, _("End auto prune.\n\n"));
+   if (!flags) {
+      return;
+   }
+
+   /* Let the background worker do it if there is one */
+   if (queue_prune_request(jcr, flags)) {
+      return;
    }
+
+   ua = new_ua_context(jcr);
+   run_prune_request(ua, jcr->client, jcr->pool, jcr->getJobType(), flags);
+   Jmsg(jcr, M_INFO, 0, _("End auto prune.\n\n"));
    free_ua_context(ua);
    return;
 }
@@ -102,6 +393,9 @@ void prune_volumes(JCR *jcr, bool InChanger, MEDIA_DBR *mr)
       return;
    }
 
+   /* Jobs waiting for the background pruning may free a Volume */
+   flush_prune_requests(jcr, jcr->pool);
+
    memset(&prune_list, 0, sizeof(prune_list));
    prune_list.max_ids = 10000;
    prune_list.JobId = (JobId_t *)malloc(sizeof(JobId_t) * prune_list.max_ids);
@@ -604,6 +604,7 @@ void backup_cleanup(JCR *jcr, int TermCode)
    }
 
    Dmsg2(100, "Enter backup_cleanup %d %c\n", TermCode, TermCode);
+   report_job_stages(jcr);
    memset(&mr, 0, sizeof(mr));
    memset(&cr, 0, sizeof(cr));
 
@@ -655,18 +656,14 @@ void backup_cleanup(JCR *jcr, int TermCode)
          msg_type = M_ERROR;          /* Generate error message */
          if (jcr->store_bsock) {
             jcr->store_bsock->signal(BNET_TERMINATE);
-            if (jcr->SD_msg_chan) {
-               pthread_cancel(jcr->SD_msg_chan);
-            }
+            cancel_storage_daemon_message_thread(jcr);
          }
          break;
       case JS_Canceled:
          term_msg = _("Backup Canceled");
          if (jcr->store_bsock) {
             jcr->store_bsock->signal(BNET_TERMINATE);
-            if (jcr->SD_msg_chan) {
-               pthread_cancel(jcr->SD_msg_chan);
-            }
+            cancel_storage_daemon_message_thread(jcr);
          }
          break;
       default:
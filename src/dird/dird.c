@@ -35,6 +35,7 @@
 
 #include "bacula.h"
 #include "dird.h"
+#include "cats/bvfs.h"
 
 #ifdef HAVE_PYTHON
 
@@ -330,8 +331,20 @@ int main (int argc, char *argv[])
 
    init_jcr_subsystem();              /* start JCR watchdogs etc. */
 
+   start_bstat_thread(director->stats_file, director->stats_interval);
+   start_msg_delivery_thread();       /* deliver messages in the background */
+
    init_job_server(director->MaxConcurrentJobs);
 
+   init_msg_reactor(director->MaxMsgThreads);
+
+   init_prune_worker();
+
+   if (director->BvfsPathCacheJobs > 0) {
+      /* keep the Bvfs path hierarchy in memory */
+      bvfs_enable_path_cache(director->BvfsPathCacheJobs);
+   }
+
    dbg_jcr_add_hook(db_debug_print); /* used to debug B_DB connexion after fatal signal */
 
 //   init_device_resources();
@@ -380,12 +393,17 @@ void terminate_dird(int sig)
    already_here = true;
    debug_level = 0;                   /* turn off debug */
    stop_watchdog();
+   stop_bstat_thread();
    generate_daemon_event(NULL, "Exit");
    unload_plugins();
    write_state_file(director->working_directory, "bacula-dir", get_first_port_host_order(director->DIRaddrs));
    delete_pid_file(director->pid_directory, "bacula-dir", get_first_port_host_order(director->DIRaddrs));
    term_scheduler();
    term_job_server();
+   term_msg_reactor();
+   term_prune_worker();
+   bvfs_term_path_cache();
+   db_pool_term();
    if (runjob) {
       free(runjob);
    }
@@ -1119,6 +1137,22 @@ static bool check_catalog(cat_op mode)
       /* Set type in global for debugging */
       set_db_type(db_get_type(db));
 
+      /*
+       * Define the connection pool, by default a quarter of the
+       *  connections is allowed for batch inserts
+       */
+      if (catalog->max_connections > 0) {
+         uint32_t max_batch = catalog->max_batch_connections;
+         if (max_batch == 0) {
+            max_batch = MAX(1, catalog->max_connections / 4);
+         }
+         db_pool_init(catalog->name(), catalog->db_driver, catalog->db_name,
+                      catalog->db_user, catalog->db_password,
+                      catalog->db_address, catalog->db_port,
+                      catalog->db_socket, catalog->disable_batch_insert,
+                      catalog->max_connections, max_batch);
+      }
+
       db_close_database(NULL, db);
    }
    return OK;
@@ -53,6 +53,14 @@ extern DIRRES *director;                     /* Director resource */
 extern int FDConnectTimeout;
 extern int SDConnectTimeout;
 
+/* States of the Storage daemon message channel (jcr->SD_msg_state) */
+enum {
+   SD_MSG_THREAD = 0,                 /* read by its own msg_thread */
+   SD_MSG_IDLE,                       /* waiting for data in the reactor */
+   SD_MSG_BUSY,                       /* given to a reactor worker */
+   SD_MSG_DONE                        /* reactor is done with it */
+};
+
 /* Used in ua_prune.c and ua_purge.c */
 
 struct s_count_ctx {
@@ -121,6 +121,11 @@ static RES_ITEM dir_items[] = {
    {"subsysdirectory",  store_dir, ITEM(res_dir.subsys_directory),  0, 0, 0},
    {"maximumconcurrentjobs", store_pint32, ITEM(res_dir.MaxConcurrentJobs), 0, ITEM_DEFAULT, 1},
    {"maximumconsoleconnections", store_pint32, ITEM(res_dir.MaxConsoleConnect), 0, ITEM_DEFAULT, 20},
+   {"maximummessagethreads", store_pint32, ITEM(res_dir.MaxMsgThreads), 0, ITEM_DEFAULT, 10},
+   {"longestjobsfirst", store_bool, ITEM(res_dir.LongestJobsFirst), 0, ITEM_DEFAULT, false},
+   {"backgroundprune", store_bool, ITEM(res_dir.BackgroundPrune), 0, ITEM_DEFAULT, false},
+   {"pruneinterval",   store_time, ITEM(res_dir.PruneInterval), 0, ITEM_DEFAULT, 0},
+   {"bvfspathcachejobs", store_pint32, ITEM(res_dir.BvfsPathCacheJobs), 0, ITEM_DEFAULT, 0},
    {"password",    store_password, ITEM(res_dir.password), 0, ITEM_REQUIRED, 0},
    {"fdconnecttimeout", store_time,ITEM(res_dir.FDConnectTimeout), 0, ITEM_DEFAULT, 3 * 60},
    {"sdconnecttimeout", store_time,ITEM(res_dir.SDConnectTimeout), 0, ITEM_DEFAULT, 30 * 60},
@@ -136,6 +141,8 @@ static RES_ITEM dir_items[] = {
    {"tlsdhfile",            store_dir,       ITEM(res_dir.tls_dhfile), 0, 0, 0},
    {"tlsallowedcn",         store_alist_str, ITEM(res_dir.tls_allowed_cns), 0, 0, 0},
    {"statisticsretention",  store_time,      ITEM(res_dir.stats_retention),  0, ITEM_DEFAULT, 60*60*24*31*12*5},
+   {"statisticsfile",       store_dir,       ITEM(res_dir.stats_file), 0, 0, 0},
+   {"statisticsinterval",   store_time,      ITEM(res_dir.stats_interval), 0, ITEM_DEFAULT, 5 * 60},
    {"verid",                store_str,       ITEM(res_dir.verid), 0, 0, 0},
    {NULL, NULL, {0}, 0, 0, 0}
 };
@@ -257,6 +264,9 @@ static RES_ITEM cat_items[] = {
    /* Turned off for the moment */
    {"multipleconnections", store_bit, ITEM(res_cat.mult_db_connections), 0, 0, 0},
    {"disablebatchinsert", store_bool, ITEM(res_cat.disable_batch_insert), 0, ITEM_DEFAULT, false},
+   {"restoretreeconnections", store_pint32, ITEM(res_cat.restore_tree_connections), 0, ITEM_DEFAULT, 1},
+   {"maximumconnections", store_pint32, ITEM(res_cat.max_connections), 0, ITEM_DEFAULT, 0},
+   {"maximumbatchconnections", store_pint32, ITEM(res_cat.max_batch_connections), 0, ITEM_DEFAULT, 0},
    {NULL, NULL, {0}, 0, 0, 0}
 };
 
@@ -335,6 +345,7 @@ RES_ITEM job_items[] = {
    {"runscript",          store_runscript, ITEM(res_job.RunScripts), 0, ITEM_NO_EQUALS, 0},
    {"selectiontype",      store_migtype, ITEM(res_job.selection_type), 0, 0, 0},
    {"accurate",           store_bool, ITEM(res_job.accurate), 0,0,0},
+   {"virtualfullbyreference", store_bool, ITEM(res_job.VirtualFullByReference), 0, ITEM_DEFAULT, false},
    {"allowduplicatejobs", store_bool, ITEM(res_job.AllowDuplicateJobs), 0, ITEM_DEFAULT, true},
    {"allowhigherduplicates",   store_bool, ITEM(res_job.AllowHigherDuplicates), 0, ITEM_DEFAULT, true},
    {"cancellowerlevelduplicates", store_bool, ITEM(res_job.CancelLowerLevelDuplicates), 0, ITEM_DEFAULT, false},
@@ -637,11 +648,14 @@ void dump_resource(int type, RES *reshdr, void sendit(void *sock, const char *fm
 
    case R_CATALOG:
       sendit(sock, _("Catalog: name=%s address=%s DBport=%d db_name=%s\n"
-"      db_driver=%s db_user=%s MutliDBConn=%d\n"),
+"      db_driver=%s db_user=%s MutliDBConn=%d RestoreTreeConn=%u\n"
+"      MaxConn=%u MaxBatchConn=%u\n"),
          res->res_cat.hdr.name, NPRT(res->res_cat.db_address),
          res->res_cat.db_port, res->res_cat.db_name, 
          NPRT(res->res_cat.db_driver), NPRT(res->res_cat.db_user),
-         res->res_cat.mult_db_connections);
+         res->res_cat.mult_db_connections,
+         res->res_cat.restore_tree_connections,
+         res->res_cat.max_connections, res->res_cat.max_batch_connections);
       break;
 
    case R_JOB:
@@ -660,7 +674,8 @@ void dump_resource(int type, RES *reshdr, void sendit(void *sock, const char *fm
          sendit(sock, _("     SpoolSize=%s\n"),        edit_uint64(res->res_job.spool_size, ed1));
       }
       if (res->res_job.JobType == JT_BACKUP) {
-         sendit(sock, _("     Accurate=%d\n"), res->res_job.accurate);
+         sendit(sock, _("     Accurate=%d VirtualFullByReference=%d\n"),
+                res->res_job.accurate, res->res_job.VirtualFullByReference);
       }
       if (res->res_job.JobType == JT_MIGRATE || res->res_job.JobType == JT_COPY) {
          sendit(sock, _("     SelectionType=%d\n"), res->res_job.selection_type);
@@ -1089,6 +1104,9 @@ void free_resource(RES *sres, int type)
       if (res->res_dir.scripts_directory) {
          free((char *)res->res_dir.scripts_directory);
       }
+      if (res->res_dir.stats_file) {
+         free(res->res_dir.stats_file);
+      }
       if (res->res_dir.plugin_directory) {
          free((char *)res->res_dir.plugin_directory);
       }
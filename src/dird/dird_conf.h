@@ -116,6 +116,11 @@ public:
    MSGS *messages;                    /* Daemon message handler */
    uint32_t MaxConcurrentJobs;        /* Max concurrent jobs for whole director */
    uint32_t MaxConsoleConnect;        /* Max concurrent console session */
+   uint32_t MaxMsgThreads;            /* Max threads for SD messages, 0=one per job */
+   bool LongestJobsFirst;             /* order jobs by their history */
+   bool BackgroundPrune;              /* autoprune in a separate thread */
+   utime_t PruneInterval;             /* pause between two background prunes */
+   uint32_t BvfsPathCacheJobs;        /* Jobs kept in the Bvfs path cache, 0=off */
    utime_t FDConnectTimeout;          /* timeout for connect in seconds */
    utime_t SDConnectTimeout;          /* timeout in seconds */
    utime_t heartbeat_interval;        /* Interval to send heartbeats */
@@ -127,6 +132,8 @@ public:
    alist *tls_allowed_cns;            /* TLS Allowed Clients */
    TLS_CONTEXT *tls_ctx;              /* Shared TLS Context */
    utime_t stats_retention;           /* Stats retention period in seconds */
+   char *stats_file;                  /* Daemon statistics file */
+   utime_t stats_interval;            /* Interval to append to stats_file */
    bool tls_authenticate;             /* Authenticated with TLS */
    bool tls_enable;                   /* Enable TLS */
    bool tls_require;                  /* Require TLS */
@@ -235,6 +242,9 @@ public:
    char *db_driver;                   /* Select appropriate driver */
    uint32_t mult_db_connections;      /* set if multiple connections wanted */
    bool disable_batch_insert;         /* set if batch inserts should be disabled */
+   uint32_t restore_tree_connections; /* connections used to build a restore tree */
+   uint32_t max_connections;          /* size of the connection pool, 0 = no pool */
+   uint32_t max_batch_connections;    /* size of the batch insert pool */
 
    /* Methods */
    char *name() const;
@@ -296,6 +306,7 @@ public:
    int32_t MaxConcurrentJobs;         /* Maximum concurrent jobs */
    int32_t NumConcurrentJobs;         /* number of concurrent jobs running */
    int32_t NumConcurrentReadJobs;     /* number of jobs reading */
+   uint64_t PredictedLoad;            /* predicted bytes of the running jobs */
    char *tls_ca_certfile;             /* TLS CA Certificate File */
    char *tls_ca_certdir;              /* TLS CA Certificate Directory */
    char *tls_certfile;                /* TLS Client Certificate File */
@@ -433,6 +444,7 @@ public:
    bool write_part_after_job;         /* Set to write part after job in SD */
    bool enabled;                      /* Set if job enabled */
    bool accurate;                     /* Set if it is an accurate backup job */
+   bool VirtualFullByReference;       /* Virtual Full references the data */
    bool AllowDuplicateJobs;           /* Allow duplicate jobs */
    bool AllowHigherDuplicates;        /* Permit Higher Level */
    bool CancelLowerLevelDuplicates;   /* Cancel lower level backup jobs */
@@ -129,6 +129,23 @@ static void set_jcr_sd_job_status(JCR *jcr, int SDJobStatus)
 int bget_dirmsg(BSOCK *bs)
 {
    int32_t n = BNET_TERMINATE;
+   bool more = true;
+
+   while (more && !bs->is_stop() && !bs->is_timed_out()) {
+      n = bget_dirmsg_once(bs, &more);
+   }
+   return n;
+}
+
+/*
+ * Same as bget_dirmsg(), but read only one message so that
+ *  the caller does not block when no more data is waiting.
+ *  more is set when the message was handled here and the
+ *  caller should read the next one.
+ */
+int bget_dirmsg_once(BSOCK *bs, bool *more)
+{
+   int32_t n;
    char Job[MAX_NAME_LENGTH];
    char MsgType[20];
    int type;
@@ -136,201 +153,203 @@ int bget_dirmsg(BSOCK *bs)
    JCR *jcr = bs->jcr();
    char *msg;
 
-   for ( ; !bs->is_stop() && !bs->is_timed_out(); ) {
-      n = bs->recv();
-      Dmsg2(100, "bget_dirmsg %d: %s\n", n, bs->msg);
+   *more = false;
+   n = bs->recv();
+   Dmsg2(100, "bget_dirmsg %d: %s\n", n, bs->msg);
 
-      if (bs->is_stop() || bs->is_timed_out()) {
-         return n;                    /* error or terminate */
-      }
-      if (n == BNET_SIGNAL) {          /* handle signal */
-         /* BNET_SIGNAL (-1) return from bnet_recv() => network signal */
-         switch (bs->msglen) {
-         case BNET_EOD:            /* end of data */
-            return n;
-         case BNET_EOD_POLL:
-            bs->fsend(OK_msg);/* send response */
-            return n;              /* end of data */
-         case BNET_TERMINATE:
-            bs->set_terminated();
-            return n;
-         case BNET_POLL:
-            bs->fsend(OK_msg); /* send response */
-            break;
-         case BNET_HEARTBEAT:
+   if (bs->is_stop() || bs->is_timed_out()) {
+      return n;                    /* error or terminate */
+   }
+   if (n == BNET_SIGNAL) {          /* handle signal */
+      /* BNET_SIGNAL (-1) return from bnet_recv() => network signal */
+      switch (bs->msglen) {
+      case BNET_EOD:            /* end of data */
+         return n;
+      case BNET_EOD_POLL:
+         bs->fsend(OK_msg);/* send response */
+         return n;              /* end of data */
+      case BNET_TERMINATE:
+         bs->set_terminated();
+         return n;
+      case BNET_POLL:
+         bs->fsend(OK_msg); /* send response */
+         break;
+      case BNET_HEARTBEAT:
 //          encode_time(time(NULL), Job);
 //          Dmsg1(100, "%s got heartbeat.\n", Job);
-            break;
-         case BNET_HB_RESPONSE:
-            break;
-         case BNET_STATUS:
-            /* *****FIXME***** Implement more completely */
-            bs->fsend("Status OK\n");
-            bs->signal(BNET_EOD);
-            break;
-         case BNET_BTIME:             /* send Bacula time */
-            char ed1[50];
-            bs->fsend("btime %s\n", edit_uint64(get_current_btime(),ed1));
-            break;
-         default:
-            Jmsg1(jcr, M_WARNING, 0, _("bget_dirmsg: unknown bnet signal %d\n"), bs->msglen);
-            return n;
-         }
-         continue;
+         break;
+      case BNET_HB_RESPONSE:
+         break;
+      case BNET_STATUS:
+         /* *****FIXME***** Implement more completely */
+         bs->fsend("Status OK\n");
+         bs->signal(BNET_EOD);
+         break;
+      case BNET_BTIME:             /* send Bacula time */
+         char ed1[50];
+         bs->fsend("btime %s\n", edit_uint64(get_current_btime(),ed1));
+         break;
+      default:
+         Jmsg1(jcr, M_WARNING, 0, _("bget_dirmsg: unknown bnet signal %d\n"), bs->msglen);
+         return n;
       }
+      goto handled;
+   }
 
-      /* Handle normal data */
+   /* Handle normal data */
 
-      if (n > 0 && B_ISDIGIT(bs->msg[0])) {      /* response? */
-         return n;                    /* yes, return it */
-      }
+   if (n > 0 && B_ISDIGIT(bs->msg[0])) {      /* response? */
+      return n;                    /* yes, return it */
+   }
 
-      /*
-       * If we get here, it must be a request.  Either
-       *  a message to dispatch, or a catalog request.
-       *  Try to fulfill it.
-       */
-      if (sscanf(bs->msg, "%020s Job=%127s ", MsgType, Job) != 2) {
-         Jmsg1(jcr, M_ERROR, 0, _("Malformed message: %s\n"), bs->msg);
-         continue;
-      }
+   /*
+    * If we get here, it must be a request.  Either
+    *  a message to dispatch, or a catalog request.
+    *  Try to fulfill it.
+    */
+   if (sscanf(bs->msg, "%020s Job=%127s ", MsgType, Job) != 2) {
+      Jmsg1(jcr, M_ERROR, 0, _("Malformed message: %s\n"), bs->msg);
+      goto handled;
+   }
 
-      /* Skip past "Jmsg Job=nnn" */
-      if (!(msg=find_msg_start(bs->msg))) {
-         Jmsg1(jcr, M_ERROR, 0, _("Malformed message: %s\n"), bs->msg);
-         continue;
-      }
+   /* Skip past "Jmsg Job=nnn" */
+   if (!(msg=find_msg_start(bs->msg))) {
+      Jmsg1(jcr, M_ERROR, 0, _("Malformed message: %s\n"), bs->msg);
+      goto handled;
+   }
 
-      /*
-       * Here we are expecting a message of the following format:
-       *   Jmsg Job=nnn type=nnn level=nnn Message-string
-       * Note, level should really be mtime, but that changes
-       *   the protocol.
-       */
-      if (bs->msg[0] == 'J') {           /* Job message */
-         if (sscanf(bs->msg, "Jmsg Job=%127s type=%d level=%lld",
-                    Job, &type, &mtime) != 3) {
-            Jmsg1(jcr, M_ERROR, 0, _("Malformed message: %s\n"), bs->msg);
-            continue;
-         }
-         Dmsg1(900, "Got msg: %s\n", bs->msg);
-         skip_spaces(&msg);
-         skip_nonspaces(&msg);        /* skip type=nnn */
-         skip_spaces(&msg);
-         skip_nonspaces(&msg);        /* skip level=nnn */
-         if (*msg == ' ') {
-            msg++;                    /* skip leading space */
-         }
-         Dmsg1(900, "Dispatch msg: %s", msg);
-         dispatch_message(jcr, type, mtime, msg);
-         continue;
-      }
-      /*
-       * Here we expact a CatReq message
-       *   CatReq Job=nn Catalog-Request-Message
-       */
-      if (bs->msg[0] == 'C') {        /* Catalog request */
-         Dmsg2(900, "Catalog req jcr 0x%x: %s", jcr, bs->msg);
-         catalog_request(jcr, bs);
-         continue;
+   /*
+    * Here we are expecting a message of the following format:
+    *   Jmsg Job=nnn type=nnn level=nnn Message-string
+    * Note, level should really be mtime, but that changes
+    *   the protocol.
+    */
+   if (bs->msg[0] == 'J') {           /* Job message */
+      if (sscanf(bs->msg, "Jmsg Job=%127s type=%d level=%lld",
+                 Job, &type, &mtime) != 3) {
+         Jmsg1(jcr, M_ERROR, 0, _("Malformed message: %s\n"), bs->msg);
+         goto handled;
       }
-      if (bs->msg[0] == 'U') {        /* SD sending attributes */
-         Dmsg2(900, "Catalog upd jcr 0x%x: %s", jcr, bs->msg);
-         catalog_update(jcr, bs);
-         continue;
+      Dmsg1(900, "Got msg: %s\n", bs->msg);
+      skip_spaces(&msg);
+      skip_nonspaces(&msg);        /* skip type=nnn */
+      skip_spaces(&msg);
+      skip_nonspaces(&msg);        /* skip level=nnn */
+      if (*msg == ' ') {
+         msg++;                    /* skip leading space */
       }
-      if (bs->msg[0] == 'B') {        /* SD sending file spool attributes */
-         Dmsg2(100, "Blast attributes jcr 0x%x: %s", jcr, bs->msg);
-         char filename[256];
-         if (sscanf(bs->msg, "BlastAttr Job=%127s File=%255s", 
-                    Job, filename) != 2) {
-            Jmsg1(jcr, M_ERROR, 0, _("Malformed message: %s\n"), bs->msg);
-            continue;
-         }
-         unbash_spaces(filename);
-         if (despool_attributes_from_file(jcr, filename)) {
-            bs->fsend("1000 OK BlastAttr\n");
-         } else {
-            bs->fsend("1990 ERROR BlastAttr\n");
-         }
-         continue;
+      Dmsg1(900, "Dispatch msg: %s", msg);
+      dispatch_message(jcr, type, mtime, msg);
+      goto handled;
+   }
+   /*
+    * Here we expact a CatReq message
+    *   CatReq Job=nn Catalog-Request-Message
+    */
+   if (bs->msg[0] == 'C') {        /* Catalog request */
+      Dmsg2(900, "Catalog req jcr 0x%x: %s", jcr, bs->msg);
+      catalog_request(jcr, bs);
+      goto handled;
+   }
+   if (bs->msg[0] == 'U') {        /* SD sending attributes */
+      Dmsg2(900, "Catalog upd jcr 0x%x: %s", jcr, bs->msg);
+      catalog_update(jcr, bs);
+      goto handled;
+   }
+   if (bs->msg[0] == 'B') {        /* SD sending file spool attributes */
+      Dmsg2(100, "Blast attributes jcr 0x%x: %s", jcr, bs->msg);
+      char filename[256];
+      if (sscanf(bs->msg, "BlastAttr Job=%127s File=%255s", 
+                 Job, filename) != 2) {
+         Jmsg1(jcr, M_ERROR, 0, _("Malformed message: %s\n"), bs->msg);
+         goto handled;
       }
-      if (bs->msg[0] == 'M') {        /* Mount request */
-         Dmsg1(900, "Mount req: %s", bs->msg);
-         mount_request(jcr, bs, msg);
-         continue;
+      unbash_spaces(filename);
+      if (despool_attributes_from_file(jcr, filename)) {
+         bs->fsend("1000 OK BlastAttr\n");
+      } else {
+         bs->fsend("1990 ERROR BlastAttr\n");
       }
-      if (bs->msg[0] == 'S') {       /* Status change */
-         int JobStatus;
-         char Job[MAX_NAME_LENGTH];
-         if (sscanf(bs->msg, Job_status, &Job, &JobStatus) == 2) {
-            set_jcr_sd_job_status(jcr, JobStatus); /* current status */
-         } else {
-            Jmsg1(jcr, M_ERROR, 0, _("Malformed message: %s\n"), bs->msg);
-         }
-         continue;
+      goto handled;
+   }
+   if (bs->msg[0] == 'M') {        /* Mount request */
+      Dmsg1(900, "Mount req: %s", bs->msg);
+      mount_request(jcr, bs, msg);
+      goto handled;
+   }
+   if (bs->msg[0] == 'S') {       /* Status change */
+      int JobStatus;
+      char Job[MAX_NAME_LENGTH];
+      if (sscanf(bs->msg, Job_status, &Job, &JobStatus) == 2) {
+         set_jcr_sd_job_status(jcr, JobStatus); /* current status */
+      } else {
+         Jmsg1(jcr, M_ERROR, 0, _("Malformed message: %s\n"), bs->msg);
       }
+      goto handled;
+   }
 #ifdef needed
-      /* No JCR for Device Updates! */
-      if (bs->msg[0] = 'D') {         /* Device update */
-         DEVICE *dev;
-         POOL_MEM dev_name, changer_name, media_type, volume_name;
-         int dev_open, dev_append, dev_read, dev_labeled;
-         int dev_offline, dev_autochanger, dev_autoselect;
-         int dev_num_writers, dev_max_writers, dev_reserved;
-         uint64_t dev_read_time, dev_write_time, dev_write_bytes, dev_read_bytes;
-         uint64_t dev_PoolId;
-         Dmsg1(100, "<stored: %s", bs->msg);
-         if (sscanf(bs->msg, Device_update,
-             &Job, dev_name.c_str(),
-             &dev_append, &dev_read,
-             &dev_num_writers, &dev_open,
-             &dev_labeled, &dev_offline, &dev_reserved,
-             &dev_max_writers, &dev_autoselect, 
-             &dev_autochanger, 
-             changer_name.c_str(), media_type.c_str(),
-             volume_name.c_str(),
-             &dev_read_time, &dev_write_time, &dev_read_bytes,
-             &dev_write_bytes) != 19) {
-            Emsg1(M_ERROR, 0, _("Malformed message: %s\n"), bs->msg);
-         } else {
-            unbash_spaces(dev_name);
-            dev = (DEVICE *)GetResWithName(R_DEVICE, dev_name.c_str());
-            if (!dev) {
-               continue;
-            }
-            unbash_spaces(changer_name);
-            unbash_spaces(media_type);
-            unbash_spaces(volume_name);
-            bstrncpy(dev->ChangerName, changer_name.c_str(), sizeof(dev->ChangerName));
-            bstrncpy(dev->MediaType, media_type.c_str(), sizeof(dev->MediaType));
-            bstrncpy(dev->VolumeName, volume_name.c_str(), sizeof(dev->VolumeName));
-            /* Note, these are copied because they are boolean rather than
-             *  integer.
-             */
-            dev->open = dev_open;
-            dev->append = dev_append;
-            dev->read = dev_read;
-            dev->labeled = dev_labeled;
-            dev->offline = dev_offline;
-            dev->autoselect = dev_autoselect;
-            dev->autochanger = dev_autochanger > 0;
-            dev->num_drives = dev_autochanger;    /* does double duty */
-            dev->PoolId = dev_PoolId;
-            dev->num_writers = dev_num_writers;
-            dev->max_writers = dev_max_writers;
-            dev->reserved = dev_reserved;
-            dev->found = true;
-            dev->DevReadTime = dev_read_time; /* TODO : have to update database */
-            dev->DevWriteTime = dev_write_time;
-            dev->DevReadBytes = dev_read_bytes;
-            dev->DevWriteBytes = dev_write_bytes;
+   /* No JCR for Device Updates! */
+   if (bs->msg[0] = 'D') {         /* Device update */
+      DEVICE *dev;
+      POOL_MEM dev_name, changer_name, media_type, volume_name;
+      int dev_open, dev_append, dev_read, dev_labeled;
+      int dev_offline, dev_autochanger, dev_autoselect;
+      int dev_num_writers, dev_max_writers, dev_reserved;
+      uint64_t dev_read_time, dev_write_time, dev_write_bytes, dev_read_bytes;
+      uint64_t dev_PoolId;
+      Dmsg1(100, "<stored: %s", bs->msg);
+      if (sscanf(bs->msg, Device_update,
+          &Job, dev_name.c_str(),
+          &dev_append, &dev_read,
+          &dev_num_writers, &dev_open,
+          &dev_labeled, &dev_offline, &dev_reserved,
+          &dev_max_writers, &dev_autoselect, 
+          &dev_autochanger, 
+          changer_name.c_str(), media_type.c_str(),
+          volume_name.c_str(),
+          &dev_read_time, &dev_write_time, &dev_read_bytes,
+          &dev_write_bytes) != 19) {
+         Emsg1(M_ERROR, 0, _("Malformed message: %s\n"), bs->msg);
+      } else {
+         unbash_spaces(dev_name);
+         dev = (DEVICE *)GetResWithName(R_DEVICE, dev_name.c_str());
+         if (!dev) {
+            goto handled;
          }
-         continue;
+         unbash_spaces(changer_name);
+         unbash_spaces(media_type);
+         unbash_spaces(volume_name);
+         bstrncpy(dev->ChangerName, changer_name.c_str(), sizeof(dev->ChangerName));
+         bstrncpy(dev->MediaType, media_type.c_str(), sizeof(dev->MediaType));
+         bstrncpy(dev->VolumeName, volume_name.c_str(), sizeof(dev->VolumeName));
+         /* Note, these are copied because they are boolean rather than
+          *  integer.
+          */
+         dev->open = dev_open;
+         dev->append = dev_append;
+         dev->read = dev_read;
+         dev->labeled = dev_labeled;
+         dev->offline = dev_offline;
+         dev->autoselect = dev_autoselect;
+         dev->autochanger = dev_autochanger > 0;
+         dev->num_drives = dev_autochanger;    /* does double duty */
+         dev->PoolId = dev_PoolId;
+         dev->num_writers = dev_num_writers;
+         dev->max_writers = dev_max_writers;
+         dev->reserved = dev_reserved;
+         dev->found = true;
+         dev->DevReadTime = dev_read_time; /* TODO : have to update database */
+         dev->DevWriteTime = dev_write_time;
+         dev->DevReadBytes = dev_read_bytes;
+         dev->DevWriteBytes = dev_write_bytes;
       }
-#endif
-      return n;
+      goto handled;
    }
+#endif
+   return n;
+
+handled:
+   *more = true;
    return n;
 }
 
@@ -130,6 +130,7 @@ static RES_ITEM options_items[] = {
    {"strippath",       store_opts,    {0},     0, 0, 0},
    {"honornodumpflag", store_opts,    {0},     0, 0, 0},
    {"xattrsupport",    store_opts,    {0},     0, 0, 0},
+   {"compactattributes", store_opts,  {0},     0, 0, 0},
    {NULL, NULL, {0}, 0, 0, 0}
 };
 
@@ -161,7 +162,8 @@ enum {
    INC_KW_CHKCHANGES,
    INC_KW_STRIPPATH,
    INC_KW_HONOR_NODUMP,
-   INC_KW_XATTR
+   INC_KW_XATTR,
+   INC_KW_COMPACT_STAT
 };
 
 /*
@@ -196,6 +198,7 @@ static struct s_kw FS_option_kw[] = {
    {"strippath",   INC_KW_STRIPPATH},
    {"honornodumpflag", INC_KW_HONOR_NODUMP},
    {"xattrsupport", INC_KW_XATTR},
+   {"compactattributes", INC_KW_COMPACT_STAT},
    {NULL,          0}
 };
 
@@ -268,6 +271,8 @@ static struct s_fs_opt FS_options[] = {
    {"no",       INC_KW_HONOR_NODUMP,  "0"},
    {"yes",      INC_KW_XATTR,         "X"},
    {"no",       INC_KW_XATTR,         "0"},
+   {"yes",      INC_KW_COMPACT_STAT,  "L"},
+   {"no",       INC_KW_COMPACT_STAT,  "0"},
    {NULL,       0,                      0}
 };
 
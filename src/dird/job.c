@@ -121,14 +121,22 @@ bool setup_job(JCR *jcr)
    jcr->unlock();
 
    /*
-    * Open database
+    * Open database, unless we share the connection of a
+    *  control job (see migrate.c)
     */
    Dmsg0(100, "Open database\n");
-   jcr->db = db_init_database(jcr, jcr->catalog->db_driver, jcr->catalog->db_name, 
-                              jcr->catalog->db_user, jcr->catalog->db_password,
-                              jcr->catalog->db_address, jcr->catalog->db_port,
-                              jcr->catalog->db_socket, jcr->catalog->mult_db_connections,
-                              jcr->catalog->disable_batch_insert);
+   if (!jcr->db) {
+      jcr->db = db_pool_acquire(jcr, jcr->catalog->db_driver, jcr->catalog->db_name,
+                                jcr->catalog->db_user, jcr->catalog->db_address,
+                                jcr->catalog->db_port);
+   }
+   if (!jcr->db) {
+      jcr->db = db_init_database(jcr, jcr->catalog->db_driver, jcr->catalog->db_name, 
+                                 jcr->catalog->db_user, jcr->catalog->db_password,
+                                 jcr->catalog->db_address, jcr->catalog->db_port,
+                                 jcr->catalog->db_socket, jcr->catalog->mult_db_connections,
+                                 jcr->catalog->disable_batch_insert);
+   }
    if (!jcr->db || !db_open_database(jcr, jcr->db)) {
       Jmsg(jcr, M_FATAL, 0, _("Could not open database \"%s\".\n"),
                  jcr->catalog->db_name);
@@ -366,6 +374,10 @@ static void *job_thread(void *arg)
 
 void sd_msg_thread_send_signal(JCR *jcr, int sig)
 {
+   if (get_sd_msg_state(jcr) != SD_MSG_THREAD) {
+      cancel_storage_daemon_message_thread(jcr); /* channel in the reactor */
+      return;
+   }
    jcr->lock();
    if (  !jcr->sd_msg_thread_done
        && jcr->SD_msg_chan 
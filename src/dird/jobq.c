@@ -57,6 +57,9 @@ static int  start_server(jobq_t *jq);
 static bool acquire_resources(JCR *jcr);
 static bool reschedule_job(JCR *jcr, jobq_t *jq, jobq_item_t *je);
 static void dec_write_store(JCR *jcr);
+static void predict_job(JCR *jcr);
+static bool runs_longer(JCR *jcr, JCR *other);
+static void select_wstore(JCR *jcr);
 
 /*
  * Initialize a job queue
@@ -231,6 +234,9 @@ int jobq_add(jobq_t *jq, JCR *jcr)
 
    jcr->inc_use_count();                 /* mark jcr in use by us */
    Dmsg3(2300, "jobq_add jobid=%d jcr=0x%x use_count=%d\n", jcr->JobId, jcr, jcr->use_count());
+   if (director->LongestJobsFirst && !job_canceled(jcr)) {
+      predict_job(jcr);
+   }
    if (!job_canceled(jcr) && wtime > 0) {
       set_thread_concurrency(jq->max_workers + 2);
       sched_pkt = (wait_pkt *)malloc(sizeof(wait_pkt));
@@ -259,11 +265,17 @@ int jobq_add(jobq_t *jq, JCR *jcr)
       jq->ready_jobs->prepend(item);
       Dmsg1(2300, "Prepended job=%d to ready queue\n", jcr->JobId);
    } else {
-      /* Add this job to the wait queue in priority sorted order */
+      /*
+       * Add this job to the wait queue in priority sorted order,
+       *  and with Longest Jobs First, the longest first within
+       *  a priority.
+       */
       foreach_dlist(li, jq->waiting_jobs) {
          Dmsg2(2300, "waiting item jobid=%d priority=%d\n",
             li->jcr->JobId, li->jcr->JobPriority);
-         if (li->jcr->JobPriority > jcr->JobPriority) {
+         if (li->jcr->JobPriority > jcr->JobPriority ||
+             (li->jcr->JobPriority == jcr->JobPriority &&
+              director->LongestJobsFirst && runs_longer(jcr, li->jcr))) {
             jq->waiting_jobs->insert_before(item, li);
             Dmsg2(2300, "insert_before jobid=%d before waiting job=%d\n",
                li->jcr->JobId, jcr->JobId);
@@ -466,6 +478,16 @@ void *jobq_server(void *arg)
           *  put into the ready queue.
           */
          if (jcr->acquired_resource_locks) {
+            /* The wstore may have changed since, use the one charged */
+            if (jcr->PredictedStore) {
+               STORE *store = jcr->PredictedStore;
+               if (store->PredictedLoad > jcr->PredictedBytes) {
+                  store->PredictedLoad -= jcr->PredictedBytes;
+               } else {
+                  store->PredictedLoad = 0;
+               }
+               jcr->PredictedStore = NULL;
+            }
             dec_read_store(jcr);
             dec_write_store(jcr);
             jcr->client->NumConcurrentJobs--;
@@ -758,6 +780,9 @@ static bool acquire_resources(JCR *jcr)
       }
    }
    
+   if (director->LongestJobsFirst && !jcr->rstore) {
+      select_wstore(jcr);
+   }
    if (jcr->wstore) {
       Dmsg1(200, "Wstore=%s\n", jcr->wstore->name());
       if (jcr->wstore->NumConcurrentJobs < jcr->wstore->MaxConcurrentJobs) {
@@ -796,10 +821,125 @@ static bool acquire_resources(JCR *jcr)
       return false;
    }
 
+   if (jcr->wstore) {
+      jcr->wstore->PredictedLoad += jcr->PredictedBytes;
+      jcr->PredictedStore = jcr->wstore;
+   }
    jcr->acquired_resource_locks = true;
    return true;
 }
 
+/*
+ * Longest Jobs First
+ *
+ * The run time and the bytes of a job are predicted from the last
+ *  successful runs of the same Job at the same level. Jobs of the
+ *  same priority are then started longest first, so that the few
+ *  long jobs of the night do not start last and make the backup
+ *  window longer, and a backup job with several write Storages is
+ *  given the one with the least predicted bytes to write.
+ */
+#define HISTORY_JOBS 5                /* runs used for the prediction */
+
+struct predict_ctx {
+   int count;
+   utime_t run_time;
+   uint64_t bytes;
+};
+
+static int predict_handler(void *ctx, int num_fields, char **row)
+{
+   predict_ctx *pc = (predict_ctx *)ctx;
+   utime_t start, end;
+
+   if (!row[0] || !row[1] || !row[2]) {
+      return 0;
+   }
+   start = str_to_utime(row[0]);
+   end = str_to_utime(row[1]);
+   if (start <= 0 || end < start) {
+      return 0;
+   }
+   pc->run_time += end - start;
+   pc->bytes += str_to_uint64(row[2]);
+   pc->count++;
+   return 0;
+}
+
+static void predict_job(JCR *jcr)
+{
+   POOL_MEM query(PM_MESSAGE);
+   predict_ctx pc;
+   char esc[MAX_ESCAPE_NAME_LENGTH];
+   char ed1[50], ed2[50];
+
+   if (!jcr->db || !jcr->job) {
+      return;
+   }
+   memset(&pc, 0, sizeof(pc));
+   db_escape_string(jcr, jcr->db, esc, jcr->job->name(), strlen(jcr->job->name()));
+   Mmsg(query, "SELECT StartTime,EndTime,JobBytes FROM Job "
+        "WHERE Name='%s' AND Type='%c' AND Level='%c' AND JobStatus IN ('T','W') "
+        "ORDER BY JobTDate DESC LIMIT %d",
+        esc, jcr->getJobType(), jcr->getJobLevel(), HISTORY_JOBS);
+   if (!db_sql_query(jcr->db, query.c_str(), predict_handler, &pc)) {
+      Dmsg1(50, "Job history query failed: %s\n", db_strerror(jcr->db));
+      return;
+   }
+   if (pc.count > 0) {
+      jcr->PredictedRunTime = pc.run_time / pc.count;
+      jcr->PredictedBytes = pc.bytes / pc.count;
+   }
+   Dmsg4(100, "Job %s predicted from %d runs: %s secs %s bytes\n", jcr->Job, pc.count,
+      edit_uint64(jcr->PredictedRunTime, ed1), edit_uint64(jcr->PredictedBytes, ed2));
+}
+
+/*
+ * Returns true if jcr is expected to run longer than other.
+ *  A job without history may be a new big client, so it is
+ *  taken as running longer than any known job.
+ */
+static bool runs_longer(JCR *jcr, JCR *other)
+{
+   if (jcr->PredictedRunTime == 0) {
+      return other->PredictedRunTime != 0;
+   }
+   return other->PredictedRunTime != 0 &&
+          jcr->PredictedRunTime > other->PredictedRunTime;
+}
+
+/*
+ * Give the job the write Storage with room for it that has the
+ *  least predicted bytes to write. It is moved at the head of
+ *  the job's Storage list, which is what the SD will use first.
+ */
+static void select_wstore(JCR *jcr)
+{
+   STORE *store, *best = NULL;
+   int i, best_index = 0;
+
+   if (!jcr->wstorage || jcr->wstorage->size() < 2 || jcr->getJobType() != JT_BACKUP) {
+      return;
+   }
+   for (i = 0; i < jcr->wstorage->size(); i++) {
+      store = (STORE *)jcr->wstorage->get(i);
+      if (store->NumConcurrentJobs >= store->MaxConcurrentJobs) {
+         continue;
+      }
+      if (!best || store->PredictedLoad < best->PredictedLoad) {
+         best = store;
+         best_index = i;
+      }
+   }
+   if (best && best != jcr->wstore) {
+      Dmsg3(100, "Job %s moved from Storage %s to %s\n", jcr->Job,
+         jcr->wstore ? jcr->wstore->name() : "*none*", best->name());
+      jcr->wstorage->remove(best_index);
+      jcr->wstorage->prepend(best);
+      jcr->wstore = best;
+   }
+}
+
 static pthread_mutex_t rstore_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 /* 
@@ -199,6 +199,15 @@ bool do_migration_init(JCR *jcr)
     *   the previous backup job "prev_job".
     */
    set_jcr_defaults(mig_jcr, prev_job);
+
+   /*
+    * With a connection pool, a second lease could wait on ourself.
+    *  The mig_jcr is driven by this thread, so it can use our catalog
+    *  connection instead.
+    */
+   if (mig_jcr->catalog == jcr->catalog && jcr->catalog->max_connections > 0) {
+      mig_jcr->db = db_clone_database_connection(jcr->db, mig_jcr, false);
+   }
    if (!setup_job(mig_jcr)) {
       Jmsg(jcr, M_FATAL, 0, _("setup job failed.\n"));
       return false;
@@ -1272,18 +1281,14 @@ void migration_cleanup(JCR *jcr, int TermCode)
          msg_type = M_ERROR;          /* Generate error message */
          if (jcr->store_bsock) {
             bnet_sig(jcr->store_bsock, BNET_TERMINATE);
-            if (jcr->SD_msg_chan) {
-               pthread_cancel(jcr->SD_msg_chan);
-            }
+            cancel_storage_daemon_message_thread(jcr);
          }
          break;
       case JS_Canceled:
          term_msg = _("%s Canceled");
          if (jcr->store_bsock) {
             bnet_sig(jcr->store_bsock, BNET_TERMINATE);
-            if (jcr->SD_msg_chan) {
-               pthread_cancel(jcr->SD_msg_chan);
-            }
+            cancel_storage_daemon_message_thread(jcr);
          }
          break;
       default:
@@ -39,11 +39,18 @@
  *      to authenticate ourself and to pass the JobId.
  *    Create a thread to interact with the Storage daemon
  *      who returns a job status and requests Catalog services, etc.
+ *      Where epoll is available, the message channels of all the
+ *      jobs are instead watched by a single reactor thread, and
+ *      read by a small pool of workers when they have data.
  *
  */
 
 #include "bacula.h"
 #include "dird.h"
+#ifdef HAVE_EPOLL_CREATE
+#include <sys/epoll.h>
+#include <poll.h>
+#endif
 
 static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 
@@ -68,6 +75,21 @@ static char Job_end[]    =
 
 /* Forward referenced functions */
 extern "C" void *msg_thread(void *arg);
+static bool sd_msg_response(JCR *jcr, BSOCK *sd);
+
+/*
+ * State of the Storage daemon message channel of the job,
+ *  the reactor and its workers change it under our mutex.
+ */
+int get_sd_msg_state(JCR *jcr)
+{
+   int state;
+
+   P(mutex);
+   state = jcr->SD_msg_state;
+   V(mutex);
+   return state;
+}
 
 /*
  * Establish a message channel connection with the Storage daemon
@@ -323,9 +345,335 @@ bool start_storage_daemon_job(JCR *jcr, alist *rstore, alist *wstore, bool send_
    return ok;
 }
 
+#ifdef HAVE_EPOLL_CREATE
+/*
+ * The message reactor. Most of the time, the Storage daemon of
+ *  a running job has nothing to tell us, so rather than having a
+ *  thread per job blocked in bget_dirmsg(), one thread waits with
+ *  epoll on the channels of all the jobs. When a channel has data,
+ *  the job is given to a worker of msg_workq that handles messages
+ *  while some are waiting, then puts the channel back in epoll.
+ *  A channel is registered with EPOLLONESHOT, so only one worker
+ *  at a time reads it, and the messages of a job stay in order.
+ *
+ *  The channel holds a reference on the jcr. As epoll_wait() may
+ *  have returned an event just before the channel was removed, that
+ *  reference is not released where the channel is removed, but by
+ *  the reactor thread once it is done with the events it holds.
+ */
+#define MSG_REACTOR_EVENTS 64         /* events read by epoll_wait() */
+#define MSG_REACTOR_BURST 100         /* messages read before yielding */
+
+static int reactor_fd = -1;           /* epoll descriptor */
+static int reactor_pipe[2] = {-1, -1}; /* wakes up the reactor */
+static pthread_t reactor_tid;
+static workq_t msg_workq;             /* workers reading the channels */
+static bool reactor_started = false;
+static alist *retired_jcrs = NULL;    /* jcrs to release, protected by mutex */
+static bool reactor_wakeup = false;   /* the reactor has been woken up */
+
+/*
+ * Release the jcrs of the channels removed from the reactor.
+ *  Called by the reactor thread between two epoll_wait(), or
+ *  with last once the reactor is stopped.
+ */
+static void free_retired_jcrs(bool last)
+{
+   alist *jcrs;
+   JCR *jcr;
+
+   P(mutex);
+   jcrs = retired_jcrs;
+   if (!last && jcrs->empty()) {
+      V(mutex);
+      return;
+   }
+   retired_jcrs = last ? NULL : New(alist(10, not_owned_by_alist));
+   V(mutex);
+   foreach_alist(jcr, jcrs) {
+      free_jcr(jcr);
+   }
+   delete jcrs;
+}
+
+/*
+ * The reactor is done with the channel of the job
+ */
+static void msg_reactor_done(JCR *jcr)
+{
+   BSOCK *sd = jcr->store_bsock;
+
+   P(mutex);
+   epoll_ctl(reactor_fd, EPOLL_CTL_DEL, sd->m_fd, NULL);
+   V(mutex);
+   if (is_bnet_error(sd)) {
+      jcr->SDJobStatus = JS_ErrorTerminated;
+   }
+   db_end_transaction(jcr, jcr->db);        /* terminate any open transaction */
+   jcr->lock();
+   jcr->sd_msg_thread_done = true;
+   jcr->SD_msg_chan = 0;
+   jcr->unlock();
+   pthread_cond_broadcast(&jcr->term_wait); /* wakeup any waiting threads */
+   Dmsg2(100, "=== End msg channel. JobId=%d usecnt=%d\n", jcr->JobId, jcr->use_count());
+
+   /* The reactor may still hold an event of the channel, it releases the jcr */
+   P(mutex);
+   if (retired_jcrs) {
+      retired_jcrs->append(jcr);
+      if (reactor_started && !reactor_wakeup) {
+         reactor_wakeup = write(reactor_pipe[1], "r", 1) == 1;
+      }
+      jcr = NULL;
+   }
+   V(mutex);
+   if (jcr) {
+      free_jcr(jcr);                        /* the reactor is gone */
+   }
+}
+
+/*
+ * Handle the messages waiting on the channel of a job.
+ *  Called by the msg_workq workers.
+ */
+extern "C" void *msg_reactor_engine(void *arg)
+{
+   JCR *jcr = (JCR *)arg;
+   BSOCK *sd = jcr->store_bsock;
+   struct epoll_event ev;
+   struct pollfd pfd;
+   bool more, done = false;
+   int32_t n;
+   int i;
+
+   set_jcr_in_tsd(jcr);
+   jcr->lock();
+   jcr->SD_msg_chan = pthread_self(); /* so that a cancel can wake us up */
+   jcr->unlock();
+
+   pfd.fd = sd->m_fd;
+   pfd.events = POLLIN;
+   for (i = 0; i < MSG_REACTOR_BURST; i++) {
+      if (job_canceled(jcr) || sd->is_stop() || sd->is_timed_out()) {
+         done = true;
+         break;
+      }
+      if (i > 0 && poll(&pfd, 1, 0) <= 0) {
+         break;                       /* nothing more for now */
+      }
+      n = bget_dirmsg_once(sd, &more);
+      if (more) {
+         continue;
+      }
+      if (n < 0 || sd_msg_response(jcr, sd)) {
+         done = true;
+         break;
+      }
+   }
+
+   jcr->lock();
+   jcr->SD_msg_chan = 0;
+   jcr->unlock();
+
+   P(mutex);
+   if (!done && (job_canceled(jcr) || sd->is_stop() || sd->is_timed_out())) {
+      done = true;
+   }
+   if (!done) {
+      jcr->SD_msg_state = SD_MSG_IDLE;
+      memset(&ev, 0, sizeof(ev));
+      ev.events = EPOLLIN | EPOLLONESHOT;
+      ev.data.ptr = jcr;
+      if (epoll_ctl(reactor_fd, EPOLL_CTL_MOD, sd->m_fd, &ev) != 0) {
+         berrno be;
+         Jmsg1(jcr, M_ERROR, 0, _("Cannot watch Storage daemon channel: ERR=%s\n"),
+            be.bstrerror());
+         done = true;
+      }
+   }
+   if (done) {
+      jcr->SD_msg_state = SD_MSG_DONE;
+   }
+   V(mutex);
+
+   if (done) {
+      msg_reactor_done(jcr);
+   }
+   set_jcr_in_tsd(INVALID_JCR);
+   return NULL;
+}
+
+/*
+ * Wait for data on the channels and hand them to the workers
+ */
+extern "C" void *msg_reactor_thread(void *arg)
+{
+   struct epoll_event ev[MSG_REACTOR_EVENTS];
+   char buf[10];
+   JCR *jcr;
+   bool queue;
+   int i, n, stat;
+
+   set_jcr_in_tsd(INVALID_JCR);
+   for ( ;; ) {
+      n = epoll_wait(reactor_fd, ev, MSG_REACTOR_EVENTS, -1);
+      if (n < 0) {
+         if (errno == EINTR) {
+            continue;
+         }
+         berrno be;
+         Emsg1(M_ERROR, 0, _("Message reactor epoll_wait error: ERR=%s\n"), be.bstrerror());
+         bmicrosleep(1, 0);
+         continue;
+      }
+      for (i = 0; i < n; i++) {
+         jcr = (JCR *)ev[i].data.ptr;
+         if (!jcr) {
+            P(mutex);
+            reactor_wakeup = false;
+            V(mutex);
+            if ((stat = read(reactor_pipe[0], buf, sizeof(buf))) > 0 &&
+                memchr(buf, 'q', stat)) {
+               return NULL;           /* term_msg_reactor() */
+            }
+            continue;                 /* msg_reactor_done() */
+         }
+         /* The jcr is still referenced, but the channel may be done */
+         P(mutex);
+         queue = jcr->SD_msg_state == SD_MSG_IDLE;
+         if (queue) {
+            jcr->SD_msg_state = SD_MSG_BUSY;
+         }
+         V(mutex);
+         if (queue && (stat = workq_add(&msg_workq, (void *)jcr, NULL, 0)) != 0) {
+            berrno be;
+            Jmsg1(jcr, M_FATAL, 0, _("Could not add job to message queue: ERR=%s\n"),
+               be.bstrerror(stat));
+            P(mutex);
+            jcr->SD_msg_state = SD_MSG_DONE;
+            V(mutex);
+            msg_reactor_done(jcr);
+         }
+      }
+      /* None of the events left refers to a removed channel */
+      free_retired_jcrs(false);
+   }
+   return NULL;
+}
+
+/*
+ * Start the message reactor with max_workers threads to read
+ *  the channels. With max_workers == 0, or if epoll is not
+ *  usable, each job has its own msg_thread as before.
+ */
+void init_msg_reactor(int max_workers)
+{
+   struct epoll_event ev;
+   int stat;
+
+   if (max_workers <= 0) {
+      return;
+   }
+   if ((reactor_fd = epoll_create(MSG_REACTOR_EVENTS)) < 0) {
+      berrno be;
+      Emsg1(M_WARNING, 0, _("Could not create message reactor: ERR=%s\n"), be.bstrerror());
+      return;
+   }
+   if (pipe(reactor_pipe) != 0) {
+      berrno be;
+      Emsg1(M_WARNING, 0, _("Could not create message reactor: ERR=%s\n"), be.bstrerror());
+      goto bail_out;
+   }
+   memset(&ev, 0, sizeof(ev));
+   ev.events = EPOLLIN;
+   ev.data.ptr = NULL;
+   if (epoll_ctl(reactor_fd, EPOLL_CTL_ADD, reactor_pipe[0], &ev) != 0) {
+      berrno be;
+      Emsg1(M_WARNING, 0, _("Could not create message reactor: ERR=%s\n"), be.bstrerror());
+      goto bail_out;
+   }
+   if ((stat = workq_init(&msg_workq, max_workers, msg_reactor_engine)) != 0) {
+      berrno be;
+      Emsg1(M_ABORT, 0, _("Could not init message queue: ERR=%s\n"), be.bstrerror(stat));
+   }
+   retired_jcrs = New(alist(10, not_owned_by_alist));
+   if ((stat = pthread_create(&reactor_tid, NULL, msg_reactor_thread, NULL)) != 0) {
+      berrno be;
+      Emsg1(M_ABORT, 0, _("Cannot create message reactor thread: %s\n"), be.bstrerror(stat));
+   }
+   reactor_started = true;
+   Dmsg1(100, "Message reactor started with %d workers\n", max_workers);
+   return;
+
+bail_out:
+   if (reactor_pipe[0] >= 0) {
+      close(reactor_pipe[0]);
+      close(reactor_pipe[1]);
+      reactor_pipe[0] = reactor_pipe[1] = -1;
+   }
+   close(reactor_fd);
+   reactor_fd = -1;
+}
+
+void term_msg_reactor()
+{
+   if (!reactor_started) {
+      return;
+   }
+   P(mutex);
+   reactor_started = false;
+   V(mutex);
+   if (write(reactor_pipe[1], "q", 1) == 1) {
+      pthread_join(reactor_tid, NULL);
+   }
+   workq_destroy(&msg_workq);         /* ignore any errors */
+   free_retired_jcrs(true);
+   close(reactor_pipe[0]);
+   close(reactor_pipe[1]);
+   close(reactor_fd);
+   reactor_fd = -1;
+}
+
+/*
+ * Give the channel of the job to the reactor.
+ *  Returns: false if the job needs a msg_thread
+ */
+static bool msg_reactor_add(JCR *jcr)
+{
+   BSOCK *sd = jcr->store_bsock;
+   struct epoll_event ev;
+   bool ok;
+
+   /* The TLS layer may have buffered data that epoll does not see */
+   if (!reactor_started || sd->tls) {
+      return false;
+   }
+   memset(&ev, 0, sizeof(ev));
+   ev.events = EPOLLIN | EPOLLONESHOT;
+   ev.data.ptr = jcr;
+   P(mutex);
+   jcr->SD_msg_state = SD_MSG_IDLE;
+   ok = epoll_ctl(reactor_fd, EPOLL_CTL_ADD, sd->m_fd, &ev) == 0;
+   if (!ok) {
+      jcr->SD_msg_state = SD_MSG_THREAD;
+   }
+   V(mutex);
+   if (!ok) {
+      berrno be;
+      Dmsg1(50, "Cannot add SD channel to the reactor: ERR=%s\n", be.bstrerror());
+   }
+   return ok;
+}
+
+#else
+void init_msg_reactor(int max_workers) { }
+void term_msg_reactor() { }
+static bool msg_reactor_add(JCR *jcr) { return false; }
+#endif
+
 /*
  * Start a thread to handle Storage daemon messages and
- *  Catalog requests.
+ *  Catalog requests, or give the channel to the reactor.
  */
 bool start_storage_daemon_message_thread(JCR *jcr)
 {
@@ -335,6 +683,13 @@ bool start_storage_daemon_message_thread(JCR *jcr)
    jcr->inc_use_count();              /* mark in use by msg thread */
    jcr->sd_msg_thread_done = false;
    jcr->SD_msg_chan = 0;
+   P(mutex);
+   jcr->SD_msg_state = SD_MSG_THREAD;
+   V(mutex);
+   if (msg_reactor_add(jcr)) {
+      Dmsg1(100, "SD msg channel in reactor. use=%d\n", jcr->use_count());
+      return true;
+   }
    Dmsg0(100, "Start SD msg_thread.\n");
    if ((status=pthread_create(&thid, NULL, msg_thread, (void *)jcr)) != 0) {
       berrno be;
@@ -351,6 +706,39 @@ bool start_storage_daemon_message_thread(JCR *jcr)
    return true;
 }
 
+/*
+ * Stop handling the Storage daemon messages of a canceled job
+ */
+void cancel_storage_daemon_message_thread(JCR *jcr)
+{
+#ifdef HAVE_EPOLL_CREATE
+   bool idle = false;
+
+   P(mutex);
+   if (jcr->SD_msg_state == SD_MSG_IDLE) {
+      jcr->SD_msg_state = SD_MSG_DONE;
+      idle = true;
+   }
+   V(mutex);
+   if (idle) {
+      msg_reactor_done(jcr);
+      return;
+   }
+   if (get_sd_msg_state(jcr) != SD_MSG_THREAD) {
+      /* A worker is reading the channel, get it out of the read */
+      jcr->lock();
+      if (jcr->SD_msg_chan && !pthread_equal(jcr->SD_msg_chan, pthread_self())) {
+         pthread_kill(jcr->SD_msg_chan, TIMEOUT_SIGNAL);
+      }
+      jcr->unlock();
+      return;
+   }
+#endif
+   if (jcr->SD_msg_chan) {
+      pthread_cancel(jcr->SD_msg_chan);
+   }
+}
+
 extern "C" void msg_thread_cleanup(void *arg)
 {
    JCR *jcr = (JCR *)arg;
@@ -365,6 +753,32 @@ extern "C" void msg_thread_cleanup(void *arg)
    free_jcr(jcr);                           /* release jcr */
 }
 
+/*
+ * Handle a response of the Storage daemon on the message channel.
+ *  Returns: true when the SD has terminated the job
+ */
+static bool sd_msg_response(JCR *jcr, BSOCK *sd)
+{
+   int JobStatus;
+   char Job[MAX_NAME_LENGTH];
+   uint32_t JobFiles, JobErrors;
+   uint64_t JobBytes;
+
+   Dmsg1(400, "<stored: %s", sd->msg);
+   if (sscanf(sd->msg, Job_start, Job) == 1) {
+      return false;
+   }
+   if (sscanf(sd->msg, Job_end, Job, &JobStatus, &JobFiles,
+              &JobBytes, &JobErrors) == 5) {
+      jcr->SDJobStatus = JobStatus; /* termination status */
+      jcr->SDJobFiles = JobFiles;
+      jcr->SDJobBytes = JobBytes;
+      jcr->SDErrors = JobErrors;
+      return true;
+   }
+   return false;
+}
+
 /*
  * Handle the message channel (i.e. requests from the
  *  Storage daemon).
@@ -374,10 +788,6 @@ extern "C" void *msg_thread(void *arg)
 {
    JCR *jcr = (JCR *)arg;
    BSOCK *sd;
-   int JobStatus;
-   char Job[MAX_NAME_LENGTH];
-   uint32_t JobFiles, JobErrors;
-   uint64_t JobBytes;
 
    pthread_detach(pthread_self());
    set_jcr_in_tsd(jcr);
@@ -389,16 +799,7 @@ extern "C" void *msg_thread(void *arg)
     */
    Dmsg0(100, "Start msg_thread loop\n");
    while (!job_canceled(jcr) && bget_dirmsg(sd) >= 0) {
-      Dmsg1(400, "<stored: %s", sd->msg);
-      if (sscanf(sd->msg, Job_start, Job) == 1) {
-         continue;
-      }
-      if (sscanf(sd->msg, Job_end, Job, &JobStatus, &JobFiles,
-                 &JobBytes, &JobErrors) == 5) {
-         jcr->SDJobStatus = JobStatus; /* termination status */
-         jcr->SDJobFiles = JobFiles;
-         jcr->SDJobBytes = JobBytes;
-         jcr->SDErrors = JobErrors;
+      if (sd_msg_response(jcr, sd)) {
          break;
       }
       Dmsg1(400, "end loop use=%d\n", jcr->use_count());
@@ -427,7 +828,7 @@ void wait_for_storage_daemon_termination(JCR *jcr)
       pthread_cond_timedwait(&jcr->term_wait, &mutex, &timeout);
       V(mutex);
       if (jcr->is_canceled()) {
-         if (jcr->SD_msg_chan) {
+         if (jcr->SD_msg_chan || get_sd_msg_state(jcr) == SD_MSG_IDLE) {
             jcr->store_bsock->set_timed_out();
             jcr->store_bsock->set_terminated();
             sd_msg_thread_send_signal(jcr, TIMEOUT_SIGNAL);
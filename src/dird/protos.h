@@ -43,6 +43,9 @@ extern int authenticate_user_agent(UAContext *ua);
 /* autoprune.c */
 extern void do_autoprune(JCR *jcr);
 extern void prune_volumes(JCR *jcr, bool InChanger, MEDIA_DBR *mr);
+extern void init_prune_worker();
+extern void term_prune_worker();
+extern void list_prune_status(UAContext *ua);
 
 /* autorecycle.c */
 extern bool recycle_oldest_purged_volume(JCR *jcr, bool InChanger, MEDIA_DBR *mr);
@@ -163,7 +166,12 @@ extern bool connect_to_storage_daemon(JCR *jcr, int retry_interval,
 extern bool start_storage_daemon_job(JCR *jcr, alist *rstore, alist *wstore,
               bool send_bsr=false);
 extern bool start_storage_daemon_message_thread(JCR *jcr);
+extern void cancel_storage_daemon_message_thread(JCR *jcr);
+extern int get_sd_msg_state(JCR *jcr);
+extern void init_msg_reactor(int max_workers);
+extern void term_msg_reactor();
 extern int bget_dirmsg(BSOCK *bs);
+extern int bget_dirmsg_once(BSOCK *bs, bool *more);
 extern void wait_for_storage_daemon_termination(JCR *jcr);
 extern bool send_bootstrap_file(JCR *jcr, BSOCK *sd);
 
@@ -296,6 +304,8 @@ int del_count_handler(void *ctx, int num_fields, char **row);
 int file_delete_handler(void *ctx, int num_fields, char **row);
 int get_prune_list_for_volume(UAContext *ua, MEDIA_DBR *mr, del_ctx *del);
 int exclude_running_jobs_from_list(del_ctx *prune_list);
+int exclude_referenced_jobs_from_list(UAContext *ua, del_ctx *prune_list);
+int exclude_referenced_jobids(UAContext *ua, POOL_MEM &jobids);
 
 /* ua_purge.c */
 bool is_volume_purged(UAContext *ua, MEDIA_DBR *mr, bool force=false);
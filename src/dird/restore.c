@@ -572,18 +572,14 @@ void restore_cleanup(JCR *jcr, int TermCode)
       msg_type = M_ERROR;          /* Generate error message */
       if (jcr->store_bsock) {
          jcr->store_bsock->signal(BNET_TERMINATE);
-         if (jcr->SD_msg_chan) {
-            pthread_cancel(jcr->SD_msg_chan);
-         }
+         cancel_storage_daemon_message_thread(jcr);
       }
       break;
    case JS_Canceled:
       term_msg = _("Restore Canceled");
       if (jcr->store_bsock) {
          jcr->store_bsock->signal(BNET_TERMINATE);
-         if (jcr->SD_msg_chan) {
-            pthread_cancel(jcr->SD_msg_chan);
-         }
+         cancel_storage_daemon_message_thread(jcr);
       }
       break;
    default:
@@ -42,6 +42,7 @@ public:
    JCR *jcr;
    B_DB *db;
    CAT *catalog;
+   CAT *used_catalog;                 /* last catalog shown with "Using Catalog" */
    CONRES *cons;                      /* console resource */
    POOLMEM *cmd;                      /* return command/name buffer */
    POOLMEM *args;                     /* command line arguments */
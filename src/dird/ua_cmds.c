@@ -1416,10 +1416,14 @@ static bool delete_job_id_range(UAContext *ua, char *tok)
  */
 static void do_job_delete(UAContext *ua, JobId_t JobId)
 {
+   POOL_MEM jobid;
    char ed1[50];
 
-   edit_int64(JobId, ed1);
-   purge_jobs_from_catalog(ua, ed1);
+   pm_strcpy(jobid, edit_int64(JobId, ed1));
+   if (exclude_referenced_jobids(ua, jobid) == 0) {
+      return;
+   }
+   purge_jobs_from_catalog(ua, jobid.c_str());
    ua->send_msg(_("Job %s and associated records deleted from the catalog.\n"), ed1);
 }
 
@@ -1994,11 +1998,16 @@ bool open_db(UAContext *ua)
    ua->jcr->catalog = ua->catalog;
 
    Dmsg0(100, "UA Open database\n");
-   ua->db = db_init_database(ua->jcr, ua->catalog->db_driver, ua->catalog->db_name, 
-                             ua->catalog->db_user,
-                             ua->catalog->db_password, ua->catalog->db_address,
-                             ua->catalog->db_port, ua->catalog->db_socket,
-                             mult_db_conn, ua->catalog->disable_batch_insert);
+   ua->db = db_pool_acquire(ua->jcr, ua->catalog->db_driver, ua->catalog->db_name,
+                            ua->catalog->db_user, ua->catalog->db_address,
+                            ua->catalog->db_port);
+   if (!ua->db) {
+      ua->db = db_init_database(ua->jcr, ua->catalog->db_driver, ua->catalog->db_name, 
+                                ua->catalog->db_user,
+                                ua->catalog->db_password, ua->catalog->db_address,
+                                ua->catalog->db_port, ua->catalog->db_socket,
+                                mult_db_conn, ua->catalog->disable_batch_insert);
+   }
    if (!ua->db || !db_open_database(ua->jcr, ua->db)) {
       ua->error_msg(_("Could not open catalog database \"%s\".\n"),
                  ua->catalog->db_name);
@@ -2009,9 +2018,11 @@ bool open_db(UAContext *ua)
       return false;
    }
    ua->jcr->db = ua->db;
-   if (!ua->api) {
+   /* A pooled connection is opened again for each command, say it once */
+   if (!ua->api && ua->catalog != ua->used_catalog) {
       ua->send_msg(_("Using Catalog \"%s\"\n"), ua->catalog->name()); 
    }
+   ua->used_catalog = ua->catalog;
    Dmsg1(150, "DB %s opened\n", ua->catalog->db_name);
    return true;
 }
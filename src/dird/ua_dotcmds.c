@@ -51,6 +51,7 @@ extern void do_messages(UAContext *ua, const char *cmd);
 extern int quit_cmd(UAContext *ua, const char *cmd);
 extern int qhelp_cmd(UAContext *ua, const char *cmd);
 extern bool dot_status_cmd(UAContext *ua, const char *cmd);
+extern bool dot_stats_cmd(UAContext *ua, const char *cmd);
 
 
 /* Forward referenced functions */
@@ -108,6 +109,7 @@ static struct cmdstruct commands[] = { /* help */  /* can be used in runscript *
  { NT_(".quit"),       dot_quit_cmd,             NULL,       false},
  { NT_(".sql"),        sql_cmd,                  NULL,       false},
  { NT_(".status"),     dot_status_cmd,           NULL,       false},
+ { NT_(".stats"),      dot_stats_cmd,            NULL,       false},
  { NT_(".storage"),    storagecmd,               NULL,       true},
  { NT_(".volstatus"),  volstatuscmd,             NULL,       true},
  { NT_(".media"),      mediacmd,                 NULL,       true},
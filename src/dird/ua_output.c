@@ -709,12 +709,17 @@ bool complete_jcr_for_job(JCR *jcr, JOB *job, POOL *pool)
    }
 
    Dmsg0(100, "complete_jcr open db\n");
-   jcr->db = db_init_database(jcr, jcr->catalog->db_driver, jcr->catalog->db_name, 
-                              jcr->catalog->db_user,
-                              jcr->catalog->db_password, jcr->catalog->db_address,
-                              jcr->catalog->db_port, jcr->catalog->db_socket,
-                              jcr->catalog->mult_db_connections, 
-                              jcr->catalog->disable_batch_insert);
+   jcr->db = db_pool_acquire(jcr, jcr->catalog->db_driver, jcr->catalog->db_name,
+                             jcr->catalog->db_user, jcr->catalog->db_address,
+                             jcr->catalog->db_port);
+   if (!jcr->db) {
+      jcr->db = db_init_database(jcr, jcr->catalog->db_driver, jcr->catalog->db_name, 
+                                 jcr->catalog->db_user,
+                                 jcr->catalog->db_password, jcr->catalog->db_address,
+                                 jcr->catalog->db_port, jcr->catalog->db_socket,
+                                 jcr->catalog->mult_db_connections, 
+                                 jcr->catalog->disable_batch_insert);
+   }
    if (!jcr->db || !db_open_database(jcr, jcr->db)) {
       Jmsg(jcr, M_FATAL, 0, _("Could not open database \"%s\".\n"),
                  jcr->catalog->db_name);
@@ -756,6 +761,7 @@ void do_messages(UAContext *ua, const char *cmd)
    int mlen;
    bool do_truncate = false;
 
+   flush_msg_queue();                 /* get the messages still queued */
    Pw(con_lock);
    pthread_cleanup_push(con_lock_release, (void *)NULL);
    rewind(con_fd);
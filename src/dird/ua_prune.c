@@ -255,6 +255,18 @@ bool prune_set_filter(UAContext *ua, CLIENT *client, POOL *pool, utime_t period,
    return true;
 }
 
+/*
+ * Drop the File partitions that no Job uses anymore, their range
+ *  may have been closed since the purge of their last Job.
+ */
+static void prune_file_partitions(UAContext *ua)
+{
+   if (db_get_file_partition_size(ua->db) > 0) {
+      int ndropped = db_prune_file_partitions(ua->jcr, ua->db);
+      Dmsg1(050, "Dropped %d File partitions\n", ndropped);
+   }
+}
+
 /*
  * Prune File records from the database. For any Job which
  * is older than the retention period, we unconditionally delete
@@ -332,8 +344,10 @@ int prune_files(UAContext *ua, CLIENT *client, POOL *pool)
         sql_from.c_str(), sql_where.c_str());
    Dmsg1(050, "select sql=%s\n", query.c_str());
    db_sql_query(ua->db, query.c_str(), file_delete_handler, (void *)&del);
+   exclude_referenced_jobs_from_list(ua, &del);
 
    purge_files_from_job_list(ua, del);
+   prune_file_partitions(ua);
 
    edit_uint64_with_commas(del.num_del, ed1);
    ua->info_msg(_("Pruned Files from %s Jobs for client %s from catalog.\n"),
@@ -578,6 +592,15 @@ int prune_jobs(UAContext *ua, CLIENT *client, POOL *pool, int JobType)
       Dmsg1(60, "jobids to exclude = %s\n", jobids.list);
    }
 
+   /* Jobs referenced by other Jobs through BaseFiles hold their data */
+   Mmsg(query, "DELETE FROM DelCandidates "
+                "WHERE EXISTS (SELECT 1 FROM BaseFiles "
+                               "WHERE BaseFiles.BaseJobId = DelCandidates.JobId)");
+   if (!db_sql_query(ua->db, query.c_str(), NULL, NULL)) {
+      ua->error_msg("%s", db_strerror(ua->db));
+      goto bail_out;
+   }
+
    /* We use DISTINCT because we can have two times the same job */
    Mmsg(query, 
         "SELECT DISTINCT DelCandidates.JobId,DelCandidates.PurgedFiles "
@@ -587,6 +610,7 @@ int prune_jobs(UAContext *ua, CLIENT *client, POOL *pool, int JobType)
    }
 
    purge_job_list_from_catalog(ua, del);
+   prune_file_partitions(ua);
 
    if (del.num_del > 0) {
       ua->info_msg(_("Pruned %d %s for client %s from catalog.\n"), del.num_del,
@@ -683,6 +707,9 @@ int get_prune_list_for_volume(UAContext *ua, MEDIA_DBR *mr, del_ctx *del)
       goto bail_out;
    }
    count = exclude_running_jobs_from_list(del);
+   if (count > 0) {
+      count = exclude_referenced_jobs_from_list(ua, del);
+   }
    
 bail_out:
    return count;
@@ -723,3 +750,117 @@ int exclude_running_jobs_from_list(del_ctx *prune_list)
    }
    return count;
 }
+
+/*
+ * Get in refs the Jobs of a list of JobIds that are referenced by
+ *  other Jobs through the BaseFiles table (Base Jobs and Jobs
+ *  consolidated by a Virtual Full by reference).  The lookup uses
+ *  the BaseJobId index and stops at the first reference of each Job.
+ *
+ * Returns: false on error
+ */
+static bool get_referenced_jobids(UAContext *ua, const char *jobids, db_list_ctx *refs)
+{
+   POOL_MEM query(PM_MESSAGE);
+
+   Mmsg(query, "SELECT JobId FROM Job WHERE JobId IN (%s) "
+                 "AND EXISTS (SELECT 1 FROM BaseFiles "
+                             "WHERE BaseFiles.BaseJobId = Job.JobId)", jobids);
+   if (!db_sql_query(ua->db, query.c_str(), db_list_handler, refs)) {
+      ua->error_msg("%s", db_strerror(ua->db));
+      return false;
+   }
+   return true;
+}
+
+/*
+ * Remove from a list of JobIds given by the user the Jobs that
+ *  are referenced by other Jobs, and tell the user about them.  The
+ *  list is emptied if we cannot check it.
+ *
+ * Returns: the number of JobIds left in the list
+ */
+int exclude_referenced_jobids(UAContext *ua, POOL_MEM &jobids)
+{
+   POOL_MEM kept(PM_MESSAGE);
+   db_list_ctx refs;
+   JobId_t JobId, RefId;
+   char ed1[50], *p, *q;
+   int count = 0;
+
+   if (*jobids.c_str() == 0) {
+      return 0;
+   }
+   if (!get_referenced_jobids(ua, jobids.c_str(), &refs)) {
+      pm_strcpy(jobids, "");
+      return 0;
+   }
+   for (p=jobids.c_str(); get_next_jobid_from_list(&p, &JobId) > 0; ) {
+      RefId = 0;
+      for (q=refs.list; get_next_jobid_from_list(&q, &RefId) > 0; ) {
+         if (RefId == JobId) {
+            break;
+         }
+      }
+      edit_int64(JobId, ed1);
+      if (RefId == JobId) {
+         ua->warning_msg(_("JobId %s is referenced by other Jobs, it is kept.\n"), ed1);
+         continue;
+      }
+      if (count++ > 0) {
+         pm_strcat(kept, ",");
+      }
+      pm_strcat(kept, ed1);
+   }
+   pm_strcpy(jobids, kept.c_str());
+   return count;
+}
+
+/*
+ * We have a list of jobs to prune. The Jobs referenced by other
+ *   Jobs through the BaseFiles table still hold the data of these
+ *   Jobs, so we set their JobId to zero to keep them, and their
+ *   Volumes, as long as they are referenced.
+ *
+ * Returns the number of jobs that can be pruned.
+ */
+int exclude_referenced_jobs_from_list(UAContext *ua, del_ctx *prune_list)
+{
+   db_list_ctx jobids, refs;
+   JobId_t JobId;
+   char ed1[50], *p;
+   int count = 0;
+   int i;
+
+   for (i=0; i < prune_list->num_ids; i++) {
+      if (prune_list->JobId[i] != 0) {
+         jobids.add(edit_int64(prune_list->JobId[i], ed1));
+      }
+   }
+   if (jobids.count == 0) {
+      return 0;
+   }
+   if (!get_referenced_jobids(ua, jobids.list, &refs)) {
+      /* Don't take the risk to prune referenced data */
+      for (i=0; i < prune_list->num_ids; i++) {
+         prune_list->JobId[i] = 0;
+      }
+      return 0;
+   }
+   for (i=0; i < prune_list->num_ids; i++) {
+      if (prune_list->JobId[i] == 0) {
+         continue;
+      }
+      for (p=refs.list; get_next_jobid_from_list(&p, &JobId) > 0; ) {
+         if (JobId == prune_list->JobId[i]) {
+            Dmsg2(050, "skip referenced job JobId[%d]=%d\n", i, (int)JobId);
+            prune_list->JobId[i] = 0;
+            break;
+         }
+      }
+      if (prune_list->JobId[i] != 0) {
+         count++;
+      }
+   }
+   return count;
+}
@@ -39,6 +39,7 @@
 
 #include "bacula.h"
 #include "dird.h"
+#include "cats/bvfs.h"
 
 /* Forward referenced functions */
 static int purge_files_from_client(UAContext *ua, CLIENT *client);
@@ -104,9 +105,12 @@ int purgecmd(UAContext *ua, const char *cmd)
       case 0:                         /* Job */
       case 1:                         /* JobId */
          if (get_job_dbr(ua, &jr)) {
-            char jobid[50];
-            edit_int64(jr.JobId, jobid);
-            purge_files_from_jobs(ua, jobid);
+            POOL_MEM jobid;
+            char ed1[50];
+            pm_strcpy(jobid, edit_int64(jr.JobId, ed1));
+            if (exclude_referenced_jobids(ua, jobid) > 0) {
+               purge_files_from_jobs(ua, jobid.c_str());
+            }
          }
          return 1;
       case 2:                         /* client */
@@ -206,6 +210,7 @@ static int purge_files_from_client(UAContext *ua, CLIENT *client)
    Mmsg(query, select_jobsfiles_from_client, edit_int64(cr.ClientId, ed1));
    Dmsg1(050, "select sql=%s\n", query.c_str());
    db_sql_query(ua->db, query.c_str(), file_delete_handler, (void *)&del);
+   exclude_referenced_jobs_from_list(ua, &del);
 
    purge_files_from_job_list(ua, del);
 
@@ -256,6 +261,7 @@ static int purge_jobs_from_client(UAContext *ua, CLIENT *client)
    Mmsg(query, select_jobs_from_client, edit_int64(cr.ClientId, ed1));
    Dmsg1(150, "select sql=%s\n", query.c_str());
    db_sql_query(ua->db, query.c_str(), job_delete_handler, (void *)&del);
+   exclude_referenced_jobs_from_list(ua, &del);
 
    purge_job_list_from_catalog(ua, del);
 
@@ -279,12 +285,21 @@ static int purge_jobs_from_client(UAContext *ua, CLIENT *client)
 
 /*
  * Remove File records from a list of JobIds
+ *
+ *  When the catalog File table is partitioned by JobId range,
+ *  the records written to File itself before it was partitioned
+ *  are deleted here, the Jobs are marked purged, then the
+ *  partitions of the Jobs are dropped if none of their Jobs has
+ *  File records left, or the records of the Jobs are deleted
+ *  from them.
  */
 void purge_files_from_jobs(UAContext *ua, char *jobs)
 {
    POOL_MEM query(PM_MESSAGE);
+   bool partitioned = db_get_file_partition_size(ua->db) > 0;
 
-   Mmsg(query, "DELETE FROM File WHERE JobId IN (%s)", jobs);
+   Mmsg(query, "DELETE FROM %sFile WHERE JobId IN (%s)",
+        partitioned ? "ONLY " : "", jobs);
    db_sql_query(ua->db, query.c_str(), NULL, (void *)NULL);
    Dmsg1(050, "Delete File sql=%s\n", query.c_str());
 
@@ -301,6 +316,14 @@ void purge_files_from_jobs(UAContext *ua, char *jobs)
    Mmsg(query, "UPDATE Job SET PurgedFiles=1 WHERE JobId IN (%s)", jobs);
    db_sql_query(ua->db, query.c_str(), NULL, (void *)NULL);
    Dmsg1(050, "Mark purged sql=%s\n", query.c_str());
+
+   if (partitioned) {
+      int ndropped = db_purge_file_partitions(ua->jcr, ua->db, jobs);
+      Dmsg1(050, "Dropped %d File partitions\n", ndropped);
+   }
+
+   /* The Bvfs path cache must not show them anymore */
+   bvfs_evict_jobs(ua->db, jobs);
 }
 
 /*
@@ -330,7 +353,9 @@ void purge_job_list_from_catalog(UAContext *ua, del_ctx &del)
          del.num_del++;
       }
       Dmsg1(150, "num_ids=%d\n", del.num_ids);
-      purge_jobs_from_catalog(ua, jobids.c_str());
+      if (*jobids.c_str() != 0) {
+         purge_jobs_from_catalog(ua, jobids.c_str());
+      }
    }
 }
 
@@ -362,7 +387,9 @@ void purge_files_from_job_list(UAContext *ua, del_ctx &del)
          Dmsg1(150, "Add id=%s\n", ed1);
          del.num_del++;
       }
-      purge_files_from_jobs(ua, jobids.c_str());
+      if (*jobids.c_str() != 0) {
+         purge_files_from_jobs(ua, jobids.c_str());
+      }
    }
 }
 
@@ -451,7 +478,7 @@ bool purge_jobs_from_volume(UAContext *ua, MEDIA_DBR *mr, bool force)
 {
    POOL_MEM query(PM_MESSAGE);
    db_list_ctx lst;
-   char *jobids=NULL;
+   POOL_MEM jobids;
    int i;
    bool purged = false;
    bool stat;
@@ -472,7 +499,7 @@ bool purge_jobs_from_volume(UAContext *ua, MEDIA_DBR *mr, bool force)
     */
    i = find_arg_with_value(ua, "jobid");
    if (i >= 0 && is_a_number_list(ua->argv[i])) {
-      jobids = ua->argv[i];
+      pm_strcpy(jobids, ua->argv[i]);
    } else {
       /*
        * Purge ALL JobIds
@@ -482,11 +509,12 @@ bool purge_jobs_from_volume(UAContext *ua, MEDIA_DBR *mr, bool force)
          Dmsg0(050, "Count failed\n");
          goto bail_out;
       }
-      jobids = lst.list;
+      pm_strcpy(jobids, lst.list);
    }
 
-   if (*jobids) {
-      purge_jobs_from_catalog(ua, jobids);
+   /* The Volume stays in use while other Jobs reference its Jobs */
+   if (exclude_referenced_jobids(ua, jobids) > 0) {
+      purge_jobs_from_catalog(ua, jobids.c_str());
    }
 
    ua->info_msg(_("%d File%s on Volume \"%s\" purged from catalog.\n"), 
@@ -1099,6 +1099,134 @@ static void add_delta_list_findex(RESTORE_CTX *rx, struct delta_list *lst)
    add_findex(rx->bsr, lst->JobId, lst->FileIndex);
 }
 
+/*
+ * Building the tree with several catalog connections.
+ *  Each worker asks the catalog for one PathId slice of the file
+ *  list (see db_get_file_list_part()) on its own connection, taken
+ *  from the catalog pool when there is one, and
+ *  inserts the rows into the shared tree under a mutex. All
+ *  versions of a file are in the same slice and come in the
+ *  same order as with a single query, so insert_tree_handler()
+ *  sees exactly what it expects. The time spent in the SQL engine
+ *  and in transferring the rows is what gets split.
+ */
+struct TREE_PART {
+   pthread_t tid;
+   bool started;                      /* set if tid is running */
+   JCR *jcr;
+   B_DB *db;                          /* private or pooled catalog connection */
+   char *jobids;
+   int part;
+   int nb_parts;
+   TREE_CTX *tree;
+   pthread_mutex_t *mutex;            /* protects tree */
+   bool ok;
+   POOLMEM *errmsg;
+};
+
+static int insert_tree_part_handler(void *ctx, int num_fields, char **row)
+{
+   TREE_PART *tp = (TREE_PART *)ctx;
+
+   P(*tp->mutex);
+   insert_tree_handler(tp->tree, num_fields, row);
+   V(*tp->mutex);
+   return 0;
+}
+
+extern "C" void *tree_part_thread(void *arg)
+{
+   TREE_PART *tp = (TREE_PART *)arg;
+
+   tp->ok = db_get_file_list_part(tp->jcr, tp->db, tp->jobids,
+                                  false /* do not use md5 */,
+                                  true /* get delta */,
+                                  tp->part, tp->nb_parts,
+                                  insert_tree_part_handler, (void *)tp);
+   if (!tp->ok) {
+      pm_strcpy(tp->errmsg, db_strerror(tp->db));
+   }
+   return NULL;
+}
+
+/*
+ * Fill the tree using nb_parts catalog connections.
+ *
+ * Returns: false if the connections could not be opened, nothing
+ *            has been inserted into the tree in that case.
+ *          true otherwise, errors are reported to the user.
+ */
+static bool build_tree_parallel(UAContext *ua, RESTORE_CTX *rx, TREE_CTX *tree,
+                                int nb_parts)
+{
+   pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+   CAT *catalog = ua->catalog;
+   TREE_PART *parts;
+   int i, status;
+
+   parts = (TREE_PART *)malloc(nb_parts * sizeof(TREE_PART));
+   memset(parts, 0, nb_parts * sizeof(TREE_PART));
+   for (i = 0; i < nb_parts; i++) {
+      parts[i].db = db_pool_acquire(ua->jcr, catalog->db_driver,
+                       catalog->db_name, catalog->db_user,
+                       catalog->db_address, catalog->db_port);
+      if (!parts[i].db) {
+         parts[i].db = db_init_database(ua->jcr, catalog->db_driver,
+                          catalog->db_name, catalog->db_user,
+                          catalog->db_password, catalog->db_address,
+                          catalog->db_port, catalog->db_socket,
+                          true /* mult_db_connections */,
+                          catalog->disable_batch_insert);
+      }
+      if (!parts[i].db || !db_open_database(ua->jcr, parts[i].db)) {
+         Dmsg2(100, "Cannot open restore tree connection %d: %s\n", i,
+               parts[i].db ? db_strerror(parts[i].db) : "");
+         if (parts[i].db) {
+            db_close_database(ua->jcr, parts[i].db);
+         }
+         while (i-- > 0) {
+            db_close_database(ua->jcr, parts[i].db);
+         }
+         free(parts);
+         return false;
+      }
+   }
+
+   for (i = 0; i < nb_parts; i++) {
+      parts[i].jcr = ua->jcr;
+      parts[i].jobids = rx->JobIds;
+      parts[i].part = i;
+      parts[i].nb_parts = nb_parts;
+      parts[i].tree = tree;
+      parts[i].mutex = &mutex;
+      parts[i].errmsg = get_pool_memory(PM_MESSAGE);
+      *parts[i].errmsg = 0;
+      if ((status = pthread_create(&parts[i].tid, NULL, tree_part_thread,
+                                   (void *)&parts[i])) != 0) {
+         berrno be;
+         Dmsg1(100, "Cannot create restore tree thread: %s\n",
+               be.bstrerror(status));
+         tree_part_thread((void *)&parts[i]);  /* do it ourself */
+      } else {
+         parts[i].started = true;
+      }
+   }
+
+   for (i = 0; i < nb_parts; i++) {
+      if (parts[i].started) {
+         pthread_join(parts[i].tid, NULL);
+      }
+      if (!parts[i].ok) {
+         ua->error_msg("%s", parts[i].errmsg);
+      }
+      free_pool_memory(parts[i].errmsg);
+      db_close_database(ua->jcr, parts[i].db);
+   }
+   pthread_mutex_destroy(&mutex);
+   free(parts);
+   return true;
+}
+
 static bool build_directory_tree(UAContext *ua, RESTORE_CTX *rx)
 {
    TREE_CTX tree;
@@ -1106,6 +1234,7 @@ static bool build_directory_tree(UAContext *ua, RESTORE_CTX *rx)
    char *p;
    bool OK = true;
    char ed1[50];
+   int nb_parts;
 
    memset(&tree, 0, sizeof(TREE_CTX));
    /*
@@ -1139,12 +1268,15 @@ static bool build_directory_tree(UAContext *ua, RESTORE_CTX *rx)
 
 #define new_get_file_list
 #ifdef new_get_file_list
-   if (!db_get_file_list(ua->jcr, ua->db, 
-                         rx->JobIds, false /* do not use md5 */, 
-                         true /* get delta */,
-                         insert_tree_handler, (void *)&tree))
-   {
-      ua->error_msg("%s", db_strerror(ua->db));
+   nb_parts = ua->catalog ? ua->catalog->restore_tree_connections : 1;
+   if (nb_parts <= 1 || !build_tree_parallel(ua, rx, &tree, nb_parts)) {
+      if (!db_get_file_list(ua->jcr, ua->db, 
+                            rx->JobIds, false /* do not use md5 */, 
+                            true /* get delta */,
+                            insert_tree_handler, (void *)&tree))
+      {
+         ua->error_msg("%s", db_strerror(ua->db));
+      }
    }
    if (*rx->BaseJobIds) {
       pm_strcat(rx->JobIds, ",");
@@ -145,6 +145,10 @@ static void *handle_UA_client_request(void *arg)
          } else {
             do_a_command(ua);
          }
+         /* Give the pooled catalog connection back between two commands */
+         if (ua->db && ua->db->get_pool()) {
+            close_db(ua);
+         }
          dequeue_messages(ua->jcr);
          if (!ua->quit) {
             if (console_msg_pending && acl_access_ok(ua, Command_ACL, "messages", 8)) {
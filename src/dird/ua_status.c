@@ -42,8 +42,10 @@ extern void *start_heap;
 static void list_scheduled_jobs(UAContext *ua);
 static void list_running_jobs(UAContext *ua);
 static void list_terminated_jobs(UAContext *ua);
-static void do_storage_status(UAContext *ua, STORE *store, char *cmd);
-static void do_client_status(UAContext *ua, CLIENT *client, char *cmd);
+static void do_storage_status(UAContext *ua, STORE *store, const char *cmd,
+                              const char *dotcmd=".status");
+static void do_client_status(UAContext *ua, CLIENT *client, const char *cmd,
+                             const char *dotcmd=".status");
 static void do_director_status(UAContext *ua);
 static void do_all_status(UAContext *ua);
 void status_slots(UAContext *ua, STORE *store);
@@ -98,6 +100,10 @@ bool dot_status_cmd(UAContext *ua, const char *cmd)
           list_running_jobs(ua);
       } else if (strcasecmp(ua->argk[2], "terminated") == 0) {
           list_terminated_jobs(ua);
+      } else if (strcasecmp(ua->argk[2], "locks") == 0) {
+          POOLMEM *buf = get_pool_memory(PM_MESSAGE);
+          ua->send_msg("%s", lmgr_edit_profile(buf));
+          free_pool_memory(buf);
       } else {
          ua->send_msg("1900 Bad .status command, wrong argument.\n");
          return false;
@@ -121,6 +127,37 @@ bool dot_status_cmd(UAContext *ua, const char *cmd)
    return true;
 }
 
+/*
+ * .stats command
+ *   .stats [json]                  Director statistics
+ *   .stats [json] client=<name>    File daemon statistics
+ *   .stats [json] storage=<name>   Storage daemon statistics
+ */
+bool dot_stats_cmd(UAContext *ua, const char *cmd)
+{
+   STORE *store;
+   CLIENT *client;
+   POOLMEM *buf;
+   bool json = find_arg(ua, NT_("json")) > 0;
+
+   if (find_arg_with_value(ua, NT_("client")) > 0) {
+      client = get_client_resource(ua);
+      if (client) {
+         do_client_status(ua, client, json ? "json" : "text", ".stats");
+      }
+   } else if (find_arg_with_value(ua, NT_("storage")) > 0) {
+      store = get_storage_resource(ua, false /*no default*/);
+      if (store) {
+         do_storage_status(ua, store, json ? "json" : "text", ".stats");
+      }
+   } else {
+      buf = get_pool_memory(PM_MESSAGE);
+      ua->send_msg("%s", bstat_edit(buf, json));
+      free_pool_memory(buf);
+   }
+   return true;
+}
+
 /* This is the *old* command handler, so we must return
  *  1 or it closes the connection
  */
@@ -303,6 +340,8 @@ void list_dir_status_header(UAContext *ua)
             edit_uint64_with_commas(sm_max_bytes, b3),
             edit_uint64_with_commas(sm_buffers, b4),
             edit_uint64_with_commas(sm_max_buffers, b5));
+   list_prune_status(ua);
+   db_pool_list_stats(prtit, ua);
 
    /* TODO: use this function once for all daemons */
    if (debug_level > 0 && bplugin_list->size() > 0) {
@@ -343,7 +382,8 @@ static void do_director_status(UAContext *ua)
    ua->send_msg("====\n");
 }
 
-static void do_storage_status(UAContext *ua, STORE *store, char *cmd)
+static void do_storage_status(UAContext *ua, STORE *store, const char *cmd,
+                              const char *dotcmd)
 {
    BSOCK *sd;
    USTORE lstore;
@@ -366,7 +406,7 @@ static void do_storage_status(UAContext *ua, STORE *store, char *cmd)
    Dmsg0(20, _("Connected to storage daemon\n"));
    sd = ua->jcr->store_bsock;
    if (cmd) {
-      sd->fsend(".status %s", cmd);
+      sd->fsend("%s %s", dotcmd, cmd);
    } else {
       sd->fsend("status");
    }
@@ -379,7 +419,8 @@ static void do_storage_status(UAContext *ua, STORE *store, char *cmd)
    return;
 }
 
-static void do_client_status(UAContext *ua, CLIENT *client, char *cmd)
+static void do_client_status(UAContext *ua, CLIENT *client, const char *cmd,
+                             const char *dotcmd)
 {
    BSOCK *fd;
 
@@ -408,7 +449,7 @@ static void do_client_status(UAContext *ua, CLIENT *client, char *cmd)
    Dmsg0(20, _("Connected to file daemon\n"));
    fd = ua->jcr->file_bsock;
    if (cmd) {
-      fd->fsend(".status %s", cmd);
+      fd->fsend("%s %s", dotcmd, cmd);
    } else {
       fd->fsend("status");
    }
@@ -591,6 +632,25 @@ static void list_scheduled_jobs(UAContext *ua)
    Dmsg0(200, "Leave list_sched_jobs_runs()\n");
 }
 
+/*
+ * Print the run time predicted from the Job history, and
+ *  when the job should end if it is running.
+ */
+static void list_job_prediction(UAContext *ua, JCR *jcr)
+{
+   char dt[MAX_TIME_LENGTH];
+   char ed1[50], ed2[50];
+
+   edit_utime(jcr->PredictedRunTime, ed1, sizeof(ed1));
+   edit_uint64_with_suffix(jcr->PredictedBytes, ed2);
+   if (jcr->acquired_resource_locks) {   /* started */
+      bstrftime_nc(dt, sizeof(dt), jcr->start_time + jcr->PredictedRunTime);
+      ua->send_msg(_("               predicted end %s (%s, %sB)\n"), dt, ed1, ed2);
+   } else {
+      ua->send_msg(_("               predicted run time %s (%sB)\n"), ed1, ed2);
+   }
+}
+
 static void list_running_jobs(UAContext *ua)
 {
    JCR *jcr;
@@ -792,6 +852,10 @@ static void list_running_jobs(UAContext *ua)
          if (*jcr->comment) {
             ua->send_msg(_("               %-30s\n"), jcr->comment);
          }
+         /* and what Longest Jobs First expects */
+         if (jcr->PredictedRunTime > 0) {
+            list_job_prediction(ua, jcr);
+         }
       }
 
       if (pool_mem) {
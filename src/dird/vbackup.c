@@ -50,6 +50,7 @@
 static const int dbglevel = 10;
 
 static bool create_bootstrap_file(JCR *jcr, char *jobids);
+static bool do_vbackup_by_reference(JCR *jcr, char *jobids);
 void vbackup_cleanup(JCR *jcr, int TermCode);
 
 /* 
@@ -182,6 +183,10 @@ _("This Job is not an Accurate backup so is not equivalent to a Full backup.\n")
       return false;
    }
 
+   if (jcr->job->VirtualFullByReference) {
+      return do_vbackup_by_reference(jcr, jobids.list);
+   }
+
    if (!create_bootstrap_file(jcr, jobids.list)) {
       Jmsg(jcr, M_FATAL, 0, _("Could not get or create the FileSet record.\n"));
       return false;
@@ -264,6 +269,51 @@ _("This Job is not an Accurate backup so is not equivalent to a Full backup.\n")
 }
 
 
+/*
+ * Do a virtual backup by reference. Nothing is read or written
+ *  by the Storage daemon, the new Job references the last version
+ *  of each file in the Volumes of the consolidated Jobs through the
+ *  BaseFiles table, exactly like a Job that uses Base Jobs. Restores
+ *  and Accurate backups already follow these references, and the
+ *  referenced Jobs are kept by the pruning code while the new Job
+ *  exists.
+ *
+ *  Returns:  false on failure
+ *            true  on success
+ */
+static bool do_vbackup_by_reference(JCR *jcr, char *jobids)
+{
+   char ed1[50];
+
+   jcr->start_time = time(NULL);
+   jcr->jr.StartTime = jcr->start_time;
+   jcr->jr.JobTDate = jcr->start_time;
+   jcr->setJobStatus(JS_Running);
+
+   /* Update job start record */
+   if (!db_update_job_start_record(jcr, jcr->db, &jcr->jr)) {
+      Jmsg(jcr, M_FATAL, 0, "%s", db_strerror(jcr->db));
+      return false;
+   }
+
+   if (!db_create_base_file_references(jcr, jcr->db, jobids)) {
+      Jmsg(jcr, M_FATAL, 0, _("Could not reference the files of JobIds %s. ERR=%s"),
+           jobids, db_strerror(jcr->db));
+      return false;
+   }
+   Jmsg(jcr, M_INFO, 0, _("Referenced %s files from JobIds %s.\n"),
+        edit_uint64_with_commas(jcr->nb_base_files_used, ed1), jobids);
+
+   jcr->HasBase = true;
+   jcr->SDJobFiles = jcr->nb_base_files_used;
+   jcr->SDJobBytes = 0;
+   jcr->SDJobStatus = JS_Terminated;
+   jcr->setJobStatus(JS_Terminated);
+
+   vbackup_cleanup(jcr, jcr->JobStatus);
+   return true;
+}
+
 /*
  * Release resources allocated during backup.
  */
@@ -313,7 +363,8 @@ void vbackup_cleanup(JCR *jcr, int TermCode)
    }
 
    bstrncpy(mr.VolumeName, jcr->VolumeName, sizeof(mr.VolumeName));
-   if (!db_get_media_record(jcr, jcr->db, &mr)) {
+   /* By reference, no Volume was written */
+   if (!jcr->HasBase && !db_get_media_record(jcr, jcr->db, &mr)) {
       Jmsg(jcr, M_WARNING, 0, _("Error getting Media record for Volume \"%s\": ERR=%s"),
          mr.VolumeName, db_strerror(jcr->db));
       jcr->setJobStatus(JS_ErrorTerminated);
@@ -335,18 +386,14 @@ void vbackup_cleanup(JCR *jcr, int TermCode)
          msg_type = M_ERROR;          /* Generate error message */
          if (jcr->store_bsock) {
             jcr->store_bsock->signal(BNET_TERMINATE);
-            if (jcr->SD_msg_chan) {
-               pthread_cancel(jcr->SD_msg_chan);
-            }
+            cancel_storage_daemon_message_thread(jcr);
          }
          break;
       case JS_Canceled:
          term_msg = _("Backup Canceled");
          if (jcr->store_bsock) {
             jcr->store_bsock->signal(BNET_TERMINATE);
-            if (jcr->SD_msg_chan) {
-               pthread_cancel(jcr->SD_msg_chan);
-            }
+            cancel_storage_daemon_message_thread(jcr);
          }
          break;
       default:
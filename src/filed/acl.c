@@ -101,7 +101,7 @@ static bacl_exit_code send_acl_stream(JCR *jcr, int stream)
    /*
     * Send header
     */
-   if (!sd->fsend("%ld %d 0", jcr->JobFiles, stream)) {
+   if (!send_stream_header(jcr, sd, jcr->JobFiles, stream)) {
       Jmsg1(jcr, M_FATAL, 0, _("Network send error to SD. ERR=%s\n"),
             sd->bstrerror());
       return bacl_exit_fatal;
@@ -301,13 +301,29 @@ static void crypto_session_end(JCR *jcr)
    }
 }
 
+/**
+ * Send the header that starts each stream to the Storage daemon
+ *    <file-index> <stream> <info>
+ *  With the binary protocol the header is only queued, it goes out
+ *  in the same packet as the first data of the stream.
+ */
+bool send_stream_header(JCR *jcr, BSOCK *sd, int32_t file_index, int32_t stream)
+{
+   Dmsg2(300, ">stored: hdr fi=%ld stream=%d\n", file_index, stream);
+   if (jcr->stream_proto >= STREAM_PROTO_BINHDR) {
+      sd->set_stream_header(file_index, stream);
+      return true;
+   }
+   return sd->fsend("%ld %d 0", file_index, stream);
+}
+
 static bool crypto_session_send(JCR *jcr, BSOCK *sd)
 {
    POOLMEM *msgsave;
 
    /** Send our header */
    Dmsg2(100, "Send hdr fi=%ld stream=%d\n", jcr->JobFiles, STREAM_ENCRYPTED_SESSION_DATA);
-   sd->fsend("%ld %d 0", jcr->JobFiles, STREAM_ENCRYPTED_SESSION_DATA);
+   send_stream_header(jcr, sd, jcr->JobFiles, STREAM_ENCRYPTED_SESSION_DATA);
 
    msgsave = sd->msg;
    sd->msg = jcr->crypto.pki_session_encoded;
@@ -618,7 +634,10 @@ int save_file(JCR *jcr, FF_PKT *ff_pkt, bool top_level)
       int noatime = ff_pkt->flags & FO_NOATIME ? O_NOATIME : 0;
       ff_pkt->bfd.reparse_point = (ff_pkt->type == FT_REPARSE || 
                                    ff_pkt->type == FT_JUNCTION);
-      if (bopen(&ff_pkt->bfd, ff_pkt->fname, O_RDONLY | O_BINARY | noatime, 0) < 0) {
+      btime_t open_start = get_current_btime();
+      int bstat = bopen(&ff_pkt->bfd, ff_pkt->fname, O_RDONLY | O_BINARY | noatime, 0);
+      jcr->add_stage(JOB_STAGE_OPEN, open_start, 0);
+      if (bstat < 0) {
          ff_pkt->ff_errno = errno;
          berrno be;
          Jmsg(jcr, M_NOTSAVED, 0, _("     Cannot open \"%s\": ERR=%s.\n"), ff_pkt->fname,
@@ -682,8 +701,7 @@ int save_file(JCR *jcr, FF_PKT *ff_pkt, bool top_level)
          }
 
          Dmsg1(300, "Saving Finder Info for \"%s\"\n", ff_pkt->fname);
-         sd->fsend("%ld %d 0", jcr->JobFiles, STREAM_HFSPLUS_ATTRIBUTES);
-         Dmsg1(300, "bfiled>stored:header %s\n", sd->msg);
+         send_stream_header(jcr, sd, jcr->JobFiles, STREAM_HFSPLUS_ATTRIBUTES);
          pm_memcpy(sd->msg, ff_pkt->hfsinfo.fndrinfo, 32);
          sd->msglen = 32;
          if (digest) {
@@ -775,8 +793,7 @@ int save_file(JCR *jcr, FF_PKT *ff_pkt, bool top_level)
       }
 
       /** Send our header */
-      sd->fsend("%ld %ld 0", jcr->JobFiles, STREAM_SIGNED_DIGEST);
-      Dmsg1(300, "bfiled>stored:header %s\n", sd->msg);
+      send_stream_header(jcr, sd, jcr->JobFiles, STREAM_SIGNED_DIGEST);
 
       /** Encode signature data */
       if (!crypto_sign_encode(sig, (uint8_t *)sd->msg, &size)) {
@@ -793,8 +810,7 @@ int save_file(JCR *jcr, FF_PKT *ff_pkt, bool top_level)
    if (digest) {
       uint32_t size;
 
-      sd->fsend("%ld %d 0", jcr->JobFiles, digest_stream);
-      Dmsg1(300, "bfiled>stored:header %s\n", sd->msg);
+      send_stream_header(jcr, sd, jcr->JobFiles, digest_stream);
 
       size = CRYPTO_DIGEST_MAX_SIZE;
 
@@ -821,7 +837,7 @@ int save_file(JCR *jcr, FF_PKT *ff_pkt, bool top_level)
    /* Check if original file has a digest, and send it */
    if (ff_pkt->type == FT_LNKSAVED && ff_pkt->digest) {
       Dmsg2(300, "Link %s digest %d\n", ff_pkt->fname, ff_pkt->digest_len);
-      sd->fsend("%ld %d 0", jcr->JobFiles, ff_pkt->digest_stream);
+      send_stream_header(jcr, sd, jcr->JobFiles, ff_pkt->digest_stream);
 
       sd->msg = check_pool_memory_size(sd->msg, ff_pkt->digest_len);
       memcpy(sd->msg, ff_pkt->digest, ff_pkt->digest_len);
@@ -835,6 +851,8 @@ good_rtn:
    rtnstat = jcr->is_canceled() ? 0 : 1; /* good return if not canceled */
 
 bail_out:
+   /* A header queued for a stream that was not sent must not go out */
+   sd->clear_stream_header();
    if (jcr->is_incomplete() || jcr->is_canceled()) {
       rtnstat = 0;
    }
@@ -870,6 +888,17 @@ bail_out:
  * Currently this is not a problem as the only other stream, resource forks,
  * are not handled as sparse files.
  */
+/*
+ * bread() accounted in the job read stage
+ */
+static ssize_t timed_bread(JCR *jcr, BFILE *bfd, void *buf, size_t count)
+{
+   btime_t start = get_current_btime();
+   ssize_t stat = bread(bfd, buf, count);
+   jcr->add_stage(JOB_STAGE_READ, start, stat > 0 ? stat : 0);
+   return stat;
+}
+
 static int send_data(JCR *jcr, int stream, FF_PKT *ff_pkt, DIGEST *digest, 
                      DIGEST *signing_digest)
 {
@@ -883,6 +912,7 @@ static int send_data(JCR *jcr, int stream, FF_PKT *ff_pkt, DIGEST *digest,
    uint32_t cipher_input_len;
    uint32_t cipher_block_size;
    uint32_t encrypted_len;
+   btime_t stage_start;
 #ifdef FD_NO_SEND_TEST
    return 1;
 #endif
@@ -988,14 +1018,13 @@ static int send_data(JCR *jcr, int stream, FF_PKT *ff_pkt, DIGEST *digest,
     * Send Data header to Storage daemon
     *    <file-index> <stream> <info>
     */
-   if (!sd->fsend("%ld %d 0", jcr->JobFiles, stream)) {
+   if (!send_stream_header(jcr, sd, jcr->JobFiles, stream)) {
       if (!jcr->is_job_canceled()) {
          Jmsg1(jcr, M_FATAL, 0, _("Network send error to SD. ERR=%s\n"),
                sd->bstrerror());
       }
       goto err;
    }
-   Dmsg1(300, ">stored: datahdr %s\n", sd->msg);
 
    /**
     * Make space at beginning of buffer for fileAddr because this
@@ -1022,7 +1051,7 @@ static int send_data(JCR *jcr, int stream, FF_PKT *ff_pkt, DIGEST *digest,
    /**
     * Read the file data
     */
-   while ((sd->msglen=(uint32_t)bread(&ff_pkt->bfd, rbuf, rsize)) > 0) {
+   while ((sd->msglen=(uint32_t)timed_bread(jcr, &ff_pkt->bfd, rbuf, rsize)) > 0) {
 
       /** Check for sparse blocks */
       if (ff_pkt->flags & FO_SPARSE) {
@@ -1075,6 +1104,7 @@ static int send_data(JCR *jcr, int stream, FF_PKT *ff_pkt, DIGEST *digest,
          ((z_stream*)jcr->pZLIB_compress_workset)->next_out  = (Bytef *)cbuf;
                 ((z_stream*)jcr->pZLIB_compress_workset)->avail_out = max_compress_len;
 
+         stage_start = get_current_btime();
          if ((zstat=deflate((z_stream*)jcr->pZLIB_compress_workset, Z_FINISH)) != Z_STREAM_END) {
             Jmsg(jcr, M_FATAL, 0, _("Compression deflate error: %d\n"), zstat);
             jcr->setJobStatus(JS_ErrorTerminated);
@@ -1088,6 +1118,7 @@ static int send_data(JCR *jcr, int stream, FF_PKT *ff_pkt, DIGEST *digest,
             goto err;
          }
 
+         jcr->add_stage(JOB_STAGE_COMPRESS, stage_start, sd->msglen);
          Dmsg2(400, "GZIP compressed len=%d uncompressed len=%d\n", compress_len, 
                sd->msglen);
 
@@ -1103,6 +1134,7 @@ static int send_data(JCR *jcr, int stream, FF_PKT *ff_pkt, DIGEST *digest,
 
          Dmsg3(400, "cbuf=0x%x rbuf=0x%x len=%u\n", cbuf, rbuf, sd->msglen);
 
+         stage_start = get_current_btime();
          lzores = lzo1x_1_compress((const unsigned char*)rbuf, sd->msglen, cbuf2, &compress_len, jcr->LZO_compress_workset);
          if (lzores == LZO_E_OK && compress_len <= max_compress_len)
          {
@@ -1118,6 +1150,7 @@ static int send_data(JCR *jcr, int stream, FF_PKT *ff_pkt, DIGEST *digest,
             goto err;
          }
 
+         jcr->add_stage(JOB_STAGE_COMPRESS, stage_start, sd->msglen);
          Dmsg2(400, "LZO compressed len=%d uncompressed len=%d\n", compress_len, 
                sd->msglen);
 
@@ -1155,6 +1188,7 @@ static int send_data(JCR *jcr, int stream, FF_PKT *ff_pkt, DIGEST *digest,
          ser_uint32(cipher_input_len);    /* store data len in begin of buffer */
          Dmsg1(20, "Encrypt len=%d\n", cipher_input_len);
 
+         stage_start = get_current_btime();
          if (!crypto_cipher_update(cipher_ctx, packet_len, sizeof(packet_len),
              (uint8_t *)jcr->crypto.crypto_buf, &initial_len)) {
             /** Encryption failed. Shouldn't happen. */
@@ -1165,6 +1199,7 @@ static int send_data(JCR *jcr, int stream, FF_PKT *ff_pkt, DIGEST *digest,
          /** Encrypt the input block */
          if (crypto_cipher_update(cipher_ctx, cipher_input, cipher_input_len, 
              (uint8_t *)&jcr->crypto.crypto_buf[initial_len], &encrypted_len)) {
+            jcr->add_stage(JOB_STAGE_ENCRYPT, stage_start, cipher_input_len);
             if ((initial_len + encrypted_len) == 0) {
                /** No full block of data available, read more data */
                continue;
@@ -1256,6 +1291,7 @@ err:
 
    sd->msg = msgsave; /* restore bnet buffer */
    sd->msglen = 0;
+   sd->clear_stream_header();
    return 0;
 }
 
@@ -1280,7 +1316,11 @@ bool encode_and_send_attributes(JCR *jcr, FF_PKT *ff_pkt, int &data_stream)
       Jmsg0(jcr, M_FATAL, 0, _("Invalid file flags, no supported data stream type.\n"));
       return false;
    }
-   encode_stat(attribs, &ff_pkt->statp, sizeof(ff_pkt->statp), ff_pkt->LinkFI, data_stream);
+   if (ff_pkt->flags & FO_COMPACT_STAT) {
+      encode_stat_compact(attribs, &ff_pkt->statp, sizeof(ff_pkt->statp), ff_pkt->LinkFI, data_stream);
+   } else {
+      encode_stat(attribs, &ff_pkt->statp, sizeof(ff_pkt->statp), ff_pkt->LinkFI, data_stream);
+   }
 
    /** Now possibly extend the attributes */
    if (IS_FT_OBJECT(ff_pkt->type)) {
@@ -1310,14 +1350,13 @@ bool encode_and_send_attributes(JCR *jcr, FF_PKT *ff_pkt, int &data_stream)
     * Send Attributes header to Storage daemon
     *    <file-index> <stream> <info>
     */
-   if (!sd->fsend("%ld %d 0", jcr->JobFiles, attr_stream)) {
+   if (!send_stream_header(jcr, sd, jcr->JobFiles, attr_stream)) {
       if (!jcr->is_canceled() && !jcr->is_incomplete()) {
          Jmsg1(jcr, M_FATAL, 0, _("Network send error to SD. ERR=%s\n"),
                sd->bstrerror());
       }
       return false;
    }
-   Dmsg1(300, ">stored: attrhdr %s\n", sd->msg);
 
    /**
     * Send file attributes to Storage daemon
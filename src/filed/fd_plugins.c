@@ -693,12 +693,11 @@ bool send_plugin_name(JCR *jcr, BSOCK *sd, bool start)
    }
    Dmsg1(dbglvl, "send_plugin_name=%s\n", sp->cmd);
    /* Send stream header */
-   if (!sd->fsend("%ld %d 0", index, STREAM_PLUGIN_NAME)) {
+   if (!send_stream_header(jcr, sd, index, STREAM_PLUGIN_NAME)) {
      Jmsg1(jcr, M_FATAL, 0, _("Network send error to SD. ERR=%s\n"),
            sd->bstrerror());
      return false;
    }
-   Dmsg1(50, "send plugin name hdr: %s\n", sd->msg);
 
    if (start) {
       /* Send data -- not much */
@@ -267,6 +267,8 @@ int main (int argc, char *argv[])
    if (!no_signals) {
       start_watchdog();               /* start watchdog thread */
       init_jcr_subsystem();           /* start JCR watchdogs etc. */
+      start_bstat_thread(me->stats_file, me->stats_interval);
+      start_msg_delivery_thread();    /* deliver messages in the background */
    }
    server_tid = pthread_self();
 
@@ -292,6 +294,7 @@ void terminate_filed(int sig)
    already_here = true;
    debug_level = 0;                   /* turn off debug */
    stop_watchdog();
+   stop_bstat_thread();
 
    bnet_stop_thread_server(server_tid);
    generate_daemon_event(NULL, "Exit");
@@ -103,6 +103,10 @@ static RES_ITEM cli_items[] = {
    {"sdconnecttimeout", store_time,ITEM(res_client.SDConnectTimeout), 0, ITEM_DEFAULT, 60 * 30},
    {"heartbeatinterval", store_time, ITEM(res_client.heartbeat_interval), 0, ITEM_DEFAULT, 0},
    {"maximumnetworkbuffersize", store_pint32, ITEM(res_client.max_network_buffer_size), 0, 0, 0},
+   {"maximumrestorethreads", store_pint32, ITEM(res_client.MaxRestoreThreads), 0, ITEM_DEFAULT, 1},
+   {"deferrestoreattributes", store_bool, ITEM(res_client.DeferRestoreAttributes), 0, ITEM_DEFAULT, 0},
+   {"statisticsfile",    store_dir,  ITEM(res_client.stats_file), 0, 0, 0},
+   {"statisticsinterval", store_time, ITEM(res_client.stats_interval), 0, ITEM_DEFAULT, 5 * 60},
 #ifdef DATA_ENCRYPTION
    {"pkisignatures",         store_bool,    ITEM(res_client.pki_sign), 0, ITEM_DEFAULT, 0},
    {"pkiencryption",         store_bool,    ITEM(res_client.pki_encrypt), 0, ITEM_DEFAULT, 0},
@@ -262,6 +266,9 @@ void free_resource(RES *sres, int type)
       if (res->res_client.scripts_directory) {
          free(res->res_client.scripts_directory);
       }
+      if (res->res_client.stats_file) {
+         free(res->res_client.stats_file);
+      }
       if (res->res_client.plugin_directory) {
          free(res->res_client.plugin_directory);
       }
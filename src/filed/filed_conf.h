@@ -86,6 +86,10 @@ struct CLIENT {
    utime_t SDConnectTimeout;          /* timeout in seconds */
    utime_t heartbeat_interval;        /* Interval to send heartbeats */
    uint32_t max_network_buffer_size;  /* max network buf size */
+   uint32_t MaxRestoreThreads;        /* files restored in parallel */
+   bool DeferRestoreAttributes;       /* set file attributes at end of restore */
+   char *stats_file;                  /* Daemon statistics file */
+   utime_t stats_interval;            /* Interval to append to stats_file */
    bool pki_sign;                     /* Enable Data Integrity Verification via Digital Signatures */
    bool pki_encrypt;                  /* Enable Data Encryption */
    char *pki_keypair_file;            /* PKI Key Pair File */
@@ -30,6 +30,9 @@
  *    Listens for heartbeats coming from the SD
  *    If configured, sends heartbeats to Dir
  *
+ *  The heartbeats are watchdog timers, so they all run from
+ *    the watchdog thread instead of one thread per job.
+ *
  *    Kern Sibbald, May MMIII
  *
  *   Version $Id$
@@ -41,161 +44,148 @@
 
 #define WAIT_INTERVAL 5
 
-extern "C" void *sd_heartbeat_thread(void *arg);
-extern "C" void *dir_heartbeat_thread(void *arg);
-extern bool no_signals;
+/*
+ * True if a signal can be written without blocking, the
+ *  watchdog thread must never wait on a slow Director.
+ */
+static bool can_send(BSOCK *bs)
+{
+   fd_set fdset;
+   struct timeval tv;
+
+   FD_ZERO(&fdset);
+   FD_SET((unsigned)bs->m_fd, &fdset);
+   tv.tv_sec = 0;
+   tv.tv_usec = 0;
+   return select(bs->m_fd + 1, NULL, &fdset, NULL, &tv) > 0;
+}
 
 /*
- * Listen on the SD socket for heartbeat signals.
- * Send heartbeats to the Director every HB_TIME
- *   seconds.
+ * True if a whole message from the SD waits on the socket, so
+ *  that recv() returns at once. The SD only sends heartbeat
+ *  signals there, but a data message must be complete too. The
+ *  TLS records cannot be looked at, nothing is read with TLS.
  */
-extern "C" void *sd_heartbeat_thread(void *arg)
+static bool msg_ready(BSOCK *bs)
 {
-   int32_t n;
-   JCR *jcr = (JCR *)arg;
-   BSOCK *sd, *dir;
-   time_t last_heartbeat = time(NULL);
-   time_t now;
+#if defined(MSG_DONTWAIT) && defined(FIONREAD)
+   int32_t pktsiz;
+   int avail;
 
-   pthread_detach(pthread_self());
+   if (bs->tls) {
+      return false;
+   }
+   if (recv(bs->m_fd, (char *)&pktsiz, sizeof(pktsiz), MSG_PEEK|MSG_DONTWAIT) !=
+       (ssize_t)sizeof(pktsiz)) {
+      return false;
+   }
+   pktsiz = ntohl(pktsiz);
+   if (pktsiz <= 0) {
+      return true;                    /* a signal, the header is all */
+   }
+   if (ioctl(bs->m_fd, FIONREAD, &avail) < 0) {
+      return false;
+   }
+   return avail >= (int)sizeof(pktsiz) + pktsiz;
+#else
+   return false;
+#endif
+}
 
-   /* Get our own local copy */
-   sd = dup_bsock(jcr->store_bsock);
-   dir = dup_bsock(jcr->dir_bsock);
+/*
+ * Called by the watchdog every heartbeat interval (or every
+ *  WAIT_INTERVAL if there is no heartbeat to send). Read the
+ *  heartbeats that the SD sent on our socket, and send one to
+ *  the Director. Nothing here may block the watchdog thread.
+ */
+static void heartbeat_callback(watchdog_t *self)
+{
+   JCR *jcr = (JCR *)self->data;
+   BSOCK *sd = jcr->hb_bsock;
+   BSOCK *dir = jcr->hb_dir_bsock;
 
-   jcr->hb_bsock = sd;
-   jcr->hb_started = true;
-   jcr->hb_dir_bsock = dir;
-
-   /* Hang reading the socket to the SD, and every time we get
-    *   a heartbeat or we get a wait timeout (1 minute), we
-    *   check to see if we need to send a heartbeat to the
-    *   Director.
-    */
-   for ( ; !is_bnet_stop(sd); ) {
-      n = bnet_wait_data_intr(sd, WAIT_INTERVAL);
-      if (me->heartbeat_interval) {
-         now = time(NULL);
-         if (now-last_heartbeat >= me->heartbeat_interval) {
-            bnet_sig(dir, BNET_HEARTBEAT);
-            last_heartbeat = now;
-         }
-      }
-      if (n < 0 || is_bnet_stop(sd)) {
-         break;
-      }
-      if (n == 1) {                   /* input waiting */
+   if (sd && !is_bnet_stop(sd)) {
+      /* Only the messages already there, at most a few */
+      for (int i=0; i < 10 && msg_ready(sd); i++) {
          sd->recv();                  /* read it -- probably heartbeat from sd */
          if (sd->msglen <= 0) {
             Dmsg1(100, "Got BNET_SIG %d from SD\n", sd->msglen);
          } else {
             Dmsg2(100, "Got %d bytes from SD. MSG=%s\n", sd->msglen, sd->msg);
          }
+         if (is_bnet_stop(sd)) {
+            break;
+         }
+      }
+   }
+   if (dir && me->heartbeat_interval && !is_bnet_stop(dir)) {
+      if (can_send(dir)) {
+         dir->signal(BNET_HEARTBEAT);
+      } else {
+         Dmsg0(100, "Director socket is full, heartbeat skipped\n");
       }
-      Dmsg2(100, "wait_intr=%d stop=%d\n", n, is_bnet_stop(sd));
    }
-   sd->close();
-   dir->close();
-   jcr->hb_bsock = NULL;
-   jcr->hb_started = false;
-   jcr->hb_dir_bsock = NULL;
-   return NULL;
 }
 
-/* Startup the heartbeat thread -- see above */
+/* Register the heartbeat timer of the job -- see above */
+static void start_heartbeat(JCR *jcr, BSOCK *sd, BSOCK *dir)
+{
+   watchdog_t *wd = new_watchdog();
+
+   /* Get our own local copy */
+   jcr->hb_bsock = sd ? dup_bsock(sd) : NULL;
+   jcr->hb_dir_bsock = dup_bsock(dir);
+
+   wd->one_shot = false;
+   wd->interval = me->heartbeat_interval ? me->heartbeat_interval : WAIT_INTERVAL;
+   wd->callback = heartbeat_callback;
+   wd->data = jcr;
+   jcr->hb_wd = wd;
+   jcr->hb_started = true;
+   register_watchdog(wd);
+}
+
+/* Startup the heartbeat timer -- see above */
 void start_heartbeat_monitor(JCR *jcr)
 {
-   /*
-    * If no signals are set, do not start the heartbeat because
-    * it gives a constant stream of TIMEOUT_SIGNAL signals that
-    * make debugging impossible.
-    */
-   if (!no_signals) {
-      jcr->hb_bsock = NULL;
-      jcr->hb_started = false;
-      jcr->hb_dir_bsock = NULL;
-      pthread_create(&jcr->heartbeat_id, NULL, sd_heartbeat_thread, (void *)jcr);
-   }
+   start_heartbeat(jcr, jcr->store_bsock, jcr->dir_bsock);
 }
 
-/* Terminate the heartbeat thread. Used for both SD and DIR */
+/*
+ * Terminate the heartbeat timer. Used for both SD and DIR.
+ *  Once unregister_watchdog() returns, the callback is not
+ *  running and will not run again.
+ */
 void stop_heartbeat_monitor(JCR *jcr)
 {
-   int cnt = 0;
-   if (no_signals) {
+   if (!jcr->hb_started) {
       return;
    }
-   /* Wait max 10 secs for heartbeat thread to start */
-   while (!jcr->hb_started && cnt++ < 200) {
-      bmicrosleep(0, 50000);         /* wait for start */
-   }
-
-   if (jcr->hb_started) {
-      jcr->hb_bsock->set_timed_out();       /* set timed_out to terminate read */
-      jcr->hb_bsock->set_terminated();      /* set to terminate read */
+   Dmsg0(100, "Stop heartbeat timer\n");
+   unregister_watchdog(jcr->hb_wd);
+   free(jcr->hb_wd);
+   jcr->hb_wd = NULL;
+   if (jcr->hb_bsock) {
+      jcr->hb_bsock->close();
+      jcr->hb_bsock = NULL;
    }
    if (jcr->hb_dir_bsock) {
-      jcr->hb_dir_bsock->set_timed_out();     /* set timed_out to terminate read */
-      jcr->hb_dir_bsock->set_terminated();    /* set to terminate read */
-   }
-   if (jcr->hb_started) {
-      Dmsg0(100, "Send kill to heartbeat id\n");
-      pthread_kill(jcr->heartbeat_id, TIMEOUT_SIGNAL);  /* make heartbeat thread go away */
-      bmicrosleep(0, 50000);
-   }
-   cnt = 0;
-   /* Wait max 100 secs for heartbeat thread to stop */
-   while (jcr->hb_started && cnt++ < 200) {
-      pthread_kill(jcr->heartbeat_id, TIMEOUT_SIGNAL);  /* make heartbeat thread go away */
-      bmicrosleep(0, 500000);
-   }
-}
-
-/*
- * Thread for sending heartbeats to the Director when there
- *   is no SD monitoring needed -- e.g. restore and verify Vol
- *   both do their own read() on the SD socket.
- */
-extern "C" void *dir_heartbeat_thread(void *arg)
-{
-   JCR *jcr = (JCR *)arg;
-   BSOCK *dir;
-   time_t last_heartbeat = time(NULL);
-
-   pthread_detach(pthread_self());
-
-   /* Get our own local copy */
-   dir = dup_bsock(jcr->dir_bsock);
-
-   jcr->hb_bsock = dir;
-   jcr->hb_started = true;
-
-   for ( ; !is_bnet_stop(dir); ) {
-      time_t now, next;
-
-      now = time(NULL);
-      next = now - last_heartbeat;
-      if (next >= me->heartbeat_interval) {
-         dir->signal(BNET_HEARTBEAT);
-         last_heartbeat = now;
-      }
-      bmicrosleep(next, 0);
+      jcr->hb_dir_bsock->close();
+      jcr->hb_dir_bsock = NULL;
    }
-   dir->close();
-   jcr->hb_bsock = NULL;
    jcr->hb_started = false;
-   return NULL;
 }
 
 /*
- * Same as above but we don't listen to the SD
+ * Heartbeats to the Director when there is no SD monitoring
+ *   needed -- e.g. restore and verify Vol both do their own
+ *   read() on the SD socket.
  */
 void start_dir_heartbeat(JCR *jcr)
 {
    if (me->heartbeat_interval) {
       jcr->dir_bsock->set_locking();
-      pthread_create(&jcr->heartbeat_id, NULL, dir_heartbeat_thread, (void *)jcr);
+      start_heartbeat(jcr, NULL, jcr->dir_bsock);
    }
 }
 
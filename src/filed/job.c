@@ -64,6 +64,7 @@ extern CLIENT *me;                    /* our client resource */
 /* Imported functions */
 extern int status_cmd(JCR *jcr);
 extern int qstatus_cmd(JCR *jcr);
+extern int stats_cmd(JCR *jcr);
 extern int accurate_cmd(JCR *jcr);
 
 /* Forward referenced functions */
@@ -122,6 +123,7 @@ static struct s_cmds cmds[] = {
    {"session",      session_cmd,   0},
    {"status",       status_cmd,    1},
    {".status",      qstatus_cmd,   1},
+   {".stats",       stats_cmd,     1},
    {"storage ",     storage_cmd,   0},
    {"verify",       verify_cmd,    0},
    {"bootstrap",    bootstrap_cmd, 0},
@@ -186,13 +188,14 @@ static char OKRestoreObject[] = "2000 OK ObjectRestored\n";
 static char OK_end[]       = "3000 OK end\n";
 static char OK_close[]     = "3000 OK close Status = %d\n";
 static char OK_open[]      = "3000 OK open ticket = %d\n";
+static char OK_open_proto[] = "3000 OK open ticket = %d proto=%d\n";
 static char OK_data[]      = "3000 OK data\n";
 static char OK_append[]    = "3000 OK append data\n";
 static char OKSDbootstrap[]= "3000 OK bootstrap\n";
 
 
 /* Commands sent to Storage Daemon */
-static char append_open[]  = "append open session\n";
+static char append_open[]  = "append open session proto=%d\n";
 static char append_data[]  = "append data %d\n";
 static char append_end[]   = "append end session %d\n";
 static char append_close[] = "append close session %d\n";
@@ -1452,6 +1455,9 @@ static int set_options(findFOPTS *fo, const char *opts)
       case 'X':
          fo->flags |= FO_XATTR;
          break;
+      case 'L':                 /* compact stat packets */
+         fo->flags |= FO_COMPACT_STAT;
+         break;
       default:
          Emsg1(M_ERROR, 0, _("Unknown include/exclude option: %c\n"), *p);
          break;
@@ -1809,6 +1815,7 @@ static int backup_cmd(JCR *jcr)
    BSOCK *dir = jcr->dir_bsock;
    BSOCK *sd = jcr->store_bsock;
    int ok = 0;
+   bool blasted;
    int SDJobStatus;
    int32_t FileIndex;
 
@@ -1857,18 +1864,24 @@ static int backup_cmd(JCR *jcr)
    /**
     * Send Append Open Session to Storage daemon
     */
-   sd->fsend(append_open);
+   sd->fsend(append_open, STREAM_PROTO_MAX);
    Dmsg1(110, ">stored: %s", sd->msg);
    /**
-    * Expect to receive back the Ticket number
+    * Expect to receive back the Ticket number, and from newer
+    *  Storage daemons the stream protocol level to use.
     */
+   jcr->stream_proto = STREAM_PROTO_TEXT;
    if (bget_msg(sd) >= 0) {
       Dmsg1(110, "<stored: %s", sd->msg);
-      if (sscanf(sd->msg, OK_open, &jcr->Ticket) != 1) {
-         Jmsg(jcr, M_FATAL, 0, _("Bad response to append open: %s\n"), sd->msg);
-         goto cleanup;
+      if (sscanf(sd->msg, OK_open_proto, &jcr->Ticket, &jcr->stream_proto) != 2) {
+         jcr->stream_proto = STREAM_PROTO_TEXT;
+         if (sscanf(sd->msg, OK_open, &jcr->Ticket) != 1) {
+            Jmsg(jcr, M_FATAL, 0, _("Bad response to append open: %s\n"), sd->msg);
+            goto cleanup;
+         }
       }
-      Dmsg1(110, "Got Ticket=%d\n", jcr->Ticket);
+      jcr->stream_proto = MIN(jcr->stream_proto, STREAM_PROTO_MAX);
+      Dmsg2(110, "Got Ticket=%d proto=%d\n", jcr->Ticket, jcr->stream_proto);
    } else {
       Jmsg(jcr, M_FATAL, 0, _("Bad response from stored to open command\n"));
       goto cleanup;
@@ -1933,7 +1946,9 @@ static int backup_cmd(JCR *jcr)
     * Send Files to Storage daemon
     */
    Dmsg1(110, "begin blast ff=%p\n", (FF_PKT *)jcr->ff);
-   if (!blast_data_to_storage_daemon(jcr, NULL)) {
+   blasted = blast_data_to_storage_daemon(jcr, NULL);
+   report_job_stages(jcr);
+   if (!blasted) {
       jcr->setJobStatus(JS_ErrorTerminated);
       bnet_suppress_error_messages(sd, 1);
       Dmsg0(110, "Error in blast_data.\n");
@@ -59,6 +59,7 @@ void accurate_free(JCR *jcr);
 
 /* from backup.c */
 bool encode_and_send_attributes(JCR *jcr, FF_PKT *ff_pkt, int &data_stream);
+bool send_stream_header(JCR *jcr, BSOCK *sd, int32_t file_index, int32_t stream);
 void strip_path(FF_PKT *ff_pkt);
 void unstrip_path(FF_PKT *ff_pkt);
 
@@ -94,17 +94,52 @@ static void free_signature(r_ctx &rctx);
 static void free_session(r_ctx &rctx);
 static bool close_previous_stream(JCR *jcr, r_ctx &rctx);
 static bool verify_signature(JCR *jcr, r_ctx &rctx);
-int32_t extract_data(JCR *jcr, BFILE *bfd, POOLMEM *buf, int32_t buflen,
+static int32_t extract_data(r_ctx &rctx, BFILE *bfd, char *buf, int32_t buflen,
                      uint64_t *addr, int flags, int32_t stream, RESTORE_CIPHER_CTX *cipher_ctx);
-bool flush_cipher(JCR *jcr, BFILE *bfd, uint64_t *addr, int flags, int32_t stream,
+static bool flush_cipher(r_ctx &rctx, BFILE *bfd, uint64_t *addr, int flags, int32_t stream,
                   RESTORE_CIPHER_CTX *cipher_ctx);
+static void stop_restore_writer(r_ctx &rctx, bool started);
+static bool wait_restore_writer(RESTORE_WRITER *wr);
+static void sync_restore_writer(r_ctx &rctx);
+
+/*
+ * Maximum number of records queued for one restore worker
+ */
+#define RESTORE_QUEUE_MAX 64
+
+/*
+ * Destination of the records of the current file
+ *  when restoring with workers (otherwise worker index)
+ */
+#define DEST_INLINE   -1               /* handled by the reading thread */
+#define DEST_DEFERRED -2               /* directory, applied at the end */
+
+/*
+ * Size and alignment of the coalesced writes of the file data
+ */
+#define RESTORE_WRITE_SIZE (1024 * 1024)
+
+/*
+ * Several restore workers may update the job counters
+ *  at the same time.
+ */
+static inline void update_restore_counters(JCR *jcr, int32_t files, 
+                                           uint64_t read_bytes, uint64_t job_bytes)
+{
+   jcr->lock();
+   jcr->JobFiles += files;
+   jcr->ReadBytes += read_bytes;
+   jcr->JobBytes += job_bytes;
+   jcr->unlock();
+}
 
 /*
  * Close a bfd check that we are at the expected file offset.
  * Makes use of some code from set_attributes().
  */
-static int bclose_chksize(JCR *jcr, BFILE *bfd, boffset_t osize)
+static int bclose_chksize(r_ctx &rctx, BFILE *bfd, boffset_t osize)
 {
+   JCR *jcr = rctx.jcr;
    char ec1[50], ec2[50];
    boffset_t fsize;
 
@@ -112,7 +147,7 @@ static int bclose_chksize(JCR *jcr, BFILE *bfd, boffset_t osize)
    bclose(bfd);
    if (fsize > 0 && fsize != osize) {
       Qmsg3(jcr, M_WARNING, 0, _("Size of data or stream of %s not correct. Original %s, restored %s.\n"),
-            jcr->last_fname, edit_uint64(osize, ec1),
+            rctx.attr->ofname, edit_uint64(osize, ec1),
             edit_uint64(fsize, ec2));
       return -1;
    }
@@ -120,8 +155,9 @@ static int bclose_chksize(JCR *jcr, BFILE *bfd, boffset_t osize)
 }
 
 #ifdef HAVE_DARWIN_OS
-static bool restore_finderinfo(JCR *jcr, POOLMEM *buf, int32_t buflen)
+static bool restore_finderinfo(r_ctx &rctx, char *buf, int32_t buflen)
 {
+   JCR *jcr = rctx.jcr;
    struct attrlist attrList;
 
    memset(&attrList, 0, sizeof(attrList));
@@ -135,15 +171,15 @@ static bool restore_finderinfo(JCR *jcr, POOLMEM *buf, int32_t buflen)
       return false;
    }
 
-   if (setattrlist(jcr->last_fname, &attrList, buf, buflen, 0) != 0) {
-      Jmsg(jcr, M_WARNING, 0, _("Could not set Finder Info on %s\n"), jcr->last_fname);
+   if (setattrlist(rctx.attr->ofname, &attrList, buf, buflen, 0) != 0) {
+      Jmsg(jcr, M_WARNING, 0, _("Could not set Finder Info on %s\n"), rctx.attr->ofname);
       return false;
    }
 
    return true;
 }
 #else
-static bool restore_finderinfo(JCR *jcr, POOLMEM *buf, int32_t buflen)
+static bool restore_finderinfo(r_ctx &rctx, char *buf, int32_t buflen)
 {
    return true;
 }
@@ -176,7 +212,7 @@ static inline void drop_delayed_restore_streams(r_ctx &rctx, bool reuse)
  * Push a data stream onto the delayed restore stack for
  * later processing.
  */
-static inline void push_delayed_restore_stream(r_ctx &rctx, BSOCK *sd)
+static inline void push_delayed_restore_stream(r_ctx &rctx, char *data, int32_t len)
 {
    RESTORE_DATA_STREAM *rds;
 
@@ -186,9 +222,9 @@ static inline void push_delayed_restore_stream(r_ctx &rctx, BSOCK *sd)
 
    rds = (RESTORE_DATA_STREAM *)malloc(sizeof(RESTORE_DATA_STREAM));
    rds->stream = rctx.stream;
-   rds->content = (char *)malloc(sd->msglen);
-   memcpy(rds->content, sd->msg, sd->msglen);
-   rds->content_length = sd->msglen;
+   rds->content = (char *)malloc(len);
+   memcpy(rds->content, data, len);
+   rds->content_length = len;
 
    rctx.delayed_streams->append(rds);
 }
@@ -257,18 +293,10 @@ static inline bool do_restore_xattr(JCR *jcr,
  * attributes otherwise we might clear some security flags
  * by setting the attributes.
  */
-static inline bool pop_delayed_data_streams(JCR *jcr, r_ctx &rctx)
+static bool apply_delayed_data_streams(JCR *jcr, alist *delayed)
 {
    RESTORE_DATA_STREAM *rds;
 
-   /*
-    * See if there is anything todo.
-    */
-   if (!rctx.delayed_streams ||
-        rctx.delayed_streams->empty()) {
-      return true;
-   }
-
    /*
     * Only process known delayed data streams here.
     * If you start using more delayed data streams
@@ -280,7 +308,7 @@ static inline bool pop_delayed_data_streams(JCR *jcr, r_ctx &rctx)
     * - *_ACL_*
     * - *_XATTR_*
     */
-   foreach_alist(rds, rctx.delayed_streams) {
+   foreach_alist(rds, delayed) {
       switch (rds->stream) {
       case STREAM_UNIX_ACCESS_ACL:
       case STREAM_UNIX_DEFAULT_ACL:
@@ -303,9 +331,10 @@ static inline bool pop_delayed_data_streams(JCR *jcr, r_ctx &rctx)
       case STREAM_ACL_AIX_NFS4:
       case STREAM_ACL_FREEBSD_NFS4_ACL:
          if (!do_restore_acl(jcr, rds->stream, rds->content, rds->content_length)) {
-            goto bail_out;
+            return false;
          }
          free(rds->content);
+         rds->content = NULL;
          break;
       case STREAM_XATTR_IRIX:
       case STREAM_XATTR_TRU64:
@@ -317,9 +346,10 @@ static inline bool pop_delayed_data_streams(JCR *jcr, r_ctx &rctx)
       case STREAM_XATTR_LINUX:
       case STREAM_XATTR_NETBSD:
          if (!do_restore_xattr(jcr, rds->stream, rds->content, rds->content_length)) {
-            goto bail_out;
+            return false;
          }
          free(rds->content);
+         rds->content = NULL;
          break;
       default:
          Jmsg(jcr, M_WARNING, 0, _("Unknown stream=%d ignored. This shouldn't happen!\n"),
@@ -328,348 +358,623 @@ static inline bool pop_delayed_data_streams(JCR *jcr, r_ctx &rctx)
       }
    }
 
+   return true;
+}
+
+static void lock_restore_fname(r_ctx &rctx);
+static void unlock_restore_fname(r_ctx &rctx);
+
+/*
+ * Apply the delayed data streams of the restore context.
+ *  The caller must have set jcr->last_fname to the file.
+ */
+static bool pop_delayed_data_streams(JCR *jcr, r_ctx &rctx)
+{
    /*
-    * We processed the stack so we can destroy it.
+    * See if there is anything todo.
     */
-   rctx.delayed_streams->destroy();
+   if (!rctx.delayed_streams ||
+        rctx.delayed_streams->empty()) {
+      return true;
+   }
+
+   if (!apply_delayed_data_streams(jcr, rctx.delayed_streams)) {
+      /*
+       * Destroy the content of the stack and (re)initialize it for a new use.
+       */
+      drop_delayed_restore_streams(rctx, true);
+      return false;
+   }
 
    /*
-    * (Re)Initialize the stack for a new use.
+    * We processed the stack so we can destroy it and
+    * (re)initialize it for a new use.
     */
+   rctx.delayed_streams->destroy();
    rctx.delayed_streams->init(10, owned_by_alist);
-
    return true;
+}
 
-bail_out:
+static void set_restore_fname(JCR *jcr, const char *fname, int type)
+{
+   jcr->lock();
+   pm_strcpy(jcr->last_fname, fname);
+   jcr->last_type = type;
+   jcr->unlock();
+}
 
-   /*
-    * Destroy the content of the stack and (re)initialize it for a new use.
-    */
-   drop_delayed_restore_streams(rctx, true);
+/*
+ * Make jcr->last_fname name the file of the restore context.
+ *  The acl and xattr code works on jcr->last_fname, so restore
+ *  workers keep the fname lock until they are done with it.
+ */
+static void lock_restore_fname(r_ctx &rctx)
+{
+   JCR *jcr = rctx.jcr;
 
-   return false;
+   if (rctx.workers) {
+      P(rctx.workers->fname_mutex);
+   }
+   set_restore_fname(jcr, rctx.attr->ofname, rctx.attr->type);
+}
+
+static void unlock_restore_fname(r_ctx &rctx)
+{
+   if (rctx.workers) {
+      V(rctx.workers->fname_mutex);
+   }
 }
 
+#ifndef HAVE_WIN32
 /*
- * Restore the requested files.
+ * Journal of the attributes of the restored files.
+ *
+ * With "Defer Restore Attributes = yes" the owner, modes, times,
+ *  flags, acls and xattrs are not set when the file is closed but
+ *  saved in a compact journal. They are applied at the end of the
+ *  restore (or when RESTORE_JOURNAL_BATCH files are waiting) with
+ *  the files sorted by directory and inode, which avoids seeking
+ *  all over the filesystem metadata. Directories are applied last,
+ *  deepest first, so that restoring their content can no longer
+ *  change their times or be prevented by their modes.
  */
-void do_restore(JCR *jcr)
+static RESTORE_JOURNAL *new_restore_journal()
 {
-   BSOCK *sd;
-   uint32_t VolSessionId, VolSessionTime;
-   int32_t file_index;
-   char ec1[50];                      /* Buffer printing huge values */
-   uint32_t buf_size;                 /* client buffer size */
-   int stat;
-   int64_t rsrc_len = 0;              /* Original length of resource fork */
-   r_ctx rctx;
+   RESTORE_JOURNAL *jp;
+
+   jp = (RESTORE_JOURNAL *)malloc(sizeof(RESTORE_JOURNAL));
+   memset(jp, 0, sizeof(RESTORE_JOURNAL));
+   pthread_mutex_init(&jp->mutex, NULL);
+   return jp;
+}
+
+static void free_restore_jentry(RESTORE_JENTRY *je)
+{
+   RESTORE_DATA_STREAM *rds;
+
+   if (je->delayed) {
+      foreach_alist(rds, je->delayed) {
+         if (rds->content) {
+            free(rds->content);
+         }
+      }
+      delete je->delayed;
+   }
+   free(je);
+}
+
+static void free_restore_journal(RESTORE_JOURNAL *jp)
+{
+   int32_t i;
+
+   for (i = 0; i < jp->num_files; i++) {
+      free_restore_jentry(jp->files[i]);
+   }
+   for (i = 0; i < jp->num_dirs; i++) {
+      free_restore_jentry(jp->dirs[i]);
+   }
+   if (jp->files) {
+      free(jp->files);
+   }
+   if (jp->dirs) {
+      free(jp->dirs);
+   }
+   pthread_mutex_destroy(&jp->mutex);
+   free(jp);
+}
+
+/*
+ * Files: group them by directory, then by inode
+ */
+static int jentry_file_cmp(const void *a, const void *b)
+{
+   const RESTORE_JENTRY *ja = *(const RESTORE_JENTRY **)a;
+   const RESTORE_JENTRY *jb = *(const RESTORE_JENTRY **)b;
+   int len = MIN(ja->dir_len, jb->dir_len);
+   int cmp;
+
+   cmp = memcmp(ja->fname, jb->fname, len);
+   if (cmp == 0 && ja->dir_len != jb->dir_len) {
+      cmp = ja->dir_len < jb->dir_len ? -1 : 1;
+   }
+   if (cmp == 0 && ja->ino != jb->ino) {
+      cmp = ja->ino < jb->ino ? -1 : 1;
+   }
+   if (cmp == 0) {
+      cmp = strcmp(ja->fname, jb->fname);
+   }
+   return cmp;
+}
+
+/*
+ * Directories: deepest first
+ */
+static int jentry_dir_cmp(const void *a, const void *b)
+{
+   const RESTORE_JENTRY *ja = *(const RESTORE_JENTRY **)a;
+   const RESTORE_JENTRY *jb = *(const RESTORE_JENTRY **)b;
+
+   if (ja->depth != jb->depth) {
+      return ja->depth > jb->depth ? -1 : 1;
+   }
+   return strcmp(ja->fname, jb->fname);
+}
+
+/*
+ * Set the attributes of a sorted list of journal entries
+ *  and release them.
+ * Returns: false on fatal error
+ */
+static bool apply_journal_entries(r_ctx &rctx, RESTORE_JENTRY **list, int32_t count)
+{
+   JCR *jcr = rctx.jcr;
+   RESTORE_JENTRY *je;
    ATTR *attr;
-   /* ***FIXME*** make configurable */
-   crypto_digest_t signing_algorithm = have_sha2 ? 
-                                       CRYPTO_DIGEST_SHA256 : CRYPTO_DIGEST_SHA1;
-   memset(&rctx, 0, sizeof(rctx));
-   rctx.jcr = jcr;
+   BFILE bfd;
+   bool ok = true;
+   int32_t i;
 
+   Dmsg1(100, "Apply %d journaled attributes\n", count);
+   attr = new_attr(jcr);
+   binit(&bfd);
    /*
-    * The following variables keep track of "known unknowns"
+    * The acl code uses jcr->last_fname, so keep the workers out
+    *  while we apply.
     */
-   int non_support_data = 0;
-   int non_support_attr = 0;
-   int non_support_rsrc = 0;
-   int non_support_finfo = 0;
-   int non_support_acl = 0;
-   int non_support_progname = 0;
-   int non_support_crypto = 0;
-   int non_support_xattr = 0;
+   if (rctx.workers) {
+      P(rctx.workers->fname_mutex);
+   }
+   for (i = 0; i < count; i++) {
+      je = list[i];
+      if (ok && !job_canceled(jcr)) {
+         pm_strcpy(attr->ofname, je->fname);
+         attr->type = je->type;
+         memset(&attr->statp, 0, sizeof(attr->statp));
+         attr->statp.st_uid = je->uid;
+         attr->statp.st_gid = je->gid;
+         attr->statp.st_mode = je->mode;
+         attr->statp.st_atime = je->atime;
+         attr->statp.st_mtime = je->mtime;
+#ifdef HAVE_CHFLAGS
+         attr->statp.st_flags = je->flags;
+#endif
+         set_attributes(jcr, attr, &bfd);
+         if (je->delayed) {
+            set_restore_fname(jcr, je->fname, je->type);
+            ok = apply_delayed_data_streams(jcr, je->delayed);
+         }
+      }
+      free_restore_jentry(je);
+   }
+   if (rctx.workers) {
+      V(rctx.workers->fname_mutex);
+   }
+   free_attr(attr);
+   return ok;
+}
 
-   sd = jcr->store_bsock;
-   jcr->setJobStatus(JS_Running);
+/*
+ * Apply the journaled files, and the directories if all is set.
+ * Returns: false on fatal error
+ */
+static bool apply_restore_journal(r_ctx &rctx, bool all)
+{
+   RESTORE_JOURNAL *jp = rctx.journal;
+   RESTORE_JENTRY **files, **dirs = NULL;
+   int32_t num_files, num_dirs = 0;
+   bool ok = true;
+
+   P(jp->mutex);
+   files = jp->files;
+   num_files = jp->num_files;
+   jp->files = NULL;
+   jp->num_files = jp->max_files = 0;
+   if (all) {
+      dirs = jp->dirs;
+      num_dirs = jp->num_dirs;
+      jp->dirs = NULL;
+      jp->num_dirs = jp->max_dirs = 0;
+   }
+   V(jp->mutex);
+
+   if (files) {
+      qsort(files, num_files, sizeof(RESTORE_JENTRY *), jentry_file_cmp);
+      ok = apply_journal_entries(rctx, files, num_files);
+      free(files);
+   }
+   if (dirs) {
+      qsort(dirs, num_dirs, sizeof(RESTORE_JENTRY *), jentry_dir_cmp);
+      ok = apply_journal_entries(rctx, dirs, num_dirs) && ok;
+      free(dirs);
+   }
+   return ok;
+}
 
-   LockRes();
-   CLIENT *client = (CLIENT *)GetNextRes(R_CLIENT, NULL);
-   UnlockRes();
-   if (client) {
-      buf_size = client->max_network_buffer_size;
-   } else {
-      buf_size = 0;                   /* use default */
+/*
+ * Close the file of the restore context and journal its attributes
+ *  together with its delayed data streams.
+ * Returns: false on fatal error
+ */
+static bool journal_attributes(r_ctx &rctx)
+{
+   RESTORE_JOURNAL *jp = rctx.journal;
+   ATTR *attr = rctx.attr;
+   RESTORE_JENTRY *je;
+   struct stat statp;
+   int len = strlen(attr->ofname);
+   char *p;
+   bool batch;
+
+   /*
+    * We do not restore sockets, see set_attributes()
+    */
+   if (attr->type == FT_SPEC && S_ISSOCK(attr->statp.st_mode)) {
+      close_restored_file(rctx.jcr, attr, &rctx.bfd);
+      pm_strcpy(attr->ofname, "*none*");
+      return true;
    }
-   if (!bnet_set_buffer_size(sd, buf_size, BNET_SETBUF_WRITE)) {
-      jcr->setJobStatus(JS_ErrorTerminated);
-      return;
+
+   je = (RESTORE_JENTRY *)malloc(sizeof(RESTORE_JENTRY) + len);
+   je->ino = 0;
+   if (is_bopen(&rctx.bfd) && fstat(rctx.bfd.fid, &statp) == 0) {
+      je->ino = statp.st_ino;
+   }
+   close_restored_file(rctx.jcr, attr, &rctx.bfd);
+
+   je->uid = attr->statp.st_uid;
+   je->gid = attr->statp.st_gid;
+   je->mode = attr->statp.st_mode;
+   je->atime = attr->statp.st_atime;
+   je->mtime = attr->statp.st_mtime;
+#ifdef HAVE_CHFLAGS
+   je->flags = attr->statp.st_flags;
+#else
+   je->flags = 0;
+#endif
+   je->type = attr->type;
+   memcpy(je->fname, attr->ofname, len + 1);
+   je->dir_len = 0;
+   je->depth = 0;
+   for (p = je->fname; p < je->fname + len - 1; p++) {  /* ignore trailing slash */
+      if (IsPathSeparator(*p)) {
+         je->dir_len = p - je->fname + 1;
+         je->depth++;
+      }
    }
-   jcr->buf_size = sd->msglen;
 
    /*
-    * St Bernard code goes here if implemented -- see end of file
+    * The delayed streams are applied after the attributes
     */
+   je->delayed = NULL;
+   if (rctx.delayed_streams && !rctx.delayed_streams->empty()) {
+      je->delayed = rctx.delayed_streams;
+      rctx.delayed_streams = NULL;
+   }
+   pm_strcpy(attr->ofname, "*none*");
+
+   P(jp->mutex);
+   if (je->type == FT_DIREND) {
+      if (jp->num_dirs == jp->max_dirs) {
+         jp->max_dirs = jp->max_dirs ? jp->max_dirs * 2 : 1024;
+         jp->dirs = (RESTORE_JENTRY **)realloc(jp->dirs,
+                       jp->max_dirs * sizeof(RESTORE_JENTRY *));
+      }
+      jp->dirs[jp->num_dirs++] = je;
+      rctx.jdir = je;                 /* for the directory acls and xattrs */
+      batch = false;
+   } else {
+      if (jp->num_files == jp->max_files) {
+         jp->max_files = jp->max_files ? jp->max_files * 2 : 1024;
+         jp->files = (RESTORE_JENTRY **)realloc(jp->files,
+                       jp->max_files * sizeof(RESTORE_JENTRY *));
+      }
+      jp->files[jp->num_files++] = je;
+      batch = jp->num_files >= RESTORE_JOURNAL_BATCH;
+   }
+   V(jp->mutex);
 
-   /* use the same buffer size to decompress both gzip and lzo */
-   if (have_libz || have_lzo) {
-      uint32_t compress_buf_size = jcr->buf_size + 12 + ((jcr->buf_size+999) / 1000) + 100;
-      jcr->compress_buf = get_memory(compress_buf_size);
-      jcr->compress_buf_size = compress_buf_size;
+   if (batch) {
+      return apply_restore_journal(rctx, false);
    }
+   return true;
+}
 
-#ifdef HAVE_LZO
-   if (lzo_init() != LZO_E_OK) {
-      Jmsg(jcr, M_FATAL, 0, _("LZO init failed\n"));
-      goto bail_out;
+/*
+ * Add an acl or xattr stream of a directory to its journal entry.
+ *  Directory entries stay in the journal until the end, so nobody
+ *  else is using it.
+ */
+static void journal_restore_stream(r_ctx &rctx, char *data, int32_t len)
+{
+   RESTORE_DATA_STREAM *rds;
+   RESTORE_JENTRY *je = rctx.jdir;
+
+   if (!je->delayed) {
+      je->delayed = New(alist(10, owned_by_alist));
    }
+   rds = (RESTORE_DATA_STREAM *)malloc(sizeof(RESTORE_DATA_STREAM));
+   rds->stream = rctx.stream;
+   rds->content = (char *)malloc(len);
+   memcpy(rds->content, data, len);
+   rds->content_length = len;
+   je->delayed->append(rds);
+}
+
+#else
+static RESTORE_JOURNAL *new_restore_journal() { return NULL; }
+static void free_restore_journal(RESTORE_JOURNAL *jp) { }
+static bool apply_restore_journal(r_ctx &rctx, bool all) { return true; }
+static bool journal_attributes(r_ctx &rctx) { return true; }
+static void journal_restore_stream(r_ctx &rctx, char *data, int32_t len) { }
 #endif
 
-   if (have_crypto) {
-      rctx.cipher_ctx.buf = get_memory(CRYPTO_CIPHER_MAX_BLOCK_SIZE);
-      if (have_darwin_os) {
-         rctx.fork_cipher_ctx.buf = get_memory(CRYPTO_CIPHER_MAX_BLOCK_SIZE);
-      }
+/*
+ * Set the attributes of the file of the restore context then
+ *  restore its delayed data streams, or journal all of them when
+ *  the attributes are deferred.
+ * Returns: false on fatal error
+ */
+static bool restore_set_attributes(JCR *jcr, r_ctx &rctx)
+{
+   bool ok;
+
+   if (rctx.journal && !jcr->plugin) {
+      return journal_attributes(rctx);
    }
-   
+
    /*
-    * Get a record from the Storage daemon. We are guaranteed to
-    *   receive records in the following order:
-    *   1. Stream record header
-    *   2. Stream data (one or more of the following in the order given)
-    *        a. Attributes (Unix or Win32)
-    *        b. Possibly stream encryption session data (e.g., symmetric session key)
-    *        c. File data for the file
-    *        d. Alternate data stream (e.g. Resource Fork)
-    *        e. Finder info
-    *        f. ACLs
-    *        g. XATTRs
-    *        h. Possibly a cryptographic signature
-    *        i. Possibly MD5 or SHA1 record
-    *   3. Repeat step 1
-    *
-    * NOTE: We keep track of two bacula file descriptors:
-    *   1. bfd for file data.
-    *      This fd is opened for non empty files when an attribute stream is
-    *      encountered and closed when we find the next attribute stream.
-    *   2. fork_bfd for alternate data streams
-    *      This fd is opened every time we encounter a new alternate data
-    *      stream for the current file. When we find any other stream, we
-    *      close it again.
-    *      The expected size of the stream, fork_len, should be set when
-    *      opening the fd.
-    *   3. Not all the stream data records are required -- e.g. if there
-    *      is no fork, there is no alternate data stream, no ACL, ...
+    * set_attributes() clears attr->ofname, so name the file
+    *  for the delayed streams now.
     */
-   binit(&rctx.bfd);
-   binit(&rctx.forkbfd);
-   attr = rctx.attr = new_attr(jcr);
-   if (have_acl) {
-      jcr->acl_data = (acl_data_t *)malloc(sizeof(acl_data_t));
-      memset(jcr->acl_data, 0, sizeof(acl_data_t));
-      jcr->acl_data->u.parse = (acl_parse_data_t *)malloc(sizeof(acl_parse_data_t));
-      memset(jcr->acl_data->u.parse, 0, sizeof(acl_parse_data_t));
+   lock_restore_fname(rctx);
+   if (jcr->plugin) {
+      plugin_set_attributes(jcr, rctx.attr, &rctx.bfd);
+   } else {
+      set_attributes(jcr, rctx.attr, &rctx.bfd);
    }
-   if (have_xattr) {
-      jcr->xattr_data = (xattr_data_t *)malloc(sizeof(xattr_data_t));
-      memset(jcr->xattr_data, 0, sizeof(xattr_data_t));
-      jcr->xattr_data->u.parse = (xattr_parse_data_t *)malloc(sizeof(xattr_parse_data_t));
-      memset(jcr->xattr_data->u.parse, 0, sizeof(xattr_parse_data_t));
+   ok = pop_delayed_data_streams(jcr, rctx);
+   unlock_restore_fname(rctx);
+   return ok;
+}
+
+/*
+ * Handle one stream record of the restore context. The record
+ *  header has already been read and checked.
+ * Returns: false on fatal error
+ */
+static bool restore_record(r_ctx &rctx, int32_t full_stream, char *msg, int32_t msglen)
+{
+   JCR *jcr = rctx.jcr;
+   ATTR *attr = rctx.attr;
+   int stat;
+   bool ok;
+   /* ***FIXME*** make configurable */
+   crypto_digest_t signing_algorithm = have_sha2 ? 
+                                       CRYPTO_DIGEST_SHA256 : CRYPTO_DIGEST_SHA1;
+
+   /*
+    * Remember previous stream type
+    */
+   rctx.prev_stream = rctx.stream;
+   rctx.full_stream = full_stream;
+   rctx.size = msglen;
+
+   /* Strip off new stream high bits */
+   rctx.stream = rctx.full_stream & STREAMMASK_TYPE;
+   Dmsg3(130, "Got stream: %s len=%d extract=%d\n", stream_to_ascii(rctx.stream), 
+         msglen, rctx.extract);
+
+   /*
+    * The file data may still be in the hands of the writer
+    */
+   if (rctx.prev_stream != rctx.stream) {
+      sync_restore_writer(rctx);
    }
 
-   while (bget_msg(sd) >= 0 && !job_canceled(jcr)) {
+   /*
+    * If we change streams, close and reset alternate data streams
+    */
+   if (rctx.prev_stream != rctx.stream) {
+      if (is_bopen(&rctx.forkbfd)) {
+         deallocate_fork_cipher(rctx);
+         bclose_chksize(rctx, &rctx.forkbfd, rctx.fork_size);
+      }
       /*
-       * Remember previous stream type
+       * Use an impossible value and set a proper one below
        */
-      rctx.prev_stream = rctx.stream;
+      rctx.fork_size = -1;
+      rctx.fork_addr = 0;
+   }
 
+   /*
+    * File Attributes stream
+    */
+   switch (rctx.stream) {
+   case STREAM_UNIX_ATTRIBUTES:
+   case STREAM_UNIX_ATTRIBUTES_EX:
       /*
-       * First we expect a Stream Record Header
+       * if any previous stream open, close it
        */
-      if (sscanf(sd->msg, rec_header, &VolSessionId, &VolSessionTime, &file_index,
-          &rctx.full_stream, &rctx.size) != 5) {
-         Jmsg1(jcr, M_FATAL, 0, _("Record header scan error: %s\n"), sd->msg);
-         goto bail_out;
+      if (!close_previous_stream(jcr, rctx)) {
+         return false;
       }
-      /* Strip off new stream high bits */
-      rctx.stream = rctx.full_stream & STREAMMASK_TYPE;
-      Dmsg5(150, "Got hdr: Files=%d FilInx=%d size=%d Stream=%d, %s.\n", 
-            jcr->JobFiles, file_index, rctx.size, rctx.stream, stream_to_ascii(rctx.stream));
+      rctx.jdir = NULL;
 
       /*
-       * Now we expect the Stream Data
+       * TODO: manage deleted files
        */
-      if (bget_msg(sd) < 0) {
-         Jmsg1(jcr, M_FATAL, 0, _("Data record error. ERR=%s\n"), sd->bstrerror());
-         goto bail_out;
+      if (rctx.type == FT_DELETED) { /* deleted file */
+         return true;
       }
-      if (rctx.size != (uint32_t)sd->msglen) {
-         Jmsg2(jcr, M_FATAL, 0, _("Actual data size %d not same as header %d\n"), 
-               sd->msglen, rctx.size);
-         Dmsg2(50, "Actual data size %d not same as header %d\n",
-               sd->msglen, rctx.size);
-         goto bail_out;
+      /*
+       * Restore objects should be ignored here -- they are
+       * returned at the beginning of the restore. 
+       */
+      if (IS_FT_OBJECT(rctx.type)) {
+         return true;
       }
-      Dmsg3(130, "Got stream: %s len=%d extract=%d\n", stream_to_ascii(rctx.stream), 
-            sd->msglen, rctx.extract);
 
       /*
-       * If we change streams, close and reset alternate data streams
+       * Unpack attributes and do sanity check them
        */
-      if (rctx.prev_stream != rctx.stream) {
-         if (is_bopen(&rctx.forkbfd)) {
-            deallocate_fork_cipher(rctx);
-            bclose_chksize(jcr, &rctx.forkbfd, rctx.fork_size);
+      if (!unpack_attributes_record(jcr, rctx.stream, msg, msglen, attr)) {
+         return false;
+      }
+
+      Dmsg3(100, "File %s\nattrib=%s\nattribsEx=%s\n", attr->fname,
+            attr->attr, attr->attrEx);
+      Dmsg3(100, "=== msglen=%d attrExlen=%d msg=%s\n", msglen,
+            strlen(attr->attrEx), msg);
+
+      attr->data_stream = decode_stat(attr->attr, &attr->statp, sizeof(attr->statp), &attr->LinkFI);
+
+      if (!is_restore_stream_supported(attr->data_stream)) {
+         if (!rctx.non_support_data++) {
+            Jmsg(jcr, M_WARNING, 0, _("%s stream not supported on this Client.\n"),
+                 stream_to_ascii(attr->data_stream));
          }
-         /*
-          * Use an impossible value and set a proper one below
-          */
-         rctx.fork_size = -1;
-         rctx.fork_addr = 0;
+         return true;
       }
 
       /*
-       * File Attributes stream
+       * The restore workers share jcr->where_bregexp, and
+       *  apply_bregexps() keeps its results in it.
        */
-      switch (rctx.stream) {
-      case STREAM_UNIX_ATTRIBUTES:
-      case STREAM_UNIX_ATTRIBUTES_EX:
-         /*
-          * if any previous stream open, close it
-          */
-         if (!close_previous_stream(jcr, rctx)) {
-            goto bail_out;
-         }
+      if (rctx.workers) {
+         P(rctx.workers->fname_mutex);
+      }
+      build_attr_output_fnames(jcr, attr);
+      if (rctx.workers) {
+         V(rctx.workers->fname_mutex);
+      }
 
+      /*
+       * Try to actually create the file, which returns a status telling
+       * us if we need to extract or not.
+       */
+      rctx.extract = false;
+      stat = CF_CORE;        /* By default, let Bacula's core handle it */
+
+      if (jcr->plugin) {
+         stat = plugin_create_file(jcr, attr, &rctx.bfd, jcr->replace);
+      } 
+      
+      if (stat == CF_CORE) {
+         stat = create_file(jcr, attr, &rctx.bfd, jcr->replace);
+      }
+      jcr->lock();  
+      jcr->num_files_examined++;
+      jcr->unlock();
+      lock_restore_fname(rctx);
+      unlock_restore_fname(rctx);
+      Dmsg2(130, "Outfile=%s create_file stat=%d\n", attr->ofname, stat);
+      switch (stat) {
+      case CF_ERROR:
+      case CF_SKIP:
+         update_restore_counters(jcr, 1, 0, 0);
+         break;
+      case CF_EXTRACT:
          /*
-          * TODO: manage deleted files
+          * File created and we expect file data
           */
-         if (rctx.type == FT_DELETED) { /* deleted file */
-            continue;
-         }
+         rctx.extract = true;
          /*
-          * Restore objects should be ignored here -- they are
-          * returned at the beginning of the restore. 
+          * FALLTHROUGH
           */
-         if (IS_FT_OBJECT(rctx.type)) {
-            continue;
-         }
-
+      case CF_CREATED:
          /*
-          * Unpack attributes and do sanity check them
+          * File created, but there is no content
           */
-         if (!unpack_attributes_record(jcr, rctx.stream, sd->msg, sd->msglen, attr)) {
-            goto bail_out;
-         }
-
-         Dmsg3(100, "File %s\nattrib=%s\nattribsEx=%s\n", attr->fname,
-               attr->attr, attr->attrEx);
-         Dmsg3(100, "=== msglen=%d attrExlen=%d msg=%s\n", sd->msglen,
-               strlen(attr->attrEx), sd->msg);
-
-         attr->data_stream = decode_stat(attr->attr, &attr->statp, sizeof(attr->statp), &attr->LinkFI);
-
-         if (!is_restore_stream_supported(attr->data_stream)) {
-            if (!non_support_data++) {
-               Jmsg(jcr, M_WARNING, 0, _("%s stream not supported on this Client.\n"),
-                    stream_to_ascii(attr->data_stream));
-            }
-            continue;
-         }
+         rctx.fileAddr = 0;
+         rctx.cbuf_len = 0;
+         rctx.cbuf_addr = 0;
+         rctx.file_pos = 0;
+         rctx.data_end = 0;
+         rctx.prealloc_done = false;
+         rctx.prealloc_ok = false;
+         print_ls_output(jcr, attr);
 
-         build_attr_output_fnames(jcr, attr);
-
-         /*
-          * Try to actually create the file, which returns a status telling
-          * us if we need to extract or not.
-          */
-         jcr->num_files_examined++;
-         rctx.extract = false;
-         stat = CF_CORE;        /* By default, let Bacula's core handle it */
-
-         if (jcr->plugin) {
-            stat = plugin_create_file(jcr, attr, &rctx.bfd, jcr->replace);
-         } 
-         
-         if (stat == CF_CORE) {
-            stat = create_file(jcr, attr, &rctx.bfd, jcr->replace);
-         }
-         jcr->lock();  
-         pm_strcpy(jcr->last_fname, attr->ofname);
-         jcr->last_type = attr->type;
-         jcr->unlock();
-         Dmsg2(130, "Outfile=%s create_file stat=%d\n", attr->ofname, stat);
-         switch (stat) {
-         case CF_ERROR:
-         case CF_SKIP:
-            jcr->JobFiles++;
-            break;
-         case CF_EXTRACT:
-            /*
-             * File created and we expect file data
-             */
-            rctx.extract = true;
+         if (have_darwin_os) {
             /*
-             * FALLTHROUGH
+             * Only restore the resource fork for regular files
              */
-         case CF_CREATED:
+            from_base64(&rctx.rsrc_len, attr->attrEx);
+            if (attr->type == FT_REG && rctx.rsrc_len > 0) {
+               rctx.extract = true;
+            }
+
             /*
-             * File created, but there is no content
+             * Do not count the resource forks as regular files being restored.
              */
-            rctx.fileAddr = 0;
-            print_ls_output(jcr, attr);
-
-            if (have_darwin_os) {
-               /*
-                * Only restore the resource fork for regular files
-                */
-               from_base64(&rsrc_len, attr->attrEx);
-               if (attr->type == FT_REG && rsrc_len > 0) {
-                  rctx.extract = true;
-               }
-
-               /*
-                * Do not count the resource forks as regular files being restored.
-                */
-               if (rsrc_len == 0) {
-                  jcr->JobFiles++;
-               }
-            } else {
-               jcr->JobFiles++;
+            if (rctx.rsrc_len == 0) {
+               update_restore_counters(jcr, 1, 0, 0);
             }
+         } else {
+            update_restore_counters(jcr, 1, 0, 0);
+         }
 
-            if (!rctx.extract) {
-               /*
-                * set attributes now because file will not be extracted
-                */
-               if (jcr->plugin) {
-                  plugin_set_attributes(jcr, attr, &rctx.bfd);
-               } else {
-                  set_attributes(jcr, attr, &rctx.bfd);
-               }
+         if (!rctx.extract) {
+            /*
+             * set attributes now because file will not be extracted
+             */
+            if (!restore_set_attributes(jcr, rctx)) {
+               return false;
             }
-            break;
          }
          break;
+      }
+      break;
+
+   /*
+    * Data stream
+    */
+   case STREAM_ENCRYPTED_SESSION_DATA:
+      crypto_error_t cryptoerr;
 
       /*
-       * Data stream
+       * Is this an unexpected session data entry?
        */
-      case STREAM_ENCRYPTED_SESSION_DATA:
-         crypto_error_t cryptoerr;
-
-         /*
-          * Is this an unexpected session data entry?
-          */
-         if (rctx.cs) {
-            Jmsg0(jcr, M_ERROR, 0, _("Unexpected cryptographic session data stream.\n"));
-            rctx.extract = false;
-            bclose(&rctx.bfd);
-            continue;
-         }
+      if (rctx.cs) {
+         Jmsg0(jcr, M_ERROR, 0, _("Unexpected cryptographic session data stream.\n"));
+         rctx.extract = false;
+         bclose(&rctx.bfd);
+         return true;
+      }
 
-         /*
-          * Do we have any keys at all?
-          */
-         if (!jcr->crypto.pki_recipients) {
-            Jmsg(jcr, M_ERROR, 0, _("No private decryption keys have been defined to decrypt encrypted backup data.\n"));
-            rctx.extract = false;
-            bclose(&rctx.bfd);
-            break;
-         }
+      /*
+       * Do we have any keys at all?
+       */
+      if (!jcr->crypto.pki_recipients) {
+         Jmsg(jcr, M_ERROR, 0, _("No private decryption keys have been defined to decrypt encrypted backup data.\n"));
+         rctx.extract = false;
+         bclose(&rctx.bfd);
+         break;
+      }
 
+      /*
+       * The digest is only used to verify signatures
+       */
+      if (jcr->crypto.pki_sign) {
          if (jcr->crypto.digest) {
             crypto_digest_free(jcr->crypto.digest);
          }  
@@ -680,366 +985,936 @@ void do_restore(JCR *jcr)
             bclose(&rctx.bfd);
             break;
          }
+      }
 
+      /*
+       * Decode and save session keys.
+       */
+      cryptoerr = crypto_session_decode((uint8_t *)msg, (uint32_t)msglen, 
+                     jcr->crypto.pki_recipients, &rctx.cs);
+      switch(cryptoerr) {
+      case CRYPTO_ERROR_NONE:
          /*
-          * Decode and save session keys.
+          * Success
           */
-         cryptoerr = crypto_session_decode((uint8_t *)sd->msg, (uint32_t)sd->msglen, 
-                        jcr->crypto.pki_recipients, &rctx.cs);
-         switch(cryptoerr) {
-         case CRYPTO_ERROR_NONE:
-            /*
-             * Success
-             */
-            break;
-         case CRYPTO_ERROR_NORECIPIENT:
-            Jmsg(jcr, M_ERROR, 0, _("Missing private key required to decrypt encrypted backup data.\n"));
-            break;
-         case CRYPTO_ERROR_DECRYPTION:
-            Jmsg(jcr, M_ERROR, 0, _("Decrypt of the session key failed.\n"));
-            break;
-         default:
-            /*
-             * Shouldn't happen
-             */
-            Jmsg1(jcr, M_ERROR, 0, _("An error occurred while decoding encrypted session data stream: %s\n"), crypto_strerror(cryptoerr));
-            break;
-         }
-
-         if (cryptoerr != CRYPTO_ERROR_NONE) {
-            rctx.extract = false;
-            bclose(&rctx.bfd);
-            continue;
-         }
-
          break;
-
-      case STREAM_FILE_DATA:
-      case STREAM_SPARSE_DATA:
-      case STREAM_WIN32_DATA:
-      case STREAM_GZIP_DATA:
-      case STREAM_SPARSE_GZIP_DATA:
-      case STREAM_WIN32_GZIP_DATA:
-      case STREAM_COMPRESSED_DATA:
-      case STREAM_SPARSE_COMPRESSED_DATA:
-      case STREAM_WIN32_COMPRESSED_DATA:
-      case STREAM_ENCRYPTED_FILE_DATA:
-      case STREAM_ENCRYPTED_WIN32_DATA:
-      case STREAM_ENCRYPTED_FILE_GZIP_DATA:
-      case STREAM_ENCRYPTED_WIN32_GZIP_DATA:
-      case STREAM_ENCRYPTED_FILE_COMPRESSED_DATA:
-      case STREAM_ENCRYPTED_WIN32_COMPRESSED_DATA:
+      case CRYPTO_ERROR_NORECIPIENT:
+         Jmsg(jcr, M_ERROR, 0, _("Missing private key required to decrypt encrypted backup data.\n"));
+         break;
+      case CRYPTO_ERROR_DECRYPTION:
+         Jmsg(jcr, M_ERROR, 0, _("Decrypt of the session key failed.\n"));
+         break;
+      default:
          /*
-          * Force an expected, consistent stream type here
+          * Shouldn't happen
           */
-         if (rctx.extract && (rctx.prev_stream == rctx.stream 
-                         || rctx.prev_stream == STREAM_UNIX_ATTRIBUTES
-                         || rctx.prev_stream == STREAM_UNIX_ATTRIBUTES_EX
-                         || rctx.prev_stream == STREAM_ENCRYPTED_SESSION_DATA)) {
-            rctx.flags = 0;
-
-            if (rctx.stream == STREAM_SPARSE_DATA
-                  || rctx.stream == STREAM_SPARSE_COMPRESSED_DATA
-                  || rctx.stream == STREAM_SPARSE_GZIP_DATA) {
-               rctx.flags |= FO_SPARSE;
-            }
-
-            if (rctx.stream == STREAM_GZIP_DATA 
-                  || rctx.stream == STREAM_SPARSE_GZIP_DATA
-                  || rctx.stream == STREAM_WIN32_GZIP_DATA
-                  || rctx.stream == STREAM_ENCRYPTED_FILE_GZIP_DATA
-                  || rctx.stream == STREAM_COMPRESSED_DATA
-                  || rctx.stream == STREAM_SPARSE_COMPRESSED_DATA
-                  || rctx.stream == STREAM_WIN32_COMPRESSED_DATA
-                  || rctx.stream == STREAM_ENCRYPTED_FILE_COMPRESSED_DATA
-                  || rctx.stream == STREAM_ENCRYPTED_WIN32_COMPRESSED_DATA
-                  || rctx.stream == STREAM_ENCRYPTED_WIN32_GZIP_DATA) {
-               rctx.flags |= FO_COMPRESS;
-               rctx.comp_stream = rctx.stream;
-            }
-
-            if (rctx.stream == STREAM_ENCRYPTED_FILE_DATA
-                  || rctx.stream == STREAM_ENCRYPTED_FILE_GZIP_DATA
-                  || rctx.stream == STREAM_ENCRYPTED_WIN32_DATA
-                  || rctx.stream == STREAM_ENCRYPTED_FILE_COMPRESSED_DATA
-                  || rctx.stream == STREAM_ENCRYPTED_WIN32_COMPRESSED_DATA
-                  || rctx.stream == STREAM_ENCRYPTED_WIN32_GZIP_DATA) {               
-               /*
-                * Set up a decryption context
-                */
-               if (!rctx.cipher_ctx.cipher) {
-                  if (!rctx.cs) {
-                     Jmsg1(jcr, M_ERROR, 0, _("Missing encryption session data stream for %s\n"), jcr->last_fname);
-                     rctx.extract = false;
-                     bclose(&rctx.bfd);
-                     continue;
-                  }
-
-                  if ((rctx.cipher_ctx.cipher = crypto_cipher_new(rctx.cs, false, 
-                           &rctx.cipher_ctx.block_size)) == NULL) {
-                     Jmsg1(jcr, M_ERROR, 0, _("Failed to initialize decryption context for %s\n"), jcr->last_fname);
-                     free_session(rctx);
-                     rctx.extract = false;
-                     bclose(&rctx.bfd);
-                     continue;
-                  }
-               }
-               rctx.flags |= FO_ENCRYPT;
-            }
+         Jmsg1(jcr, M_ERROR, 0, _("An error occurred while decoding encrypted session data stream: %s\n"), crypto_strerror(cryptoerr));
+         break;
+      }
 
-            if (is_win32_stream(rctx.stream) && !have_win32_api()) {
-               set_portable_backup(&rctx.bfd);
-               /*
-                * "decompose" BackupWrite data
-                */
-               rctx.flags |= FO_WIN32DECOMP;
-            }
+      if (cryptoerr != CRYPTO_ERROR_NONE) {
+         rctx.extract = false;
+         bclose(&rctx.bfd);
+         return true;
+      }
 
-            if (extract_data(jcr, &rctx.bfd, sd->msg, sd->msglen, &rctx.fileAddr,
-                             rctx.flags, rctx.stream, &rctx.cipher_ctx) < 0) {
-               rctx.extract = false;
-               bclose(&rctx.bfd);
-               continue;
-            }
-         }
-         break;
+      break;
 
+   case STREAM_FILE_DATA:
+   case STREAM_SPARSE_DATA:
+   case STREAM_WIN32_DATA:
+   case STREAM_GZIP_DATA:
+   case STREAM_SPARSE_GZIP_DATA:
+   case STREAM_WIN32_GZIP_DATA:
+   case STREAM_COMPRESSED_DATA:
+   case STREAM_SPARSE_COMPRESSED_DATA:
+   case STREAM_WIN32_COMPRESSED_DATA:
+   case STREAM_ENCRYPTED_FILE_DATA:
+   case STREAM_ENCRYPTED_WIN32_DATA:
+   case STREAM_ENCRYPTED_FILE_GZIP_DATA:
+   case STREAM_ENCRYPTED_WIN32_GZIP_DATA:
+   case STREAM_ENCRYPTED_FILE_COMPRESSED_DATA:
+   case STREAM_ENCRYPTED_WIN32_COMPRESSED_DATA:
       /*
-       * Resource fork stream - only recorded after a file to be restored
-       * Silently ignore if we cannot write - we already reported that
+       * Force an expected, consistent stream type here
        */
-      case STREAM_ENCRYPTED_MACOS_FORK_DATA:
-      case STREAM_MACOS_FORK_DATA:
-         if (have_darwin_os) {
-            rctx.fork_flags = 0;
-            jcr->ff->flags |= FO_HFSPLUS;
-
-            if (rctx.stream == STREAM_ENCRYPTED_MACOS_FORK_DATA) {
-               rctx.fork_flags |= FO_ENCRYPT;
-
-               /*
-                * Set up a decryption context
-                */
-               if (rctx.extract && !rctx.fork_cipher_ctx.cipher) {
-                  if (!rctx.cs) {
-                     Jmsg1(jcr, M_ERROR, 0, _("Missing encryption session data stream for %s\n"), jcr->last_fname);
-                     rctx.extract = false;
-                     bclose(&rctx.bfd);
-                     continue;
-                  }
-
-                  if ((rctx.fork_cipher_ctx.cipher = crypto_cipher_new(rctx.cs, false, &rctx.fork_cipher_ctx.block_size)) == NULL) {
-                     Jmsg1(jcr, M_ERROR, 0, _("Failed to initialize decryption context for %s\n"), jcr->last_fname);
-                     free_session(rctx);
-                     rctx.extract = false;
-                     bclose(&rctx.bfd);
-                     continue;
-                  }
-               }
-            }
+      if (rctx.extract && (rctx.prev_stream == rctx.stream 
+                      || rctx.prev_stream == STREAM_UNIX_ATTRIBUTES
+                      || rctx.prev_stream == STREAM_UNIX_ATTRIBUTES_EX
+                      || rctx.prev_stream == STREAM_ENCRYPTED_SESSION_DATA)) {
+         rctx.flags = 0;
+
+         if (rctx.stream == STREAM_SPARSE_DATA
+               || rctx.stream == STREAM_SPARSE_COMPRESSED_DATA
+               || rctx.stream == STREAM_SPARSE_GZIP_DATA) {
+            rctx.flags |= FO_SPARSE;
+         }
 
-            if (rctx.extract) {
-               if (rctx.prev_stream != rctx.stream) {
-                  if (bopen_rsrc(&rctx.forkbfd, jcr->last_fname, O_WRONLY | O_TRUNC | O_BINARY, 0) < 0) {
-                     Jmsg(jcr, M_WARNING, 0, _("Cannot open resource fork for %s.\n"), jcr->last_fname);
-                     rctx.extract = false;
-                     continue;
-                  }
+         if (rctx.stream == STREAM_GZIP_DATA 
+               || rctx.stream == STREAM_SPARSE_GZIP_DATA
+               || rctx.stream == STREAM_WIN32_GZIP_DATA
+               || rctx.stream == STREAM_ENCRYPTED_FILE_GZIP_DATA
+               || rctx.stream == STREAM_COMPRESSED_DATA
+               || rctx.stream == STREAM_SPARSE_COMPRESSED_DATA
+               || rctx.stream == STREAM_WIN32_COMPRESSED_DATA
+               || rctx.stream == STREAM_ENCRYPTED_FILE_COMPRESSED_DATA
+               || rctx.stream == STREAM_ENCRYPTED_WIN32_COMPRESSED_DATA
+               || rctx.stream == STREAM_ENCRYPTED_WIN32_GZIP_DATA) {
+            rctx.flags |= FO_COMPRESS;
+            rctx.comp_stream = rctx.stream;
+         }
 
-                  rctx.fork_size = rsrc_len;
-                  Dmsg0(130, "Restoring resource fork\n");
+         if (rctx.stream == STREAM_ENCRYPTED_FILE_DATA
+               || rctx.stream == STREAM_ENCRYPTED_FILE_GZIP_DATA
+               || rctx.stream == STREAM_ENCRYPTED_WIN32_DATA
+               || rctx.stream == STREAM_ENCRYPTED_FILE_COMPRESSED_DATA
+               || rctx.stream == STREAM_ENCRYPTED_WIN32_COMPRESSED_DATA
+               || rctx.stream == STREAM_ENCRYPTED_WIN32_GZIP_DATA) {               
+            /*
+             * Set up a decryption context
+             */
+            if (!rctx.cipher_ctx.cipher) {
+               if (!rctx.cs) {
+                  Jmsg1(jcr, M_ERROR, 0, _("Missing encryption session data stream for %s\n"), rctx.attr->ofname);
+                  rctx.extract = false;
+                  bclose(&rctx.bfd);
+                  return true;
                }
 
-               if (extract_data(jcr, &rctx.forkbfd, sd->msg, sd->msglen, &rctx.fork_addr, rctx.fork_flags,
-                                rctx.stream, &rctx.fork_cipher_ctx) < 0) {
+               if ((rctx.cipher_ctx.cipher = crypto_cipher_new(rctx.cs, false, 
+                        &rctx.cipher_ctx.block_size)) == NULL) {
+                  Jmsg1(jcr, M_ERROR, 0, _("Failed to initialize decryption context for %s\n"), rctx.attr->ofname);
+                  free_session(rctx);
                   rctx.extract = false;
-                  bclose(&rctx.forkbfd);
-                  continue;
+                  bclose(&rctx.bfd);
+                  return true;
                }
             }
-         } else {
-            non_support_rsrc++;
+            rctx.flags |= FO_ENCRYPT;
          }
-         break;
 
-      case STREAM_HFSPLUS_ATTRIBUTES:
-         if (have_darwin_os) {
-            if (!restore_finderinfo(jcr, sd->msg, sd->msglen)) {
-               continue;
-            }
-         } else {
-            non_support_finfo++;
+         if (is_win32_stream(rctx.stream) && !have_win32_api()) {
+            set_portable_backup(&rctx.bfd);
+            /*
+             * "decompose" BackupWrite data
+             */
+            rctx.flags |= FO_WIN32DECOMP;
          }
-         break;
 
-      case STREAM_UNIX_ACCESS_ACL:
-      case STREAM_UNIX_DEFAULT_ACL:
-      case STREAM_ACL_AIX_TEXT:
-      case STREAM_ACL_DARWIN_ACCESS_ACL:
-      case STREAM_ACL_FREEBSD_DEFAULT_ACL:
-      case STREAM_ACL_FREEBSD_ACCESS_ACL:
-      case STREAM_ACL_HPUX_ACL_ENTRY:
-      case STREAM_ACL_IRIX_DEFAULT_ACL:
-      case STREAM_ACL_IRIX_ACCESS_ACL:
-      case STREAM_ACL_LINUX_DEFAULT_ACL:
-      case STREAM_ACL_LINUX_ACCESS_ACL:
-      case STREAM_ACL_TRU64_DEFAULT_ACL:
-      case STREAM_ACL_TRU64_DEFAULT_DIR_ACL:
-      case STREAM_ACL_TRU64_ACCESS_ACL:
-      case STREAM_ACL_SOLARIS_ACLENT:
-      case STREAM_ACL_SOLARIS_ACE:
-      case STREAM_ACL_AFS_TEXT:
-      case STREAM_ACL_AIX_AIXC:
-      case STREAM_ACL_AIX_NFS4:
-      case STREAM_ACL_FREEBSD_NFS4_ACL:
-         /*
-          * Do not restore ACLs when
-          * a) The current file is not extracted
-          * b)     and it is not a directory (they are never "extracted")
-          * c) or the file name is empty
-          */
-         if ((!rctx.extract &&
-               jcr->last_type != FT_DIREND) ||
-             (*jcr->last_fname == 0)) {
-            break;
+         if (extract_data(rctx, &rctx.bfd, msg, msglen, &rctx.fileAddr,
+                          rctx.flags, rctx.stream, &rctx.cipher_ctx) < 0) {
+            rctx.extract = false;
+            bclose(&rctx.bfd);
+            return true;
          }
-         if (have_acl) {
+      }
+      break;
+
+   /*
+    * Resource fork stream - only recorded after a file to be restored
+    * Silently ignore if we cannot write - we already reported that
+    */
+   case STREAM_ENCRYPTED_MACOS_FORK_DATA:
+   case STREAM_MACOS_FORK_DATA:
+      if (have_darwin_os) {
+         rctx.fork_flags = 0;
+         jcr->ff->flags |= FO_HFSPLUS;
+
+         if (rctx.stream == STREAM_ENCRYPTED_MACOS_FORK_DATA) {
+            rctx.fork_flags |= FO_ENCRYPT;
+
             /*
-             * For anything that is not a directory we delay
-             * the restore of acls till a later stage.
+             * Set up a decryption context
              */
-            if (jcr->last_type != FT_DIREND) {
-               push_delayed_restore_stream(rctx, sd);
-            } else {
-               if (!do_restore_acl(jcr, rctx.stream, sd->msg, sd->msglen)) {
-                  goto bail_out;
+            if (rctx.extract && !rctx.fork_cipher_ctx.cipher) {
+               if (!rctx.cs) {
+                  Jmsg1(jcr, M_ERROR, 0, _("Missing encryption session data stream for %s\n"), rctx.attr->ofname);
+                  rctx.extract = false;
+                  bclose(&rctx.bfd);
+                  return true;
+               }
+
+               if ((rctx.fork_cipher_ctx.cipher = crypto_cipher_new(rctx.cs, false, &rctx.fork_cipher_ctx.block_size)) == NULL) {
+                  Jmsg1(jcr, M_ERROR, 0, _("Failed to initialize decryption context for %s\n"), rctx.attr->ofname);
+                  free_session(rctx);
+                  rctx.extract = false;
+                  bclose(&rctx.bfd);
+                  return true;
                }
             }
-         } else {
-            non_support_acl++;
          }
-         break;
 
-      case STREAM_XATTR_IRIX:
-      case STREAM_XATTR_TRU64:
-      case STREAM_XATTR_AIX:
-      case STREAM_XATTR_OPENBSD:
-      case STREAM_XATTR_SOLARIS_SYS:
-      case STREAM_XATTR_DARWIN:
-      case STREAM_XATTR_FREEBSD:
-      case STREAM_XATTR_LINUX:
-      case STREAM_XATTR_NETBSD:
-         /*
-          * Do not restore Extended Attributes when
-          * a) The current file is not extracted
-          * b)     and it is not a directory (they are never "extracted")
-          * c) or the file name is empty
-          */
-         if ((!rctx.extract &&
-               jcr->last_type != FT_DIREND) ||
-             (*jcr->last_fname == 0)) {
-            break;
-         }
-         if (have_xattr) {
-            /*
-             * For anything that is not a directory we delay
-             * the restore of xattr till a later stage.
-             */
-            if (jcr->last_type != FT_DIREND) {
-               push_delayed_restore_stream(rctx, sd);
-            } else {
-               if (!do_restore_xattr(jcr, rctx.stream, sd->msg, sd->msglen)) {
-                  goto bail_out;
+         if (rctx.extract) {
+            if (rctx.prev_stream != rctx.stream) {
+               if (bopen_rsrc(&rctx.forkbfd, rctx.attr->ofname, O_WRONLY | O_TRUNC | O_BINARY, 0) < 0) {
+                  Jmsg(jcr, M_WARNING, 0, _("Cannot open resource fork for %s.\n"), rctx.attr->ofname);
+                  rctx.extract = false;
+                  return true;
                }
+
+               rctx.fork_size = rctx.rsrc_len;
+               Dmsg0(130, "Restoring resource fork\n");
             }
-         } else {
-            non_support_xattr++;
-         }
-         break;
 
-      case STREAM_XATTR_SOLARIS:
-         /*
-          * Do not restore Extended Attributes when
-          * a) The current file is not extracted
-          * b)     and it is not a directory (they are never "extracted")
-          * c) or the file name is empty
-          */
-         if ((!rctx.extract &&
-               jcr->last_type != FT_DIREND) ||
-             (*jcr->last_fname == 0)) {
-            break;
-         }
-         if (have_xattr) {
-            if (!do_restore_xattr(jcr, rctx.stream, sd->msg, sd->msglen)) {
-               goto bail_out;
+            if (extract_data(rctx, &rctx.forkbfd, msg, msglen, &rctx.fork_addr, rctx.fork_flags,
+                             rctx.stream, &rctx.fork_cipher_ctx) < 0) {
+               rctx.extract = false;
+               bclose(&rctx.forkbfd);
+               return true;
             }
-         } else {
-            non_support_xattr++;
          }
-         break;
+      } else {
+         rctx.non_support_rsrc++;
+      }
+      break;
 
-      case STREAM_SIGNED_DIGEST:
-         /*
-          * Is this an unexpected signature?
-          */
-         if (rctx.sig) {
-            Jmsg0(jcr, M_ERROR, 0, _("Unexpected cryptographic signature data stream.\n"));
-            free_signature(rctx);
-            continue;
+   case STREAM_HFSPLUS_ATTRIBUTES:
+      if (have_darwin_os) {
+         if (!restore_finderinfo(rctx, msg, msglen)) {
+            return true;
          }
+      } else {
+         rctx.non_support_finfo++;
+      }
+      break;
+
+   case STREAM_UNIX_ACCESS_ACL:
+   case STREAM_UNIX_DEFAULT_ACL:
+   case STREAM_ACL_AIX_TEXT:
+   case STREAM_ACL_DARWIN_ACCESS_ACL:
+   case STREAM_ACL_FREEBSD_DEFAULT_ACL:
+   case STREAM_ACL_FREEBSD_ACCESS_ACL:
+   case STREAM_ACL_HPUX_ACL_ENTRY:
+   case STREAM_ACL_IRIX_DEFAULT_ACL:
+   case STREAM_ACL_IRIX_ACCESS_ACL:
+   case STREAM_ACL_LINUX_DEFAULT_ACL:
+   case STREAM_ACL_LINUX_ACCESS_ACL:
+   case STREAM_ACL_TRU64_DEFAULT_ACL:
+   case STREAM_ACL_TRU64_DEFAULT_DIR_ACL:
+   case STREAM_ACL_TRU64_ACCESS_ACL:
+   case STREAM_ACL_SOLARIS_ACLENT:
+   case STREAM_ACL_SOLARIS_ACE:
+   case STREAM_ACL_AFS_TEXT:
+   case STREAM_ACL_AIX_AIXC:
+   case STREAM_ACL_AIX_NFS4:
+   case STREAM_ACL_FREEBSD_NFS4_ACL:
+      /*
+       * Do not restore ACLs when
+       * a) The current file is not extracted
+       * b)     and it is not a directory (they are never "extracted")
+       * c) or the file name is empty
+       */
+      if ((!rctx.extract &&
+            rctx.attr->type != FT_DIREND) ||
+          (*rctx.attr->ofname == 0)) {
+         break;
+      }
+      if (have_acl) {
          /*
-          * Save signature.
+          * For anything that is not a directory we delay
+          * the restore of acls till a later stage.
           */
-         if (rctx.extract && (rctx.sig = crypto_sign_decode(jcr, (uint8_t *)sd->msg, (uint32_t)sd->msglen)) == NULL) {
-            Jmsg1(jcr, M_ERROR, 0, _("Failed to decode message signature for %s\n"), jcr->last_fname);
+         if (rctx.attr->type != FT_DIREND) {
+            push_delayed_restore_stream(rctx, msg, msglen);
+         } else if (rctx.jdir) {
+            journal_restore_stream(rctx, msg, msglen);
+         } else {
+            if (!do_restore_acl(jcr, rctx.stream, msg, msglen)) {
+               return false;
+            }
          }
-         break;
+      } else {
+         rctx.non_support_acl++;
+      }
+      break;
 
-      case STREAM_MD5_DIGEST:
-      case STREAM_SHA1_DIGEST:
-      case STREAM_SHA256_DIGEST:
-      case STREAM_SHA512_DIGEST:
+   case STREAM_XATTR_IRIX:
+   case STREAM_XATTR_TRU64:
+   case STREAM_XATTR_AIX:
+   case STREAM_XATTR_OPENBSD:
+   case STREAM_XATTR_SOLARIS_SYS:
+   case STREAM_XATTR_DARWIN:
+   case STREAM_XATTR_FREEBSD:
+   case STREAM_XATTR_LINUX:
+   case STREAM_XATTR_NETBSD:
+      /*
+       * Do not restore Extended Attributes when
+       * a) The current file is not extracted
+       * b)     and it is not a directory (they are never "extracted")
+       * c) or the file name is empty
+       */
+      if ((!rctx.extract &&
+            rctx.attr->type != FT_DIREND) ||
+          (*rctx.attr->ofname == 0)) {
          break;
-
-      case STREAM_PROGRAM_NAMES:
-      case STREAM_PROGRAM_DATA:
-         if (!non_support_progname) {
-            Pmsg0(000, "Got Program Name or Data Stream. Ignored.\n");
-            non_support_progname++;
+      }
+      if (have_xattr) {
+         /*
+          * For anything that is not a directory we delay
+          * the restore of xattr till a later stage.
+          */
+         if (rctx.attr->type != FT_DIREND) {
+            push_delayed_restore_stream(rctx, msg, msglen);
+         } else if (rctx.jdir) {
+            journal_restore_stream(rctx, msg, msglen);
+         } else {
+            if (!do_restore_xattr(jcr, rctx.stream, msg, msglen)) {
+               return false;
+            }
          }
+      } else {
+         rctx.non_support_xattr++;
+      }
+      break;
+
+   case STREAM_XATTR_SOLARIS:
+      /*
+       * Do not restore Extended Attributes when
+       * a) The current file is not extracted
+       * b)     and it is not a directory (they are never "extracted")
+       * c) or the file name is empty
+       */
+      if ((!rctx.extract &&
+            rctx.attr->type != FT_DIREND) ||
+          (*rctx.attr->ofname == 0)) {
          break;
+      }
+      if (have_xattr) {
+         lock_restore_fname(rctx);
+         ok = do_restore_xattr(jcr, rctx.stream, msg, msglen);
+         unlock_restore_fname(rctx);
+         if (!ok) {
+            return false;
+         }
+      } else {
+         rctx.non_support_xattr++;
+      }
+      break;
+
+   case STREAM_SIGNED_DIGEST:
+      /*
+       * Is this an unexpected signature?
+       */
+      if (rctx.sig) {
+         Jmsg0(jcr, M_ERROR, 0, _("Unexpected cryptographic signature data stream.\n"));
+         free_signature(rctx);
+         return true;
+      }
+      /*
+       * Save signature.
+       */
+      if (rctx.extract && (rctx.sig = crypto_sign_decode(jcr, (uint8_t *)msg, (uint32_t)msglen)) == NULL) {
+         Jmsg1(jcr, M_ERROR, 0, _("Failed to decode message signature for %s\n"), rctx.attr->ofname);
+      }
+      break;
+
+   case STREAM_MD5_DIGEST:
+   case STREAM_SHA1_DIGEST:
+   case STREAM_SHA256_DIGEST:
+   case STREAM_SHA512_DIGEST:
+      break;
+
+   case STREAM_PROGRAM_NAMES:
+   case STREAM_PROGRAM_DATA:
+      if (!rctx.non_support_progname) {
+         Pmsg0(000, "Got Program Name or Data Stream. Ignored.\n");
+         rctx.non_support_progname++;
+      }
+      break;
+
+   case STREAM_PLUGIN_NAME:
+      if (!close_previous_stream(jcr, rctx)) {
+         return false;
+      }
+      Dmsg1(50, "restore stream_plugin_name=%s\n", msg);
+      plugin_name_stream(jcr, msg);
+      break;
+
+   case STREAM_RESTORE_OBJECT:
+      break;                    /* these are sent by Director */
+
+   default:
+      if (!close_previous_stream(jcr, rctx)) {
+         return false;
+      }
+      Jmsg(jcr, M_WARNING, 0, _("Unknown stream=%d ignored. This shouldn't happen!\n"),
+           rctx.stream);
+      Dmsg2(0, "Unknown stream=%d data=%s\n", rctx.stream, msg);
+      break;
+   } /* end switch(stream) */
+   return true;
+}
+
+/*
+ * Setup a restore context for the job
+ */
+static void init_restore_ctx(JCR *jcr, r_ctx &rctx)
+{
+   memset(&rctx, 0, sizeof(rctx));
+   rctx.jcr = jcr;
+
+   /* use the same buffer size to decompress both gzip and lzo */
+   if (have_libz || have_lzo) {
+      rctx.compress_buf_size = jcr->buf_size + 12 + ((jcr->buf_size+999) / 1000) + 100;
+      rctx.compress_buf = get_memory(rctx.compress_buf_size);
+   }
+
+   if (have_crypto) {
+      rctx.cipher_ctx.buf = get_memory(CRYPTO_CIPHER_MAX_BLOCK_SIZE);
+      if (have_darwin_os) {
+         rctx.fork_cipher_ctx.buf = get_memory(CRYPTO_CIPHER_MAX_BLOCK_SIZE);
+      }
+   }
+
+#ifndef HAVE_WIN32
+   rctx.cbuf = get_memory(RESTORE_WRITE_SIZE);
+#endif
+
+   binit(&rctx.bfd);
+   binit(&rctx.forkbfd);
+   rctx.attr = new_attr(jcr);
+}
+
+/*
+ * If output file is still open, it was the last one in the
+ * archive since we just hit an end of file, so close the file.
+ */
+static bool close_restore_ctx(r_ctx &rctx)
+{
+   if (is_bopen(&rctx.forkbfd)) {
+      bclose_chksize(rctx, &rctx.forkbfd, rctx.fork_size);
+   }
+   return close_previous_stream(rctx.jcr, rctx);
+}
+
+static void free_restore_ctx(r_ctx &rctx)
+{
+   if (rctx.writer) {
+      stop_restore_writer(rctx, true);
+   }
+
+   /*
+    * Free Signature & Crypto Data
+    */
+   free_signature(rctx);
+   free_session(rctx);
+
+   /*
+    * Free file cipher restore context
+    */
+   if (rctx.cipher_ctx.cipher) {
+      crypto_cipher_free(rctx.cipher_ctx.cipher);
+      rctx.cipher_ctx.cipher = NULL;
+   }
+
+   if (rctx.cipher_ctx.buf) {
+      free_pool_memory(rctx.cipher_ctx.buf);
+      rctx.cipher_ctx.buf = NULL;
+   }
+
+   /*
+    * Free alternate stream cipher restore context
+    */
+   if (rctx.fork_cipher_ctx.cipher) {
+      crypto_cipher_free(rctx.fork_cipher_ctx.cipher);
+      rctx.fork_cipher_ctx.cipher = NULL;
+   }
+   if (rctx.fork_cipher_ctx.buf) {
+      free_pool_memory(rctx.fork_cipher_ctx.buf);
+      rctx.fork_cipher_ctx.buf = NULL;
+   }
+
+   if (rctx.compress_buf) {
+      free_pool_memory(rctx.compress_buf);
+      rctx.compress_buf = NULL;
+      rctx.compress_buf_size = 0;
+   }
+
+   if (rctx.cbuf) {
+      free_pool_memory(rctx.cbuf);
+      rctx.cbuf = NULL;
+   }
+
+   /*
+    * Free the delayed stream stack list.
+    */
+   if (rctx.delayed_streams) {
+      drop_delayed_restore_streams(rctx, false);
+      delete rctx.delayed_streams;
+      rctx.delayed_streams = NULL;
+   }
+
+   bclose(&rctx.forkbfd);
+   bclose(&rctx.bfd);
+   free_attr(rctx.attr);
+   rctx.attr = NULL;
+}
+
+static RESTORE_REC *new_restore_rec(int32_t full_stream, char *msg, int32_t msglen)
+{
+   RESTORE_REC *rec;
+
+   rec = (RESTORE_REC *)malloc(sizeof(RESTORE_REC) + msglen);
+   rec->full_stream = full_stream;
+   rec->len = msglen;
+   memcpy(rec->data, msg, msglen);
+   rec->data[msglen] = 0;
+   return rec;
+}
+
+/*
+ * Restore worker thread. Restores the records queued for it
+ *  by the thread reading the Storage daemon.
+ */
+static void *restore_worker(void *arg)
+{
+   RESTORE_WORKER *w = (RESTORE_WORKER *)arg;
+   RESTORE_WORKERS *wp = w->pool;
+   RESTORE_REC *rec;
+   bool ok;
+
+   set_jcr_in_tsd(wp->jcr);
+   P(wp->mutex);
+   for ( ;; ) {
+      while ((rec = (RESTORE_REC *)w->queue->first()) == NULL && !wp->quit) {
+         pthread_cond_wait(&w->work, &wp->mutex);
+      }
+      if (!rec) {
+         break;                       /* asked to quit and nothing left */
+      }
+      w->queue->remove(rec);
+      ok = !wp->failed;
+      V(wp->mutex);
+
+      /* Once something went wrong, just drop the records */
+      if (ok && !job_canceled(wp->jcr)) {
+         if (rec->full_stream == 0) {
+            ok = close_restore_ctx(w->rctx);
+         } else {
+            ok = restore_record(w->rctx, rec->full_stream, rec->data, rec->len);
+         }
+      }
+      free(rec);
+
+      P(wp->mutex);
+      if (!ok) {
+         wp->failed = true;
+      }
+      w->queued--;
+      pthread_cond_signal(&wp->done);
+   }
+   V(wp->mutex);
+   return NULL;
+}
+
+static void stop_restore_workers(RESTORE_WORKERS *wp, r_ctx &rctx);
+
+/*
+ * Start the restore workers. Returns NULL if the files must
+ *  be restored by the thread reading the Storage daemon.
+ */
+static RESTORE_WORKERS *start_restore_workers(JCR *jcr, uint32_t nthreads)
+{
+   RESTORE_WORKERS *wp;
+   RESTORE_WORKER *w;
+   RESTORE_REC *rec = NULL;
+   int stat;
+
+   /*
+    * Signature verification uses a single digest for the job and
+    *  resource forks are restored on the job FF_PKT, so keep these
+    *  restores serial.
+    */
+   if (nthreads <= 1 || jcr->crypto.pki_sign || have_darwin_os) {
+      return NULL;
+   }
+   nthreads = MIN(nthreads, 64);
+
+   wp = (RESTORE_WORKERS *)malloc(sizeof(RESTORE_WORKERS));
+   memset(wp, 0, sizeof(RESTORE_WORKERS));
+   wp->jcr = jcr;
+   pthread_mutex_init(&wp->mutex, NULL);
+   pthread_mutex_init(&wp->fname_mutex, NULL);
+   pthread_cond_init(&wp->done, NULL);
+   wp->dest = DEST_INLINE;
+   wp->deferred = New(dlist(rec, &rec->link));
+   wp->worker = (RESTORE_WORKER *)malloc(nthreads * sizeof(RESTORE_WORKER));
+   memset(wp->worker, 0, nthreads * sizeof(RESTORE_WORKER));
+
+   for (uint32_t i = 0; i < nthreads; i++) {
+      w = &wp->worker[i];
+      w->pool = wp;
+      w->queue = New(dlist(rec, &rec->link));
+      pthread_cond_init(&w->work, NULL);
+      init_restore_ctx(jcr, w->rctx);
+      w->rctx.workers = wp;
+      wp->nworkers++;
+      if ((stat = pthread_create(&w->tid, NULL, restore_worker, (void *)w)) != 0) {
+         berrno be;
+         Jmsg1(jcr, M_WARNING, 0, _("Cannot create restore thread: ERR=%s\n"),
+               be.bstrerror(stat));
+         break;
+      }
+      w->started = true;
+   }
+   if (!wp->worker[0].started) {
+      r_ctx unused;
+      memset(&unused, 0, sizeof(unused));
+      stop_restore_workers(wp, unused);
+      return NULL;
+   }
+   Dmsg1(50, "Started %d restore threads\n", wp->nworkers);
+   return wp;
+}
+
+/*
+ * Stop the workers and release the pool. The "known unknowns"
+ *  of the workers are added to the given context.
+ */
+static void stop_restore_workers(RESTORE_WORKERS *wp, r_ctx &rctx)
+{
+   RESTORE_WORKER *w;
+   RESTORE_REC *rec;
+   int32_t i;
+
+   P(wp->mutex);
+   wp->quit = true;
+   for (i = 0; i < wp->nworkers; i++) {
+      pthread_cond_signal(&wp->worker[i].work);
+   }
+   V(wp->mutex);
+
+   for (i = 0; i < wp->nworkers; i++) {
+      w = &wp->worker[i];
+      if (w->started) {
+         pthread_join(w->tid, NULL);
+      }
+      rctx.non_support_data += w->rctx.non_support_data;
+      rctx.non_support_attr += w->rctx.non_support_attr;
+      rctx.non_support_rsrc += w->rctx.non_support_rsrc;
+      rctx.non_support_finfo += w->rctx.non_support_finfo;
+      rctx.non_support_acl += w->rctx.non_support_acl;
+      rctx.non_support_progname += w->rctx.non_support_progname;
+      rctx.non_support_crypto += w->rctx.non_support_crypto;
+      rctx.non_support_xattr += w->rctx.non_support_xattr;
+      free_restore_ctx(w->rctx);
+      while ((rec = (RESTORE_REC *)w->queue->first())) {
+         w->queue->remove(rec);
+         free(rec);
+      }
+      delete w->queue;
+      pthread_cond_destroy(&w->work);
+   }
+   while ((rec = (RESTORE_REC *)wp->deferred->first())) {
+      wp->deferred->remove(rec);
+      free(rec);
+   }
+   delete wp->deferred;
+   pthread_cond_destroy(&wp->done);
+   pthread_mutex_destroy(&wp->fname_mutex);
+   pthread_mutex_destroy(&wp->mutex);
+   free(wp->worker);
+   free(wp);
+}
+
+/*
+ * Queue a record for a worker, wait if the worker is too far behind
+ */
+static bool queue_restore_rec(RESTORE_WORKERS *wp, int32_t i, RESTORE_REC *rec)
+{
+   RESTORE_WORKER *w = &wp->worker[i];
+   bool ok;
+
+   P(wp->mutex);
+   while (w->queued >= RESTORE_QUEUE_MAX && !wp->failed) {
+      pthread_cond_wait(&wp->done, &wp->mutex);
+   }
+   ok = !wp->failed;
+   if (ok) {
+      w->queue->append(rec);
+      w->queued++;
+      pthread_cond_signal(&w->work);
+   }
+   V(wp->mutex);
+   if (!ok) {
+      free(rec);
+   }
+   return ok;
+}
+
+/*
+ * Make all the workers close their current file and wait
+ *  until they are idle. Returns false if a worker failed.
+ */
+static bool drain_restore_workers(RESTORE_WORKERS *wp)
+{
+   int32_t i;
+   bool ok;
+
+   for (i = 0; i < wp->nworkers; i++) {
+      if (!queue_restore_rec(wp, i, new_restore_rec(0, (char *)"", 0))) {
+         return false;
+      }
+   }
+   P(wp->mutex);
+   for (i = 0; i < wp->nworkers; i++) {
+      while (wp->worker[i].queued > 0) {
+         pthread_cond_wait(&wp->done, &wp->mutex);
+      }
+   }
+   ok = !wp->failed;
+   V(wp->mutex);
+   return ok;
+}
+
+/*
+ * Pick the worker with the shortest queue for a new file
+ */
+static int32_t select_restore_worker(RESTORE_WORKERS *wp)
+{
+   int32_t i, best = 0;
+
+   P(wp->mutex);
+   for (i = 1; i < wp->nworkers; i++) {
+      if (wp->worker[i].queued < wp->worker[best].queued) {
+         best = i;
+      }
+   }
+   V(wp->mutex);
+   return best;
+}
+
+/*
+ * Hand a record over to the place where its file is restored.
+ *  An attributes record chooses the worker for the new file and
+ *  the records that follow go to the same worker. Directories
+ *  are restored at the end, once all their files are written,
+ *  so that their attributes stick. Hard links and plugin files
+ *  are restored only when the workers are idle.
+ */
+static bool dispatch_restore_record(RESTORE_WORKERS *wp, r_ctx &rctx,
+                                    int32_t full_stream, char *msg, int32_t msglen)
+{
+   JCR *jcr = rctx.jcr;
+   int32_t file_index, type;
+
+   switch (full_stream & STREAMMASK_TYPE) {
+   case STREAM_UNIX_ATTRIBUTES:
+   case STREAM_UNIX_ATTRIBUTES_EX:
+      if (jcr->plugin) {
+         wp->dest = DEST_INLINE;
+         break;
+      }
+      if (sscanf(msg, "%d %d", &file_index, &type) != 2) {
+         wp->dest = DEST_INLINE;      /* let restore_record() complain */
+         break;
+      }
+      switch (type & FT_MASK) {
+      case FT_DIREND:
+         wp->dest = DEST_DEFERRED;
+         break;
+      case FT_LNKSAVED:
+         /* The file we link to must be complete */
+         if (!drain_restore_workers(wp)) {
+            return false;
+         }
+         wp->dest = select_restore_worker(wp);
+         break;
+      default:
+         wp->dest = select_restore_worker(wp);
+         break;
+      }
+      break;
+
+   case STREAM_PLUGIN_NAME:
+      /* Plugins do not expect to be called from several threads */
+      if (!drain_restore_workers(wp)) {
+         return false;
+      }
+      wp->dest = DEST_INLINE;
+      break;
+
+   default:
+      break;
+   }
+
+   switch (wp->dest) {
+   case DEST_INLINE:
+      return restore_record(rctx, full_stream, msg, msglen);
+   case DEST_DEFERRED:
+      wp->deferred->append(new_restore_rec(full_stream, msg, msglen));
+      return true;
+   default:
+      return queue_restore_rec(wp, wp->dest, new_restore_rec(full_stream, msg, msglen));
+   }
+}
+
+/*
+ * Restore the requested files.
+ */
+void do_restore(JCR *jcr)
+{
+   BSOCK *sd;
+   uint32_t VolSessionId, VolSessionTime;
+   int32_t file_index;
+   int32_t full_stream;
+   uint32_t size;
+   char ec1[50];                      /* Buffer printing huge values */
+   uint32_t buf_size;                 /* client buffer size */
+   uint32_t nthreads;                 /* files restored in parallel */
+   bool defer_attributes;             /* journal the file attributes */
+   r_ctx rctx;
+   RESTORE_WORKERS *workers = NULL;
+   RESTORE_REC *rec;
+   bool ok;
+
+   sd = jcr->store_bsock;
+   jcr->setJobStatus(JS_Running);
+
+   LockRes();
+   CLIENT *client = (CLIENT *)GetNextRes(R_CLIENT, NULL);
+   UnlockRes();
+   if (client) {
+      buf_size = client->max_network_buffer_size;
+      nthreads = client->MaxRestoreThreads;
+      defer_attributes = client->DeferRestoreAttributes;
+   } else {
+      buf_size = 0;                   /* use default */
+      nthreads = 1;
+      defer_attributes = false;
+   }
+   if (!bnet_set_buffer_size(sd, buf_size, BNET_SETBUF_WRITE)) {
+      jcr->setJobStatus(JS_ErrorTerminated);
+      return;
+   }
+   jcr->buf_size = sd->msglen;
+
+   /*
+    * St Bernard code goes here if implemented -- see end of file
+    */
+
+   init_restore_ctx(jcr, rctx);
+
+#ifdef HAVE_LZO
+   if (lzo_init() != LZO_E_OK) {
+      Jmsg(jcr, M_FATAL, 0, _("LZO init failed\n"));
+      goto bail_out;
+   }
+#endif
+
+   /*
+    * Get a record from the Storage daemon. We are guaranteed to
+    *   receive records in the following order:
+    *   1. Stream record header
+    *   2. Stream data (one or more of the following in the order given)
+    *        a. Attributes (Unix or Win32)
+    *        b. Possibly stream encryption session data (e.g., symmetric session key)
+    *        c. File data for the file
+    *        d. Alternate data stream (e.g. Resource Fork)
+    *        e. Finder info
+    *        f. ACLs
+    *        g. XATTRs
+    *        h. Possibly a cryptographic signature
+    *        i. Possibly MD5 or SHA1 record
+    *   3. Repeat step 1
+    *
+    * NOTE: We keep track of two bacula file descriptors:
+    *   1. bfd for file data.
+    *      This fd is opened for non empty files when an attribute stream is
+    *      encountered and closed when we find the next attribute stream.
+    *   2. fork_bfd for alternate data streams
+    *      This fd is opened every time we encounter a new alternate data
+    *      stream for the current file. When we find any other stream, we
+    *      close it again.
+    *      The expected size of the stream, fork_len, should be set when
+    *      opening the fd.
+    *   3. Not all the stream data records are required -- e.g. if there
+    *      is no fork, there is no alternate data stream, no ACL, ...
+    *
+    * With Maximum Restore Threads > 1, all the records of a file are
+    *   given to one restore worker, each worker having its own
+    *   restore context (see dispatch_restore_record()).
+    */
+   if (have_acl) {
+      jcr->acl_data = (acl_data_t *)malloc(sizeof(acl_data_t));
+      memset(jcr->acl_data, 0, sizeof(acl_data_t));
+      jcr->acl_data->u.parse = (acl_parse_data_t *)malloc(sizeof(acl_parse_data_t));
+      memset(jcr->acl_data->u.parse, 0, sizeof(acl_parse_data_t));
+   }
+   if (have_xattr) {
+      jcr->xattr_data = (xattr_data_t *)malloc(sizeof(xattr_data_t));
+      memset(jcr->xattr_data, 0, sizeof(xattr_data_t));
+      jcr->xattr_data->u.parse = (xattr_parse_data_t *)malloc(sizeof(xattr_parse_data_t));
+      memset(jcr->xattr_data->u.parse, 0, sizeof(xattr_parse_data_t));
+   }
+
+   if (defer_attributes) {
+      rctx.journal = new_restore_journal();
+   }
+   workers = start_restore_workers(jcr, nthreads);
+   if (workers) {
+      for (int i = 0; i < workers->nworkers; i++) {
+         workers->worker[i].rctx.journal = rctx.journal;
+      }
+   }
+
+   while (bget_msg(sd) >= 0 && !job_canceled(jcr)) {
+      /*
+       * First we expect a Stream Record Header
+       */
+      if (sscanf(sd->msg, rec_header, &VolSessionId, &VolSessionTime, &file_index,
+          &full_stream, &size) != 5) {
+         Jmsg1(jcr, M_FATAL, 0, _("Record header scan error: %s\n"), sd->msg);
+         goto bail_out;
+      }
+      Dmsg5(150, "Got hdr: Files=%d FilInx=%d size=%d Stream=%d, %s.\n", 
+            jcr->JobFiles, file_index, size, full_stream & STREAMMASK_TYPE,
+            stream_to_ascii(full_stream & STREAMMASK_TYPE));
 
-      case STREAM_PLUGIN_NAME:
-         if (!close_previous_stream(jcr, rctx)) {
-            goto bail_out;
-         }
-         Dmsg1(50, "restore stream_plugin_name=%s\n", sd->msg);
-         plugin_name_stream(jcr, sd->msg);
-         break;
+      /*
+       * Now we expect the Stream Data
+       */
+      if (bget_msg(sd) < 0) {
+         Jmsg1(jcr, M_FATAL, 0, _("Data record error. ERR=%s\n"), sd->bstrerror());
+         goto bail_out;
+      }
+      if (size != (uint32_t)sd->msglen) {
+         Jmsg2(jcr, M_FATAL, 0, _("Actual data size %d not same as header %d\n"), 
+               sd->msglen, size);
+         Dmsg2(50, "Actual data size %d not same as header %d\n",
+               sd->msglen, size);
+         goto bail_out;
+      }
 
-      case STREAM_RESTORE_OBJECT:
-         break;                    /* these are sent by Director */
+      if (workers) {
+         ok = dispatch_restore_record(workers, rctx, full_stream, sd->msg, sd->msglen);
+      } else {
+         ok = restore_record(rctx, full_stream, sd->msg, sd->msglen);
+      }
+      if (!ok) {
+         goto bail_out;
+      }
+   } /* end while get_msg() */
 
-      default:
-         if (!close_previous_stream(jcr, rctx)) {
+   if (workers) {
+      if (!drain_restore_workers(workers)) {
+         goto bail_out;
+      }
+      /*
+       * Now that all the files are there, restore the directories
+       */
+      while (!job_canceled(jcr) &&
+             (rec = (RESTORE_REC *)workers->deferred->first())) {
+         workers->deferred->remove(rec);
+         ok = restore_record(rctx, rec->full_stream, rec->data, rec->len);
+         free(rec);
+         if (!ok) {
             goto bail_out;
          }
-         Jmsg(jcr, M_WARNING, 0, _("Unknown stream=%d ignored. This shouldn't happen!\n"),
-              rctx.stream);
-         Dmsg2(0, "Unknown stream=%d data=%s\n", rctx.stream, sd->msg);
-         break;
-      } /* end switch(stream) */
-   } /* end while get_msg() */
-
-   /*
-    * If output file is still open, it was the last one in the
-    * archive since we just hit an end of file, so close the file.
-    */
-   if (is_bopen(&rctx.forkbfd)) {
-      bclose_chksize(jcr, &rctx.forkbfd, rctx.fork_size);
+      }
    }
 
-   if (!close_previous_stream(jcr, rctx)) {
+   if (!close_restore_ctx(rctx)) {
       goto bail_out;
    }
    jcr->setJobStatus(JS_Terminated);
@@ -1049,6 +1924,22 @@ bail_out:
    jcr->setJobStatus(JS_ErrorTerminated);
 
 ok_out:
+   if (workers) {
+      stop_restore_workers(workers, rctx);
+   }
+
+   /*
+    * Set the deferred attributes of what we restored, even
+    *  if the job failed.
+    */
+   if (rctx.journal) {
+      if (!apply_restore_journal(rctx, true)) {
+         jcr->setJobStatus(JS_ErrorTerminated);
+      }
+      free_restore_journal(rctx.journal);
+      rctx.journal = NULL;
+   }
+
    /*
     * First output the statistics.
     */
@@ -1062,67 +1953,35 @@ ok_out:
       Jmsg(jcr, M_WARNING, 0, _("Encountered %ld xattr errors while doing restore\n"),
            jcr->xattr_data->u.parse->nr_errors);
    }
-   if (non_support_data > 1 || non_support_attr > 1) {
+   if (rctx.non_support_data > 1 || rctx.non_support_attr > 1) {
       Jmsg(jcr, M_WARNING, 0, _("%d non-supported data streams and %d non-supported attrib streams ignored.\n"),
-         non_support_data, non_support_attr);
+         rctx.non_support_data, rctx.non_support_attr);
    }
-   if (non_support_rsrc) {
-      Jmsg(jcr, M_INFO, 0, _("%d non-supported resource fork streams ignored.\n"), non_support_rsrc);
+   if (rctx.non_support_rsrc) {
+      Jmsg(jcr, M_INFO, 0, _("%d non-supported resource fork streams ignored.\n"), rctx.non_support_rsrc);
    }
-   if (non_support_finfo) {
-      Jmsg(jcr, M_INFO, 0, _("%d non-supported Finder Info streams ignored.\n"), non_support_rsrc);
+   if (rctx.non_support_finfo) {
+      Jmsg(jcr, M_INFO, 0, _("%d non-supported Finder Info streams ignored.\n"), rctx.non_support_rsrc);
    }
-   if (non_support_acl) {
-      Jmsg(jcr, M_INFO, 0, _("%d non-supported acl streams ignored.\n"), non_support_acl);
+   if (rctx.non_support_acl) {
+      Jmsg(jcr, M_INFO, 0, _("%d non-supported acl streams ignored.\n"), rctx.non_support_acl);
    }
-   if (non_support_crypto) {
-      Jmsg(jcr, M_INFO, 0, _("%d non-supported crypto streams ignored.\n"), non_support_acl);
+   if (rctx.non_support_crypto) {
+      Jmsg(jcr, M_INFO, 0, _("%d non-supported crypto streams ignored.\n"), rctx.non_support_acl);
    }
-   if (non_support_xattr) {
-      Jmsg(jcr, M_INFO, 0, _("%d non-supported xattr streams ignored.\n"), non_support_xattr);
+   if (rctx.non_support_xattr) {
+      Jmsg(jcr, M_INFO, 0, _("%d non-supported xattr streams ignored.\n"), rctx.non_support_xattr);
    }
 
    /*
     * Free Signature & Crypto Data
     */
-   free_signature(rctx);
-   free_session(rctx);
+   free_restore_ctx(rctx);
    if (jcr->crypto.digest) {
       crypto_digest_free(jcr->crypto.digest);
       jcr->crypto.digest = NULL;
    }
 
-   /*
-    * Free file cipher restore context
-    */
-   if (rctx.cipher_ctx.cipher) {
-      crypto_cipher_free(rctx.cipher_ctx.cipher);
-      rctx.cipher_ctx.cipher = NULL;
-   }
-
-   if (rctx.cipher_ctx.buf) {
-      free_pool_memory(rctx.cipher_ctx.buf);
-      rctx.cipher_ctx.buf = NULL;
-   }
-
-   /*
-    * Free alternate stream cipher restore context
-    */
-   if (rctx.fork_cipher_ctx.cipher) {
-      crypto_cipher_free(rctx.fork_cipher_ctx.cipher);
-      rctx.fork_cipher_ctx.cipher = NULL;
-   }
-   if (rctx.fork_cipher_ctx.buf) {
-      free_pool_memory(rctx.fork_cipher_ctx.buf);
-      rctx.fork_cipher_ctx.buf = NULL;
-   }
-
-   if (jcr->compress_buf) {
-      free_pool_memory(jcr->compress_buf);
-      jcr->compress_buf = NULL;
-      jcr->compress_buf_size = 0;
-   }
-
    if (have_acl && jcr->acl_data) {
       free(jcr->acl_data->u.parse);
       free(jcr->acl_data);
@@ -1134,18 +1993,6 @@ ok_out:
       free(jcr->xattr_data);
       jcr->xattr_data = NULL;
    }
-
-   /*
-    * Free the delayed stream stack list.
-    */
-   if (rctx.delayed_streams) {
-      drop_delayed_restore_streams(rctx, false);
-      delete rctx.delayed_streams;
-   }
-
-   bclose(&rctx.forkbfd);
-   bclose(&rctx.bfd);
-   free_attr(rctx.attr);
 }
 
 #ifdef HAVE_LIBZ
@@ -1315,20 +2162,133 @@ bail_out:
    return false;
 }
 
-bool sparse_data(JCR *jcr, BFILE *bfd, uint64_t *addr, char **data, uint32_t *length)
+/*
+ * The file data is gathered into large writes aligned on
+ *  RESTORE_WRITE_SIZE, rather than written record by record.
+ */
+static bool coalesce_restore_writes(r_ctx &rctx, BFILE *bfd)
+{
+   return bfd == &rctx.bfd && rctx.cbuf && !bfd->cmd_plugin;
+}
+
+/*
+ * Write the coalesced data of the file
+ */
+static bool flush_restore_writes(r_ctx &rctx)
+{
+   BFILE *bfd = &rctx.bfd;
+   char ec1[50];
+
+   if (rctx.cbuf_len == 0) {
+      return true;
+   }
+   if (rctx.file_pos != rctx.cbuf_addr && 
+       blseek(bfd, (boffset_t)rctx.cbuf_addr, SEEK_SET) < 0) {
+      berrno be;
+      Jmsg3(rctx.jcr, M_ERROR, 0, _("Seek to %s error on %s: ERR=%s\n"),
+            edit_uint64(rctx.cbuf_addr, ec1), rctx.attr->ofname, 
+            be.bstrerror(bfd->berrno));
+      return false;
+   }
+   if (bwrite(bfd, rctx.cbuf, rctx.cbuf_len) != (ssize_t)rctx.cbuf_len) {
+      berrno be;
+      Jmsg2(rctx.jcr, M_ERROR, 0, _("Write error on %s: %s\n"), 
+            rctx.attr->ofname, be.bstrerror(bfd->berrno));
+      return false;
+   }
+   rctx.cbuf_addr += rctx.cbuf_len;
+   rctx.cbuf_len = 0;
+   rctx.file_pos = rctx.cbuf_addr;
+   if (rctx.file_pos > rctx.data_end) {
+      rctx.data_end = rctx.file_pos;
+   }
+   return true;
+}
+
+/*
+ * The first write or seek of a regular file reserves the space
+ *  of the whole file, so it is laid out in few extents.
+ */
+static void preallocate_restore_file(r_ctx &rctx)
+{
+   if (rctx.prealloc_done) {
+      return;
+   }
+   rctx.prealloc_done = true;
+   if ((rctx.attr->type == FT_REG || rctx.attr->type == FT_REGE) &&
+       rctx.attr->statp.st_size > 0) {
+      rctx.prealloc_ok = bpreallocate(&rctx.bfd, (boffset_t)rctx.attr->statp.st_size);
+      Dmsg2(130, "Preallocate %s ok=%d\n", rctx.attr->ofname, rctx.prealloc_ok);
+   }
+}
+
+/*
+ * Add data to the coalesced writes. The buffer is written each
+ *  time it reaches a RESTORE_WRITE_SIZE boundary of the file.
+ */
+static bool buffer_restore_writes(r_ctx &rctx, char *data, uint32_t length)
+{
+   uint32_t room, len;
+
+   preallocate_restore_file(rctx);
+   while (length > 0) {
+      room = RESTORE_WRITE_SIZE - 
+             (uint32_t)((rctx.cbuf_addr + rctx.cbuf_len) % RESTORE_WRITE_SIZE);
+      len = MIN(room, length);
+      memcpy(rctx.cbuf + rctx.cbuf_len, data, len);
+      rctx.cbuf_len += len;
+      data += len;
+      length -= len;
+      if (len == room && !flush_restore_writes(rctx)) {
+         return false;
+      }
+   }
+   return true;
+}
+
+/*
+ * Seek in a file being restored. With coalesced writes, the
+ *  seek is done when the buffer is written, and a region of a
+ *  preallocated file that was skipped (sparse) is given back.
+ */
+static bool seek_restore_file(r_ctx &rctx, BFILE *bfd, uint64_t addr)
+{
+   char ec1[50];
+
+   if (coalesce_restore_writes(rctx, bfd)) {
+      preallocate_restore_file(rctx);
+      if (addr == rctx.cbuf_addr + rctx.cbuf_len) {
+         return true;
+      }
+      if (!flush_restore_writes(rctx)) {
+         return false;
+      }
+      if (rctx.prealloc_ok && addr > rctx.data_end) {
+         bpunch_hole(bfd, (boffset_t)rctx.data_end, (boffset_t)(addr - rctx.data_end));
+      }
+      rctx.cbuf_addr = addr;
+      return true;
+   }
+   if (blseek(bfd, (boffset_t)addr, SEEK_SET) < 0) {
+      berrno be;
+      Jmsg3(rctx.jcr, M_ERROR, 0, _("Seek to %s error on %s: ERR=%s\n"),
+            edit_uint64(addr, ec1), rctx.attr->ofname, 
+            be.bstrerror(bfd->berrno));
+      return false;
+   }
+   return true;
+}
+
+static bool sparse_data(r_ctx &rctx, BFILE *bfd, uint64_t *addr, char **data, uint32_t *length)
 {
       unser_declare;
       uint64_t faddr;
-      char ec1[50];
       unser_begin(*data, OFFSET_FADDR_SIZE);
       unser_uint64(faddr);
       if (*addr != faddr) {
          *addr = faddr;
-         if (blseek(bfd, (boffset_t)*addr, SEEK_SET) < 0) {
-            berrno be;
-            Jmsg3(jcr, M_ERROR, 0, _("Seek to %s error on %s: ERR=%s\n"),
-                  edit_uint64(*addr, ec1), jcr->last_fname, 
-                  be.bstrerror(bfd->berrno));
+         /* Without bfd, the restore writer does the seek */
+         if (bfd && !seek_restore_file(rctx, bfd, *addr)) {
             return false;
          }
       }
@@ -1337,8 +2297,9 @@ bool sparse_data(JCR *jcr, BFILE *bfd, uint64_t *addr, char **data, uint32_t *le
       return true;
 }
 
-bool decompress_data(JCR *jcr, int32_t stream, char **data, uint32_t *length)
+static bool decompress_data(r_ctx &rctx, int32_t stream, char **data, uint32_t *length)
 {
+   JCR *jcr = rctx.jcr;
 #if defined(HAVE_LZO) || defined(HAVE_LIBZ)
    char ec1[50]; /* Buffer printing huge values */
 #endif
@@ -1379,27 +2340,27 @@ bool decompress_data(JCR *jcr, int32_t stream, char **data, uint32_t *length)
       switch(comp_magic) {
 #ifdef HAVE_LZO
          case COMPRESS_LZO1X:
-            compress_len = jcr->compress_buf_size;
+            compress_len = rctx.compress_buf_size;
             cbuf = (const unsigned char*)*data + sizeof(comp_stream_header);
             real_compress_len = *length - sizeof(comp_stream_header);
             Dmsg2(200, "Comp_len=%d msglen=%d\n", compress_len, *length);
             while ((r=lzo1x_decompress_safe(cbuf, real_compress_len,
-                                            (unsigned char *)jcr->compress_buf, &compress_len, NULL)) == LZO_E_OUTPUT_OVERRUN)
+                                            (unsigned char *)rctx.compress_buf, &compress_len, NULL)) == LZO_E_OUTPUT_OVERRUN)
             {
                /*
                 * The buffer size is too small, try with a bigger one
                 */
-               compress_len = jcr->compress_buf_size = jcr->compress_buf_size + (jcr->compress_buf_size >> 1);
+               compress_len = rctx.compress_buf_size = rctx.compress_buf_size + (rctx.compress_buf_size >> 1);
                Dmsg2(200, "Comp_len=%d msglen=%d\n", compress_len, *length);
-               jcr->compress_buf = check_pool_memory_size(jcr->compress_buf,
+               rctx.compress_buf = check_pool_memory_size(rctx.compress_buf,
                                                     compress_len);
             }
             if (r != LZO_E_OK) {
                Qmsg(jcr, M_ERROR, 0, _("LZO uncompression error on file %s. ERR=%d\n"),
-                    jcr->last_fname, r);
+                    rctx.attr->ofname, r);
                return false;
             }
-            *data = jcr->compress_buf;
+            *data = rctx.compress_buf;
             *length = compress_len;
             Dmsg2(200, "Write uncompressed %d bytes, total before write=%s\n", compress_len, edit_uint64(jcr->JobBytes, ec1));
             return true;
@@ -1418,25 +2379,25 @@ bool decompress_data(JCR *jcr, int32_t stream, char **data, uint32_t *length)
        * needed by the zlib routines, they should not otherwise
        * be used in Bacula.
        */
-      compress_len = jcr->compress_buf_size;
+      compress_len = rctx.compress_buf_size;
       Dmsg2(200, "Comp_len=%d msglen=%d\n", compress_len, *length);
-      while ((stat=uncompress((Byte *)jcr->compress_buf, &compress_len,
+      while ((stat=uncompress((Byte *)rctx.compress_buf, &compress_len,
                               (const Byte *)*data, (uLong)*length)) == Z_BUF_ERROR)
       {
          /*
           * The buffer size is too small, try with a bigger one
           */
-         compress_len = jcr->compress_buf_size = jcr->compress_buf_size + (jcr->compress_buf_size >> 1);
+         compress_len = rctx.compress_buf_size = rctx.compress_buf_size + (rctx.compress_buf_size >> 1);
          Dmsg2(200, "Comp_len=%d msglen=%d\n", compress_len, *length);
-         jcr->compress_buf = check_pool_memory_size(jcr->compress_buf,
+         rctx.compress_buf = check_pool_memory_size(rctx.compress_buf,
                                                     compress_len);
       }
       if (stat != Z_OK) {
          Qmsg(jcr, M_ERROR, 0, _("Uncompression error on file %s. ERR=%s\n"),
-              jcr->last_fname, zlib_strerror(stat));
+              rctx.attr->ofname, zlib_strerror(stat));
          return false;
       }
-      *data = jcr->compress_buf;
+      *data = rctx.compress_buf;
       *length = compress_len;
       Dmsg2(200, "Write uncompressed %d bytes, total before write=%s\n", compress_len, edit_uint64(jcr->JobBytes, ec1));
       return true;
@@ -1457,8 +2418,10 @@ static void unser_crypto_packet_len(RESTORE_CIPHER_CTX *ctx)
    }
 }
 
-bool store_data(JCR *jcr, BFILE *bfd, char *data, const int32_t length, bool win32_decomp)
+static bool store_data(r_ctx &rctx, BFILE *bfd, char *data, const int32_t length, bool win32_decomp)
 {
+   JCR *jcr = rctx.jcr;
+
    if (jcr->crypto.digest) {
       crypto_digest_update(jcr->crypto.digest, (uint8_t *)data, length);
    }
@@ -1466,16 +2429,221 @@ bool store_data(JCR *jcr, BFILE *bfd, char *data, const int32_t length, bool win
       if (!processWin32BackupAPIBlock(bfd, data, length)) {
          berrno be;
          Jmsg2(jcr, M_ERROR, 0, _("Write error in Win32 Block Decomposition on %s: %s\n"), 
-               jcr->last_fname, be.bstrerror(bfd->berrno));
+               rctx.attr->ofname, be.bstrerror(bfd->berrno));
          return false;
       }
+   } else if (coalesce_restore_writes(rctx, bfd)) {
+      return buffer_restore_writes(rctx, data, length);
    } else if (bwrite(bfd, data, length) != (ssize_t)length) {
       berrno be;
       Jmsg2(jcr, M_ERROR, 0, _("Write error on %s: %s\n"), 
-            jcr->last_fname, be.bstrerror(bfd->berrno));
+            rctx.attr->ofname, be.bstrerror(bfd->berrno));
+      return false;
+   }
+
+   return true;
+}
+
+/*
+ * Write one decoded block, called by the writer thread
+ */
+static bool write_restore_block(r_ctx &rctx, RESTORE_WBLOCK *blk)
+{
+   if (blk->seek && !seek_restore_file(rctx, &rctx.bfd, blk->addr)) {
+      return false;
+   }
+   if (!store_data(rctx, &rctx.bfd, blk->buf, blk->len, blk->win32_decomp)) {
+      return false;
+   }
+   update_restore_counters(rctx.jcr, 0, 0, blk->len);
+   return true;
+}
+
+/*
+ * Restore writer thread. Writes the blocks in the order they
+ *  were decoded. Once a write failed, the blocks of the file
+ *  are dropped until wait_restore_writer() is called.
+ */
+static void *restore_writer(void *arg)
+{
+   RESTORE_WRITER *wr = (RESTORE_WRITER *)arg;
+   RESTORE_WBLOCK *blk;
+   bool ok;
+
+   set_jcr_in_tsd(wr->rctx->jcr);
+   P(wr->mutex);
+   for ( ;; ) {
+      while (wr->count == 0 && !wr->quit) {
+         pthread_cond_wait(&wr->cond, &wr->mutex);
+      }
+      if (wr->count == 0) {
+         break;                       /* asked to quit and nothing left */
+      }
+      blk = &wr->block[wr->first];
+      ok = !wr->failed;
+      V(wr->mutex);
+
+      if (ok) {
+         ok = write_restore_block(*wr->rctx, blk);
+      }
+
+      P(wr->mutex);
+      if (!ok) {
+         wr->failed = true;
+      }
+      wr->first = (wr->first + 1) % RESTORE_WRITER_DEPTH;
+      wr->count--;
+      pthread_cond_broadcast(&wr->cond);
+   }
+   V(wr->mutex);
+   return NULL;
+}
+
+static void start_restore_writer(r_ctx &rctx)
+{
+   RESTORE_WRITER *wr;
+   int stat;
+
+   wr = (RESTORE_WRITER *)malloc(sizeof(RESTORE_WRITER));
+   memset(wr, 0, sizeof(RESTORE_WRITER));
+   wr->rctx = &rctx;
+   for (int i = 0; i < RESTORE_WRITER_DEPTH; i++) {
+      wr->block[i].buf = get_memory(rctx.jcr->buf_size);
+   }
+   pthread_mutex_init(&wr->mutex, NULL);
+   pthread_cond_init(&wr->cond, NULL);
+   if ((stat = pthread_create(&wr->tid, NULL, restore_writer, (void *)wr)) != 0) {
+      berrno be;
+      Dmsg1(50, "Cannot create restore writer thread: ERR=%s\n", be.bstrerror(stat));
+      rctx.writer = wr;
+      stop_restore_writer(rctx, false);
+      rctx.no_writer = true;
+      return;
+   }
+   rctx.writer = wr;
+}
+
+/*
+ * Stop the writer thread once all the blocks are written
+ */
+static void stop_restore_writer(r_ctx &rctx, bool started)
+{
+   RESTORE_WRITER *wr = rctx.writer;
+
+   if (started) {
+      P(wr->mutex);
+      wr->quit = true;
+      pthread_cond_broadcast(&wr->cond);
+      V(wr->mutex);
+      pthread_join(wr->tid, NULL);
+   }
+   for (int i = 0; i < RESTORE_WRITER_DEPTH; i++) {
+      free_pool_memory(wr->block[i].buf);
+   }
+   pthread_cond_destroy(&wr->cond);
+   pthread_mutex_destroy(&wr->mutex);
+   free(wr);
+   rctx.writer = NULL;
+}
+
+/*
+ * Wait until all the decoded blocks are written.
+ * Returns: false if a write failed since the last wait
+ */
+static bool wait_restore_writer(RESTORE_WRITER *wr)
+{
+   bool ok;
+
+   P(wr->mutex);
+   while (wr->count > 0) {
+      pthread_cond_wait(&wr->cond, &wr->mutex);
+   }
+   ok = !wr->failed;
+   wr->failed = false;
+   V(wr->mutex);
+   return ok;
+}
+
+/*
+ * Wait for the writer before we touch the file. If a write
+ *  failed, stop extracting it as extract_data() errors do.
+ */
+static void sync_restore_writer(r_ctx &rctx)
+{
+   if (rctx.writer && !wait_restore_writer(rctx.writer)) {
+      rctx.extract = false;
+      bclose(&rctx.bfd);
+   }
+}
+
+/*
+ * Decompression and decryption of the file data are pipelined
+ *  with its writes. The writer is started with the first block
+ *  that needs such decoding.
+ */
+static bool use_restore_writer(r_ctx &rctx, BFILE *bfd, int flags)
+{
+   if (bfd != &rctx.bfd || !(flags & (FO_COMPRESS|FO_ENCRYPT)) || bfd->cmd_plugin) {
+      return false;
+   }
+   if (!rctx.writer && !rctx.no_writer) {
+      start_restore_writer(rctx);
+   }
+   return rctx.writer != NULL;
+}
+
+/*
+ * Decode a block and give it to the writer thread. Same steps
+ *  as extract_data(), but the seek and the write are left to
+ *  the writer. On return, wsize is the decoded length.
+ */
+static bool send_to_restore_writer(r_ctx &rctx, uint64_t *addr, int flags, int32_t stream,
+                                   char *wbuf, uint32_t *wsize)
+{
+   RESTORE_WRITER *wr = rctx.writer;
+   RESTORE_WBLOCK *blk;
+   uint64_t faddr = *addr;
+   POOLMEM *tmp;
+
+   /* Wait for a free block */
+   P(wr->mutex);
+   while (wr->count == RESTORE_WRITER_DEPTH && !wr->failed) {
+      pthread_cond_wait(&wr->cond, &wr->mutex);
+   }
+   if (wr->failed) {
+      V(wr->mutex);
       return false;
    }
+   blk = &wr->block[(wr->first + wr->count) % RESTORE_WRITER_DEPTH];
+   V(wr->mutex);
+
+   if ((flags & FO_SPARSE) || (flags & FO_OFFSETS)) {
+      if (!sparse_data(rctx, NULL, addr, &wbuf, wsize)) {
+         return false;
+      }
+   }
+   blk->seek = *addr != faddr;
+   blk->addr = *addr;
+
+   if (flags & FO_COMPRESS) {
+      if (!decompress_data(rctx, stream, &wbuf, wsize)) {
+         return false;
+      }
+      /* Hand the decompression buffer over rather than copy it */
+      tmp = blk->buf;
+      blk->buf = rctx.compress_buf;
+      rctx.compress_buf = check_pool_memory_size(tmp, rctx.compress_buf_size);
+   } else {
+      blk->buf = check_pool_memory_size(blk->buf, *wsize);
+      memcpy(blk->buf, wbuf, *wsize);
+   }
+   blk->len = *wsize;
+   blk->win32_decomp = (flags & FO_WIN32DECOMP) != 0;
 
+   P(wr->mutex);
+   wr->count++;
+   pthread_cond_broadcast(&wr->cond);
+   V(wr->mutex);
    return true;
 }
 
@@ -1485,9 +2653,10 @@ bool store_data(JCR *jcr, BFILE *bfd, char *data, const int32_t length, bool win
  * The flags specify whether to use sparse files or compression.
  * Return value is the number of bytes written, or -1 on errors.
  */
-int32_t extract_data(JCR *jcr, BFILE *bfd, POOLMEM *buf, int32_t buflen,
+static int32_t extract_data(r_ctx &rctx, BFILE *bfd, char *buf, int32_t buflen,
                      uint64_t *addr, int flags, int32_t stream, RESTORE_CIPHER_CTX *cipher_ctx)
 {
+   JCR *jcr = rctx.jcr;
    char *wbuf;                 /* write buffer */
    uint32_t wsize;             /* write size */
    uint32_t rsize;             /* read size */
@@ -1495,7 +2664,6 @@ int32_t extract_data(JCR *jcr, BFILE *bfd, POOLMEM *buf, int32_t buflen,
    char ec1[50];               /* Buffer printing huge values */
 
    rsize = buflen;
-   jcr->ReadBytes += rsize;
    wsize = rsize;
    wbuf = buf;
 
@@ -1532,6 +2700,7 @@ int32_t extract_data(JCR *jcr, BFILE *bfd, POOLMEM *buf, int32_t buflen,
          /*
           * No full block of encrypted data available, write more data
           */
+         update_restore_counters(jcr, 0, rsize, 0);
          return 0;
       }
 
@@ -1553,6 +2722,7 @@ int32_t extract_data(JCR *jcr, BFILE *bfd, POOLMEM *buf, int32_t buflen,
          /*
           * No full preserved block is available.
           */
+         update_restore_counters(jcr, 0, rsize, 0);
          return 0;
       }
 
@@ -1565,24 +2735,33 @@ int32_t extract_data(JCR *jcr, BFILE *bfd, POOLMEM *buf, int32_t buflen,
       Dmsg2(130, "Encryption writing full block, %u bytes, remaining %u bytes in buffer\n", wsize, cipher_ctx->buf_len);
    }
 
-   if ((flags & FO_SPARSE) || (flags & FO_OFFSETS)) {
-      if (!sparse_data(jcr, bfd, addr, &wbuf, &wsize)) {
+   if (use_restore_writer(rctx, bfd, flags)) {
+      if (!send_to_restore_writer(rctx, addr, flags, stream, wbuf, &wsize)) {
          goto bail_out;
       }
-   }
+      update_restore_counters(jcr, 0, rsize, 0);
+      *addr += wsize;
+      Dmsg1(130, "Queued %u bytes for writer\n", wsize);
+   } else {
+      if ((flags & FO_SPARSE) || (flags & FO_OFFSETS)) {
+         if (!sparse_data(rctx, bfd, addr, &wbuf, &wsize)) {
+            goto bail_out;
+         }
+      }
 
-   if (flags & FO_COMPRESS) {
-      if (!decompress_data(jcr, stream, &wbuf, &wsize)) {
-         goto bail_out;
+      if (flags & FO_COMPRESS) {
+         if (!decompress_data(rctx, stream, &wbuf, &wsize)) {
+            goto bail_out;
+         }
       }
-   }
 
-   if (!store_data(jcr, bfd, wbuf, wsize, (flags & FO_WIN32DECOMP) != 0)) {
-      goto bail_out;
+      if (!store_data(rctx, bfd, wbuf, wsize, (flags & FO_WIN32DECOMP) != 0)) {
+         goto bail_out;
+      }
+      update_restore_counters(jcr, 0, rsize, wsize);
+      *addr += wsize;
+      Dmsg2(130, "Write %u bytes, JobBytes=%s\n", wsize, edit_uint64(jcr->JobBytes, ec1));
    }
-   jcr->JobBytes += wsize;
-   *addr += wsize;
-   Dmsg2(130, "Write %u bytes, JobBytes=%s\n", wsize, edit_uint64(jcr->JobBytes, ec1));
 
    /*
     * Clean up crypto buffers
@@ -1603,6 +2782,11 @@ int32_t extract_data(JCR *jcr, BFILE *bfd, POOLMEM *buf, int32_t buflen,
    return wsize;
 
 bail_out:
+   update_restore_counters(jcr, 0, rsize, 0);
+   /* Our caller closes the file, let the writer finish with it */
+   if (rctx.writer) {
+      wait_restore_writer(rctx.writer);
+   }
    return -1;
 }
 
@@ -1611,6 +2795,10 @@ bail_out:
  */
 static bool close_previous_stream(JCR *jcr, r_ctx &rctx)
 {
+   bool ok;
+
+   sync_restore_writer(rctx);
+
    /*
     * If extracting, it was from previous stream, so
     * close the output file and validate the signature.
@@ -1625,19 +2813,22 @@ static bool close_previous_stream(JCR *jcr, r_ctx &rctx)
       if (rctx.prev_stream != STREAM_ENCRYPTED_SESSION_DATA) {
          deallocate_cipher(rctx);
          deallocate_fork_cipher(rctx);
+         if (rctx.writer) {
+            wait_restore_writer(rctx.writer);   /* flushed cipher data */
+         }
       }
 
-      if (rctx.jcr->plugin) {
-         plugin_set_attributes(rctx.jcr, rctx.attr, &rctx.bfd);
-      } else {
-         set_attributes(rctx.jcr, rctx.attr, &rctx.bfd);
+      if (!flush_restore_writes(rctx)) {
+         bclose(&rctx.bfd);
       }
-      rctx.extract = false;
 
       /*
-       * Now perform the delayed restore of some specific data streams.
+       * Set the attributes then perform the delayed restore
+       * of some specific data streams.
        */
-      if (!pop_delayed_data_streams(jcr, rctx)) {
+      ok = restore_set_attributes(jcr, rctx);
+      rctx.extract = false;
+      if (!ok) {
          return false;
       }
 
@@ -1668,9 +2859,10 @@ static bool close_previous_stream(JCR *jcr, r_ctx &rctx)
  * writing it to bfd.
  * Return value is true on success, false on failure.
  */
-bool flush_cipher(JCR *jcr, BFILE *bfd, uint64_t *addr, int flags, int32_t stream,
+static bool flush_cipher(r_ctx &rctx, BFILE *bfd, uint64_t *addr, int flags, int32_t stream,
                   RESTORE_CIPHER_CTX *cipher_ctx)
 {
+   JCR *jcr = rctx.jcr;
    uint32_t decrypted_len = 0;
    char *wbuf;                        /* write buffer */
    uint32_t wsize;                    /* write size */
@@ -1690,7 +2882,7 @@ again:
        * Writing out the final, buffered block failed. Shouldn't happen.
        */
       Jmsg3(jcr, M_ERROR, 0, _("Decryption error. buf_len=%d decrypt_len=%d on file %s\n"), 
-            cipher_ctx->buf_len, decrypted_len, jcr->last_fname);
+            cipher_ctx->buf_len, decrypted_len, rctx.attr->ofname);
    }
 
    Dmsg2(130, "Flush decrypt len=%d buf_len=%d\n", decrypted_len, cipher_ctx->buf_len);
@@ -1713,24 +2905,31 @@ again:
    cipher_ctx->buf_len -= cipher_ctx->packet_len;
    Dmsg2(130, "Encryption writing full block, %u bytes, remaining %u bytes in buffer\n", wsize, cipher_ctx->buf_len);
 
-   if ((flags & FO_SPARSE) || (flags & FO_OFFSETS)) {
-      if (!sparse_data(jcr, bfd, addr, &wbuf, &wsize)) {
+   if (use_restore_writer(rctx, bfd, flags)) {
+      if (!send_to_restore_writer(rctx, addr, flags, stream, wbuf, &wsize)) {
          return false;
       }
-   }
+      Dmsg1(130, "Flush queued %u bytes for writer\n", wsize);
+   } else {
+      if ((flags & FO_SPARSE) || (flags & FO_OFFSETS)) {
+         if (!sparse_data(rctx, bfd, addr, &wbuf, &wsize)) {
+            return false;
+         }
+      }
 
-   if (flags & FO_COMPRESS) {
-      if (!decompress_data(jcr, stream, &wbuf, &wsize)) {
-         return false;
+      if (flags & FO_COMPRESS) {
+         if (!decompress_data(rctx, stream, &wbuf, &wsize)) {
+            return false;
+         }
       }
-   }
 
-   Dmsg0(130, "Call store_data\n");
-   if (!store_data(jcr, bfd, wbuf, wsize, (flags & FO_WIN32DECOMP) != 0)) {
-      return false;
+      Dmsg0(130, "Call store_data\n");
+      if (!store_data(rctx, bfd, wbuf, wsize, (flags & FO_WIN32DECOMP) != 0)) {
+         return false;
+      }
+      update_restore_counters(jcr, 0, 0, wsize);
+      Dmsg2(130, "Flush write %u bytes, JobBytes=%s\n", wsize, edit_uint64(jcr->JobBytes, ec1));
    }
-   jcr->JobBytes += wsize;
-   Dmsg2(130, "Flush write %u bytes, JobBytes=%s\n", wsize, edit_uint64(jcr->JobBytes, ec1));
 
    /*
     * Move any remaining data to start of buffer
@@ -1766,7 +2965,7 @@ static void deallocate_cipher(r_ctx &rctx)
     * Flush and deallocate previous stream's cipher context
     */
    if (rctx.cipher_ctx.cipher) {
-      flush_cipher(rctx.jcr, &rctx.bfd, &rctx.fileAddr, rctx.flags, rctx.comp_stream, &rctx.cipher_ctx);
+      flush_cipher(rctx, &rctx.bfd, &rctx.fileAddr, rctx.flags, rctx.comp_stream, &rctx.cipher_ctx);
       crypto_cipher_free(rctx.cipher_ctx.cipher);
       rctx.cipher_ctx.cipher = NULL;
    }
@@ -1779,7 +2978,7 @@ static void deallocate_fork_cipher(r_ctx &rctx)
     * Flush and deallocate previous stream's fork cipher context
     */
    if (rctx.fork_cipher_ctx.cipher) {
-      flush_cipher(rctx.jcr, &rctx.forkbfd, &rctx.fork_addr, rctx.fork_flags, rctx.comp_stream, &rctx.fork_cipher_ctx);
+      flush_cipher(rctx, &rctx.forkbfd, &rctx.fork_addr, rctx.fork_flags, rctx.comp_stream, &rctx.fork_cipher_ctx);
       crypto_cipher_free(rctx.fork_cipher_ctx.cipher);
       rctx.fork_cipher_ctx.cipher = NULL;
    }
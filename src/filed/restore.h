@@ -44,6 +44,11 @@ struct RESTORE_CIPHER_CTX {
    int32_t packet_len;                 /* Total bytes in packet */
 };
 
+struct RESTORE_WORKERS;
+struct RESTORE_WRITER;
+struct RESTORE_JOURNAL;
+struct RESTORE_JENTRY;
+
 struct r_ctx {
    JCR *jcr;
    int32_t stream;                     /* stream less new bits */
@@ -67,6 +72,141 @@ struct r_ctx {
    CRYPTO_SESSION *cs;                 /* Cryptographic session data (if any) for file */
    RESTORE_CIPHER_CTX cipher_ctx;      /* Cryptographic restore context (if any) for file */
    RESTORE_CIPHER_CTX fork_cipher_ctx; /* Cryptographic restore context (if any) for alternative stream */
+
+   int64_t rsrc_len;                   /* Original length of resource fork */
+   POOLMEM *compress_buf;              /* Decompression buffer */
+   int32_t compress_buf_size;          /* Length of decompression buffer */
+   RESTORE_WORKERS *workers;           /* Worker pool if this is a worker context */
+   RESTORE_WRITER *writer;             /* Writer thread for decoded file data */
+   bool no_writer;                     /* could not start the writer thread */
+   POOLMEM *cbuf;                      /* coalesced writes of the file data */
+   uint32_t cbuf_len;                  /* bytes waiting in cbuf */
+   uint64_t cbuf_addr;                 /* file address of cbuf */
+   uint64_t file_pos;                  /* current offset of bfd */
+   uint64_t data_end;                  /* end of the data written to bfd */
+   bool prealloc_done;                 /* tried to preallocate the file */
+   bool prealloc_ok;                   /* the file space is reserved */
+   RESTORE_JOURNAL *journal;           /* deferred attributes or NULL */
+   RESTORE_JENTRY *jdir;               /* journaled directory being restored */
+
+   /*
+    * The following variables keep track of "known unknowns"
+    */
+   int non_support_data;
+   int non_support_attr;
+   int non_support_rsrc;
+   int non_support_finfo;
+   int non_support_acl;
+   int non_support_progname;
+   int non_support_crypto;
+   int non_support_xattr;
+};
+
+/*
+ * Number of decoded blocks waiting for the restore writer
+ */
+#define RESTORE_WRITER_DEPTH 4
+
+/*
+ * A block of file data decoded (decrypted, decompressed)
+ *  and waiting to be written.
+ */
+struct RESTORE_WBLOCK {
+   POOLMEM *buf;                       /* decoded data */
+   uint32_t len;                       /* length of data */
+   uint64_t addr;                      /* file address for a sparse block */
+   bool seek;                          /* seek to addr before writing */
+   bool win32_decomp;                  /* "decompose" BackupWrite data */
+};
+
+/*
+ * Writer thread of a restore context. It writes the blocks
+ *  of the file while extract_data() decodes the next ones.
+ */
+struct RESTORE_WRITER {
+   pthread_t tid;                      /* writer thread */
+   pthread_mutex_t mutex;              /* protects the ring */
+   pthread_cond_t cond;                /* signaled when the ring changes */
+   r_ctx *rctx;                        /* context owning the file */
+   RESTORE_WBLOCK block[RESTORE_WRITER_DEPTH]; /* ring of blocks */
+   int32_t first;                      /* next block to write */
+   int32_t count;                      /* blocks queued or being written */
+   bool failed;                        /* a write failed, drop the blocks */
+   bool quit;                          /* thread must exit */
+};
+
+/*
+ * A record queued for a restore worker. The data is
+ *  copied behind the structure and zero terminated.
+ */
+struct RESTORE_REC {
+   dlink link;
+   int32_t full_stream;                /* full stream, 0 to close current file */
+   int32_t len;                        /* data length */
+   char data[1];                       /* data follows */
+};
+
+struct RESTORE_WORKER {
+   pthread_t tid;                      /* worker thread */
+   pthread_cond_t work;                /* signaled when a record is queued */
+   dlist *queue;                       /* records waiting for this worker */
+   int32_t queued;                     /* records queued or being processed */
+   bool started;                       /* thread was created */
+   RESTORE_WORKERS *pool;              /* back pointer to the pool */
+   r_ctx rctx;                         /* restore context of this worker */
+};
+
+/*
+ * Pool of threads restoring files in parallel. The thread
+ *  reading the Storage daemon hands over all the records
+ *  of one file to the same worker.
+ */
+struct RESTORE_WORKERS {
+   JCR *jcr;
+   pthread_mutex_t mutex;              /* protects queues and counters */
+   pthread_cond_t done;                /* signaled when a record is processed */
+   pthread_mutex_t fname_mutex;        /* serializes jcr->last_fname and where_bregexp */
+   int32_t nworkers;                   /* number of workers */
+   RESTORE_WORKER *worker;             /* array of workers */
+   int32_t dest;                       /* destination of current file records */
+   dlist *deferred;                    /* directory records applied at the end */
+   bool failed;                        /* a worker hit a fatal error */
+   bool quit;                          /* workers must exit */
+};
+
+/*
+ * Number of journaled files that triggers the application
+ *  of their attributes (directories wait for the end).
+ */
+#define RESTORE_JOURNAL_BATCH 100000
+
+/*
+ * Attributes of a restored file, set at the end of the restore
+ *  when the Client has "Defer Restore Attributes = yes".
+ */
+struct RESTORE_JENTRY {
+   ino_t ino;                          /* restored inode, 0 if unknown */
+   uid_t uid;
+   gid_t gid;
+   mode_t mode;
+   time_t atime;
+   time_t mtime;
+   uint32_t flags;                     /* st_flags for chflags() */
+   int32_t type;                       /* FT_ type */
+   int32_t dir_len;                    /* length of the directory of fname */
+   int32_t depth;                      /* number of directories in fname */
+   alist *delayed;                     /* delayed acl/xattr streams or NULL */
+   char fname[1];                      /* restored file name */
+};
+
+struct RESTORE_JOURNAL {
+   pthread_mutex_t mutex;              /* protects the lists */
+   RESTORE_JENTRY **files;             /* files, applied by batches */
+   int32_t num_files;
+   int32_t max_files;
+   RESTORE_JENTRY **dirs;              /* directories, applied at the end */
+   int32_t num_dirs;
+   int32_t max_dirs;
 };
 
 #endif
@@ -215,6 +215,9 @@ static void  list_running_jobs_plain(STATUS_PKT *sp)
            edit_uint64_with_commas(bps, b3),
            njcr->JobErrors);
       sendit(msg.c_str(), len, sp);
+      if (*edit_job_stages(njcr, msg.addr())) {
+         sendit(msg.c_str(), strlen(msg.c_str()), sp);
+      }
       len = Mmsg(msg, _("    Files Examined=%s\n"),
            edit_uint64_with_commas(njcr->num_files_examined, b1));
       sendit(msg.c_str(), len, sp);
@@ -491,6 +494,10 @@ int qstatus_cmd(JCR *jcr)
    } else if (strcasecmp(cmd, "terminated") == 0) {
        sp.api = true;
        list_terminated_jobs(&sp);
+   } else if (strcasecmp(cmd, "locks") == 0) {
+       lmgr_edit_profile(dir->msg);
+       dir->msglen = strlen(dir->msg);
+       dir->send();
    } else {
       pm_strcpy(&jcr->errmsg, dir->msg);
       Jmsg1(jcr, M_FATAL, 0, _("Bad .status command: %s\n"), jcr->errmsg);
@@ -505,6 +512,22 @@ int qstatus_cmd(JCR *jcr)
    return 1;
 }
 
+/*
+ * .stats command, the daemon statistics as key=value
+ *  lines, or as a JSON object with ".stats json"
+ */
+int stats_cmd(JCR *jcr)
+{
+   BSOCK *dir = jcr->dir_bsock;
+   bool json = strncmp(dir->msg, ".stats json", 11) == 0;
+
+   bstat_edit(dir->msg, json);
+   dir->msglen = strlen(dir->msg);
+   dir->send();
+   dir->signal(BNET_EOD);
+   return 1;
+}
+
 /*
  * Convert Job Level into a string
  */
@@ -92,7 +92,7 @@ static bxattr_exit_code send_xattr_stream(JCR *jcr, int stream)
    /*
     * Send header
     */
-   if (!sd->fsend("%ld %d 0", jcr->JobFiles, stream)) {
+   if (!send_stream_header(jcr, sd, jcr->JobFiles, stream)) {
       Jmsg1(jcr, M_FATAL, 0, _("Network send error to SD. ERR=%s\n"),
             sd->bstrerror());
       return bxattr_exit_fatal;
@@ -72,5 +72,6 @@
 #define FO_DELTA         (1<<28)      /* Delta data -- i.e. all copies returned on restore */
 #define FO_PLUGIN        (1<<29)      /* Plugin data stream -- return to plugin on restore */
 #define FO_OFFSETS       (1<<30)      /* Keep I/O file offsets */
+#define FO_COMPACT_STAT  (1u<<31)     /* Send attributes with encode_stat_compact() */
 
 #endif /* __BFILEOPTSS_H */
@@ -266,6 +266,65 @@ void encode_stat(char *buf, struct stat *statp, int stat_size, int32_t LinkFI, i
    return;
 }
 
+/**
+ * Encode a stat packet in the compact form.
+ *
+ * The fields are the same ones, in the same order, as the ones
+ *   written by encode_stat(), but each one is stored as a varint
+ *   in a small binary record that starts with a version byte.
+ *   The atime and ctime are stored as a difference to the mtime,
+ *   which is usually zero or a small number.  The record is then
+ *   converted to base64 and prefixed with STAT_COMPACT_MARKER so
+ *   that it can go everywhere the text form goes (attribute
+ *   stream, spool file, LStat column) and so that decode_stat()
+ *   can tell the two forms apart.
+ *
+ * The result is about 30% shorter than the text form.  buf must
+ *   hold at least STAT_COMPACT_MAXLEN bytes.
+ */
+void encode_stat_compact(char *buf, struct stat *statp, int stat_size, int32_t LinkFI, int data_stream)
+{
+   uint8_t rec[STAT_COMPACT_MAXREC];
+   int64_t mtime;
+   ser_declare;
+
+   ASSERT(stat_size == (int)sizeof(struct stat));
+
+   mtime = (int64_t)statp->st_mtime;
+   ser_begin(rec, sizeof(rec));
+   ser_uint8(STAT_COMPACT_VERSION);
+   ser_varint((uint64_t)statp->st_dev);
+   ser_varint((uint64_t)statp->st_ino);
+   ser_varint((uint64_t)statp->st_mode);
+   ser_varint((uint64_t)statp->st_nlink);
+   ser_varint((uint64_t)statp->st_uid);
+   ser_varint((uint64_t)statp->st_gid);
+   ser_varint((uint64_t)statp->st_rdev);
+   ser_varint((uint64_t)statp->st_size);
+#ifndef HAVE_MINGW
+   ser_varint((uint64_t)statp->st_blksize);
+   ser_varint((uint64_t)statp->st_blocks);
+#else
+   ser_varint(0);                     /* place holder */
+   ser_varint(0);                     /* place holder */
+#endif
+   ser_svarint(mtime);
+   ser_svarint((int64_t)statp->st_atime - mtime);
+   ser_svarint((int64_t)statp->st_ctime - mtime);
+   ser_varint((uint32_t)LinkFI);
+#ifdef HAVE_CHFLAGS
+   ser_varint((uint64_t)statp->st_flags);
+#else
+   ser_varint(0);                     /* place holder */
+#endif
+   ser_varint((uint32_t)data_stream);
+   ser_end(rec, sizeof(rec));
+
+   buf[0] = STAT_COMPACT_MARKER;
+   bin_to_base64(buf + 1, STAT_COMPACT_MAXLEN - 1, (char *)rec,
+                 ser_length(rec), true);
+}
+
 
 /* Do casting according to unknown type to keep compiler happy */
 #ifdef HAVE_TYPEOF
@@ -284,6 +343,69 @@ void encode_stat(char *buf, struct stat *statp, int stat_size, int32_t LinkFI, i
 #endif
 
 
+/**
+ * Decode a stat packet written by encode_stat_compact().
+ *
+ * The base64 text is converted back to the binary record in one
+ *   pass, then the varints are picked up in the order they were
+ *   written.  The record buffer is zeroed first and is larger than
+ *   the largest valid record, so that garbage can only produce
+ *   wrong values, never a read past the buffer.
+ *
+ * Returns: data stream, or -1 if the record is not valid
+ */
+static int decode_stat_compact(char *buf, struct stat *statp, int32_t *LinkFI)
+{
+   uint8_t rec[STAT_COMPACT_MAXREC + 32];
+   uint8_t version;
+   int64_t mtime, val;
+   int len;
+   unser_declare;
+
+   len = strcspn(buf + 1, " ");
+   memset(rec, 0, sizeof(rec));
+   if (len == 0 ||
+       base64_to_bin((char *)rec, sizeof(rec), buf + 1, len) == 0) {
+      *LinkFI = 0;
+      return -1;
+   }
+   unser_begin(rec, sizeof(rec));
+   unser_uint8(version);
+   if (version != STAT_COMPACT_VERSION) {
+      *LinkFI = 0;
+      return -1;
+   }
+   plug(statp->st_dev, unserial_varint(&ser_ptr));
+   plug(statp->st_ino, unserial_varint(&ser_ptr));
+   plug(statp->st_mode, unserial_varint(&ser_ptr));
+   plug(statp->st_nlink, unserial_varint(&ser_ptr));
+   plug(statp->st_uid, unserial_varint(&ser_ptr));
+   plug(statp->st_gid, unserial_varint(&ser_ptr));
+   plug(statp->st_rdev, unserial_varint(&ser_ptr));
+   plug(statp->st_size, unserial_varint(&ser_ptr));
+#ifndef HAVE_MINGW
+   plug(statp->st_blksize, unserial_varint(&ser_ptr));
+   plug(statp->st_blocks, unserial_varint(&ser_ptr));
+#else
+   unserial_varint(&ser_ptr);
+   unserial_varint(&ser_ptr);
+#endif
+   unser_svarint(mtime);
+   plug(statp->st_mtime, mtime);
+   unser_svarint(val);
+   plug(statp->st_atime, mtime + val);
+   unser_svarint(val);
+   plug(statp->st_ctime, mtime + val);
+   *LinkFI = (int32_t)unserial_varint(&ser_ptr);
+   unser_varint(val);
+#ifdef HAVE_CHFLAGS
+   plug(statp->st_flags, val);
+#endif
+   unser_varint(val);
+   unser_end(rec, sizeof(rec));
+   return (int)val;
+}
+
 /** Decode a stat packet from base64 characters */
 int decode_stat(char *buf, struct stat *statp, int stat_size, int32_t *LinkFI)
 {
@@ -297,6 +419,10 @@ int decode_stat(char *buf, struct stat *statp, int stat_size, int32_t *LinkFI)
     */
    ASSERT(stat_size == (int)sizeof(struct stat));
 
+   if (*p == STAT_COMPACT_MARKER) {
+      return decode_stat_compact(buf, statp, LinkFI);
+   }
+
    p += from_base64(&val, p);
    plug(statp->st_dev, val);
    p++;
@@ -388,6 +514,12 @@ int32_t decode_LinkFI(char *buf, struct stat *statp, int stat_size)
     */
    ASSERT(stat_size == (int)sizeof(struct stat));
 
+   if (*p == STAT_COMPACT_MARKER) {
+      int32_t LinkFI;
+      decode_stat_compact(buf, statp, &LinkFI);
+      return LinkFI;
+   }
+
    skip_nonspaces(&p);                /* st_dev */
    p++;                               /* skip space */
    skip_nonspaces(&p);                /* st_ino */
@@ -424,6 +556,28 @@ int32_t decode_LinkFI(char *buf, struct stat *statp, int stat_size)
    return 0;
 }
 
+/**
+ * Close a restored file and check that its size is the
+ *  one of the original file.
+ */
+void close_restored_file(JCR *jcr, ATTR *attr, BFILE *ofd)
+{
+   char ec1[50], ec2[50];
+   boffset_t fsize;
+
+   if (!is_bopen(ofd)) {
+      return;
+   }
+   fsize = blseek(ofd, 0, SEEK_END);
+   bclose(ofd);                       /* first close file */
+   if (attr->type == FT_REG && fsize > 0 && attr->statp.st_size > 0 && 
+                     fsize != (boffset_t)attr->statp.st_size) {
+      Jmsg3(jcr, M_ERROR, 0, _("File size of restored file %s not correct. Original %s, restored %s.\n"),
+         attr->ofname, edit_uint64(attr->statp.st_size, ec1),
+         edit_uint64(fsize, ec2));
+   }
+}
+
 /**
  * Set file modes, permissions and times
  *
@@ -436,9 +590,7 @@ int32_t decode_LinkFI(char *buf, struct stat *statp, int stat_size)
 bool set_attributes(JCR *jcr, ATTR *attr, BFILE *ofd)
 {
    struct utimbuf ut;
-   mode_t old_mask;
    bool ok = true;
-   boffset_t fsize;
  
    if (uid_set) {
       my_uid = getuid();
@@ -473,18 +625,11 @@ bool set_attributes(JCR *jcr, ATTR *attr, BFILE *ofd)
     */
 #endif
 
-   old_mask = umask(0);
-   if (is_bopen(ofd)) {
-      char ec1[50], ec2[50];
-      fsize = blseek(ofd, 0, SEEK_END);
-      bclose(ofd);                    /* first close file */
-      if (attr->type == FT_REG && fsize > 0 && attr->statp.st_size > 0 && 
-                        fsize != (boffset_t)attr->statp.st_size) {
-         Jmsg3(jcr, M_ERROR, 0, _("File size of restored file %s not correct. Original %s, restored %s.\n"),
-            attr->ofname, edit_uint64(attr->statp.st_size, ec1),
-            edit_uint64(fsize, ec2));
-      }
-   }
+   /*
+    * The umask is not touched, it is shared by the restore threads
+    *  that create files, and the modes are set with chmod() below.
+    */
+   close_restored_file(jcr, attr, ofd);
 
    /**
     * We do not restore sockets, so skip trying to restore their
@@ -552,7 +697,6 @@ bool set_attributes(JCR *jcr, ATTR *attr, BFILE *ofd)
 
 bail_out:
    pm_strcpy(attr->ofname, "*none*");
-   umask(old_mask);
    return ok;
 }
 
@@ -822,6 +822,16 @@ boffset_t blseek(BFILE *bfd, boffset_t offset, int whence)
    return ((boffset_t)offset_high << 32) | dwResult;
 }
 
+bool bpreallocate(BFILE *bfd, boffset_t size)
+{
+   return false;
+}
+
+bool bpunch_hole(BFILE *bfd, boffset_t offset, boffset_t len)
+{
+   return false;
+}
+
 #else  /* Unix systems */
 
 /* ===============================================================
@@ -1094,4 +1104,37 @@ boffset_t blseek(BFILE *bfd, boffset_t offset, int whence)
    return pos;
 }
 
+/*
+ * Reserve the space of a file being restored. The size of the
+ *  file is not changed, so that a short restore is still seen
+ *  by close_restored_file(). Returns false if the system cannot
+ *  do it, which is not an error.
+ */
+bool bpreallocate(BFILE *bfd, boffset_t size)
+{
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_KEEP_SIZE)
+   if (bfd->cmd_plugin) {
+      return false;
+   }
+   return fallocate(bfd->fid, FALLOC_FL_KEEP_SIZE, 0, size) == 0;
+#else
+   return false;
+#endif
+}
+
+/*
+ * Give back the space of a zero filled region of the file
+ */
+bool bpunch_hole(BFILE *bfd, boffset_t offset, boffset_t len)
+{
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_PUNCH_HOLE)
+   if (bfd->cmd_plugin) {
+      return false;
+   }
+   return fallocate(bfd->fid, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, len) == 0;
+#else
+   return false;
+#endif
+}
+
 #endif
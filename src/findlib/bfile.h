@@ -136,6 +136,8 @@ int     bclose(BFILE *bfd);
 ssize_t bread(BFILE *bfd, void *buf, size_t count);
 ssize_t bwrite(BFILE *bfd, void *buf, size_t count);
 boffset_t blseek(BFILE *bfd, boffset_t offset, int whence);
+bool    bpreallocate(BFILE *bfd, boffset_t size);
+bool    bpunch_hole(BFILE *bfd, boffset_t offset, boffset_t len);
 const char   *stream_to_ascii(int stream);
 
 bool processWin32BackupAPIBlock (BFILE *bfd, void *pBuffer, ssize_t dwSize);
@@ -48,6 +48,7 @@
 
 static int separate_path_and_file(JCR *jcr, char *fname, char *ofile);
 static int path_already_seen(JCR *jcr, char *path, int pnl);
+static void path_seen(JCR *jcr, char *path, int pnl);
 
 
 /*
@@ -201,6 +202,7 @@ int create_file(JCR *jcr, ATTR *attr, BFILE *bfd, int replace)
                attr->ofname[pnl] = savechr;     /* restore full name */
                return CF_ERROR;
             }
+            path_seen(jcr, attr->ofname, pnl);
          }
          attr->ofname[pnl] = savechr;           /* restore full name */
       }
@@ -467,16 +469,29 @@ static int separate_path_and_file(JCR *jcr, char *fname, char *ofile)
 /*
  * Primitive caching of path to prevent recreating a pathname
  *   each time as long as we remain in the same directory.
+ *   The path is remembered only once it has been made, as
+ *   several restore threads may share the cache.
  */
 static int path_already_seen(JCR *jcr, char *path, int pnl)
 {
+   int seen = 0;
+
+   jcr->lock();
+   if (jcr->cached_path && jcr->cached_pnl == pnl && 
+       strcmp(path, jcr->cached_path) == 0) {
+      seen = 1;
+   }
+   jcr->unlock();
+   return seen;
+}
+
+static void path_seen(JCR *jcr, char *path, int pnl)
+{
+   jcr->lock();
    if (!jcr->cached_path) {
       jcr->cached_path = get_pool_memory(PM_FNAME);
    }
-   if (jcr->cached_pnl == pnl && strcmp(path, jcr->cached_path) == 0) {
-      return 1;
-   }
    pm_strcpy(jcr->cached_path, path);
    jcr->cached_pnl = pnl;
-   return 0;
+   jcr->unlock();
 }
@@ -59,6 +59,15 @@ struct utimbuf {
 
 #define MODE_RALL (S_IRUSR|S_IRGRP|S_IROTH)
 
+/*
+ * Compact stat packet (see encode_stat_compact()).  The marker
+ *  is not a base64 digit, so it can never start a text packet.
+ */
+#define STAT_COMPACT_MARKER  '~'
+#define STAT_COMPACT_VERSION 1
+#define STAT_COMPACT_MAXREC  (1 + 16 * 10)     /* version + 16 varints */
+#define STAT_COMPACT_MAXLEN  232               /* marker + base64 + EOS */
+
 #include "lib/fnmatch.h"
 // #include "lib/enh_fnmatch.h"
 
@@ -206,6 +206,9 @@ void add_fname_to_include_list(FF_PKT *ff, int prefixed, const char *fname)
          case 'X':
             inc->options |= FO_XATTR;
             break;
+         case 'L':
+            inc->options |= FO_COMPACT_STAT;
+            break;
          default:
             Emsg1(M_ERROR, 0, _("Unknown include/exclude option: %c\n"), *rp);
             break;
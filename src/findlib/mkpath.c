@@ -146,7 +146,9 @@ static bool makedir(JCR *jcr, char *path, mode_t mode, int *created)
 
    if (jcr->keep_path_list) {
       /* When replace=NEVER, we keep track of all directories newly created */
+      jcr->lock();
       path_list_add(jcr, strlen(path), path);
+      jcr->unlock();
    }
 
    *created = true;
@@ -185,7 +187,7 @@ bool makepath(ATTR *attr, const char *apath, mode_t mode, mode_t parent_mode,
             uid_t owner, gid_t group, int keep_dir_modes)
 {
    struct stat statp;
-   mode_t omask, tmode;
+   mode_t tmode;
    char *path = (char *)apath;
    char *p;
    int len;
@@ -209,8 +211,6 @@ bool makepath(ATTR *attr, const char *apath, mode_t mode, mode_t parent_mode,
       set_own_mod(attr, path, owner, group, mode);
       return true;
    }
-   omask = umask(0);
-   umask(omask);
    len = strlen(apath);
    path = (char *)alloca(len+1);
    bstrncpy(path, apath, len+1);
@@ -317,6 +317,5 @@ bool makepath(ATTR *attr, const char *apath, mode_t mode, mode_t parent_mode,
 
    ok = true;
 bail_out:
-   umask(omask);
    return ok;
 }
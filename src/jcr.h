@@ -174,6 +174,30 @@ struct CRYPTO_CTX {
 
 typedef void (JCR_free_HANDLER)(JCR *jcr);
 
+/*
+ * Pipeline stages timed for each job. Each daemon only fills
+ *  in the stages it runs, see JCR::add_stage() and
+ *  edit_job_stages() in lib/jcr.c
+ */
+enum {
+   JOB_STAGE_OPEN = 0,                /* FD: open files */
+   JOB_STAGE_READ,                    /* FD: read file data */
+   JOB_STAGE_COMPRESS,                /* FD: GZIP/LZO compression */
+   JOB_STAGE_ENCRYPT,                 /* FD: data encryption */
+   JOB_STAGE_NET_SEND,                /* all: write to the network */
+   JOB_STAGE_DEV_WRITE,               /* SD: write blocks to the device, not despooled */
+   JOB_STAGE_SPOOL_WRITE,             /* SD: write blocks to the spool file */
+   JOB_STAGE_DESPOOL,                 /* SD: despool to the device, with its writes */
+   JOB_STAGE_CATALOG,                 /* DIR: catalog attribute inserts */
+   JOB_STAGE_MAX
+};
+
+struct JOB_STAGE {
+   btime_t time;                      /* cumulated time in usecs */
+   uint64_t bytes;                    /* bytes handled */
+   uint64_t count;                    /* number of calls */
+};
+
 /* Job Control Record (JCR) */
 class JCR {
 private:
@@ -215,6 +239,28 @@ public:
    void my_thread_send_signal(int sig);   /* in lib/jcr.c */
    void set_killable(bool killable);      /* in lib/jcr.c */
    bool is_killable() const { return my_thread_killable; };
+   /*
+    * Account for one pass through a pipeline stage that began at
+    *  start. A stage can be run by several threads of the job
+    *  (e.g. heartbeat and data sends on a bsock), the counters
+    *  are updated with atomic adds, this is called for each
+    *  network send and file read.
+    */
+   void add_stage(int stage, btime_t start, uint64_t nbytes) {
+      JOB_STAGE *s = &stages[stage];
+      btime_t elapsed = get_current_btime() - start;
+#ifdef __GNUC__
+      __sync_fetch_and_add(&s->time, elapsed);
+      __sync_fetch_and_add(&s->bytes, nbytes);
+      __sync_fetch_and_add(&s->count, 1);
+#else
+      P(stage_mutex);
+      s->time += elapsed;
+      s->bytes += nbytes;
+      s->count++;
+      V(stage_mutex);
+#endif
+   };
 
    /* Global part of JCR common to all daemons */
    dlink link;                        /* JCR chain link */
@@ -293,6 +339,8 @@ public:
    POOLMEM *comment;                  /* Comment for this Job */
    int64_t max_bandwidth;             /* Bandwidth limit for this Job */
    htable *path_list;                 /* Directory list (used by findlib) */
+   JOB_STAGE stages[JOB_STAGE_MAX];   /* Pipeline stage timers */
+   pthread_mutex_t stage_mutex;       /* protects stages without atomics */
 
    /* Daemon specific part of JCR */
    /* This should be empty in the library */
@@ -327,6 +375,9 @@ public:
    uint32_t MediaId;                  /* DB record IDs associated with this job */
    uint32_t FileIndex;                /* Last FileIndex processed */
    utime_t MaxRunSchedTime;           /* max run time in seconds from Scheduled time*/
+   utime_t PredictedRunTime;          /* run time from the Job history, 0 if unknown */
+   uint64_t PredictedBytes;           /* bytes from the Job history */
+   STORE *PredictedStore;             /* storage charged with PredictedBytes */
    POOLMEM *fname;                    /* name to put into catalog */
    JOB_DBR jr;                        /* Job DB record for current job */
    JOB_DBR previous_jr;               /* previous job database record */
@@ -351,6 +402,7 @@ public:
    int32_t FDVersion;                 /* File daemon version number */
    int64_t spool_size;                /* Spool size for this job */
    volatile bool sd_msg_thread_done;  /* Set when Storage message thread done */
+   int32_t SD_msg_state;              /* Message channel state in the reactor */
    bool wasVirtualFull;               /* set if job was VirtualFull */
    bool IgnoreDuplicateJobChecking;   /* set in migration jobs */
    bool spool_data;                   /* Spool data in SD */
@@ -388,6 +440,7 @@ public:
    utime_t mtime;                     /* begin time for SINCE */
    int listing;                       /* job listing in estimate */
    long Ticket;                       /* Ticket */
+   int32_t stream_proto;              /* FD->SD stream protocol level */
    char *big_buf;                     /* I/O buffer */
    POOLMEM *compress_buf;             /* Compression buffer */
    int32_t compress_buf_size;         /* Length of compression buffer */
@@ -402,8 +455,8 @@ public:
    uint32_t EndFile;
    uint32_t StartBlock;
    uint32_t EndBlock;
-   pthread_t heartbeat_id;            /* id of heartbeat thread */
-   volatile bool hb_started;          /* heartbeat running */
+   watchdog_t *hb_wd;                 /* heartbeat timer */
+   bool hb_started;                   /* heartbeat timer registered */
    BSOCK *hb_bsock;                   /* duped SD socket */
    BSOCK *hb_dir_bsock;               /* duped DIR socket */
    alist *RunScripts;                 /* Commands to run before and after job */
@@ -436,6 +489,7 @@ public:
    int32_t label_errors;              /* count of label errors */
    bool session_opened;
    long Ticket;                       /* ticket for this job */
+   int32_t stream_proto;              /* FD->SD stream protocol level */
    bool ignore_label_errors;          /* ignore Volume label errors */
    bool spool_attributes;             /* set if spooling attributes */
    bool no_attributes;                /* set if no attributes wanted */
@@ -328,6 +328,7 @@ bool BSOCK::send()
    int32_t pktsiz;
    int32_t *hdr;
    bool ok = true;
+   btime_t start;
 
    if (errors) {
       if (!m_suppress_error_msgs) {
@@ -353,6 +354,22 @@ bool BSOCK::send()
    }
 
    if (m_use_locking) P(m_mutex);
+   start = m_jcr ? get_current_btime() : 0;
+   if (m_hdr_pending) {
+      /*
+       * A binary stream header is queued, it goes out in front of
+       *  this data in the same packet. If this is a signal, the header
+       *  is sent alone in its own packet before the signal.
+       */
+      m_hdr_pending = false;
+      rc = write_stream_header(&pktsiz);
+      if (rc == pktsiz && msglen <= 0) {
+         goto send_signal;
+      }
+      goto check_rc;
+   }
+
+send_signal:
    /* Compute total packet length */
    if (msglen <= 0) {
       pktsiz = sizeof(pktsiz);               /* signal, no data */
@@ -374,6 +391,8 @@ bool BSOCK::send()
    /* Full I/O done in one write */
    rc = write_nbytes(this, (char *)hdr, pktsiz);
    timer_start = 0;         /* clear timer */
+
+check_rc:
    if (rc != pktsiz) {
       errors++;
       if (errno == 0) {
@@ -395,10 +414,68 @@ bool BSOCK::send()
       }
       ok = false;
    }
+   if (m_jcr) {
+      m_jcr->add_stage(JOB_STAGE_NET_SEND, start, rc > 0 ? rc : 0);
+   }
    if (m_use_locking) V(m_mutex);
    return ok;
 }
 
+/*
+ * Queue a binary stream header (STREAM_PROTO_BINHDR). It is
+ *  not sent now, but prepended to the next data packet by send(),
+ *  so that the SD gets the header and the first chunk of the
+ *  stream in a single packet.
+ */
+void BSOCK::set_stream_header(int32_t FileIndex, int32_t Stream)
+{
+   m_hdr_FileIndex = FileIndex;
+   m_hdr_Stream = Stream;
+   m_hdr_pending = true;
+}
+
+/*
+ * Write the queued stream header followed by the current
+ *  data (if any) as a single packet. Small data is copied
+ *  behind the header so that the packet goes out in one write.
+ *
+ * Returns: number of bytes written, or -1 on error. The expected
+ *  number of bytes is returned in pktsiz.
+ *  Note, called with the bsock locked.
+ */
+int32_t BSOCK::write_stream_header(int32_t *pktsiz)
+{
+   char buf[sizeof(int32_t) + STREAM_HDR_SIZE + 1024];
+   int32_t datalen = msglen > 0 ? msglen : 0;
+   int32_t len, rc;
+   ser_declare;
+
+   ser_begin(buf, sizeof(buf));
+   ser_int32(STREAM_HDR_SIZE + datalen);     /* packet length */
+   ser_int32(m_hdr_FileIndex);
+   ser_int32(m_hdr_Stream);
+   ser_int32(0);                             /* info -- not used */
+   len = ser_length(buf);
+   *pktsiz = len + datalen;
+   if (datalen > 0 && datalen <= (int32_t)sizeof(buf) - len) {
+      memcpy(buf + len, msg, datalen);
+      len += datalen;
+   }
+
+   out_msg_no++;            /* increment message number */
+   timer_start = watchdog_time;  /* start timer */
+   clear_timed_out();
+   rc = write_nbytes(this, buf, len);
+   if (rc == len && len < *pktsiz) {
+      rc = write_nbytes(this, msg, datalen);  /* large data goes separately */
+      if (rc >= 0) {
+         rc += len;
+      }
+   }
+   timer_start = 0;         /* clear timer */
+   return rc;
+}
+
 /*
  * Format and send a message
  *  Returns: false on error
@@ -87,16 +87,20 @@ private:
    btimer_t *m_tid;                   /* timer id */
    boffset_t m_data_end;              /* offset of last valid data written */
    int32_t m_FileIndex;               /* last valid attr spool FI */
+   int32_t m_hdr_FileIndex;           /* FileIndex of pending stream header */
+   int32_t m_hdr_Stream;              /* Stream of pending stream header */
    volatile bool m_timed_out: 1;      /* timed out in read/write */
    volatile bool m_terminated: 1;     /* set when BNET_TERMINATE arrives */
    bool m_duped: 1;                   /* set if duped BSOCK */
    bool m_spool: 1;                   /* set for spooling */
    bool m_use_locking: 1;             /* set to use locking */
+   bool m_hdr_pending: 1;             /* binary stream header waiting to go out */
 
    void fin_init(JCR * jcr, int sockfd, const char *who, const char *host, int port,
                struct sockaddr *lclient_addr);
    bool open(JCR *jcr, const char *name, char *host, char *service,
                int port, utime_t heart_beat, int *fatal);
+   int32_t write_stream_header(int32_t *pktsiz);
    
 public:
    /* methods -- in bsock.c */
@@ -109,6 +113,8 @@ public:
    int32_t recv();
    bool send();
    bool fsend(const char*, ...);
+   void set_stream_header(int32_t FileIndex, int32_t Stream);
+   void clear_stream_header() { m_hdr_pending = false; };
    bool signal(int signal);
    void close();                      /* close connection and destroy packet */
    void destroy();                    /* destroy socket packet */
@@ -154,7 +160,7 @@ public:
    int32_t get_FileIndex() { return m_FileIndex; };
    void set_spooling() { m_spool = true; };
    void clear_spooling() { m_spool = false; };
-   void set_duped() { m_duped = true; };
+   void set_duped() { m_duped = true; m_hdr_pending = false; };
    void set_timed_out() { m_timed_out = true; };
    void clear_timed_out() { m_timed_out = false; };
    void set_terminated() { m_terminated = true; };
@@ -162,6 +168,21 @@ public:
    void stop_timer() { stop_bsock_timer(m_tid); };
 };
 
+/*
+ * FD -> SD data stream protocol levels, negotiated on "append open session".
+ *  STREAM_PROTO_TEXT:   each stream starts with a separate ASCII packet
+ *                       "<file-index> <stream> <info>".
+ *  STREAM_PROTO_BINHDR: each stream starts with a fixed binary header
+ *                       (file-index, stream, info as network order int32)
+ *                       carried in front of the first data packet.
+ */
+enum {
+   STREAM_PROTO_TEXT   = 0,
+   STREAM_PROTO_BINHDR = 1
+};
+#define STREAM_PROTO_MAX    STREAM_PROTO_BINHDR
+#define STREAM_HDR_SIZE     (3 * sizeof(int32_t))
+
 /* 
  *  Signal definitions for use in bnet_sig()   
  *  Note! These must be negative.  There are signals that are generated
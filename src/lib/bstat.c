@@ -0,0 +1,370 @@
+/*
+   Bacula® - The Network Backup Solution
+
+   Copyright (C) 2012-2012 Free Software Foundation Europe e.V.
+
+   The main author of Bacula is Kern Sibbald, with contributions from
+   many others, a complete list can be found in the file AUTHORS.
+   This program is Free Software; you can redistribute it and/or
+   modify it under the terms of version three of the GNU Affero General Public
+   License as published by the Free Software Foundation and included
+   in the file LICENSE.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU Affero General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+   02110-1301, USA.
+
+   Bacula® is a registered trademark of Kern Sibbald.
+   The licensor of Bacula is the Free Software Foundation Europe
+   (FSFE), Fiduciary Program, Sumatrastrasse 25, 8006 Zürich,
+   Switzerland, email:ftf@fsfeurope.org.
+*/
+/*
+ * Daemon statistics registry
+ *
+ *  Every daemon keeps a small table of named counters, gauges
+ *  and histograms. Updating a metric is a mutex and an add, so
+ *  it can be done from the job threads. The gauges that are cheap
+ *  to compute on demand (jobs running, memory pools, ...) are
+ *  refreshed by update handlers just before the table is edited.
+ *
+ *  The table is edited by the .stats command, and optionally
+ *  appended as one JSON object per line to a statistics file
+ *  every "Statistics Interval" by a background thread.
+ */
+
+#include "bacula.h"
+#include "jcr.h"
+
+struct BSTAT_METRIC {
+   char name[160];
+   int type;
+   int64_t value;                     /* counter/gauge value or histogram sum */
+   uint64_t count;                    /* number of histogram samples */
+   uint64_t buckets[BSTAT_HIST_BUCKETS];
+};
+
+#define MAX_UPDATE_HANDLERS 10
+
+static BSTAT_METRIC metrics[BSTAT_MAX_METRICS];
+static int nb_metrics = 0;
+static BSTAT_UPDATE_HANDLER *update_handlers[MAX_UPDATE_HANDLERS];
+static int nb_update_handlers = 0;
+static pthread_mutex_t stat_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Statistics file thread */
+static pthread_mutex_t thread_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t thread_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t thread_id;
+static bool thread_running = false;
+static bool thread_quit = false;
+static char *stat_fname = NULL;
+static utime_t stat_interval = 0;
+
+static const char *pool_names[] = {
+   "nopool", "name", "fname", "message", "emsg", "bsock"
+};
+
+/*
+ * Register a metric, or get the index of an already
+ *  registered metric with the same name. Characters that
+ *  would need quoting in the output are replaced by '_'.
+ *
+ * Returns: metric index
+ *          -1 if the table is full, updates are then ignored
+ */
+int bstat_register(const char *name, int type)
+{
+   char clean[sizeof(metrics[0].name)];
+   int i;
+
+   bstrncpy(clean, name, sizeof(clean));
+   for (char *p=clean; *p; p++) {
+      if (!B_ISALPHA(*p) && !B_ISDIGIT(*p) && *p != '.' && *p != '-' && *p != '_') {
+         *p = '_';
+      }
+   }
+   P(stat_mutex);
+   for (i=0; i < nb_metrics; i++) {
+      if (strcmp(metrics[i].name, clean) == 0) {
+         goto bail_out;
+      }
+   }
+   if (nb_metrics >= BSTAT_MAX_METRICS) {
+      Dmsg1(50, "Statistics table full, %s ignored\n", clean);
+      i = -1;
+      goto bail_out;
+   }
+   i = nb_metrics;
+   memset(&metrics[i], 0, sizeof(BSTAT_METRIC));
+   bstrncpy(metrics[i].name, clean, sizeof(metrics[i].name));
+   metrics[i].type = type;
+   nb_metrics++;
+
+bail_out:
+   V(stat_mutex);
+   return i;
+}
+
+/* Add val to a counter or gauge */
+void bstat_inc(int id, int64_t val)
+{
+   if (id < 0) {
+      return;
+   }
+   P(stat_mutex);
+   metrics[id].value += val;
+   V(stat_mutex);
+}
+
+/* Set the current value of a gauge */
+void bstat_set(int id, int64_t val)
+{
+   if (id < 0) {
+      return;
+   }
+   P(stat_mutex);
+   metrics[id].value = val;
+   V(stat_mutex);
+}
+
+/* Add a duration sample to a histogram */
+void bstat_observe(int id, int64_t usecs)
+{
+   int b = 0;
+
+   if (id < 0) {
+      return;
+   }
+   for (int64_t v=usecs; v >= 4 && b < BSTAT_HIST_BUCKETS-1; v >>= 2) {
+      b++;
+   }
+   P(stat_mutex);
+   metrics[id].value += usecs;
+   metrics[id].count++;
+   metrics[id].buckets[b]++;
+   V(stat_mutex);
+}
+
+void bstat_add_update_handler(BSTAT_UPDATE_HANDLER *handler)
+{
+   P(stat_mutex);
+   if (nb_update_handlers < MAX_UPDATE_HANDLERS) {
+      update_handlers[nb_update_handlers++] = handler;
+   }
+   V(stat_mutex);
+}
+
+/*
+ * Gauges that every daemon has
+ */
+static void update_common_stats()
+{
+   char name[100];
+   int32_t max_allocated, max_used, in_use, cached;
+   uint64_t gets, hits;
+   int running = 0;
+   JCR *jcr;
+
+   foreach_jcr(jcr) {
+      if (jcr->JobId > 0) {
+         running++;
+      }
+   }
+   endeach_jcr(jcr);
+   bstat_set(bstat_register("jobs.running", BSTAT_GAUGE), running);
+   bstat_set(bstat_register("lock.waits", BSTAT_COUNTER), lmgr_lock_waits());
+
+   for (int i=0; i <= PM_MAX; i++) {
+      get_memory_pool_stats(i, &max_allocated, &max_used, &in_use);
+      bsnprintf(name, sizeof(name), "memory.%s.in_use", pool_names[i]);
+      bstat_set(bstat_register(name, BSTAT_GAUGE), in_use);
+      bsnprintf(name, sizeof(name), "memory.%s.max_used", pool_names[i]);
+      bstat_set(bstat_register(name, BSTAT_GAUGE), max_used);
+      bsnprintf(name, sizeof(name), "memory.%s.max_size", pool_names[i]);
+      bstat_set(bstat_register(name, BSTAT_GAUGE), max_allocated);
+      get_memory_cache_stats(i, &gets, &hits, &cached);
+      bsnprintf(name, sizeof(name), "memory.%s.cached", pool_names[i]);
+      bstat_set(bstat_register(name, BSTAT_GAUGE), cached);
+      bsnprintf(name, sizeof(name), "memory.%s.gets", pool_names[i]);
+      bstat_set(bstat_register(name, BSTAT_COUNTER), gets);
+      bsnprintf(name, sizeof(name), "memory.%s.cache_hits", pool_names[i]);
+      bstat_set(bstat_register(name, BSTAT_COUNTER), hits);
+   }
+}
+
+/*
+ * Edit all the metrics, either as key=value lines:
+ *
+ *   time=1329315600
+ *   daemon=zog-fd
+ *   jobs.running=1
+ *   catalog.query.count=10
+ *   catalog.query.sum=2345
+ *   catalog.query.le_4=0
+ *   ...
+ *   catalog.query.inf=0
+ *
+ *  or as a single line JSON object where histograms are
+ *   {"count":10,"sum":2345,"buckets":[0,...]}
+ *  The sums are in usecs, bucket i counts the samples below 4^(i+1).
+ */
+POOLMEM *bstat_edit(POOLMEM *&buf, bool json)
+{
+   char ed1[50], ed2[50];
+   POOL_MEM line;
+   BSTAT_METRIC *m;
+   int nb;
+
+   update_common_stats();
+   P(stat_mutex);
+   nb = nb_update_handlers;
+   V(stat_mutex);
+   for (int i=0; i < nb; i++) {
+      update_handlers[i]();
+   }
+
+   if (json) {
+      Mmsg(buf, "{\"time\":%s,\"daemon\":\"%s\"",
+           edit_uint64(time(NULL), ed1), my_name);
+   } else {
+      Mmsg(buf, "time=%s\ndaemon=%s\n", edit_uint64(time(NULL), ed1), my_name);
+   }
+   P(stat_mutex);
+   for (int i=0; i < nb_metrics; i++) {
+      m = &metrics[i];
+      if (m->type != BSTAT_HISTOGRAM) {
+         Mmsg(line, json ? ",\"%s\":%s" : "%s=%s\n", m->name,
+              edit_int64(m->value, ed1));
+         pm_strcat(buf, line);
+         continue;
+      }
+      if (json) {
+         Mmsg(line, ",\"%s\":{\"count\":%s,\"sum\":%s,\"buckets\":[", m->name,
+              edit_uint64(m->count, ed1), edit_int64(m->value, ed2));
+         pm_strcat(buf, line);
+         for (int b=0; b < BSTAT_HIST_BUCKETS; b++) {
+            Mmsg(line, "%s%s", b > 0 ? "," : "", edit_uint64(m->buckets[b], ed1));
+            pm_strcat(buf, line);
+         }
+         pm_strcat(buf, "]}");
+         continue;
+      }
+      Mmsg(line, "%s.count=%s\n%s.sum=%s\n", m->name, edit_uint64(m->count, ed1),
+           m->name, edit_int64(m->value, ed2));
+      pm_strcat(buf, line);
+      uint64_t bound = 4;
+      for (int b=0; b < BSTAT_HIST_BUCKETS; b++) {
+         if (b < BSTAT_HIST_BUCKETS-1) {
+            Mmsg(line, "%s.le_%s=%s\n", m->name, edit_uint64(bound, ed1),
+                 edit_uint64(m->buckets[b], ed2));
+         } else {
+            Mmsg(line, "%s.inf=%s\n", m->name, edit_uint64(m->buckets[b], ed2));
+         }
+         pm_strcat(buf, line);
+         bound <<= 2;
+      }
+   }
+   V(stat_mutex);
+   if (json) {
+      pm_strcat(buf, "}\n");
+   }
+   return buf;
+}
+
+/*
+ * Append the metrics as a JSON line to the statistics file
+ */
+bool bstat_write_file(const char *fname)
+{
+   static bool warned = false;
+   POOLMEM *buf;
+   FILE *fp;
+   bool ok;
+
+   if ((fp = fopen(fname, "a")) == NULL) {
+      berrno be;
+      if (!warned) {
+         Emsg2(M_ERROR, 0, _("Cannot open statistics file \"%s\": ERR=%s\n"),
+               fname, be.bstrerror());
+         warned = true;
+      }
+      return false;
+   }
+   warned = false;
+   buf = get_pool_memory(PM_MESSAGE);
+   bstat_edit(buf, true);
+   ok = fputs(buf, fp) >= 0;
+   fclose(fp);
+   free_pool_memory(buf);
+   return ok;
+}
+
+extern "C" void *bstat_thread(void *arg)
+{
+   struct timeval tv;
+   struct timespec timeout;
+
+   set_jcr_in_tsd(INVALID_JCR);
+   P(thread_mutex);
+   while (!thread_quit) {
+      gettimeofday(&tv, NULL);
+      timeout.tv_sec = tv.tv_sec + stat_interval;
+      timeout.tv_nsec = tv.tv_usec * 1000;
+      pthread_cond_timedwait(&thread_cond, &thread_mutex, &timeout);
+      if (thread_quit) {
+         break;
+      }
+      V(thread_mutex);
+      bstat_write_file(stat_fname);
+      P(thread_mutex);
+   }
+   V(thread_mutex);
+   return NULL;
+}
+
+/*
+ * Start appending the metrics to fname every interval
+ *  seconds. Nothing is done if either is not set.
+ */
+void start_bstat_thread(const char *fname, utime_t interval)
+{
+   int status;
+
+   if (!fname || !*fname || interval <= 0 || thread_running) {
+      return;
+   }
+   stat_fname = bstrdup(fname);
+   stat_interval = interval;
+   thread_quit = false;
+   if ((status = pthread_create(&thread_id, NULL, bstat_thread, NULL)) != 0) {
+      berrno be;
+      Emsg1(M_ERROR, 0, _("Cannot start statistics thread: ERR=%s\n"),
+            be.bstrerror(status));
+      free(stat_fname);
+      stat_fname = NULL;
+      return;
+   }
+   thread_running = true;
+}
+
+void stop_bstat_thread()
+{
+   if (!thread_running) {
+      return;
+   }
+   P(thread_mutex);
+   thread_quit = true;
+   pthread_cond_signal(&thread_cond);
+   V(thread_mutex);
+   pthread_join(thread_id, NULL);
+   thread_running = false;
+   free(stat_fname);
+   stat_fname = NULL;
+}
@@ -0,0 +1,69 @@
+/*
+   Bacula® - The Network Backup Solution
+
+   Copyright (C) 2012-2012 Free Software Foundation Europe e.V.
+
+   The main author of Bacula is Kern Sibbald, with contributions from
+   many others, a complete list can be found in the file AUTHORS.
+   This program is Free Software; you can redistribute it and/or
+   modify it under the terms of version three of the GNU Affero General Public
+   License as published by the Free Software Foundation and included
+   in the file LICENSE.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU Affero General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+   02110-1301, USA.
+
+   Bacula® is a registered trademark of Kern Sibbald.
+   The licensor of Bacula is the Free Software Foundation Europe
+   (FSFE), Fiduciary Program, Sumatrastrasse 25, 8006 Zürich,
+   Switzerland, email:ftf@fsfeurope.org.
+*/
+/*
+ * Daemon statistics registry
+ *
+ *  Metrics are registered by name, then updated by their index.
+ *  They are edited as key=value lines or as a JSON object by the
+ *  .stats command, and can be appended to a statistics file at
+ *  a fixed interval.
+ *
+ */
+
+#ifndef __BSTAT_H_
+#define __BSTAT_H_
+
+enum {
+   BSTAT_COUNTER = 1,                 /* always increasing, e.g. bytes written */
+   BSTAT_GAUGE,                       /* current value, e.g. jobs running */
+   BSTAT_HISTOGRAM                    /* distribution of durations in usecs */
+};
+
+/*
+ * Histogram bucket i counts the samples below 4^(i+1) usecs,
+ *  the last bucket gets everything above ~4.5 minutes.
+ */
+#define BSTAT_HIST_BUCKETS 15
+
+/* Maximum number of metrics in a daemon */
+#define BSTAT_MAX_METRICS 256
+
+/* Called before the metrics are edited to refresh the gauges */
+typedef void (BSTAT_UPDATE_HANDLER)(void);
+
+int      bstat_register(const char *name, int type);
+void     bstat_inc(int id, int64_t val=1);
+void     bstat_set(int id, int64_t val);
+void     bstat_observe(int id, int64_t usecs);
+void     bstat_add_update_handler(BSTAT_UPDATE_HANDLER *handler);
+POOLMEM *bstat_edit(POOLMEM *&buf, bool json);
+bool     bstat_write_file(const char *fname);
+void     start_bstat_thread(const char *fname, utime_t interval);
+void     stop_bstat_thread();
+
+#endif /* __BSTAT_H_ */
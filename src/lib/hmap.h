@@ -0,0 +1,427 @@
+/*
+   Bacula® - The Network Backup Solution
+
+   Copyright (C) 2012-2012 Free Software Foundation Europe e.V.
+
+   The main author of Bacula is Kern Sibbald, with contributions from
+   many others, a complete list can be found in the file AUTHORS.
+   This program is Free Software; you can redistribute it and/or
+   modify it under the terms of version three of the GNU Affero General Public
+   License as published by the Free Software Foundation and included
+   in the file LICENSE.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU Affero General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+   02110-1301, USA.
+
+   Bacula® is a registered trademark of Kern Sibbald.
+   The licensor of Bacula is the Free Software Foundation Europe
+   (FSFE), Fiduciary Program, Sumatrastrasse 25, 8006 Zürich,
+   Switzerland, email:ftf@fsfeurope.org.
+*/
+/*
+ *  Typed hash map -- hmap
+ *
+ *  hmap<K, V> maps keys of type K to values of type V. The table
+ *    uses open addressing with linear probing, and one control byte
+ *    per slot that holds the slot state and 7 bits of the hash, so
+ *    most of the probes never touch the keys.
+ *
+ *  The table never rehashes everything at once. When it is 3/4
+ *    full, a new table (twice as big, or the same size if most of
+ *    the used slots are deleted ones) is allocated, and every
+ *    insert() or remove() moves a few slots of the old table into
+ *    the new one. Lookups look in both tables while this is going on.
+ *
+ *  Keys are hashed and compared by the hmap_traits<K> class, that
+ *    exists for char *, uint32_t and uint64_t keys. Other key types
+ *    just need their own traits. The table does not copy the char *
+ *    keys, they can be allocated in the arena of the map with
+ *    hash_malloc() or hash_strdup(), and are all released at once
+ *    by destroy() or hash_big_free().
+ *
+ *  Like the other Bacula containers, the map can be malloc()ed and
+ *    set up with init() instead of being constructed.
+ */
+
+#ifndef HMAP_H
+#define HMAP_H
+
+/*
+ * Memory arena, small allocations taken out of big buffers
+ *  that are all released by destroy()
+ */
+struct h_mem {
+   struct h_mem *next;                /* next buffer */
+   int32_t rem;                       /* remaining bytes in big_buffer */
+   char *mem;                         /* memory pointer */
+   char first[1];                     /* first byte */
+};
+
+class harena {
+   struct h_mem *mem_block;           /* malloc'ed memory block chain */
+   uint64_t total_size;               /* total bytes malloced */
+   uint32_t extend_length;            /* bytes to allocate when extending */
+   uint32_t blocks;                   /* blocks malloced */
+   void malloc_big_buf(int size);     /* Get a big buffer */
+
+public:
+   void init(int nr_pages = 0);
+   char *alloc(int size);             /* get size bytes from the arena */
+   void destroy();                    /* free all big buffers */
+   uint64_t size() { return total_size; };
+   uint32_t nb_blocks() { return blocks; };
+};
+
+/*
+ * Hash and comparison of the keys
+ */
+template <typename K> struct hmap_traits;
+
+template <> struct hmap_traits<char *> {
+   static uint64_t hash(const char *key) {
+      uint64_t hash = 0;
+      for (const char *p=key; *p; p++) {
+         hash +=  ((hash << 5) | (hash >> (sizeof(hash)*8-5))) + (uint32_t)*p;
+      }
+      return hash;
+   };
+   static bool equal(const char *a, const char *b) { return strcmp(a, b) == 0; };
+};
+
+template <> struct hmap_traits<uint32_t> {
+   static uint64_t hash(uint32_t key) { return key; };
+   static bool equal(uint32_t a, uint32_t b) { return a == b; };
+};
+
+template <> struct hmap_traits<uint64_t> {
+   static uint64_t hash(uint64_t key) { return key; };
+   static bool equal(uint64_t a, uint64_t b) { return a == b; };
+};
+
+#define HMAP_EMPTY      0x00          /* control byte of a free slot */
+#define HMAP_DELETED    0x01          /* control byte of a removed entry */
+#define HMAP_MIN_PWR    4             /* smallest table is 16 slots */
+#define HMAP_MIGRATE    16            /* old slots moved per insert/remove */
+
+template <typename K, typename V, typename T = hmap_traits<K> >
+class hmap : public SMARTALLOC {
+   struct htab {
+      uint8_t *ctrl;                  /* slot state and hash bits */
+      K *keys;
+      V *vals;
+      uint32_t buckets;               /* size of the table -- power of two */
+      uint32_t pwr;                   /* buckets = 1 << pwr */
+      uint32_t used;                  /* entries + deleted slots */
+   };
+   htab cur;                          /* table where the entries are added */
+   htab old;                          /* table being emptied, if ctrl != NULL */
+   uint32_t migrate_index;            /* next slot of old to move */
+   uint32_t num_items;                /* current number of items */
+   uint32_t nb_resize;                /* number of resizes */
+   int walk_tab;                      /* 0 = old, 1 = cur, 2 = done */
+   uint32_t walk_index;               /* next slot to walk */
+   harena arena;                      /* memory for the keys */
+
+   /* Spread the bits of the hash, use the top ones for the index */
+   static uint64_t mix(uint64_t hash) { return hash * 0x9E3779B97F4A7C15ULL; };
+   static uint8_t tag(uint64_t h) { return 0x80 | (h & 0x7F); };
+   static uint32_t slot(const htab &t, uint64_t h) { return (uint32_t)(h >> (64 - t.pwr)); };
+
+   void alloc_tab(htab &t, uint32_t pwr);
+   void free_tab(htab &t);
+   bool find(htab &t, uint64_t h, K key, uint32_t *index);
+   void put(htab &t, uint64_t h, K key, V val);
+   void migrate(uint32_t nb);
+   void start_resize();
+
+public:
+   hmap(uint32_t tsize = 32, int nr_pages = 0) { init(tsize, nr_pages); };
+   ~hmap() { destroy(); };
+   void init(uint32_t tsize = 32, int nr_pages = 0);
+   bool insert(K key, V val);         /* false if the key exists */
+   V *lookup(K key);                  /* NULL if not found */
+   bool remove(K key);                /* false if not found */
+   bool first(K *key, V *val);        /* get first entry of the table */
+   bool next(K *key, V *val);         /* get next entry of the table */
+   uint32_t size() { return num_items; };
+   char *hash_malloc(int size) { return arena.alloc(size); };
+   char *hash_strdup(const char *str);
+   void hash_big_free() { arena.destroy(); };
+   void stats();                      /* print stats about the table */
+   void destroy();
+};
+
+/*
+ * tsize is the estimated number of entries, the table is
+ *  big enough to hold them without resizing.
+ */
+template <typename K, typename V, typename T>
+void hmap<K, V, T>::init(uint32_t tsize, int nr_pages)
+{
+   uint32_t pwr = HMAP_MIN_PWR;
+
+   while (pwr < 31 && ((uint64_t)1 << pwr) * 3 / 4 <= tsize) {
+      pwr++;
+   }
+   memset(&old, 0, sizeof(old));
+   migrate_index = 0;
+   num_items = 0;
+   nb_resize = 0;
+   walk_tab = 2;
+   walk_index = 0;
+   arena.init(nr_pages);
+   alloc_tab(cur, pwr);
+}
+
+template <typename K, typename V, typename T>
+void hmap<K, V, T>::alloc_tab(htab &t, uint32_t pwr)
+{
+   t.pwr = pwr;
+   t.buckets = 1 << pwr;
+   t.used = 0;
+   t.ctrl = (uint8_t *)malloc(t.buckets);
+   memset(t.ctrl, HMAP_EMPTY, t.buckets);
+   t.keys = (K *)malloc(t.buckets * sizeof(K));
+   t.vals = (V *)malloc(t.buckets * sizeof(V));
+}
+
+template <typename K, typename V, typename T>
+void hmap<K, V, T>::free_tab(htab &t)
+{
+   if (t.ctrl) {
+      free(t.ctrl);
+      free(t.keys);
+      free(t.vals);
+   }
+   memset(&t, 0, sizeof(t));
+}
+
+/*
+ * Look for a key in one table, the slot is returned in index
+ */
+template <typename K, typename V, typename T>
+bool hmap<K, V, T>::find(htab &t, uint64_t h, K key, uint32_t *index)
+{
+   uint32_t mask = t.buckets - 1;
+   uint8_t tg = tag(h);
+
+   for (uint32_t i = slot(t, h); ; i = (i + 1) & mask) {
+      if (t.ctrl[i] == HMAP_EMPTY) {
+         return false;
+      }
+      if (t.ctrl[i] == tg && T::equal(t.keys[i], key)) {
+         *index = i;
+         return true;
+      }
+   }
+}
+
+/*
+ * Store a new entry in one table, the key must not be there
+ */
+template <typename K, typename V, typename T>
+void hmap<K, V, T>::put(htab &t, uint64_t h, K key, V val)
+{
+   uint32_t mask = t.buckets - 1;
+   uint32_t i;
+
+   for (i = slot(t, h); t.ctrl[i] > HMAP_DELETED; i = (i + 1) & mask)
+      { }
+   if (t.ctrl[i] == HMAP_EMPTY) {
+      t.used++;
+   }
+   t.ctrl[i] = tag(h);
+   t.keys[i] = key;
+   t.vals[i] = val;
+}
+
+/*
+ * Move up to nb slots of the old table into the current one,
+ *  release the old table when it is empty
+ */
+template <typename K, typename V, typename T>
+void hmap<K, V, T>::migrate(uint32_t nb)
+{
+   if (!old.ctrl) {
+      return;
+   }
+   for ( ; nb > 0 && migrate_index < old.buckets; nb--, migrate_index++) {
+      uint32_t i = migrate_index;
+      if (old.ctrl[i] > HMAP_DELETED) {
+         put(cur, mix(T::hash(old.keys[i])), old.keys[i], old.vals[i]);
+         /* Not HMAP_EMPTY, the probe sequences of the old table must go on */
+         old.ctrl[i] = HMAP_DELETED;
+      }
+   }
+   if (migrate_index >= old.buckets) {
+      Dmsg2(100, "hmap resize done buckets=%d items=%d\n", cur.buckets, num_items);
+      free_tab(old);
+      migrate_index = 0;
+   }
+}
+
+/*
+ * The current table is too full. Make it the old table and
+ *  start to fill a new one, twice as big unless most of the
+ *  used slots are deleted entries.
+ */
+template <typename K, typename V, typename T>
+void hmap<K, V, T>::start_resize()
+{
+   uint32_t pwr = cur.pwr;
+
+   if (num_items >= cur.buckets / 4 && pwr < 31) {
+      pwr++;
+   }
+   old = cur;
+   migrate_index = 0;
+   alloc_tab(cur, pwr);
+   nb_resize++;
+   Dmsg2(100, "hmap resize to buckets=%d items=%d\n", cur.buckets, num_items);
+}
+
+template <typename K, typename V, typename T>
+bool hmap<K, V, T>::insert(K key, V val)
+{
+   if (lookup(key)) {
+      return false;                   /* already exists */
+   }
+   migrate(HMAP_MIGRATE);
+   if ((uint64_t)(cur.used + 1) * 4 > (uint64_t)cur.buckets * 3) {
+      if (old.ctrl) {                 /* should not happen, see migrate() */
+         migrate(old.buckets);
+      }
+      start_resize();
+   }
+   put(cur, mix(T::hash(key)), key, val);
+   num_items++;
+   return true;
+}
+
+template <typename K, typename V, typename T>
+V *hmap<K, V, T>::lookup(K key)
+{
+   uint64_t h = mix(T::hash(key));
+   uint32_t i;
+
+   if (find(cur, h, key, &i)) {
+      return &cur.vals[i];
+   }
+   if (old.ctrl && find(old, h, key, &i)) {
+      return &old.vals[i];
+   }
+   return NULL;
+}
+
+template <typename K, typename V, typename T>
+bool hmap<K, V, T>::remove(K key)
+{
+   uint64_t h = mix(T::hash(key));
+   uint32_t i;
+
+   if (find(cur, h, key, &i)) {
+      cur.ctrl[i] = HMAP_DELETED;
+   } else if (old.ctrl && find(old, h, key, &i)) {
+      old.ctrl[i] = HMAP_DELETED;
+   } else {
+      return false;
+   }
+   num_items--;
+   migrate(HMAP_MIGRATE);
+   return true;
+}
+
+/*
+ * Walk the old table then the current one. The table must not
+ *  be modified during the walk.
+ */
+template <typename K, typename V, typename T>
+bool hmap<K, V, T>::first(K *key, V *val)
+{
+   walk_tab = 0;
+   walk_index = 0;
+   return next(key, val);
+}
+
+template <typename K, typename V, typename T>
+bool hmap<K, V, T>::next(K *key, V *val)
+{
+   for ( ; walk_tab < 2; walk_tab++, walk_index = 0) {
+      htab &t = walk_tab == 0 ? old : cur;
+      for ( ; walk_index < t.buckets; walk_index++) {
+         if (t.ctrl[walk_index] > HMAP_DELETED) {
+            *key = t.keys[walk_index];
+            *val = t.vals[walk_index];
+            walk_index++;
+            return true;
+         }
+      }
+   }
+   return false;
+}
+
+template <typename K, typename V, typename T>
+char *hmap<K, V, T>::hash_strdup(const char *str)
+{
+   int len = strlen(str) + 1;
+   char *buf = arena.alloc(len);
+   memcpy(buf, str, len);
+   return buf;
+}
+
+/*
+ * Report the table size and the length of the probe sequences
+ */
+#define HMAP_MAX_PROBE 20
+template <typename K, typename V, typename T>
+void hmap<K, V, T>::stats()
+{
+   uint32_t hits[HMAP_MAX_PROBE];
+   uint32_t max = 0, deleted = 0;
+
+   memset(hits, 0, sizeof(hits));
+   for (uint32_t i=0; i < cur.buckets; i++) {
+      if (cur.ctrl[i] == HMAP_DELETED) {
+         deleted++;
+      }
+      if (cur.ctrl[i] <= HMAP_DELETED) {
+         continue;
+      }
+      uint32_t dist = (i - slot(cur, mix(T::hash(cur.keys[i])))) & (cur.buckets - 1);
+      if (dist > max) {
+         max = dist;
+      }
+      hits[dist < HMAP_MAX_PROBE ? dist : HMAP_MAX_PROBE - 1]++;
+   }
+   printf("\n\nNumItems=%d\nTotal buckets=%d deleted=%d resizes=%d\n", num_items,
+          cur.buckets, deleted, nb_resize);
+   if (old.ctrl) {
+      printf("Resizing: %d of %d old buckets moved\n", migrate_index, old.buckets);
+   }
+   printf("Probe distance: items\n");
+   for (int i=0; i < HMAP_MAX_PROBE; i++) {
+      printf("%2d:           %d\n", i, hits[i]);
+   }
+   printf("max probe distance = %d\n", max);
+   printf("total bytes malloced = %lld\n", (long long int)arena.size());
+   printf("total blocks malloced = %d\n", arena.nb_blocks());
+}
+
+/* Destroy the table and the arena */
+template <typename K, typename V, typename T>
+void hmap<K, V, T>::destroy()
+{
+   free_tab(cur);
+   free_tab(old);
+   num_items = 0;
+   arena.destroy();
+}
+
+#endif  /* HMAP_H */
@@ -27,6 +27,9 @@
 */
 /*
  * Written by Kern Sibbald, MMIV
+ *
+ *  htable keeps its items in an hmap (see hmap.h), the items
+ *  carry their key in an hlink.
  */
 
 #ifndef HTABLE_H
@@ -66,40 +69,36 @@ union hlink_key {
 };
 
 struct hlink {
-   void *next;                        /* next hash item */
    key_type_t key_type;               /* type of key used to hash */
    union hlink_key key;               /* key for this item */
    uint64_t hash;                     /* hash for this key */
 };
 
-struct h_mem {
-   struct h_mem *next;                /* next buffer */
-   int32_t rem;                       /* remaining bytes in big_buffer */
-   char *mem;                         /* memory pointer */
-   char first[1];                     /* first byte */
+/* How the hmap of an htable hashes and compares the hlinks */
+struct hlink_traits {
+   static uint64_t hash(hlink *hp) { return hp->hash; };
+   static bool equal(hlink *a, hlink *b) {
+      if (a->key_type != b->key_type || a->hash != b->hash) {
+         return false;
+      }
+      switch (a->key_type) {
+      case KEY_TYPE_CHAR:
+         return strcmp(a->key.char_key, b->key.char_key) == 0;
+      case KEY_TYPE_UINT32:
+         return a->key.uint32_key == b->key.uint32_key;
+      default:
+         return a->key.uint64_key == b->key.uint64_key;
+      }
+   };
 };
 
+typedef hmap<hlink *, void *, hlink_traits> hlink_map;
+
 class htable : public SMARTALLOC {
-   hlink **table;                     /* hash table */
+   hlink_map *map;                    /* hlink => item */
    int loffset;                       /* link offset in item */
-   hlink *walkptr;                    /* table walk pointer */
-   uint64_t hash;                     /* temp storage */
-   uint64_t total_size;               /* total bytes malloced */
-   uint32_t extend_length;            /* number of bytes to allocate when extending buffer */
-   uint32_t walk_index;               /* table walk index */
-   uint32_t num_items;                /* current number of items */
-   uint32_t max_items;                /* maximum items before growing */
-   uint32_t buckets;                  /* size of hash table */
-   uint32_t index;                    /* temp storage */
-   uint32_t mask;                     /* "remainder" mask */
-   uint32_t rshift;                   /* amount to shift down */
-   uint32_t blocks;                   /* blocks malloced */
-   struct h_mem *mem_block;           /* malloc'ed memory block chain */
-   void malloc_big_buf(int size);     /* Get a big buffer */
-   void hash_index(char *key);        /* produce hash key,index */
-   void hash_index(uint32_t key);     /* produce hash key,index */
-   void hash_index(uint64_t key);     /* produce hash key,index */
-   void grow_table();                 /* grow the table */
+   bool insert(hlink *hp, void *item);
+   void *lookup(hlink *hp);
 
 public:
    htable(void *item, void *link, int tsize = 31, int nr_pages = 0);
@@ -289,6 +289,78 @@ bool JCR::JobReads()
    return false;
 }
 
+static const char *job_stage_names[JOB_STAGE_MAX] = {
+   NT_("open"),
+   NT_("read"),
+   NT_("compress"),
+   NT_("encrypt"),
+   NT_("net send"),
+   NT_("dev write"),
+   NT_("spool write"),
+   NT_("despool"),
+   NT_("catalog")
+};
+
+/*
+ * Edit the pipeline stages used by this job, one per line,
+ *  e.g. "    read        2.104 s   1.234 G  586.4 K/s (1234)"
+ *  Returns an empty string if no stage was timed.
+ */
+POOLMEM *edit_job_stages(JCR *jcr, POOLMEM *&buf)
+{
+   char ed1[50], ed2[50], ed3[50];
+   POOL_MEM line;
+   JOB_STAGE stages[JOB_STAGE_MAX], *s;
+   uint64_t rate;
+
+   /* The counters may move while we copy them, a call more or less */
+   memcpy(stages, jcr->stages, sizeof(stages));
+
+   pm_strcpy(buf, "");
+   for (int i=0; i < JOB_STAGE_MAX; i++) {
+      s = &stages[i];
+      if (s->count == 0) {
+         continue;
+      }
+      rate = s->time > 0 ? (uint64_t)((double)s->bytes * 1000000 / s->time) : 0;
+      Mmsg(line, _("    %-11s %5d.%03d s %9sB %9sB/s (%s)\n"),
+           job_stage_names[i], (int)(s->time / 1000000),
+           (int)((s->time / 1000) % 1000),
+           edit_uint64_with_suffix(s->bytes, ed1),
+           edit_uint64_with_suffix(rate, ed2),
+           edit_uint64(s->count, ed3));
+      pm_strcat(buf, line.c_str());
+   }
+   return buf;
+}
+
+/*
+ * Summarize the pipeline stages in the job report, and add
+ *  them to the daemon statistics
+ */
+void report_job_stages(JCR *jcr)
+{
+   char name[100];
+   JOB_STAGE *s;
+   POOLMEM *buf = get_pool_memory(PM_MESSAGE);
+
+   if (*edit_job_stages(jcr, buf)) {
+      Jmsg(jcr, M_INFO, 0, _("Pipeline stage times:\n%s"), buf);
+   }
+   free_pool_memory(buf);
+
+   for (int i=0; i < JOB_STAGE_MAX; i++) {
+      s = &jcr->stages[i];
+      if (s->count == 0) {
+         continue;
+      }
+      bsnprintf(name, sizeof(name), "stage.%s.usecs", job_stage_names[i]);
+      bstat_inc(bstat_register(name, BSTAT_COUNTER), s->time);
+      bsnprintf(name, sizeof(name), "stage.%s.bytes", job_stage_names[i]);
+      bstat_inc(bstat_register(name, BSTAT_COUNTER), s->bytes);
+   }
+}
+
 /*
  * Push a subroutine address into the job end callback stack
  */
@@ -350,6 +422,11 @@ JCR *new_jcr(int size, JCR_free_HANDLER *daemon_free_jcr)
       Jmsg(NULL, M_ABORT, 0, _("Could not init msg_queue mutex. ERR=%s\n"),
          be.bstrerror(status));
    }
+   if ((status = pthread_mutex_init(&jcr->stage_mutex, NULL)) != 0) {
+      berrno be;
+      Jmsg(NULL, M_ABORT, 0, _("Could not init stage mutex. ERR=%s\n"),
+         be.bstrerror(status));
+   }
    jcr->job_end_push.init(1, false);
    jcr->sched_time = time(NULL);
    jcr->daemon_free_jcr = daemon_free_jcr;    /* plug daemon free routine */
@@ -423,6 +500,7 @@ static void free_common_jcr(JCR *jcr)
       jcr->msg_queue = NULL;
       pthread_mutex_destroy(&jcr->msg_queue_mutex);
    }
+   pthread_mutex_destroy(&jcr->stage_mutex);
    close_msg(jcr);                    /* close messages for this job */
 
    /* do this after closing messages */
@@ -61,13 +61,16 @@
 #include "md5.h"
 #include "sha1.h"
 #include "tree.h"
+#include "twheel.h"
 #include "watchdog.h"
 #include "btimers.h"
+#include "bstat.h"
 #include "berrno.h"
 #include "bpipe.h"
 #include "attr.h"
 #include "var.h"
 #include "guid_to_name.h"
+#include "hmap.h"
 #include "htable.h"
 #include "sellist.h"
 #include "protos.h"
@@ -85,9 +85,26 @@
   g++ -g -c lockmgr.c -I.. -I../lib -D_USE_LOCKMGR -D_TEST_IT
   g++ -o lockmgr lockmgr.o -lbac -L../lib/.libs -lssl -lpthread
 
+  With USE_LOCKMGR_PROFILE, each P() done through the lock manager
+  is also accounted to its acquisition site (file:line): number of
+  locks, number of locks that had to wait, and the total and max
+  wait and hold times. The profile is printed by lmgr_dump() and
+  by the ".status dir|client|storage locks" command.
+
 */
 
 
+/*
+ * Number of P() that had to wait for the mutex. It is not
+ *  protected, so it is only an estimate for the statistics.
+ */
+static uint64_t lmgr_nb_wait = 0;
+
+uint64_t lmgr_lock_waits()
+{
+   return lmgr_nb_wait;
+}
+
 /*
  * pthread_mutex_lock for memory allocator and other
  * parts that are _LOCKMGR_COMPLIANT
@@ -95,6 +112,10 @@
 void lmgr_p(pthread_mutex_t *m)
 {
    int errstat;
+   if (pthread_mutex_trylock(m) == 0) {
+      return;
+   }
+   lmgr_nb_wait++;
    if ((errstat=pthread_mutex_lock(m))) {
       berrno be;
       e_msg(__FILE__, __LINE__, M_ABORT, 0, _("Mutex lock failure. ERR=%s\n"),
@@ -180,10 +201,14 @@ public:
    const char *file;
    int line;
 
+   int site;                    /* profile site, -1 if not profiled */
+   btime_t since;               /* time when the lock was granted */
+
    lmgr_lock_t() {
       lock = NULL;
       state = LMGR_LOCK_EMPTY;
       priority = max_priority = 0;
+      site = -1;
    }
 
    lmgr_lock_t(void *l) {
@@ -257,6 +282,130 @@ static bool contains_cycle(dlist *g)
 
 /****************************************************************/
 
+#ifdef USE_LOCKMGR_PROFILE
+
+/*
+ * Lock contention profile, one entry per acquisition site.
+ *  Sites are claimed under lmgr_prof_mutex, the counters are
+ *  not protected, so they are only an estimate.
+ */
+#define LMGR_PROF_SITES  1024         /* must be big enough for all P() */
+#define LMGR_PROF_REPORT 40           /* sites printed by lmgr_edit_profile() */
+
+typedef struct {
+   const char *file;
+   int line;
+   uint64_t nb_lock;                  /* number of acquisitions */
+   uint64_t nb_wait;                  /* acquisitions that had to wait */
+   btime_t wait_total;                /* in usecs */
+   btime_t wait_max;
+   btime_t hold_total;
+   btime_t hold_max;
+} lmgr_site_t;
+
+static lmgr_site_t lmgr_sites[LMGR_PROF_SITES];
+static pthread_mutex_t lmgr_prof_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Find the profile entry of file:line, the file pointer
+ *  is the __FILE__ constant, so we don't compare strings.
+ *  Returns -1 if the table is full.
+ */
+static int lmgr_get_site(const char *file, int line)
+{
+   uint32_t hash = (uint32_t)(((intptr_t)file >> 3) * 31 + line);
+   int i, n, ret = -1;
+
+   for (n=0; n < LMGR_PROF_SITES; n++) {
+      i = (hash + n) % LMGR_PROF_SITES;
+      if (lmgr_sites[i].file == NULL) {
+         break;
+      }
+      if (lmgr_sites[i].file == file && lmgr_sites[i].line == line) {
+         return i;
+      }
+   }
+
+   /* Not found, search again and claim a free entry under the lock */
+   lmgr_p(&lmgr_prof_mutex);
+   for (n=0; n < LMGR_PROF_SITES; n++) {
+      i = (hash + n) % LMGR_PROF_SITES;
+      if (lmgr_sites[i].file == NULL) {
+         lmgr_sites[i].line = line;
+         lmgr_sites[i].file = file;
+         ret = i;
+         break;
+      }
+      if (lmgr_sites[i].file == file && lmgr_sites[i].line == line) {
+         ret = i;
+         break;
+      }
+   }
+   lmgr_v(&lmgr_prof_mutex);
+   return ret;
+}
+
+/*
+ * Get the mutex and account the wait to the site, since is
+ *  set to the time when the lock is granted.
+ */
+static int lmgr_prof_p(pthread_mutex_t *m, const char *file, int line,
+                       btime_t *since)
+{
+   lmgr_site_t *s;
+   btime_t start, wait = 0;
+   bool contended = false;
+   int site = lmgr_get_site(file, line);
+
+   if (pthread_mutex_trylock(m) == 0) {
+      *since = get_current_btime();
+   } else {
+      contended = true;
+      start = get_current_btime();
+      lmgr_p(m);
+      *since = get_current_btime();
+      wait = *since - start;
+   }
+   if (site >= 0) {
+      s = &lmgr_sites[site];
+      s->nb_lock++;
+      if (contended) {
+         s->nb_wait++;
+         s->wait_total += wait;
+         if (wait > s->wait_max) {
+            s->wait_max = wait;
+         }
+      }
+   }
+   return site;
+}
+
+/*
+ * Account the hold time of a lock that is about to be released
+ */
+static void lmgr_prof_v(lmgr_lock_t *l)
+{
+   btime_t hold;
+   lmgr_site_t *s;
+
+   if (l->site < 0 || l->state != LMGR_LOCK_GRANTED) {
+      return;
+   }
+   s = &lmgr_sites[l->site];
+   hold = get_current_btime() - l->since;
+   s->hold_total += hold;
+   if (hold > s->hold_max) {
+      s->hold_max = hold;
+   }
+   l->site = -1;
+}
+
+#else  /* USE_LOCKMGR_PROFILE */
+
+# define lmgr_prof_v(l)
+
+#endif  /* USE_LOCKMGR_PROFILE */
+
 class lmgr_thread_t: public SMARTALLOC
 {
 public:
@@ -320,6 +469,7 @@ public:
          lock_list[current].line = l;
          lock_list[current].priority = priority;
          lock_list[current].max_priority = MAX(priority, max_priority);
+         lock_list[current].site = -1;
          max = MAX(current, max);
          max_priority = MAX(priority, max_priority);
       }
@@ -329,11 +479,14 @@ public:
 
    /*
     * Call after the lock operation (mark mutex as GRANTED)
+    *  site and since are used by the contention profile
     */
-   virtual void post_P() {
+   virtual void post_P(int site=-1, btime_t since=0) {
       ASSERT(current >= 0);
       ASSERT(lock_list[current].state == LMGR_LOCK_WANTED);
       lock_list[current].state = LMGR_LOCK_GRANTED;
+      lock_list[current].site = site;
+      lock_list[current].since = since;
    }
    
    /* Using this function is some sort of bug */
@@ -361,6 +514,7 @@ public:
       lmgr_p(&mutex);
       {
          if (lock_list[current].lock == m) {
+            lmgr_prof_v(&lock_list[current]);
             lock_list[current].lock = NULL;
             lock_list[current].state = LMGR_LOCK_EMPTY;
             current--;
@@ -375,6 +529,7 @@ public:
                      i, lock_list[i].lock, lock_list[i].file, lock_list[i].line);
                if (lock_list[i].lock == m) {
                   Pmsg3(000, "ERROR: FOUND P pos=%i %s:%i\n", i, f, l);
+                  lmgr_prof_v(&lock_list[i]);
                   shift_list(i);
                   current--;
                   break;
@@ -401,7 +556,7 @@ public:
 class lmgr_dummy_thread_t: public lmgr_thread_t
 {
    void do_V(void *m, const char *file, int l)  {}
-   void post_P()                                {}
+   void post_P(int site, btime_t since)         {}
    void pre_P(void *m, int priority, const char *file, int l) {}
 };
 
@@ -558,6 +713,11 @@ void lmgr_dump()
       }
    }
    lmgr_v(&lmgr_global_mutex);
+#ifdef USE_LOCKMGR_PROFILE
+   POOLMEM *buf = get_pool_memory(PM_MESSAGE);
+   fputs(lmgr_edit_profile(buf), stderr);
+   free_pool_memory(buf);
+#endif
 }
 
 void cln_hdl(void *a)
@@ -745,6 +905,36 @@ int bthread_kill(pthread_t thread, int sig,
    return pthread_kill(thread, sig);
 }
 
+/*
+ * Get the mutex for bthread_mutex_lock_p(), and account
+ *  it in the contention profile if it is enabled
+ */
+static inline void lmgr_lock_p(lmgr_thread_t *self, pthread_mutex_t *m,
+                               const char *file, int line)
+{
+#ifdef USE_LOCKMGR_PROFILE
+   btime_t since;
+   int site = lmgr_prof_p(m, file, line, &since);
+   self->post_P(site, since);
+#else
+   lmgr_p(m);
+   self->post_P();
+#endif
+}
+
+/*
+ * The mutex was given back by pthread_cond_wait(), the hold
+ *  time restarts at the cond_wait site.
+ */
+static inline void lmgr_relock_p(lmgr_thread_t *self, const char *file, int line)
+{
+#ifdef USE_LOCKMGR_PROFILE
+   self->post_P(lmgr_get_site(file, line), get_current_btime());
+#else
+   self->post_P();
+#endif
+}
+
 /*
  * Replacement for pthread_mutex_lock()
  * Returns always ok 
@@ -753,8 +943,7 @@ int bthread_mutex_lock_p(bthread_mutex_t *m, const char *file, int line)
 {
    lmgr_thread_t *self = lmgr_get_thread_info();
    self->pre_P(m, m->priority, file, line);
-   lmgr_p(&m->mutex);
-   self->post_P();   
+   lmgr_lock_p(self, &m->mutex, file, line);
    return 0;
 }
 
@@ -778,8 +967,7 @@ int bthread_mutex_lock_p(pthread_mutex_t *m, const char *file, int line)
 {
    lmgr_thread_t *self = lmgr_get_thread_info();
    self->pre_P(m, 0, file, line);
-   lmgr_p(m);
-   self->post_P();   
+   lmgr_lock_p(self, m, file, line);
    return 0;
 }
 
@@ -807,7 +995,7 @@ int bthread_cond_wait_p(pthread_cond_t *cond,
    self->do_V(m, file, line);   
    ret = pthread_cond_wait(cond, m);
    self->pre_P(m, 0, file, line);
-   self->post_P();
+   lmgr_relock_p(self, file, line);
    return ret;
 }
 
@@ -823,7 +1011,7 @@ int bthread_cond_timedwait_p(pthread_cond_t *cond,
    self->do_V(m, file, line);   
    ret = pthread_cond_timedwait(cond, m, abstime);
    self->pre_P(m, 0, file, line);
-   self->post_P();
+   lmgr_relock_p(self, file, line);
    return ret;
 }
 
@@ -838,7 +1026,7 @@ int bthread_cond_wait_p(pthread_cond_t *cond,
    self->do_V(m, file, line);   
    ret = pthread_cond_wait(cond, &m->mutex);
    self->pre_P(m, m->priority, file, line);
-   self->post_P();
+   lmgr_relock_p(self, file, line);
    return ret;
 }
 
@@ -854,7 +1042,7 @@ int bthread_cond_timedwait_p(pthread_cond_t *cond,
    self->do_V(m, file, line);   
    ret = pthread_cond_timedwait(cond, &m->mutex, abstime);
    self->pre_P(m, m->priority, file, line);
-   self->post_P();
+   lmgr_relock_p(self, file, line);
    return ret;
 }
 
@@ -954,6 +1142,64 @@ int lmgr_thread_create(pthread_t *thread,
    return pthread_create(thread, attr, lmgr_thread_launcher, a);
 }
 
+#ifdef USE_LOCKMGR_PROFILE
+
+/* Sort the sites by total wait time, then by number of locks */
+static int lmgr_site_cmp(const void *a, const void *b)
+{
+   const lmgr_site_t *s1 = (const lmgr_site_t *)a;
+   const lmgr_site_t *s2 = (const lmgr_site_t *)b;
+   if (s1->wait_total != s2->wait_total) {
+      return s1->wait_total < s2->wait_total ? 1 : -1;
+   }
+   if (s1->nb_lock != s2->nb_lock) {
+      return s1->nb_lock < s2->nb_lock ? 1 : -1;
+   }
+   return 0;
+}
+
+/*
+ * Edit the lock contention profile, the sites with the
+ *  most wait time first. Times are in usecs.
+ */
+POOLMEM *lmgr_edit_profile(POOLMEM *&buf)
+{
+   char ed1[50], ed2[50], ed3[50], ed4[50], ed5[50], ed6[50];
+   POOL_MEM line;
+   lmgr_site_t *tab;
+   int i, nb = 0;
+
+   tab = (lmgr_site_t *)malloc(sizeof(lmgr_sites));
+   lmgr_p(&lmgr_prof_mutex);
+   for (i=0; i < LMGR_PROF_SITES; i++) {
+      if (lmgr_sites[i].file) {
+         tab[nb++] = lmgr_sites[i];
+      }
+   }
+   lmgr_v(&lmgr_prof_mutex);
+   qsort(tab, nb, sizeof(lmgr_site_t), lmgr_site_cmp);
+
+   Mmsg(buf, _("Lock contention profile: %d sites, times in usecs\n"
+               "%13s %11s %14s %11s %14s %11s  %s\n"), nb,
+        _("Locks"), _("Waits"), _("WaitTotal"), _("WaitMax"),
+        _("HoldTotal"), _("HoldMax"), _("Site"));
+   for (i=0; i < nb && i < LMGR_PROF_REPORT; i++) {
+      Mmsg(line, "%13s %11s %14s %11s %14s %11s  %s:%d\n",
+           edit_uint64_with_commas(tab[i].nb_lock, ed1),
+           edit_uint64_with_commas(tab[i].nb_wait, ed2),
+           edit_uint64_with_commas(tab[i].wait_total, ed3),
+           edit_uint64_with_commas(tab[i].wait_max, ed4),
+           edit_uint64_with_commas(tab[i].hold_total, ed5),
+           edit_uint64_with_commas(tab[i].hold_max, ed6),
+           tab[i].file, tab[i].line);
+      pm_strcat(buf, line);
+   }
+   free(tab);
+   return buf;
+}
+
+#endif  /* USE_LOCKMGR_PROFILE */
+
 #else  /* _USE_LOCKMGR */
 
 /*
@@ -968,6 +1214,17 @@ void dbg_print_lock(FILE *fp)
 
 #endif  /* _USE_LOCKMGR */
 
+#if !defined(_USE_LOCKMGR) || !defined(USE_LOCKMGR_PROFILE)
+
+POOLMEM *lmgr_edit_profile(POOLMEM *&buf)
+{
+   Mmsg(buf, _("Lock contention profile not available, "
+               "build with _USE_LOCKMGR and USE_LOCKMGR_PROFILE.\n"));
+   return buf;
+}
+
+#endif
+
 #ifdef _TEST_IT
 
 #include "lockmgr.h"
@@ -1005,6 +1262,21 @@ void *nolock(void *temp)
    return NULL;
 }
 
+#ifdef USE_LOCKMGR_PROFILE
+static int contender_line;
+
+void *contender(void *temp)
+{
+   for (int i=0; i<200; i++) {
+      contender_line = __LINE__ + 1;
+      P(mutex3);
+      bmicrosleep(0, 100);
+      V(mutex3);
+   }
+   return NULL;
+}
+#endif
+
 void *locker(void *temp)
 {
    bthread_mutex_t *m = (bthread_mutex_t*) temp;
@@ -1297,6 +1569,28 @@ int main(int argc, char **argv)
    V(mutex_p1);
    V(mutex_p2);
 
+#ifdef USE_LOCKMGR_PROFILE
+   for(int j=0; j<4; j++) {
+      pthread_create(&tab[j], NULL, contender, NULL);
+   }
+   for(int j=0; j<4; j++) {
+      pthread_join(tab[j], NULL);
+   }
+   int site = -1;
+   for(int j=0; j<LMGR_PROF_SITES; j++) {
+      if (lmgr_sites[j].line == contender_line) {
+         site = j;
+      }
+   }
+   ok(site >= 0, "Check profile site");
+   ok(site >= 0 && lmgr_sites[site].nb_lock == 4*200, "Check profile locks");
+   ok(site >= 0 && lmgr_sites[site].nb_wait > 0, "Check profile waits");
+   ok(site >= 0 && lmgr_sites[site].hold_max >= 100, "Check profile hold");
+   POOLMEM *buf = get_pool_memory(PM_MESSAGE);
+   printf("%s", lmgr_edit_profile(buf));
+   free_pool_memory(buf);
+#endif
+
 //   lmgr_dump();
 //
 //   pthread_create(&id3, NULL, th3, NULL);
@@ -37,6 +37,10 @@
  */
 void lmgr_p(pthread_mutex_t *m);
 void lmgr_v(pthread_mutex_t *m);
+uint64_t lmgr_lock_waits();
+
+/* Edit the lock contention profile (USE_LOCKMGR_PROFILE) */
+POOLMEM *lmgr_edit_profile(POOLMEM *&buf);
 
 #ifdef _USE_LOCKMGR
 
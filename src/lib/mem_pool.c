@@ -56,8 +56,12 @@ struct s_pool_ctl {
    int32_t size;                      /* default size */
    int32_t max_allocated;             /* max allocated */
    int32_t max_used;                  /* max buffers used */
-   int32_t in_use;                    /* number in use */
+   int32_t in_use;                    /* number out of the pool */
    struct abufhead *free_buf;         /* pointer to free buffers */
+   uint64_t nb_get;                   /* gets by exited thread caches */
+   uint64_t nb_hit;                   /* hits of exited thread caches */
+   uint64_t nb_refill;                /* batches moved to thread caches */
+   uint64_t nb_flush;                 /* batches given back by thread caches */
 };
 
 /* Bacula Name length plus extra */
@@ -100,6 +104,233 @@ struct abufhead {
 
 static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 
+/*
+ * Per thread cache of free buffers
+ *
+ *  Most buffers are released by the thread that got them, so each
+ *  thread keeps a few free buffers of the small pools (names, file
+ *  names, messages) and only takes the pool mutex to move a batch
+ *  of them from or to the pool. The cache mutex is only contended
+ *  when close_memory_pool() drains the caches of all threads.
+ *
+ *  The in_use count of a pool includes the buffers in the caches.
+ *  Lock order is cache_list_mutex, cache mutex, then pool mutex.
+ */
+#define MEM_CACHE_MAX    16           /* max free buffers per thread and pool */
+#define MEM_CACHE_BATCH   8           /* buffers moved at once */
+
+#define is_cached_pool(pool) ((pool) >= PM_NAME && (pool) <= PM_EMSG)
+
+struct mem_cache {
+   pthread_mutex_t mutex;
+   struct mem_cache *next;            /* chain of all thread caches */
+   struct abufhead *free_buf[PM_MAX+1];
+   int32_t nb_free[PM_MAX+1];
+   uint64_t nb_get[PM_MAX+1];         /* buffers asked to this cache */
+   uint64_t nb_hit[PM_MAX+1];         /* given without taking the pool mutex */
+};
+
+static pthread_key_t mem_cache_key;
+static pthread_once_t mem_cache_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t cache_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct mem_cache *cache_list = NULL;
+static bool mem_cache_disabled = false;
+
+static void release_mem_cache(void *arg);
+
+static void create_mem_cache_key()
+{
+   if (pthread_key_create(&mem_cache_key, release_mem_cache) != 0) {
+      mem_cache_disabled = true;
+   }
+}
+
+/*
+ * Get the cache of the calling thread, create it the first time.
+ *  The cache is not allocated with smartalloc, the cache of the
+ *  main thread is never released.
+ */
+static struct mem_cache *get_mem_cache()
+{
+   struct mem_cache *cache;
+
+   pthread_once(&mem_cache_once, create_mem_cache_key);
+   if (mem_cache_disabled) {
+      return NULL;
+   }
+   cache = (struct mem_cache *)pthread_getspecific(mem_cache_key);
+   if (cache) {
+      return cache;
+   }
+   if ((cache = (struct mem_cache *)actuallymalloc(sizeof(struct mem_cache))) == NULL) {
+      return NULL;
+   }
+   memset(cache, 0, sizeof(struct mem_cache));
+   pthread_mutex_init(&cache->mutex, NULL);
+   P(cache_list_mutex);
+   cache->next = cache_list;
+   cache_list = cache;
+   V(cache_list_mutex);
+   pthread_setspecific(mem_cache_key, cache);
+   return cache;
+}
+
+/*
+ * Give back up to nb free buffers of a cache to the pool
+ *  Called with the cache locked
+ */
+static void flush_mem_cache(struct mem_cache *cache, int pool, int32_t nb)
+{
+   struct abufhead *buf;
+
+   P(mutex);
+   while (nb-- > 0 && (buf = cache->free_buf[pool]) != NULL) {
+      cache->free_buf[pool] = buf->next;
+      cache->nb_free[pool]--;
+      buf->next = pool_ctl[pool].free_buf;
+      pool_ctl[pool].free_buf = buf;
+      pool_ctl[pool].in_use--;
+   }
+   pool_ctl[pool].nb_flush++;
+   V(mutex);
+}
+
+/*
+ * Move a batch of free buffers from the pool to a cache
+ *  Called with the cache locked
+ */
+static void refill_mem_cache(struct mem_cache *cache, int pool)
+{
+   struct abufhead *buf;
+
+   P(mutex);
+   for (int i=0; i < MEM_CACHE_BATCH && pool_ctl[pool].free_buf; i++) {
+      buf = pool_ctl[pool].free_buf;
+      pool_ctl[pool].free_buf = buf->next;
+      buf->next = cache->free_buf[pool];
+      cache->free_buf[pool] = buf;
+      cache->nb_free[pool]++;
+      pool_ctl[pool].in_use++;
+   }
+   if (pool_ctl[pool].in_use > pool_ctl[pool].max_used) {
+      pool_ctl[pool].max_used = pool_ctl[pool].in_use;
+   }
+   pool_ctl[pool].nb_refill++;
+   V(mutex);
+}
+
+/*
+ * Thread exit, give everything back to the pool
+ */
+static void release_mem_cache(void *arg)
+{
+   struct mem_cache *cache = (struct mem_cache *)arg;
+   struct mem_cache **prev;
+
+   P(cache_list_mutex);
+   for (prev = &cache_list; *prev; prev = &(*prev)->next) {
+      if (*prev == cache) {
+         *prev = cache->next;
+         break;
+      }
+   }
+   V(cache_list_mutex);
+   P(cache->mutex);
+   for (int i=0; i <= PM_MAX; i++) {
+      if (cache->nb_free[i] > 0) {
+         flush_mem_cache(cache, i, cache->nb_free[i]);
+      }
+   }
+   P(mutex);
+   for (int i=0; i <= PM_MAX; i++) {
+      pool_ctl[i].nb_get += cache->nb_get[i];
+      pool_ctl[i].nb_hit += cache->nb_hit[i];
+   }
+   V(mutex);
+   V(cache->mutex);
+   pthread_mutex_destroy(&cache->mutex);
+   actuallyfree(cache);
+}
+
+/*
+ * Give back the free buffers of all thread caches to the pool
+ */
+static void drain_mem_caches()
+{
+   struct mem_cache *cache;
+
+   P(cache_list_mutex);
+   for (cache = cache_list; cache; cache = cache->next) {
+      P(cache->mutex);
+      for (int i=0; i <= PM_MAX; i++) {
+         if (cache->nb_free[i] > 0) {
+            flush_mem_cache(cache, i, cache->nb_free[i]);
+         }
+      }
+      V(cache->mutex);
+   }
+   V(cache_list_mutex);
+}
+
+/*
+ * Get a free buffer from the thread cache
+ *  Returns: NULL if the pool has no free buffer
+ */
+static struct abufhead *cache_get(int pool)
+{
+   struct mem_cache *cache;
+   struct abufhead *buf;
+
+   if (!is_cached_pool(pool) || (cache = get_mem_cache()) == NULL) {
+      return NULL;
+   }
+   P(cache->mutex);
+   cache->nb_get[pool]++;
+   if (cache->free_buf[pool]) {
+      cache->nb_hit[pool]++;
+   } else {
+      refill_mem_cache(cache, pool);
+   }
+   if ((buf = cache->free_buf[pool]) != NULL) {
+      cache->free_buf[pool] = buf->next;
+      cache->nb_free[pool]--;
+   }
+   V(cache->mutex);
+   return buf;
+}
+
+/*
+ * Keep a released buffer in the thread cache
+ *  Returns: false if the buffer must go back to the pool
+ */
+static bool cache_put(struct abufhead *buf)
+{
+   struct mem_cache *cache;
+   int pool = buf->pool;
+
+   if (!is_cached_pool(pool) || (cache = get_mem_cache()) == NULL) {
+      return false;
+   }
+   P(cache->mutex);
+#ifdef DEBUG
+   struct abufhead *next;
+   /* Don't let him free the same buffer twice */
+   for (next=cache->free_buf[pool]; next; next=next->next) {
+      if (next == buf) {
+         V(cache->mutex);
+         ASSERT(next != buf);         /* attempt to free twice */
+      }
+   }
+#endif
+   buf->next = cache->free_buf[pool];
+   cache->free_buf[pool] = buf;
+   if (++cache->nb_free[pool] > MEM_CACHE_MAX) {
+      flush_mem_cache(cache, pool, MEM_CACHE_BATCH);
+   }
+   V(cache->mutex);
+   return true;
+}
+
 #ifdef SMARTALLOC
 
 #define HEAD_SIZE BALIGN(sizeof(struct abufhead))
@@ -111,6 +342,11 @@ POOLMEM *sm_get_pool_memory(const char *fname, int lineno, int pool)
    if (pool > PM_MAX) {
       Emsg2(M_ABORT, 0, _("MemPool index %d larger than max %d\n"), pool, PM_MAX);
    }
+   if ((buf = cache_get(pool)) != NULL) {
+      Dmsg3(1800, "sm_get_pool_memory reuse %p to %s:%d\n", buf, fname, lineno);
+      sm_new_owner(fname, lineno, (char *)buf);
+      return (POOLMEM *)((char *)buf+HEAD_SIZE);
+   }
    P(mutex);
    if (pool_ctl[pool].free_buf) {
       buf = pool_ctl[pool].free_buf;
@@ -210,9 +446,13 @@ void sm_free_pool_memory(const char *fname, int lineno, POOLMEM *obuf)
    int pool;
 
    ASSERT(obuf);
-   P(mutex);
    buf = (struct abufhead *)((char *)obuf - HEAD_SIZE);
    pool = buf->pool;
+   if (cache_put(buf)) {
+      Dmsg4(1800, "free_pool_memory %p pool=%d from %s:%d\n", buf, pool, fname, lineno);
+      return;
+   }
+   P(mutex);
    pool_ctl[pool].in_use--;
    if (pool == 0) {
       free((char *)buf);              /* free nonpooled memory */
@@ -244,10 +484,17 @@ POOLMEM *get_pool_memory(int pool)
 {
    struct abufhead *buf;
 
+   if ((buf = cache_get(pool)) != NULL) {
+      return (POOLMEM *)((char *)buf+HEAD_SIZE);
+   }
    P(mutex);
    if (pool_ctl[pool].free_buf) {
       buf = pool_ctl[pool].free_buf;
       pool_ctl[pool].free_buf = buf->next;
+      pool_ctl[pool].in_use++;
+      if (pool_ctl[pool].in_use > pool_ctl[pool].max_used) {
+         pool_ctl[pool].max_used = pool_ctl[pool].in_use;
+      }
       V(mutex);
       return (POOLMEM *)((char *)buf+HEAD_SIZE);
    }
@@ -336,9 +583,12 @@ void free_pool_memory(POOLMEM *obuf)
    int pool;
 
    ASSERT(obuf);
-   P(mutex);
    buf = (struct abufhead *)((char *)obuf - HEAD_SIZE);
    pool = buf->pool;
+   if (cache_put(buf)) {
+      return;
+   }
+   P(mutex);
    pool_ctl[pool].in_use--;
    if (pool == 0) {
       free((char *)buf);              /* free nonpooled memory */
@@ -398,6 +648,7 @@ void close_memory_pool()
    char ed1[50];
 
    sm_check(__FILE__, __LINE__, false);
+   drain_mem_caches();
    P(mutex);
    for (int i=1; i<=PM_MAX; i++) {
       buf = pool_ctl[i].free_buf;
@@ -433,6 +684,47 @@ void garbage_collect_memory()
 #endif
 }
 
+/*
+ * Get the usage of the thread caches of a pool. The counters
+ *  of the running threads are read without their lock.
+ */
+void get_memory_cache_stats(int pool, uint64_t *nb_get, uint64_t *nb_hit,
+                            int32_t *nb_cached)
+{
+   struct mem_cache *cache;
+
+   P(cache_list_mutex);
+   P(mutex);
+   *nb_get = pool_ctl[pool].nb_get;
+   *nb_hit = pool_ctl[pool].nb_hit;
+   *nb_cached = 0;
+   for (cache = cache_list; cache; cache = cache->next) {
+      *nb_get += cache->nb_get[pool];
+      *nb_hit += cache->nb_hit[pool];
+      *nb_cached += cache->nb_free[pool];
+   }
+   V(mutex);
+   V(cache_list_mutex);
+}
+
+/*
+ * Get the usage of a pool, for the statistics. The buffers
+ *  kept free in the thread caches are not counted as in use.
+ */
+void get_memory_pool_stats(int pool, int32_t *max_allocated, int32_t *max_used,
+                           int32_t *in_use)
+{
+   uint64_t nb_get, nb_hit;
+   int32_t nb_cached;
+
+   get_memory_cache_stats(pool, &nb_get, &nb_hit, &nb_cached);
+   P(mutex);
+   *max_allocated = pool_ctl[pool].max_allocated;
+   *max_used = pool_ctl[pool].max_used;
+   *in_use = pool_ctl[pool].in_use - nb_cached;
+   V(mutex);
+}
+
 #ifdef DEBUG
 static const char *pool_name(int pool)
 {
@@ -450,10 +742,12 @@ static const char *pool_name(int pool)
  */
 void print_memory_pool_stats()
 {
-   Pmsg0(-1, "Pool   Maxsize  Maxused  Inuse\n");
+   char ed1[50], ed2[50];
+   Pmsg0(-1, "Pool   Maxsize  Maxused  Inuse    Refill     Flush\n");
    for (int i=0; i<=PM_MAX; i++)
-      Pmsg4(-1, "%5s  %7d  %7d  %5d\n", pool_name(i), pool_ctl[i].max_allocated,
-         pool_ctl[i].max_used, pool_ctl[i].in_use);
+      Pmsg6(-1, "%5s  %7d  %7d  %5d  %8s  %8s\n", pool_name(i), pool_ctl[i].max_allocated,
+         pool_ctl[i].max_used, pool_ctl[i].in_use,
+         edit_uint64(pool_ctl[i].nb_refill, ed1), edit_uint64(pool_ctl[i].nb_flush, ed2));
 
    Pmsg0(-1, "\n");
 }
@@ -657,3 +951,91 @@ int POOL_MEM::strcpy(const char *str)
    memcpy(mem, str, len);
    return len - 1;
 }
+
+#ifdef TEST_PROGRAM
+/*
+ * Stress the pools with several threads getting and releasing
+ *  buffers of the cached pools, with and without the thread caches.
+ *
+ *   mem_pool_test [threads] [loops]
+ */
+static int nb_loops = 1000000;
+
+extern "C" void *mem_pool_worker(void *arg)
+{
+   POOLMEM *held[8];
+   int pools[] = { PM_NAME, PM_FNAME, PM_MESSAGE, PM_EMSG };
+
+   memset(held, 0, sizeof(held));
+   for (int i=0; i < nb_loops; i++) {
+      int slot = i % 8;
+      if (held[slot]) {
+         free_pool_memory(held[slot]);
+      }
+      held[slot] = get_pool_memory(pools[(i / 8) % 4]);
+      held[slot][0] = 0;
+   }
+   for (int i=0; i < 8; i++) {
+      if (held[i]) {
+         free_pool_memory(held[i]);
+      }
+   }
+   return NULL;
+}
+
+static btime_t run_workers(int nb_threads)
+{
+   pthread_t *thids = (pthread_t *)malloc(nb_threads * sizeof(pthread_t));
+   btime_t start = get_current_btime();
+
+   for (int i=0; i < nb_threads; i++) {
+      pthread_create(&thids[i], NULL, mem_pool_worker, NULL);
+   }
+   for (int i=0; i < nb_threads; i++) {
+      pthread_join(thids[i], NULL);
+   }
+   free(thids);
+   return get_current_btime() - start;
+}
+
+int main(int argc, char *argv[])
+{
+   int nb_threads = 8;
+   btime_t t1, t2;
+   uint64_t gets, hits;
+   int32_t cached;
+   char ed1[50], ed2[50];
+
+   if (argc > 1) {
+      nb_threads = atoi(argv[1]);
+   }
+   if (argc > 2) {
+      nb_loops = atoi(argv[2]);
+   }
+   if (nb_threads < 1 || nb_loops < 1) {
+      Pmsg0(0, "Usage: mem_pool_test [threads] [loops]\n");
+      exit(1);
+   }
+   Pmsg2(0, "%d threads, %d get/free each\n", nb_threads, nb_loops);
+
+   mem_cache_disabled = true;
+   t1 = run_workers(nb_threads);
+   Pmsg2(0, "Without thread cache: %d.%03d s\n", (int)(t1 / 1000000),
+         (int)((t1 % 1000000) / 1000));
+
+   mem_cache_disabled = false;
+   t2 = run_workers(nb_threads);
+   Pmsg2(0, "With thread cache:    %d.%03d s\n", (int)(t2 / 1000000),
+         (int)((t2 % 1000000) / 1000));
+
+   for (int i=PM_NAME; i <= PM_EMSG; i++) {
+      get_memory_cache_stats(i, &gets, &hits, &cached);
+      Pmsg5(0, "pool %d gets=%s hits=%s refill=%d flush=%d\n", i,
+            edit_uint64(gets, ed1), edit_uint64(hits, ed2),
+            (int)pool_ctl[i].nb_refill, (int)pool_ctl[i].nb_flush);
+   }
+   close_memory_pool();
+   sm_dump(false);
+   return 0;
+}
+#endif /* TEST_PROGRAM */
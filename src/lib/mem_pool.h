@@ -75,6 +75,10 @@ extern void   free_pool_memory(POOLMEM *buf);
 extern void garbage_collect_memory_pool();
 extern void  close_memory_pool();
 extern void  print_memory_pool_stats();
+extern void  get_memory_pool_stats(int pool, int32_t *max_allocated,
+                                   int32_t *max_used, int32_t *in_use);
+extern void  get_memory_cache_stats(int pool, uint64_t *nb_get, uint64_t *nb_hit,
+                                    int32_t *nb_cached);
 
 extern void garbage_collect_memory();
 
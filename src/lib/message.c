@@ -87,6 +87,10 @@ static bool trace = false;
 #endif
 static int hangup = 0;
 
+static void report_dropped_msgs(JCR *jcr, MSGS *msgs);
+static void drain_msg_queue(MSGS *msgs);
+static void open_msg_queue(MSGS *msgs);
+
 /* Constants */
 const char *host_os = HOST_OS;
 const char *distname = DISTNAME;
@@ -314,6 +318,7 @@ init_msg(JCR *jcr, MSGS *msg)
    } else {
       /* If we have default values, release them now */
       if (daemon_msgs) {
+         drain_msg_queue(daemon_msgs);
          free_msgs_res(daemon_msgs);
       }
       daemon_msgs = (MSGS *)malloc(sizeof(MSGS));
@@ -428,11 +433,11 @@ void rem_msg_dest(MSGS *msg, int dest_code, int msg_type, char *where)
 /*
  * Create a unique filename for the mail command
  */
-static void make_unique_mail_filename(JCR *jcr, POOLMEM *&name, DEST *d)
+static void make_unique_mail_filename(const char *job, POOLMEM *&name, DEST *d)
 {
-   if (jcr) {
+   if (job) {
       Mmsg(name, "%s/%s.%s.%d.mail", working_directory, my_name,
-                 jcr->Job, (int)(intptr_t)d);
+                 job, (int)(intptr_t)d);
    } else {
       Mmsg(name, "%s/%s.%s.%d.mail", working_directory, my_name,
                  my_name, (int)(intptr_t)d);
@@ -441,17 +446,24 @@ static void make_unique_mail_filename(JCR *jcr, POOLMEM *&name, DEST *d)
 }
 
 /*
- * Open a mail pipe
+ * Edit the mail command of a destination
  */
-static BPIPE *open_mail_pipe(JCR *jcr, POOLMEM *&cmd, DEST *d)
+static void edit_mail_cmd(JCR *jcr, POOLMEM *&cmd, DEST *d)
 {
-   BPIPE *bpipe;
-
    if (d->mail_cmd) {
       cmd = edit_job_codes(jcr, cmd, d->mail_cmd, d->where);
    } else {
       Mmsg(cmd, "/usr/lib/sendmail -F Bacula %s", d->where);
    }
+}
+
+/*
+ * Run an edited mail command
+ */
+static BPIPE *run_mail_pipe(POOLMEM *cmd, DEST *d)
+{
+   BPIPE *bpipe;
+
    fflush(stdout);
 
    if ((bpipe = open_bpipe(cmd, 120, "rw"))) {
@@ -467,6 +479,15 @@ static BPIPE *open_mail_pipe(JCR *jcr, POOLMEM *&cmd, DEST *d)
    return bpipe;
 }
 
+/*
+ * Open a mail pipe
+ */
+static BPIPE *open_mail_pipe(JCR *jcr, POOLMEM *&cmd, DEST *d)
+{
+   edit_mail_cmd(jcr, cmd, d);
+   return run_mail_pipe(cmd, d);
+}
+
 /*
  * Close the messages for this Messages resource, which means to close
  *  any open files, and dispatch any pending email messages.
@@ -495,6 +516,8 @@ void close_msg(JCR *jcr)
    if (msgs->is_closing()) {
       return;
    }
+   drain_msg_queue(msgs);            /* the queue may use the destinations */
+   report_dropped_msgs(jcr, msgs);
    msgs->wait_not_in_use();          /* leaves fides_mutex set */
    msgs->set_closing();
    msgs->unlock();
@@ -589,6 +612,7 @@ rem_temp_file:
       msgs = NULL;
    } else {
       msgs->clear_closing();
+      open_msg_queue(msgs);
    }
    Dmsg0(850, "===End close msg resource\n");
 }
@@ -627,6 +651,7 @@ void free_msgs_res(MSGS *msgs)
 void term_msg()
 {
    Dmsg0(850, "Enter term_msg\n");
+   stop_msg_delivery_thread();
    close_msg(NULL);                   /* close global chain */
    free_msgs_res(daemon_msgs);        /* free the resources */
    daemon_msgs = NULL;
@@ -687,6 +712,612 @@ static void send_to_syslog(int mode, const char *msg)
    }
 }
 
+/*
+ * Send a message to one destination
+ *
+ *  jcr is NULL when called by the delivery thread, job is then
+ *  the Job name of the message and op_cmd the operator command
+ *  edited by the sending thread.
+ */
+static void send_to_dest(JCR *jcr, const char *job, MSGS *msgs, DEST *d,
+                         int type, utime_t mtime, const char *dt, int dtlen,
+                         char *msg, const char *op_cmd)
+{
+   POOLMEM *mcmd;
+   int len;
+   BPIPE *bpipe;
+   const char *mode;
+
+   switch (d->dest_code) {
+      case MD_CATALOG:
+         char ed1[50], sdt[MAX_TIME_LENGTH];
+         if (!jcr || !jcr->db) {
+            break;
+         }
+         if (p_sql_query && p_sql_escape) {
+            POOLMEM *cmd = get_pool_memory(PM_MESSAGE);
+            POOLMEM *esc_msg = get_pool_memory(PM_MESSAGE);
+            
+            int len = strlen(msg) + 1;
+            esc_msg = check_pool_memory_size(esc_msg, len*2+1);
+            p_sql_escape(jcr, jcr->db, esc_msg, msg, len);
+
+            bstrutime(sdt, sizeof(sdt), mtime);
+            Mmsg(cmd, "INSERT INTO Log (JobId, Time, LogText) VALUES (%s,'%s','%s')",
+                  edit_int64(jcr->JobId, ed1), sdt, esc_msg);
+            p_sql_query(jcr, cmd);
+            
+            free_pool_memory(cmd);
+            free_pool_memory(esc_msg);
+         }
+         break;
+      case MD_CONSOLE:
+         Dmsg1(850, "CONSOLE for following msg: %s", msg);
+         if (!con_fd) {
+            con_fd = fopen(con_fname, "a+b");
+            Dmsg0(850, "Console file not open.\n");
+         }
+         if (con_fd) {
+            Pw(con_lock);      /* get write lock on console message file */
+            errno = 0;
+            if (dtlen) {
+               (void)fwrite(dt, dtlen, 1, con_fd);
+            }
+            len = strlen(msg);
+            if (len > 0) {
+               (void)fwrite(msg, len, 1, con_fd);
+               if (msg[len-1] != '\n') {
+                  (void)fwrite("\n", 2, 1, con_fd);
+               }
+            } else {
+               (void)fwrite("\n", 2, 1, con_fd);
+            }
+            fflush(con_fd);
+            console_msg_pending = true;
+            Vw(con_lock);
+         }
+         break;
+      case MD_SYSLOG:
+         Dmsg1(850, "SYSLOG for following msg: %s\n", msg);
+         /*
+          * We really should do an openlog() here.
+          */
+         send_to_syslog(LOG_DAEMON|LOG_ERR, msg);
+         break;
+      case MD_OPERATOR:
+         Dmsg1(850, "OPERATOR for following msg: %s\n", msg);
+         mcmd = get_pool_memory(PM_MESSAGE);
+         if (op_cmd) {
+            pm_strcpy(mcmd, op_cmd);     /* edited by the sending thread */
+         } else {
+            edit_mail_cmd(jcr, mcmd, d);
+         }
+         if ((bpipe=run_mail_pipe(mcmd, d))) {
+            int stat;
+            fputs(dt, bpipe->wfd);
+            fputs(msg, bpipe->wfd);
+            /* Messages to the operator go one at a time */
+            stat = close_bpipe(bpipe);
+            if (stat != 0) {
+               berrno be;
+               be.set_errno(stat);
+               delivery_error(_("Msg delivery error: Operator mail program terminated in error.\n"
+                     "CMD=%s\n"
+                     "ERR=%s\n"), mcmd, be.bstrerror());
+            }
+         }
+         free_pool_memory(mcmd);
+         break;
+      case MD_MAIL:
+      case MD_MAIL_ON_ERROR:
+      case MD_MAIL_ON_SUCCESS:
+         Dmsg1(850, "MAIL for following msg: %s", msg);
+         if (msgs->is_closing()) {
+            break;
+         }
+         msgs->set_in_use();
+         if (!d->fd) {
+            POOLMEM *name = get_pool_memory(PM_MESSAGE);
+            make_unique_mail_filename(job, name, d);
+            d->fd = fopen(name, "w+b");
+            if (!d->fd) {
+               berrno be;
+               delivery_error(_("Msg delivery error: fopen %s failed: ERR=%s\n"), name,
+                     be.bstrerror());
+               free_pool_memory(name);
+               msgs->clear_in_use();
+               break;
+            }
+            d->mail_filename = name;
+         }
+         fputs(dt, d->fd);
+         len = strlen(msg) + dtlen;;
+         if (len > d->max_len) {
+            d->max_len = len;      /* keep max line length */
+         }
+         fputs(msg, d->fd);
+         msgs->clear_in_use();
+         break;
+      case MD_APPEND:
+         Dmsg1(850, "APPEND for following msg: %s", msg);
+         mode = "ab";
+         goto send_to_file;
+      case MD_FILE:
+         Dmsg1(850, "FILE for following msg: %s", msg);
+         mode = "w+b";
+send_to_file:
+         if (msgs->is_closing()) {
+            break;
+         }
+         msgs->set_in_use();
+         if (!d->fd && !open_dest_file(jcr, d, mode)) {
+            msgs->clear_in_use();
+            break;
+         }
+         fputs(dt, d->fd);
+         fputs(msg, d->fd);
+         /* On error, we close and reopen to handle log rotation */
+         if (ferror(d->fd)) {
+            fclose(d->fd);
+            d->fd = NULL;
+            if (open_dest_file(jcr, d, mode)) {
+               fputs(dt, d->fd);
+               fputs(msg, d->fd);
+            }
+         }
+         msgs->clear_in_use();
+         break;
+      case MD_DIRECTOR:
+         Dmsg1(850, "DIRECTOR for following msg: %s", msg);
+         if (jcr && jcr->dir_bsock && !jcr->dir_bsock->errors) {
+            jcr->dir_bsock->fsend("Jmsg Job=%s type=%d level=%lld %s",
+               jcr->Job, type, mtime, msg);
+         } else {
+            Dmsg1(800, "no jcr for following msg: %s", msg);
+         }
+         break;
+      case MD_STDOUT:
+         Dmsg1(850, "STDOUT for following msg: %s", msg);
+         if (type != M_ABORT && type != M_ERROR_TERM) { /* already printed */
+            fputs(dt, stdout);
+            fputs(msg, stdout);
+            fflush(stdout);
+         }
+         break;
+      case MD_STDERR:
+         Dmsg1(850, "STDERR for following msg: %s", msg);
+         fputs(dt, stderr);
+         fputs(msg, stderr);
+         fflush(stdout);
+         break;
+      default:
+         break;
+   }
+}
+
+/*
+ * Asynchronous delivery
+ *
+ *  Writing to a file, syslog, the console file or a mail pipe can
+ *  be slow, and a burst of messages then throttles the job that
+ *  sends them. When the delivery thread runs, the sending thread
+ *  only sends the message to the Director and to the catalog (they
+ *  use the job connections), and queues it for the other
+ *  destinations.
+ *
+ *  - A message identical to the last one queued is not queued
+ *    again, the repeat count of the queued one is incremented.
+ *  - At most MSG_FLOOD_MAX warnings and errors of a MSGS are
+ *    queued per MSG_FLOOD_INTERVAL, the other ones (a warning per
+ *    file on a bad tree) are only sent to the Director and to the
+ *    catalog, and counted.
+ *  - When the queue is full, the file messages (saved, skipped,
+ *    restored, not saved) are dropped and counted in their MSGS,
+ *    the other ones wait for some room.
+ *  - The dropped and suppressed counts are reported to the
+ *    destinations of that MSGS with its next queued message, or
+ *    when it is closed.
+ *  - Fatal messages flush the queue and are then delivered by the
+ *    sending thread, so nothing is lost if the daemon stops.
+ *  - The delivery thread itself never queues.
+ *
+ *  Each MSGS counts its queued items. Before releasing the
+ *  destinations, init_msg() and close_msg() mark it closed, under
+ *  the queue lock, and wait for its count to drop to zero. The
+ *  later messages are delivered by their sending thread, so a
+ *  queued message never outlives its MSGS.
+ */
+#define MSG_QUEUE_SIZE 1000
+#define MSG_FLOOD_MAX 100
+#define MSG_FLOOD_INTERVAL 60
+
+struct MSG_ITEM {
+   MSGS *msgs;                        /* destinations */
+   int type;
+   utime_t mtime;
+   int repeat;                        /* identical messages coalesced */
+   int dropped;                       /* messages dropped before this one */
+   int dropped_type;                  /* type of the dropped messages */
+   int suppressed;                    /* warnings and errors not queued */
+   char *op_cmds;                     /* edited operator commands */
+   char job[MAX_NAME_LENGTH];         /* for the mail file name */
+   char dt[MAX_TIME_LENGTH];
+   char msg[1];
+};
+
+static pthread_mutex_t mq_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t mq_cond = PTHREAD_COND_INITIALIZER;  /* item queued */
+static pthread_cond_t mq_done = PTHREAD_COND_INITIALIZER;  /* item delivered */
+static MSG_ITEM *mq_ring[MSG_QUEUE_SIZE];
+static int mq_head = 0;               /* oldest item */
+static int mq_count = 0;              /* items in the ring */
+static uint64_t mq_queued = 0;        /* items queued since start */
+static uint64_t mq_delivered = 0;     /* items delivered since start */
+static bool mq_running = false;
+static pthread_t mq_tid;
+static int mq_stat_queued = -1, mq_stat_coalesced = -1, mq_stat_dropped = -1;
+static int mq_stat_suppressed = -1;
+
+static bool is_async_dest(int dest_code)
+{
+   return dest_code != MD_DIRECTOR && dest_code != MD_CATALOG;
+}
+
+/* Messages that can be dropped when the queue is full */
+static bool is_droppable(int type)
+{
+   switch (type) {
+   case M_SAVED:
+   case M_NOTSAVED:
+   case M_SKIPPED:
+   case M_RESTORED:
+      return true;
+   default:
+      return false;
+   }
+}
+
+static bool is_delivery_thread()
+{
+   return mq_running && pthread_equal(pthread_self(), mq_tid);
+}
+
+static void free_msg_item(MSG_ITEM *item)
+{
+   if (item->op_cmds) {
+      free(item->op_cmds);
+   }
+   free(item);
+}
+
+/*
+ * The operator commands use the jcr, edit them in the sending
+ *  thread. They are stored one after the other, NUL separated,
+ *  in the order of the destination chain.
+ */
+static char *edit_op_cmds(JCR *jcr, MSGS *msgs, int type)
+{
+   POOLMEM *cmd = NULL, *cmds = NULL;
+   int len = 0, clen;
+   char *buf;
+
+   for (DEST *d=msgs->dest_chain; d; d=d->next) {
+      if (d->dest_code != MD_OPERATOR || !bit_is_set(type, d->msg_types)) {
+         continue;
+      }
+      if (!cmd) {
+         cmd = get_pool_memory(PM_MESSAGE);
+         cmds = get_pool_memory(PM_MESSAGE);
+      }
+      edit_mail_cmd(jcr, cmd, d);
+      clen = strlen(cmd) + 1;
+      cmds = check_pool_memory_size(cmds, len + clen);
+      memcpy(cmds + len, cmd, clen);
+      len += clen;
+   }
+   if (!cmd) {
+      return NULL;
+   }
+   buf = (char *)malloc(len);
+   memcpy(buf, cmds, len);
+   free_pool_memory(cmd);
+   free_pool_memory(cmds);
+   return buf;
+}
+
+/*
+ * Queue a message for the delivery thread
+ *  Returns: false if the thread is stopped or msgs is being
+ *           closed, the caller must deliver the message
+ */
+static bool queue_message(JCR *jcr, MSGS *msgs, int type, utime_t mtime,
+                          const char *dt, char *msg)
+{
+   MSG_ITEM *item, *last;
+   int len = strlen(msg);
+
+   item = (MSG_ITEM *)malloc(sizeof(MSG_ITEM) + len);
+   memset(item, 0, sizeof(MSG_ITEM));
+   item->msgs = msgs;
+   item->type = type;
+   item->mtime = mtime;
+   item->op_cmds = edit_op_cmds(jcr, msgs, type);
+   bstrncpy(item->job, jcr ? jcr->Job : my_name, sizeof(item->job));
+   bstrncpy(item->dt, dt, sizeof(item->dt));
+   memcpy(item->msg, msg, len + 1);
+
+   P(mq_mutex);
+   for ( ;; ) {
+      if (!mq_running || msgs->queue_closed) {
+         V(mq_mutex);
+         free_msg_item(item);
+         return false;
+      }
+      last = mq_count ? mq_ring[(mq_head + mq_count - 1) % MSG_QUEUE_SIZE] : NULL;
+      if (last && last->msgs == msgs && last->type == type &&
+          !last->op_cmds && !item->op_cmds && strcmp(last->msg, msg) == 0) {
+         last->repeat++;
+         V(mq_mutex);
+         bstat_inc(mq_stat_coalesced, 1);
+         free_msg_item(item);
+         return true;
+      }
+      if (type == M_WARNING || type == M_ERROR) {
+         if (mtime - msgs->flood_start >= MSG_FLOOD_INTERVAL) {
+            msgs->flood_start = mtime;
+            msgs->flood_count = 0;
+         }
+         if (msgs->flood_count >= MSG_FLOOD_MAX) {
+            msgs->suppressed++;
+            V(mq_mutex);
+            bstat_inc(mq_stat_suppressed, 1);
+            free_msg_item(item);
+            return true;
+         }
+      }
+      if (mq_count < MSG_QUEUE_SIZE) {
+         break;
+      }
+      if (is_droppable(type)) {
+         msgs->dropped++;
+         msgs->dropped_type = type;
+         V(mq_mutex);
+         bstat_inc(mq_stat_dropped, 1);
+         free_msg_item(item);
+         return true;
+      }
+      pthread_cond_wait(&mq_done, &mq_mutex);    /* wait for some room */
+   }
+   if (type == M_WARNING || type == M_ERROR) {
+      msgs->flood_count++;
+   }
+   item->dropped = msgs->dropped;
+   item->dropped_type = msgs->dropped_type;
+   item->suppressed = msgs->suppressed;
+   msgs->dropped = 0;
+   msgs->suppressed = 0;
+   msgs->queued++;
+   mq_ring[(mq_head + mq_count) % MSG_QUEUE_SIZE] = item;
+   mq_count++;
+   mq_queued++;
+   pthread_cond_signal(&mq_cond);
+   V(mq_mutex);
+   bstat_inc(mq_stat_queued, 1);
+   return true;
+}
+
+/*
+ * Tell the destinations of the dropped or suppressed messages how
+ *  many were lost
+ */
+static void send_lost_note(JCR *jcr, const char *job, MSGS *msgs, int type,
+                           char *note, utime_t mtime, const char *dt)
+{
+   for (DEST *d=msgs->dest_chain; d; d=d->next) {
+      if (bit_is_set(type, d->msg_types) && is_async_dest(d->dest_code) &&
+          d->dest_code != MD_OPERATOR) {
+         send_to_dest(jcr, job, msgs, d, type, mtime, dt, strlen(dt), note, NULL);
+      }
+   }
+}
+
+static void send_lost_notes(JCR *jcr, const char *job, MSGS *msgs,
+                            int dropped, int dropped_type, int suppressed,
+                            utime_t mtime, const char *dt)
+{
+   char note[200];
+
+   if (dropped) {
+      bsnprintf(note, sizeof(note), _("%s: %d messages dropped, message queue full\n"),
+                my_name, dropped);
+      send_lost_note(jcr, job, msgs, dropped_type, note, mtime, dt);
+   }
+   if (suppressed) {
+      bsnprintf(note, sizeof(note),
+                _("%s: %d warning and error messages suppressed\n"),
+                my_name, suppressed);
+      send_lost_note(jcr, job, msgs, M_WARNING, note, mtime, dt);
+   }
+}
+
+/*
+ * Report the messages of msgs dropped or suppressed since its last
+ *  queued message, the queue must be drained.
+ */
+static void report_dropped_msgs(JCR *jcr, MSGS *msgs)
+{
+   char dt[MAX_TIME_LENGTH];
+   utime_t mtime;
+   int dropped, type, suppressed;
+
+   P(mq_mutex);
+   dropped = msgs->dropped;
+   type = msgs->dropped_type;
+   suppressed = msgs->suppressed;
+   msgs->dropped = 0;
+   msgs->suppressed = 0;
+   V(mq_mutex);
+   if (dropped == 0 && suppressed == 0) {
+      return;
+   }
+   mtime = time(NULL);
+   bstrftime_ny(dt, sizeof(dt), mtime);
+   bstrncat(dt, " ", sizeof(dt));
+   send_lost_notes(jcr, jcr ? jcr->Job : my_name, msgs, dropped, type,
+                   suppressed, mtime, dt);
+}
+
+/*
+ * Deliver a queued message to its asynchronous destinations
+ */
+static void deliver_msg_item(MSG_ITEM *item)
+{
+   const char *op_cmd = item->op_cmds;
+   int dtlen = strlen(item->dt);
+   char note[200];
+
+   send_lost_notes(NULL, item->job, item->msgs, item->dropped,
+                   item->dropped_type, item->suppressed, item->mtime, item->dt);
+
+   for (DEST *d=item->msgs->dest_chain; d; d=d->next) {
+      if (!bit_is_set(item->type, d->msg_types) || !is_async_dest(d->dest_code)) {
+         continue;
+      }
+      send_to_dest(NULL, item->job, item->msgs, d, item->type, item->mtime,
+                   item->dt, dtlen, item->msg, op_cmd);
+      if (d->dest_code == MD_OPERATOR) {
+         op_cmd += strlen(op_cmd) + 1;
+         continue;                    /* no mail for the notes */
+      }
+      if (item->repeat) {
+         bsnprintf(note, sizeof(note), _("%s: last message repeated %d times\n"),
+                   my_name, item->repeat);
+         send_to_dest(NULL, item->job, item->msgs, d, item->type, item->mtime,
+                      item->dt, dtlen, note, NULL);
+      }
+   }
+}
+
+extern "C" void *msg_delivery_thread(void *arg)
+{
+   MSG_ITEM *item;
+   MSGS *msgs;
+
+   set_jcr_in_tsd(INVALID_JCR);
+   P(mq_mutex);
+   for ( ;; ) {
+      while (mq_count == 0 && mq_running) {
+         pthread_cond_wait(&mq_cond, &mq_mutex);
+      }
+      if (mq_count == 0) {
+         break;                       /* stopped and empty */
+      }
+      item = mq_ring[mq_head];
+      mq_head = (mq_head + 1) % MSG_QUEUE_SIZE;
+      mq_count--;
+      V(mq_mutex);
+
+      deliver_msg_item(item);
+      msgs = item->msgs;
+      free_msg_item(item);
+
+      P(mq_mutex);
+      msgs->queued--;                 /* msgs may be released now */
+      mq_delivered++;
+      pthread_cond_broadcast(&mq_done);
+   }
+   V(mq_mutex);
+   return NULL;
+}
+
+/*
+ * Start the delivery thread, must be called after the daemon
+ *  has forked.
+ */
+void start_msg_delivery_thread()
+{
+   int status;
+
+   if (mq_running) {
+      return;
+   }
+   mq_stat_queued = bstat_register("messages.queued", BSTAT_COUNTER);
+   mq_stat_coalesced = bstat_register("messages.coalesced", BSTAT_COUNTER);
+   mq_stat_dropped = bstat_register("messages.dropped", BSTAT_COUNTER);
+   mq_stat_suppressed = bstat_register("messages.suppressed", BSTAT_COUNTER);
+   P(mq_mutex);
+   mq_running = true;
+   if ((status = pthread_create(&mq_tid, NULL, msg_delivery_thread, NULL)) != 0) {
+      berrno be;
+      mq_running = false;
+      delivery_error(_("Cannot start message delivery thread: ERR=%s\n"),
+                     be.bstrerror(status));
+   }
+   V(mq_mutex);
+}
+
+/*
+ * Deliver what is queued and stop the delivery thread, the
+ *  messages are then delivered by the sending threads.
+ */
+void stop_msg_delivery_thread()
+{
+   pthread_t tid;
+
+   P(mq_mutex);
+   if (!mq_running || pthread_equal(pthread_self(), mq_tid)) {
+      V(mq_mutex);
+      return;
+   }
+   tid = mq_tid;
+   mq_running = false;
+   pthread_cond_signal(&mq_cond);
+   pthread_cond_broadcast(&mq_done);  /* wake up the senders waiting for room */
+   V(mq_mutex);
+   pthread_join(tid, NULL);
+}
+
+/*
+ * Wait until the messages queued so far are delivered
+ */
+void flush_msg_queue()
+{
+   uint64_t target;
+
+   if (!mq_running || is_delivery_thread()) {
+      return;
+   }
+   P(mq_mutex);
+   target = mq_queued;
+   while (mq_delivered < target && (mq_running || mq_count > 0)) {
+      pthread_cond_wait(&mq_done, &mq_mutex);
+   }
+   V(mq_mutex);
+}
+
+/*
+ * Stop queueing for msgs, and wait until its queued messages
+ *  are delivered
+ */
+static void drain_msg_queue(MSGS *msgs)
+{
+   P(mq_mutex);
+   msgs->queue_closed = true;
+   if (!is_delivery_thread()) {
+      while (msgs->queued > 0 && (mq_running || mq_count > 0)) {
+         pthread_cond_wait(&mq_done, &mq_mutex);
+      }
+   }
+   V(mq_mutex);
+}
+
+static void open_msg_queue(MSGS *msgs)
+{
+   P(mq_mutex);
+   msgs->queue_closed = false;
+   V(mq_mutex);
+}
+
 /*
  * Handle sending the message to the appropriate place
  */
@@ -694,11 +1325,9 @@ void dispatch_message(JCR *jcr, int type, utime_t mtime, char *msg)
 {
     DEST *d;
     char dt[MAX_TIME_LENGTH];
-    POOLMEM *mcmd;
-    int len, dtlen;
+    int dtlen;
     MSGS *msgs;
-    BPIPE *bpipe;
-    const char *mode;
+    bool queued = false;
 
     Dmsg2(850, "Enter dispatch_msg type=%d msg=%s", type, msg);
 
@@ -762,168 +1391,29 @@ void dispatch_message(JCR *jcr, int type, utime_t mtime, char *msg)
        return;
     }
 
+    /*
+     * Fatal messages are delivered here, after what is queued.
+     *  Otherwise, if the delivery thread runs, only the Director
+     *  and the catalog are done here.
+     */
+    if (type == M_FATAL || type == M_ABORT || type == M_ERROR_TERM) {
+       flush_msg_queue();
+    } else if (mq_running && !is_delivery_thread()) {
+       for (d=msgs->dest_chain; d; d=d->next) {
+          if (bit_is_set(type, d->msg_types) && is_async_dest(d->dest_code)) {
+             queued = queue_message(jcr, msgs, type, mtime, dt, msg);
+             break;
+          }
+       }
+    }
+
     for (d=msgs->dest_chain; d; d=d->next) {
        if (bit_is_set(type, d->msg_types)) {
-          switch (d->dest_code) {
-             case MD_CATALOG:
-                char ed1[50];
-                if (!jcr || !jcr->db) {
-                   break;
-                }
-                if (p_sql_query && p_sql_escape) {
-                   POOLMEM *cmd = get_pool_memory(PM_MESSAGE);
-                   POOLMEM *esc_msg = get_pool_memory(PM_MESSAGE);
-                   
-                   int len = strlen(msg) + 1;
-                   esc_msg = check_pool_memory_size(esc_msg, len*2+1);
-                   p_sql_escape(jcr, jcr->db, esc_msg, msg, len);
-
-                   bstrutime(dt, sizeof(dt), mtime);
-                   Mmsg(cmd, "INSERT INTO Log (JobId, Time, LogText) VALUES (%s,'%s','%s')",
-                         edit_int64(jcr->JobId, ed1), dt, esc_msg);
-                   p_sql_query(jcr, cmd);
-                   
-                   free_pool_memory(cmd);
-                   free_pool_memory(esc_msg);
-                }
-                break;
-             case MD_CONSOLE:
-                Dmsg1(850, "CONSOLE for following msg: %s", msg);
-                if (!con_fd) {
-                   con_fd = fopen(con_fname, "a+b");
-                   Dmsg0(850, "Console file not open.\n");
-                }
-                if (con_fd) {
-                   Pw(con_lock);      /* get write lock on console message file */
-                   errno = 0;
-                   if (dtlen) {
-                      (void)fwrite(dt, dtlen, 1, con_fd);
-                   }
-                   len = strlen(msg);
-                   if (len > 0) {
-                      (void)fwrite(msg, len, 1, con_fd);
-                      if (msg[len-1] != '\n') {
-                         (void)fwrite("\n", 2, 1, con_fd);
-                      }
-                   } else {
-                      (void)fwrite("\n", 2, 1, con_fd);
-                   }
-                   fflush(con_fd);
-                   console_msg_pending = true;
-                   Vw(con_lock);
-                }
-                break;
-             case MD_SYSLOG:
-                Dmsg1(850, "SYSLOG for following msg: %s\n", msg);
-                /*
-                 * We really should do an openlog() here.
-                 */
-                send_to_syslog(LOG_DAEMON|LOG_ERR, msg);
-                break;
-             case MD_OPERATOR:
-                Dmsg1(850, "OPERATOR for following msg: %s\n", msg);
-                mcmd = get_pool_memory(PM_MESSAGE);
-                if ((bpipe=open_mail_pipe(jcr, mcmd, d))) {
-                   int stat;
-                   fputs(dt, bpipe->wfd);
-                   fputs(msg, bpipe->wfd);
-                   /* Messages to the operator go one at a time */
-                   stat = close_bpipe(bpipe);
-                   if (stat != 0) {
-                      berrno be;
-                      be.set_errno(stat);
-                      delivery_error(_("Msg delivery error: Operator mail program terminated in error.\n"
-                            "CMD=%s\n"
-                            "ERR=%s\n"), mcmd, be.bstrerror());
-                   }
-                }
-                free_pool_memory(mcmd);
-                break;
-             case MD_MAIL:
-             case MD_MAIL_ON_ERROR:
-             case MD_MAIL_ON_SUCCESS:
-                Dmsg1(850, "MAIL for following msg: %s", msg);
-                if (msgs->is_closing()) {
-                   break;
-                }
-                msgs->set_in_use();
-                if (!d->fd) {
-                   POOLMEM *name = get_pool_memory(PM_MESSAGE);
-                   make_unique_mail_filename(jcr, name, d);
-                   d->fd = fopen(name, "w+b");
-                   if (!d->fd) {
-                      berrno be;
-                      delivery_error(_("Msg delivery error: fopen %s failed: ERR=%s\n"), name,
-                            be.bstrerror());
-                      free_pool_memory(name);
-                      msgs->clear_in_use();
-                      break;
-                   }
-                   d->mail_filename = name;
-                }
-                fputs(dt, d->fd);
-                len = strlen(msg) + dtlen;;
-                if (len > d->max_len) {
-                   d->max_len = len;      /* keep max line length */
-                }
-                fputs(msg, d->fd);
-                msgs->clear_in_use();
-                break;
-             case MD_APPEND:
-                Dmsg1(850, "APPEND for following msg: %s", msg);
-                mode = "ab";
-                goto send_to_file;
-             case MD_FILE:
-                Dmsg1(850, "FILE for following msg: %s", msg);
-                mode = "w+b";
-send_to_file:
-                if (msgs->is_closing()) {
-                   break;
-                }
-                msgs->set_in_use();
-                if (!d->fd && !open_dest_file(jcr, d, mode)) {
-                   msgs->clear_in_use();
-                   break;
-                }
-                fputs(dt, d->fd);
-                fputs(msg, d->fd);
-                /* On error, we close and reopen to handle log rotation */
-                if (ferror(d->fd)) {
-                   fclose(d->fd);
-                   d->fd = NULL;
-                   if (open_dest_file(jcr, d, mode)) {
-                      fputs(dt, d->fd);
-                      fputs(msg, d->fd);
-                   }
-                }
-                msgs->clear_in_use();
-                break;
-             case MD_DIRECTOR:
-                Dmsg1(850, "DIRECTOR for following msg: %s", msg);
-                if (jcr && jcr->dir_bsock && !jcr->dir_bsock->errors) {
-                   jcr->dir_bsock->fsend("Jmsg Job=%s type=%d level=%lld %s",
-                      jcr->Job, type, mtime, msg);
-                } else {
-                   Dmsg1(800, "no jcr for following msg: %s", msg);
-                }
-                break;
-             case MD_STDOUT:
-                Dmsg1(850, "STDOUT for following msg: %s", msg);
-                if (type != M_ABORT && type != M_ERROR_TERM) { /* already printed */
-                   fputs(dt, stdout);
-                   fputs(msg, stdout);
-                   fflush(stdout);
-                }
-                break;
-             case MD_STDERR:
-                Dmsg1(850, "STDERR for following msg: %s", msg);
-                fputs(dt, stderr);
-                fputs(msg, stderr);
-                fflush(stdout);
-                break;
-             default:
-                break;
+          if (queued && is_async_dest(d->dest_code)) {
+             continue;                /* done by the delivery thread */
           }
+          send_to_dest(jcr, jcr ? jcr->Job : NULL, msgs, d, type, mtime,
+                       dt, dtlen, msg, NULL);
        }
     }
 }
@@ -0,0 +1,525 @@
+/*
+ * Microbenchmarks of the encoding routines used for each file
+ *
+ *  encode_stat()/decode_stat(), to_base64()/from_base64(), the
+ *  ser_xxx()/unser_xxx() macros, bcrc32(), bsnprintf() and
+ *  edit_uint64() are called for every file or every record, so
+ *  a small change there shows on a backup of millions of files.
+ *
+ *  All inputs are generated from a fixed seed, so two runs (or
+ *  two builds) work on exactly the same data and the numbers can
+ *  be compared.  Build and run with "make bench" in src/lib.
+ *
+ */
+/*
+   Bacula® - The Network Backup Solution
+
+   Copyright (C) 2012-2012 Free Software Foundation Europe e.V.
+
+   The main author of Bacula is Kern Sibbald, with contributions from
+   many others, a complete list can be found in the file AUTHORS.
+   This program is Free Software; you can redistribute it and/or
+   modify it under the terms of version three of the GNU Affero General Public
+   License as published by the Free Software Foundation and included
+   in the file LICENSE.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU Affero General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+   02110-1301, USA.
+
+   Bacula® is a registered trademark of Kern Sibbald.
+   The licensor of Bacula is the Free Software Foundation Europe
+   (FSFE), Fiduciary Program, Sumatrastrasse 25, 8006 Zürich,
+   Switzerland, email:ftf@fsfeurope.org.
+*/
+
+#include "bacula.h"
+#include "findlib/find.h"
+
+#define NB_INPUTS    1024               /* inputs per batch */
+#define BIG_BUFSIZE  (64 * 1024)        /* bcrc32 on a data block */
+#define SMALL_BUFSIZE 64                /* bcrc32 on a record header */
+#define REC_SIZE     48                 /* serialized test record */
+
+/* What a ser_xxx() user typically packs, a block/record header */
+struct bench_rec {
+   uint32_t CheckSum;
+   uint32_t block_len;
+   uint32_t BlockNumber;
+   uint32_t VolSessionId;
+   uint32_t VolSessionTime;
+   int32_t  FileIndex;
+   uint64_t FileAddr;
+   uint64_t data_len;
+   char     ID[8];
+};
+
+static struct stat stats[NB_INPUTS];
+static char stat_enc[NB_INPUTS][STAT_COMPACT_MAXLEN + 100];
+static char stat_cenc[NB_INPUTS][STAT_COMPACT_MAXLEN];
+static int64_t values[NB_INPUTS];
+static char b64[NB_INPUTS][20];
+static struct bench_rec recs[NB_INPUTS];
+static uint8_t ser_buf[NB_INPUTS * REC_SIZE];
+static uint8_t varint_buf[NB_INPUTS * 10];
+static char fnames[NB_INPUTS][100];
+static uint8_t *data;
+
+/* Keeps the compiler from throwing the work away */
+static volatile uint64_t sink;
+
+/* xorshift64*, same generator as bgentree */
+static uint64_t seed = 1;
+static inline uint64_t next_rand()
+{
+   seed ^= seed >> 12;
+   seed ^= seed << 25;
+   seed ^= seed >> 27;
+   return seed * 2685821657736338717ULL;
+}
+
+/* Values spread over all magnitudes, like sizes and addresses */
+static inline uint64_t next_rand_log()
+{
+   return next_rand() >> (next_rand() % 64);
+}
+
+static void make_inputs()
+{
+   int i;
+
+   for (i=0; i < NB_INPUTS; i++) {
+      struct stat *st = &stats[i];
+      memset(st, 0, sizeof(struct stat));
+      st->st_dev = 2049 + next_rand() % 4;
+      st->st_ino = next_rand() % 100000000;
+      st->st_mode = (next_rand() % 10) ? 0100644 : 040755;
+      st->st_nlink = 1 + next_rand() % 3;
+      st->st_uid = next_rand() % 1100;
+      st->st_gid = next_rand() % 1100;
+      st->st_rdev = 0;
+      st->st_size = next_rand_log() & 0xFFFFFFFFFFLL;
+      st->st_blksize = 4096;
+      st->st_blocks = (st->st_size + 511) / 512;
+      st->st_atime = 1300000000 + next_rand() % 100000000;
+      st->st_mtime = st->st_atime - next_rand() % 1000000;
+      st->st_ctime = st->st_mtime;
+      encode_stat(stat_enc[i], st, sizeof(struct stat), 0, STREAM_UNIX_ATTRIBUTES);
+      encode_stat_compact(stat_cenc[i], st, sizeof(struct stat), 0, STREAM_UNIX_ATTRIBUTES);
+
+      values[i] = next_rand_log();
+      if (next_rand() % 8 == 0) {
+         values[i] = -values[i];
+      }
+      to_base64(values[i], b64[i]);
+
+      struct bench_rec *r = &recs[i];
+      r->CheckSum = (uint32_t)next_rand();
+      r->block_len = 64512;
+      r->BlockNumber = i;
+      r->VolSessionId = 1 + next_rand() % 1000;
+      r->VolSessionTime = 1300000000 + next_rand() % 100000000;
+      r->FileIndex = 1 + next_rand() % 1000000;
+      r->FileAddr = next_rand_log();
+      r->data_len = next_rand_log() & 0xFFFFFFFF;
+      bstrncpy(r->ID, "BB02", sizeof(r->ID));
+
+      bsnprintf(fnames[i], sizeof(fnames[i]), "/home/user%d/d%d/file%d.txt",
+                (int)(next_rand() % 100), (int)(next_rand() % 1000), i);
+   }
+   data = (uint8_t *)malloc(BIG_BUFSIZE);
+   for (i=0; i < BIG_BUFSIZE; i++) {
+      data[i] = (uint8_t)next_rand();
+   }
+}
+
+/*
+ * Each bench does one batch of operations, sets the number of
+ *  operations and returns the number of bytes produced or consumed.
+ */
+typedef int64_t (bench_fn)(int64_t *ops);
+
+static int64_t bench_encode_stat(int64_t *ops)
+{
+   char buf[STAT_COMPACT_MAXLEN + 100];
+   int64_t bytes = 0;
+
+   for (int i=0; i < NB_INPUTS; i++) {
+      encode_stat(buf, &stats[i], sizeof(struct stat), 0, STREAM_UNIX_ATTRIBUTES);
+      bytes += strlen(buf);
+   }
+   *ops = NB_INPUTS;
+   return bytes;
+}
+
+static int64_t bench_decode_stat(int64_t *ops)
+{
+   struct stat st;
+   int32_t LinkFI;
+   int64_t bytes = 0;
+
+   for (int i=0; i < NB_INPUTS; i++) {
+      decode_stat(stat_enc[i], &st, sizeof(struct stat), &LinkFI);
+      sink += st.st_size;
+      bytes += strlen(stat_enc[i]);
+   }
+   *ops = NB_INPUTS;
+   return bytes;
+}
+
+static int64_t bench_encode_stat_compact(int64_t *ops)
+{
+   char buf[STAT_COMPACT_MAXLEN];
+   int64_t bytes = 0;
+
+   for (int i=0; i < NB_INPUTS; i++) {
+      encode_stat_compact(buf, &stats[i], sizeof(struct stat), 0, STREAM_UNIX_ATTRIBUTES);
+      bytes += strlen(buf);
+   }
+   *ops = NB_INPUTS;
+   return bytes;
+}
+
+static int64_t bench_decode_stat_compact(int64_t *ops)
+{
+   struct stat st;
+   int32_t LinkFI;
+   int64_t bytes = 0;
+
+   for (int i=0; i < NB_INPUTS; i++) {
+      decode_stat(stat_cenc[i], &st, sizeof(struct stat), &LinkFI);
+      sink += st.st_size;
+      bytes += strlen(stat_cenc[i]);
+   }
+   *ops = NB_INPUTS;
+   return bytes;
+}
+
+static int64_t bench_to_base64(int64_t *ops)
+{
+   char buf[20];
+   int64_t bytes = 0;
+
+   for (int i=0; i < NB_INPUTS; i++) {
+      bytes += to_base64(values[i], buf);
+   }
+   *ops = NB_INPUTS;
+   return bytes;
+}
+
+static int64_t bench_from_base64(int64_t *ops)
+{
+   int64_t val;
+   int64_t bytes = 0;
+
+   for (int i=0; i < NB_INPUTS; i++) {
+      bytes += from_base64(&val, b64[i]);
+      sink += val;
+   }
+   *ops = NB_INPUTS;
+   return bytes;
+}
+
+static int64_t bench_bin_to_base64(int64_t *ops)
+{
+   char buf[100];
+   int64_t bytes = 0;
+
+   /* A SHA1 digest, as sent for each file */
+   for (int i=0; i < NB_INPUTS; i++) {
+      bin_to_base64(buf, sizeof(buf), (char *)data + i, 20, true);
+      bytes += 20;
+   }
+   *ops = NB_INPUTS;
+   return bytes;
+}
+
+static int64_t bench_ser(int64_t *ops)
+{
+   ser_declare;
+
+   ser_begin(ser_buf, sizeof(ser_buf));
+   for (int i=0; i < NB_INPUTS; i++) {
+      struct bench_rec *r = &recs[i];
+      ser_uint32(r->CheckSum);
+      ser_uint32(r->block_len);
+      ser_uint32(r->BlockNumber);
+      ser_uint32(r->VolSessionId);
+      ser_uint32(r->VolSessionTime);
+      ser_int32(r->FileIndex);
+      ser_uint64(r->FileAddr);
+      ser_uint64(r->data_len);
+      ser_bytes(r->ID, sizeof(r->ID));
+   }
+   ser_end(ser_buf, sizeof(ser_buf));
+   *ops = NB_INPUTS;
+   return ser_length(ser_buf);
+}
+
+static int64_t bench_unser(int64_t *ops)
+{
+   struct bench_rec r;
+   unser_declare;
+
+   unser_begin(ser_buf, sizeof(ser_buf));
+   for (int i=0; i < NB_INPUTS; i++) {
+      unser_uint32(r.CheckSum);
+      unser_uint32(r.block_len);
+      unser_uint32(r.BlockNumber);
+      unser_uint32(r.VolSessionId);
+      unser_uint32(r.VolSessionTime);
+      unser_int32(r.FileIndex);
+      unser_uint64(r.FileAddr);
+      unser_uint64(r.data_len);
+      unser_bytes(r.ID, sizeof(r.ID));
+      sink += r.FileAddr;
+   }
+   unser_end(ser_buf, sizeof(ser_buf));
+   *ops = NB_INPUTS;
+   return unser_length(ser_buf);
+}
+
+static int64_t bench_ser_varint(int64_t *ops)
+{
+   ser_declare;
+
+   ser_begin(varint_buf, sizeof(varint_buf));
+   for (int i=0; i < NB_INPUTS; i++) {
+      ser_svarint(values[i]);
+   }
+   ser_end(varint_buf, sizeof(varint_buf));
+   *ops = NB_INPUTS;
+   return ser_length(varint_buf);
+}
+
+static int64_t bench_unser_varint(int64_t *ops)
+{
+   int64_t val;
+   unser_declare;
+
+   unser_begin(varint_buf, sizeof(varint_buf));
+   for (int i=0; i < NB_INPUTS; i++) {
+      unser_svarint(val);
+      sink += val;
+   }
+   unser_end(varint_buf, sizeof(varint_buf));
+   *ops = NB_INPUTS;
+   return unser_length(varint_buf);
+}
+
+static int64_t bench_bcrc32_small(int64_t *ops)
+{
+   for (int i=0; i < NB_INPUTS; i++) {
+      sink += bcrc32(data + i, SMALL_BUFSIZE);
+   }
+   *ops = NB_INPUTS;
+   return NB_INPUTS * SMALL_BUFSIZE;
+}
+
+static int64_t bench_bcrc32_big(int64_t *ops)
+{
+   sink += bcrc32(data, BIG_BUFSIZE);
+   *ops = 1;
+   return BIG_BUFSIZE;
+}
+
+static int64_t bench_bsnprintf(int64_t *ops)
+{
+   char buf[512];
+   int64_t bytes = 0;
+
+   /* Looks like the attributes line sent by the FD */
+   for (int i=0; i < NB_INPUTS; i++) {
+      bytes += bsnprintf(buf, sizeof(buf), "%ld %d %s %s %u",
+                         (long)recs[i].FileIndex, STREAM_UNIX_ATTRIBUTES,
+                         fnames[i], stat_enc[i], recs[i].VolSessionId);
+   }
+   *ops = NB_INPUTS;
+   return bytes;
+}
+
+static int64_t bench_edit_uint64(int64_t *ops)
+{
+   char ed1[50];
+   int64_t bytes = 0;
+
+   for (int i=0; i < NB_INPUTS; i++) {
+      bytes += strlen(edit_uint64(recs[i].FileAddr, ed1));
+   }
+   *ops = NB_INPUTS;
+   return bytes;
+}
+
+static int64_t bench_edit_uint64_with_commas(int64_t *ops)
+{
+   char ed1[50];
+   int64_t bytes = 0;
+
+   for (int i=0; i < NB_INPUTS; i++) {
+      bytes += strlen(edit_uint64_with_commas(recs[i].FileAddr, ed1));
+   }
+   *ops = NB_INPUTS;
+   return bytes;
+}
+
+static struct {
+   const char *name;
+   bench_fn *fn;
+} benches[] = {
+   { "encode_stat",              bench_encode_stat },
+   { "decode_stat",              bench_decode_stat },
+   { "encode_stat_compact",      bench_encode_stat_compact },
+   { "decode_stat_compact",      bench_decode_stat_compact },
+   { "to_base64",                bench_to_base64 },
+   { "from_base64",              bench_from_base64 },
+   { "bin_to_base64",            bench_bin_to_base64 },
+   { "ser_header",               bench_ser },
+   { "unser_header",             bench_unser },
+   { "ser_varint",               bench_ser_varint },
+   { "unser_varint",             bench_unser_varint },
+   { "bcrc32_64",                bench_bcrc32_small },
+   { "bcrc32_64k",               bench_bcrc32_big },
+   { "bsnprintf",                bench_bsnprintf },
+   { "edit_uint64",              bench_edit_uint64 },
+   { "edit_uint64_with_commas",  bench_edit_uint64_with_commas },
+   { NULL,                       NULL }
+};
+
+/*
+ * Check that what we measure is right, a fast routine that gives
+ *  a wrong answer is not an optimization.
+ */
+static bool check_inputs()
+{
+   struct stat st;
+   int32_t LinkFI;
+   int64_t val, ops;
+   int i;
+   bool ok = true;
+
+   bench_ser(&ops);
+   bench_ser_varint(&ops);
+   unser_declare;
+   unser_begin(varint_buf, sizeof(varint_buf));
+   for (i=0; i < NB_INPUTS; i++) {
+      decode_stat(stat_enc[i], &st, sizeof(struct stat), &LinkFI);
+      if (st.st_size != stats[i].st_size || st.st_mtime != stats[i].st_mtime) {
+         Pmsg1(0, _("decode_stat mismatch on input %d\n"), i);
+         ok = false;
+      }
+      decode_stat(stat_cenc[i], &st, sizeof(struct stat), &LinkFI);
+      if (st.st_size != stats[i].st_size || st.st_ino != stats[i].st_ino) {
+         Pmsg1(0, _("decode_stat compact mismatch on input %d\n"), i);
+         ok = false;
+      }
+      from_base64(&val, b64[i]);
+      if (val != values[i]) {
+         Pmsg1(0, _("from_base64 mismatch on input %d\n"), i);
+         ok = false;
+      }
+      unser_svarint(val);
+      if (val != values[i]) {
+         Pmsg1(0, _("unser_svarint mismatch on input %d\n"), i);
+         ok = false;
+      }
+   }
+   return ok;
+}
+
+static void usage()
+{
+   fprintf(stderr, _(
+"\n"
+"Usage: microbench [options] [name ...]\n"
+"       -t <msecs>  minimum time for each routine (default 500)\n"
+"       -s <seed>   seed of the inputs (default 1)\n"
+"       -l          list the routines\n"
+"       -?          print this message.\n"
+"\n"
+"       Only the routines that contain one of the names are run.\n"
+"\n"));
+   exit(1);
+}
+
+static bool selected(const char *name, int argc, char *const *argv)
+{
+   if (argc == 0) {
+      return true;
+   }
+   for (int i=0; i < argc; i++) {
+      if (strstr(name, argv[i])) {
+         return true;
+      }
+   }
+   return false;
+}
+
+int main(int argc, char *const *argv)
+{
+   int64_t min_time = 500 * 1000;
+   int64_t ops, bytes, nb_ops, nb_bytes;
+   btime_t start, elapsed;
+   int ch, i;
+
+   setlocale(LC_ALL, "");
+   bindtextdomain("bacula", LOCALEDIR);
+   textdomain("bacula");
+
+   while ((ch = getopt(argc, argv, "t:s:l?")) != -1) {
+      switch (ch) {
+      case 't':
+         min_time = str_to_int64(optarg) * 1000;
+         break;
+      case 's':
+         seed = str_to_uint64(optarg);
+         break;
+      case 'l':
+         for (i=0; benches[i].name; i++) {
+            printf("%s\n", benches[i].name);
+         }
+         exit(0);
+      case '?':
+      default:
+         usage();
+      }
+   }
+   argc -= optind;
+   argv += optind;
+
+   if (seed == 0 || min_time <= 0) {
+      usage();
+   }
+   base64_init();
+   make_inputs();
+   if (!check_inputs()) {
+      exit(1);
+   }
+
+   printf("%-24s %12s %10s %10s\n", "routine", "ops", "ns/op", "MB/s");
+   for (i=0; benches[i].name; i++) {
+      if (!selected(benches[i].name, argc, argv)) {
+         continue;
+      }
+      benches[i].fn(&ops);      /* warm up the caches */
+      nb_ops = nb_bytes = 0;
+      start = get_current_btime();
+      do {
+         bytes = benches[i].fn(&ops);
+         nb_ops += ops;
+         nb_bytes += bytes;
+         elapsed = get_current_btime() - start;
+      } while (elapsed < min_time);
+
+      printf("%-24s %12lld %10.1f %10.1f\n", benches[i].name,
+             (long long)nb_ops, (double)elapsed * 1000.0 / nb_ops,
+             (double)nb_bytes / elapsed);
+   }
+   free(data);
+   exit(0);
+}
@@ -134,6 +134,13 @@ public:
    char *operator_cmd;                /* Operator command */
    DEST *dest_chain;                  /* chain of destinations */
    char send_msg[nbytes_for_bits(M_MAX+1)];  /* bit array of types */
+   int32_t dropped;                   /* file messages dropped, see message.c */
+   int32_t dropped_type;              /* type of the last one dropped */
+   int32_t queued;                    /* items in the delivery queue */
+   bool queue_closed;                 /* set by close_msg(), deliver directly */
+   int32_t flood_count;               /* warnings and errors queued ... */
+   utime_t flood_start;               /* ... since this time */
+   int32_t suppressed;                /* warnings and errors not queued */
 
 private:
    bool m_in_use;                     /* set when using to send a message */
@@ -203,6 +203,8 @@ bool     read_last_jobs_list(int fd, uint64_t addr);
 uint64_t write_last_jobs_list(int fd, uint64_t addr);
 void     write_state_file(char *dir, const char *progname, int port);
 void     job_end_push(JCR *jcr, void job_end_cb(JCR *jcr,void *), void *ctx);
+POOLMEM *edit_job_stages(JCR *jcr, POOLMEM *&buf);
+void     report_job_stages(JCR *jcr);
 void     lock_jobs();
 void     unlock_jobs();
 JCR     *jcr_walk_start();
@@ -244,6 +246,9 @@ void       set_hangup            (int hangup_value);
 int        get_hangup            (void);
 void       set_db_type           (const char *name);
 void       register_message_callback(void msg_callback(int type, char *msg));
+void       start_msg_delivery_thread(void);
+void       stop_msg_delivery_thread(void);
+void       flush_msg_queue       (void);
 
 /* bnet_server.c */
 void       bnet_thread_server(dlist *addr, int max_clients, workq_t *client_wq,
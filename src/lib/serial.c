@@ -184,6 +184,33 @@ void serial_string(uint8_t * * const ptr, const char * const str)
 }
 
 
+/*  serial_varint  --  Serialise an unsigned 64 bit integer in as few
+                       bytes as possible: seven bits per byte, low
+                       order group first, high bit set on all bytes
+                       but the last one.  At most 10 bytes are used. */
+
+void serial_varint(uint8_t * * const ptr, uint64_t v)
+{
+   uint8_t *p = *ptr;
+
+   while (v >= 0x80) {
+      *p++ = (uint8_t)(v | 0x80);
+      v >>= 7;
+   }
+   *p++ = (uint8_t)v;
+   *ptr = p;
+}
+
+/*  serial_svarint  --  Serialise a signed 64 bit integer as a varint,
+                        zigzag encoded so that small negative values
+                        stay short. */
+
+void serial_svarint(uint8_t * * const ptr, int64_t v)
+{
+   serial_varint(ptr, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+}
+
+
 /*  unserial_int16  --  Unserialise a signed 16 bit integer.  */
 
 int16_t unserial_int16(uint8_t * * const ptr)
@@ -316,3 +343,32 @@ void unserial_string(uint8_t * * const ptr, char * const str, int max)
    *ptr += i;                /* update pointer */
 // Dmsg2(000, "unser src=%s dest=%s\n", src, dest);
 }
+
+/*  unserial_varint  --  Unserialise a varint written by serial_varint().
+                         Stops after 10 bytes whatever the data says so
+                         that a corrupted buffer cannot run away. */
+
+uint64_t unserial_varint(uint8_t * * const ptr)
+{
+   uint8_t *p = *ptr;
+   uint64_t v = 0;
+   int shift;
+
+   for (shift = 0; shift < 64; shift += 7) {
+      uint8_t b = *p++;
+      v |= (uint64_t)(b & 0x7F) << shift;
+      if (!(b & 0x80)) {
+         break;
+      }
+   }
+   *ptr = p;
+   return v;
+}
+
+/*  unserial_svarint  --  Unserialise a zigzag encoded signed varint. */
+
+int64_t unserial_svarint(uint8_t * * const ptr)
+{
+   uint64_t v = unserial_varint(ptr);
+   return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
@@ -42,6 +42,8 @@ extern void serial_uint64(uint8_t * * const ptr, const uint64_t v);
 extern void serial_btime(uint8_t * * const ptr, const btime_t v);
 extern void serial_float64(uint8_t * * const ptr, const float64_t v);
 extern void serial_string(uint8_t * * const ptr, const char * const str);
+extern void serial_varint(uint8_t * * const ptr, uint64_t v);
+extern void serial_svarint(uint8_t * * const ptr, int64_t v);
 
 extern int16_t unserial_int16(uint8_t * * const ptr);
 extern uint16_t unserial_uint16(uint8_t * * const ptr);
@@ -52,6 +54,8 @@ extern uint64_t unserial_uint64(uint8_t * * const ptr);
 extern btime_t unserial_btime(uint8_t * * const ptr);
 extern float64_t unserial_float64(uint8_t * * const ptr);
 extern void unserial_string(uint8_t * * const ptr, char * const str, int max);
+extern uint64_t unserial_varint(uint8_t * * const ptr);
+extern int64_t unserial_svarint(uint8_t * * const ptr);
 
 /*
 
@@ -127,6 +131,10 @@ extern void unserial_string(uint8_t * * const ptr, char * const str, int max);
 /* Binary string not requiring serialization */
 #define ser_string(x)   serial_string(&ser_ptr, (x))
 
+/*  Variable length (1 to 10 bytes) unsigned and signed 64 bit integers  */
+#define ser_varint(x)   serial_varint(&ser_ptr, (x))
+#define ser_svarint(x)  serial_svarint(&ser_ptr, (x))
+
 /*                         Unserialisation                  */
 
 /*  8 bit signed integer  */
@@ -170,4 +178,8 @@ extern void unserial_string(uint8_t * * const ptr, char * const str, int max);
 /*  Binary string not requiring serialisation (length obtained by sizeof)  */
 #define unser_string(x) unserial_string(&ser_ptr, (x), sizeof(x))
 
+/*  Variable length (1 to 10 bytes) unsigned and signed 64 bit integers  */
+#define unser_varint(x)  (x) = unserial_varint(&ser_ptr)
+#define unser_svarint(x) (x) = unserial_svarint(&ser_ptr)
+
 #endif /* __SERIAL_H_ */
@@ -0,0 +1,366 @@
+/*
+   Bacula® - The Network Backup Solution
+
+   Copyright (C) 2012-2012 Free Software Foundation Europe e.V.
+
+   The main author of Bacula is Kern Sibbald, with contributions from
+   many others, a complete list can be found in the file AUTHORS.
+   This program is Free Software; you can redistribute it and/or
+   modify it under the terms of version three of the GNU Affero General Public
+   License as published by the Free Software Foundation and included
+   in the file LICENSE.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU Affero General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+   02110-1301, USA.
+
+   Bacula® is a registered trademark of Kern Sibbald.
+   The licensor of Bacula is the Free Software Foundation Europe
+   (FSFE), Fiduciary Program, Sumatrastrasse 25, 8006 Zürich,
+   Switzerland, email:ftf@fsfeurope.org.
+*/
+/*
+ *  Bacula hierarchical timer wheel, see twheel.h
+ */
+
+#include "bacula.h"
+
+void twheel::init(void *item, twlink *link, utime_t start)
+{
+   memset(slots, 0, sizeof(slots));
+   memset(level_items, 0, sizeof(level_items));
+   num_items = 0;
+   now = start;
+   loffset = (int)((char *)link - (char *)item);
+}
+
+/* Level of the wheel that holds slot, TW_LEVELS for the expired list */
+static inline int slot_level(int slot)
+{
+   return slot >> TW_BITS;
+}
+
+void twheel::link_slot(twlink *l, int slot)
+{
+   l->prev = NULL;
+   l->next = slots[slot];
+   if (l->next) {
+      l->next->prev = l;
+   }
+   slots[slot] = l;
+   l->slot = slot + 1;
+   if (slot < TW_PENDING) {
+      level_items[slot_level(slot)]++;
+   }
+}
+
+void twheel::unlink_slot(twlink *l)
+{
+   int slot = l->slot - 1;
+
+   if (l->prev) {
+      l->prev->next = l->next;
+   } else {
+      slots[slot] = l->next;
+   }
+   if (l->next) {
+      l->next->prev = l->prev;
+   }
+   l->next = l->prev = NULL;
+   l->slot = 0;
+   if (slot < TW_PENDING) {
+      level_items[slot_level(slot)]--;
+   }
+}
+
+/*
+ * Put the link in the wheel that covers its expiration time.
+ *  A timer already expired goes in the slot of the next tick,
+ *  one too far away goes in the last slot of the last wheel,
+ *  and will be queued again when that slot is cascaded.
+ */
+void twheel::queue(twlink *l)
+{
+   utime_t expires = l->expires;
+   utime_t delta;
+   int level;
+
+   if (expires < now) {
+      expires = now;
+   }
+   delta = expires - now;
+   if (delta >= TW_MAXDELTA) {
+      delta = TW_MAXDELTA - 1;
+      expires = now + delta;
+   }
+   for (level=0; level < TW_LEVELS - 1; level++) {
+      if (delta < ((utime_t)1 << (TW_BITS * (level + 1)))) {
+         break;
+      }
+   }
+   link_slot(l, level * TW_SIZE + (int)((expires >> (TW_BITS * level)) & TW_MASK));
+}
+
+/* Move the timers of a slot of an upper wheel down */
+void twheel::cascade(int slot)
+{
+   twlink *l, *next;
+
+   l = slots[slot];
+   slots[slot] = NULL;
+   for ( ; l; l = next) {
+      next = l->next;
+      level_items[slot_level(slot)]--;
+      queue(l);
+   }
+}
+
+/*
+ * Run the tick now: when the first wheel wraps, cascade the
+ *  slot of the upper wheel(s) that covers the next TW_SIZE ticks,
+ *  then move the timers of the current slot to the expired list.
+ */
+void twheel::run_tick()
+{
+   int idx = (int)(now & TW_MASK);
+   twlink *l, *next;
+
+   if (idx == 0) {
+      for (int level=1; level < TW_LEVELS; level++) {
+         int i = (int)((now >> (TW_BITS * level)) & TW_MASK);
+         cascade(level * TW_SIZE + i);
+         if (i != 0) {
+            break;
+         }
+      }
+   }
+   l = slots[idx];
+   slots[idx] = NULL;
+   for ( ; l; l = next) {
+      next = l->next;
+      level_items[0]--;
+      link_slot(l, TW_PENDING);
+   }
+   now++;
+}
+
+/*
+ * Next tick where something may happen: a timer of the first
+ *  wheel, or the cascade of the lowest wheel that is not empty.
+ *  Ticks in between have nothing to do and can be skipped.
+ */
+utime_t twheel::next_stop()
+{
+   utime_t t, step;
+   int level;
+
+   if (level_items[0]) {
+      for (t = now; t <= (now | TW_MASK); t++) {
+         if (slots[t & TW_MASK]) {
+            return t;
+         }
+      }
+      return (now | TW_MASK) + 1;
+   }
+   for (level=1; level < TW_LEVELS - 1; level++) {
+      if (level_items[level]) {
+         break;
+      }
+   }
+   step = (utime_t)1 << (TW_BITS * level);
+   return (now + step - 1) & ~(step - 1);
+}
+
+void twheel::insert(void *item, utime_t expires)
+{
+   twlink *l = get_link(item);
+
+   if (l->slot) {
+      unlink_slot(l);
+   } else {
+      num_items++;
+   }
+   l->expires = expires;
+   queue(l);
+}
+
+bool twheel::remove(void *item)
+{
+   twlink *l = get_link(item);
+
+   if (!l->slot) {
+      return false;
+   }
+   unlink_slot(l);
+   num_items--;
+   return true;
+}
+
+/*
+ * Run the ticks up to t, and return the next expired item,
+ *  removed from the wheel, or NULL when there is none left.
+ */
+void *twheel::expire(utime_t t)
+{
+   twlink *l;
+   utime_t stop;
+
+   while (!slots[TW_PENDING] && now <= t) {
+      if (num_items == 0) {
+         now = t + 1;
+         break;
+      }
+      stop = next_stop();
+      if (stop > now) {
+         now = MIN(stop, t + 1);
+         continue;
+      }
+      run_tick();
+   }
+   l = slots[TW_PENDING];
+   if (!l) {
+      return NULL;
+   }
+   unlink_slot(l);
+   num_items--;
+   return get_item(l);
+}
+
+/*
+ * Time of the next call to expire() that may return an item,
+ *  it is never later than the real next expiration, but can
+ *  be earlier when timers are waiting in the upper wheels.
+ */
+utime_t twheel::next_expire()
+{
+   if (slots[TW_PENDING]) {
+      return now - 1;
+   }
+   if (num_items == 0) {
+      return now + TW_MAXDELTA;
+   }
+   return next_stop();
+}
+
+void *twheel::first()
+{
+   for (int i=0; i <= TW_PENDING; i++) {
+      if (slots[i]) {
+         return get_item(slots[i]);
+      }
+   }
+   return NULL;
+}
+
+#ifdef TEST_PROGRAM
+/*
+ * Test and benchmark of the timer wheel
+ *
+ *   twheel_test [ntimers]
+ *
+ *  Schedule ntimers timers from 0 to a few days away, cancel one
+ *  out of four, and run the clock with random steps. Each timer
+ *  must expire exactly once, at the first expire() call with a
+ *  time >= its expiration, and the cancelled ones never.
+ */
+struct MYTIMER {
+   utime_t when;
+   utime_t fired;
+   bool cancelled;
+   twlink link;
+};
+
+static uint64_t seed = 1;
+static uint64_t next_rand()
+{
+   seed ^= seed >> 12;
+   seed ^= seed << 25;
+   seed ^= seed >> 27;
+   return seed * 2685821657736338717ULL;
+}
+
+int main(int argc, char *argv[])
+{
+   MYTIMER *timers, *t = NULL;
+   twheel *wheel;
+   int ntimers = 1000000;
+   int errors = 0, nfired = 0, ncancel = 0;
+   utime_t tnow = 1330000000, last = tnow - 1, end;
+   btime_t start, t_insert, t_remove, t_expire;
+
+   if (argc > 1) {
+      ntimers = atoi(argv[1]);
+   }
+   timers = (MYTIMER *)malloc(ntimers * sizeof(MYTIMER));
+   memset(timers, 0, ntimers * sizeof(MYTIMER));
+   wheel = New(twheel(t, &t->link, tnow));
+
+   start = get_current_btime();
+   for (int i=0; i < ntimers; i++) {
+      /* Mostly short timeouts, a few long ones */
+      utime_t delay = next_rand() % ((i % 10) ? 300 : 5 * 86400);
+      timers[i].when = tnow + delay;
+      wheel->insert(&timers[i], timers[i].when);
+   }
+   t_insert = get_current_btime() - start;
+
+   start = get_current_btime();
+   for (int i=0; i < ntimers; i += 4) {
+      timers[i].cancelled = true;
+      if (!wheel->remove(&timers[i])) {
+         errors++;
+      }
+      ncancel++;
+   }
+   t_remove = get_current_btime() - start;
+   if (wheel->remove(&timers[0])) {
+      Pmsg0(0, "Second remove() of the same timer succeeded\n");
+      errors++;
+   }
+
+   start = get_current_btime();
+   end = tnow + 5 * 86400 + 1;
+   while (last < end) {
+      /* The next expiration is never missed */
+      if (wheel->size() && wheel->next_expire() < last) {
+         Pmsg0(0, "next_expire() went back in time\n");
+         errors++;
+      }
+      while ((t = (MYTIMER *)wheel->expire(tnow)) != NULL) {
+         if (t->fired || t->cancelled || t->when > tnow || t->when <= last) {
+            if (errors++ < 10) {
+               Pmsg4(0, "Bad expire when=%lld tnow=%lld fired=%lld cancelled=%d\n",
+                     t->when, tnow, t->fired, t->cancelled);
+            }
+         }
+         t->fired = tnow;
+         nfired++;
+      }
+      last = tnow;
+      tnow += 1 + next_rand() % ((next_rand() % 100) ? 10 : 5000);
+   }
+   t_expire = get_current_btime() - start;
+
+   if (nfired + ncancel != ntimers || wheel->size() != 0) {
+      Pmsg3(0, "%d fired + %d cancelled != %d timers\n", nfired, ncancel, ntimers);
+      errors++;
+   }
+   printf("insert %d timers   %lld ns/timer\n", ntimers,
+          (long long)(t_insert * 1000 / ntimers));
+   printf("remove %d timers   %lld ns/timer\n", ncancel,
+          (long long)(t_remove * 1000 / MAX(ncancel, 1)));
+   printf("expire %d timers   %lld ns/timer\n", nfired,
+          (long long)(t_expire * 1000 / MAX(nfired, 1)));
+   printf("%d errors\n", errors);
+   delete wheel;
+   free(timers);
+   sm_dump(false);
+   return errors ? 1 : 0;
+}
+#endif /* TEST_PROGRAM */
@@ -0,0 +1,109 @@
+/*
+   Bacula® - The Network Backup Solution
+
+   Copyright (C) 2012-2012 Free Software Foundation Europe e.V.
+
+   The main author of Bacula is Kern Sibbald, with contributions from
+   many others, a complete list can be found in the file AUTHORS.
+   This program is Free Software; you can redistribute it and/or
+   modify it under the terms of version three of the GNU Affero General Public
+   License as published by the Free Software Foundation and included
+   in the file LICENSE.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU Affero General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+   02110-1301, USA.
+
+   Bacula® is a registered trademark of Kern Sibbald.
+   The licensor of Bacula is the Free Software Foundation Europe
+   (FSFE), Fiduciary Program, Sumatrastrasse 25, 8006 Zürich,
+   Switzerland, email:ftf@fsfeurope.org.
+*/
+/*
+ *  Hierarchical timer wheel -- twheel
+ *
+ *  Timers are kept in TW_LEVELS wheels of TW_SIZE slots. The first
+ *    wheel has one slot per tick, each slot of the next wheel covers
+ *    all the slots of the previous one, and so on. A timer goes in
+ *    the wheel that covers its expiration time, and is moved down
+ *    (cascaded) to the lower wheels as the time goes, so insert()
+ *    and remove() are O(1) whatever the number of timers.
+ *
+ *  The wheel does not know about threads or clocks, the caller
+ *    gives the current time to expire() and does the locking. The
+ *    unit of the time is up to the caller, the watchdog uses seconds.
+ *
+ *  Like dlist, the links are embedded in the items, and the wheel
+ *    never allocates or frees anything.
+ */
+
+#ifndef TWHEEL_H
+#define TWHEEL_H
+
+#define TW_BITS     6                 /* 64 slots per wheel */
+#define TW_SIZE     (1 << TW_BITS)
+#define TW_MASK     (TW_SIZE - 1)
+#define TW_LEVELS   4                 /* 2^24 ticks, 194 days in seconds */
+#define TW_MAXDELTA ((utime_t)1 << (TW_BITS * TW_LEVELS))
+#define TW_PENDING  (TW_LEVELS * TW_SIZE) /* slot of the expired timers */
+
+/*
+ * Embedded in each item put on a wheel, a zeroed link is
+ *  not queued.
+ */
+struct twlink {
+   twlink *next;
+   twlink *prev;
+   utime_t expires;                   /* expiration time */
+   int32_t slot;                      /* slot + 1, 0 when not queued */
+};
+
+class twheel : public SMARTALLOC {
+   twlink *slots[TW_PENDING + 1];     /* the wheels, then the expired list */
+   uint32_t level_items[TW_LEVELS];   /* items in each wheel */
+   uint32_t num_items;                /* items queued, expired ones included */
+   utime_t now;                       /* next tick to run */
+   int16_t loffset;                   /* offset of the twlink in the item */
+
+   twlink *get_link(void *item) { return (twlink *)(((char *)item) + loffset); };
+   void *get_item(twlink *l) { return (void *)(((char *)l) - loffset); };
+   void link_slot(twlink *l, int slot);
+   void unlink_slot(twlink *l);
+   void queue(twlink *l);
+   void cascade(int slot);
+   void run_tick();
+   utime_t next_stop();
+
+public:
+   twheel(void *item, twlink *link, utime_t start);
+   twheel();
+   ~twheel() { };
+   void init(void *item, twlink *link, utime_t start);
+   void insert(void *item, utime_t expires); /* (re)schedule item */
+   bool remove(void *item);           /* false if item was not queued */
+   bool is_queued(void *item) { return get_link(item)->slot != 0; };
+   utime_t get_expires(void *item) { return get_link(item)->expires; };
+   void *expire(utime_t t);           /* next item expired at t, or NULL */
+   utime_t next_expire();             /* when expire() may return something */
+   void *first();                     /* any item, to empty the wheel */
+   uint32_t size() { return num_items; };
+   utime_t get_time() { return now; };
+};
+
+inline twheel::twheel(void *item, twlink *link, utime_t start)
+{
+   init(item, link, start);
+}
+
+inline twheel::twheel()
+{
+   init(NULL, NULL, 0);
+}
+
+#endif /* TWHEEL_H */
@@ -30,6 +30,13 @@
  *  allows setting a watchdog timer with a callback that is
  *  called when the timer goes off.
  *
+ *  The timers are kept in a timer wheel (see twheel.h), so
+ *  registering or unregistering one does not depend on the
+ *  number of timers, and the thread only wakes up when a timer
+ *  is due. All the periodic work of the daemons (job monitor,
+ *  jcr_timeout_check(), bsock and thread timers, FD heartbeats)
+ *  runs from this single thread.
+ *
  *  Kern Sibbald, January MMII
  *
  */
@@ -57,8 +64,11 @@ static bool wd_is_init = false;
 static brwlock_t lock;                /* watchdog lock */
 
 static pthread_t wd_tid;
-static dlist *wd_queue;
+static twheel *wd_wheel;
 static dlist *wd_inactive;
+static utime_t wd_wake_time = 0;      /* when the thread wakes up, under timer_mutex */
+static watchdog_t *wd_running = NULL; /* callback being run */
+static bool wd_running_removed = false;
 
 /* 
  * Returns: 0 if the current thread is NOT the watchdog
@@ -96,7 +106,7 @@ int start_watchdog(void)
       Jmsg1(NULL, M_ABORT, 0, _("Unable to initialize watchdog lock. ERR=%s\n"),
             be.bstrerror(errstat));
    }
-   wd_queue = New(dlist(dummy, &dummy->link));
+   wd_wheel = New(twheel(dummy, &dummy->wlink, watchdog_time));
    wd_inactive = New(dlist(dummy, &dummy->link));
    wd_is_init = true;
 
@@ -118,6 +128,28 @@ static void ping_watchdog()
    bmicrosleep(0, 100);
 }
 
+/*
+ * Wake the watchdog thread only if it sleeps past next_fire.
+ *  The thread sets wd_wake_time and goes to sleep without
+ *  releasing timer_mutex, so the signal cannot be lost.
+ */
+static void wake_watchdog(utime_t next_fire)
+{
+   P(timer_mutex);
+   if (next_fire < wd_wake_time) {
+      pthread_cond_signal(&timer);
+   }
+   V(timer_mutex);
+}
+
+static void free_watchdog(watchdog_t *p)
+{
+   if (p->destructor != NULL) {
+      p->destructor(p);
+   }
+   free(p);
+}
+
 /*
  * Terminate the watchdog thread
  *
@@ -138,26 +170,17 @@ int stop_watchdog(void)
 
    stat = pthread_join(wd_tid, NULL);
 
-   while (!wd_queue->empty()) {
-      void *item = wd_queue->first();
-      wd_queue->remove(item);
-      p = (watchdog_t *)item;
-      if (p->destructor != NULL) {
-         p->destructor(p);
-      }
-      free(p);
+   while ((p = (watchdog_t *)wd_wheel->first()) != NULL) {
+      wd_wheel->remove(p);
+      free_watchdog(p);
    }
-   delete wd_queue;
-   wd_queue = NULL;
+   delete wd_wheel;
+   wd_wheel = NULL;
 
    while (!wd_inactive->empty()) {
       void *item = wd_inactive->first();
       wd_inactive->remove(item);
-      p = (watchdog_t *)item;
-      if (p->destructor != NULL) {
-         p->destructor(p);
-      }
-      free(p);
+      free_watchdog((watchdog_t *)item);
    }
    delete wd_inactive;
    wd_inactive = NULL;
@@ -178,6 +201,7 @@ watchdog_t *new_watchdog(void)
    if (wd == NULL) {
       return NULL;
    }
+   memset(wd, 0, sizeof(watchdog_t));
    wd->one_shot = true;
    wd->interval = 0;
    wd->callback = NULL;
@@ -200,19 +224,23 @@ bool register_watchdog(watchdog_t *wd)
    }
 
    wd_lock();
-   wd->next_fire = watchdog_time + wd->interval;
-   wd_queue->append(wd);
+   if (wd->inactive) {
+      wd_inactive->remove(wd);
+      wd->inactive = false;
+   }
+   /* watchdog_time can be one sleep old, the timer must not fire early */
+   wd->next_fire = time(NULL) + wd->interval;
+   wd_wheel->insert(wd, wd->next_fire);
    Dmsg3(800, "Registered watchdog %p, interval %d%s\n",
          wd, wd->interval, wd->one_shot ? " one shot" : "");
    wd_unlock();
-   ping_watchdog();
+   wake_watchdog(wd->next_fire);
 
    return false;
 }
 
 bool unregister_watchdog(watchdog_t *wd)
 {
-   watchdog_t *p;
    bool ok = false;
 
    if (!wd_is_init) {
@@ -220,34 +248,31 @@ bool unregister_watchdog(watchdog_t *wd)
    }
 
    wd_lock();
-   foreach_dlist(p, wd_queue) {
-      if (wd == p) {
-         wd_queue->remove(wd);
-         Dmsg1(800, "Unregistered watchdog %p\n", wd);
-         ok = true;
-         goto get_out;
-      }
-   }
+   if (wd_wheel->remove(wd)) {
+      Dmsg1(800, "Unregistered watchdog %p\n", wd);
+      ok = true;
+
+   } else if (wd->inactive) {
+      wd_inactive->remove(wd);
+      wd->inactive = false;
+      Dmsg1(800, "Unregistered inactive watchdog %p\n", wd);
+      ok = true;
+
+   } else if (wd == wd_running) {
+      /* Called from its own callback, do not reschedule it */
+      wd_running_removed = true;
+      Dmsg1(800, "Unregistered running watchdog %p\n", wd);
+      ok = true;
 
-   foreach_dlist(p, wd_inactive) {
-      if (wd == p) {
-         wd_inactive->remove(wd);
-         Dmsg1(800, "Unregistered inactive watchdog %p\n", wd);
-         ok = true;
-         goto get_out;
-      }
+   } else {
+      Dmsg1(800, "Failed to unregister watchdog %p\n", wd);
    }
-
-   Dmsg1(800, "Failed to unregister watchdog %p\n", wd);
-
-get_out:
    wd_unlock();
-   ping_watchdog();
    return ok;
 }
 
 /*
- * This is the thread that walks the watchdog queue
+ * This is the thread that runs the timer wheel
  *  and when a queue item fires, the callback is
  *  invoked.  If it is a one shot, the queue item
  *  is moved to the inactive queue.
@@ -255,8 +280,6 @@ get_out:
 extern "C" void *watchdog_thread(void *arg)
 {
    struct timespec timeout;
-   struct timeval tv;
-   struct timezone tz;
    utime_t next_time;
 
    set_jcr_in_tsd(INVALID_JCR);
@@ -280,45 +303,46 @@ extern "C" void *watchdog_thread(void *arg)
        */
       wd_lock();
 
-walk_list:
       watchdog_time = time(NULL);
-      next_time = watchdog_time + watchdog_sleep_time;
-      foreach_dlist(p, wd_queue) {
-         if (p->next_fire <= watchdog_time) {
-            /* Run the callback */
-            Dmsg2(3400, "Watchdog callback p=0x%p fire=%d\n", p, p->next_fire);
-            p->callback(p);
-
-            /* Reschedule (or move to inactive list if it's a one-shot timer) */
-            if (p->one_shot) {
-               wd_queue->remove(p);
-               wd_inactive->append(p);
-               goto walk_list;
-            } else {
-               p->next_fire = watchdog_time + p->interval;
-            }
+      while ((p = (watchdog_t *)wd_wheel->expire(watchdog_time)) != NULL) {
+         /* Run the callback */
+         Dmsg2(3400, "Watchdog callback p=0x%p fire=%d\n", p, p->next_fire);
+         wd_running = p;
+         wd_running_removed = false;
+         p->callback(p);
+         wd_running = NULL;
+         if (wd_running_removed) {
+            continue;
          }
-         if (p->next_fire <= next_time) {
-            next_time = p->next_fire;
+
+         /* Reschedule (or move to inactive list if it's a one-shot timer) */
+         if (p->one_shot) {
+            p->inactive = true;
+            wd_inactive->append(p);
+         } else {
+            p->next_fire = watchdog_time + p->interval;
+            wd_wheel->insert(p, p->next_fire);
          }
       }
-      wd_unlock();
+      next_time = MIN(wd_wheel->next_expire(), watchdog_time + watchdog_sleep_time);
+      next_time = MAX(next_time, watchdog_time + 1);
 
       /*
-       * Wait sleep time or until someone wakes us
+       * Wait until the next timer or until someone wakes us,
+       *  timer_mutex is taken before the watchdog lock is
+       *  released, see wake_watchdog().
        */
-      gettimeofday(&tv, &tz);
-      timeout.tv_nsec = tv.tv_usec * 1000;
-      timeout.tv_sec = tv.tv_sec + next_time - time(NULL);
-      while (timeout.tv_nsec >= 1000000000) {
-         timeout.tv_nsec -= 1000000000;
-         timeout.tv_sec++;
-      }
+      P(timer_mutex);
+      wd_wake_time = next_time;
+      wd_unlock();
+      timeout.tv_sec = next_time;
+      timeout.tv_nsec = 0;
 
-      Dmsg1(1900, "pthread_cond_timedwait %d\n", timeout.tv_sec - tv.tv_sec);
+      Dmsg1(1900, "pthread_cond_timedwait %d\n", (int)(next_time - watchdog_time));
       /* Note, this unlocks mutex during the sleep */
-      P(timer_mutex);
-      pthread_cond_timedwait(&timer, &timer_mutex, &timeout);
+      if (!quit) {
+         pthread_cond_timedwait(&timer, &timer_mutex, &timeout);
+      }
       V(timer_mutex);
    }
 
@@ -47,8 +47,10 @@ struct s_watchdog_t {
         void (*destructor)(struct s_watchdog_t *wd);
         void *data;
         /* Private data below - don't touch outside of watchdog.c */
-        dlink link;
+        dlink link;                     /* inactive list */
+        twlink wlink;                   /* timer wheel */
         utime_t next_fire;
+        bool inactive;                  /* one shot that has fired */
 };
 typedef struct s_watchdog_t watchdog_t;
 
@@ -61,6 +61,7 @@ bool do_append_data(JCR *jcr)
    char buf1[100], buf2[100];
    DCR *dcr = jcr->dcr;
    DEVICE *dev;
+   char *data;
    char ec[50];
 
 
@@ -152,6 +153,8 @@ bool do_append_data(JCR *jcr)
        *    stream     (Bacula number to distinguish parts of data)
        *    info       (Info for Storage daemon -- compressed, encrypted, ...)
        *       info is not currently used, so is read, but ignored!
+       *  With STREAM_PROTO_TEXT it is an ASCII packet of its own, with
+       *  STREAM_PROTO_BINHDR it is binary and prefixes the first data.
        */
      if ((n=bget_msg(fd)) <= 0) {
          if (n == BNET_SIGNAL && fd->msglen == BNET_EOD) {
@@ -164,11 +167,32 @@ bool do_append_data(JCR *jcr)
          break;
       }
 
-      if (sscanf(fd->msg, "%ld %ld", &file_index, &stream) != 2) {
-         Jmsg1(jcr, M_FATAL, 0, _("Malformed data header from FD: %s\n"), fd->msg);
-         ok = false;
-         possible_incomplete_job(jcr, last_file_index);
-         break;
+      if (jcr->stream_proto >= STREAM_PROTO_BINHDR) {
+         /*
+          * Binary header, the first chunk of data (if any) follows
+          *  it in the same packet.
+          */
+         if (fd->msglen < (int32_t)STREAM_HDR_SIZE) {
+            Jmsg1(jcr, M_FATAL, 0, _("Malformed data header from FD: len=%d\n"),
+                  fd->msglen);
+            ok = false;
+            possible_incomplete_job(jcr, last_file_index);
+            break;
+         }
+         ser_declare;
+         unser_begin(fd->msg, STREAM_HDR_SIZE);
+         unser_int32(file_index);
+         unser_int32(stream);
+         data = fd->msg + STREAM_HDR_SIZE;
+         n = fd->msglen - STREAM_HDR_SIZE;
+      } else {
+         if (sscanf(fd->msg, "%ld %ld", &file_index, &stream) != 2) {
+            Jmsg1(jcr, M_FATAL, 0, _("Malformed data header from FD: %s\n"), fd->msg);
+            ok = false;
+            possible_incomplete_job(jcr, last_file_index);
+            break;
+         }
+         n = 0;                       /* no data yet */
       }
 
       Dmsg2(890, "<filed: Header FilInx=%d stream=%d\n", file_index, stream);
@@ -198,16 +222,21 @@ fi_checked:
       }
 
       /* Read data stream from the File daemon.
-       *  The data stream is just raw bytes
+       *  The data stream is just raw bytes. With the binary header,
+       *  the first chunk is already in the message buffer.
        */
-      while ((n=bget_msg(fd)) > 0 && !jcr->is_job_canceled()) {
+      if (n == 0) {
+         n = bget_msg(fd);
+         data = fd->msg;
+      }
+      for ( ; n > 0 && !jcr->is_job_canceled(); n = bget_msg(fd), data = fd->msg) {
          rec.VolSessionId = jcr->VolSessionId;
          rec.VolSessionTime = jcr->VolSessionTime;
          rec.FileIndex = file_index;
          rec.Stream = stream;
          rec.maskedStream = stream & STREAMMASK_TYPE;   /* strip high bits */
-         rec.data_len = fd->msglen;
-         rec.data = fd->msg;            /* use message buffer */
+         rec.data_len = n;
+         rec.data = data;               /* use message buffer */
 
          Dmsg4(850, "before writ_rec FI=%d SessId=%d Strm=%s len=%d\n",
             rec.FileIndex, rec.VolSessionId, 
@@ -336,6 +365,7 @@ fi_checked:
       commit_attribute_spool(jcr);
    }
 
+   report_job_stages(jcr);
    dir_send_job_status(jcr);          /* update director */
 
    Dmsg1(100, "return from do_append_data() ok=%d\n", ok);
@@ -538,6 +538,7 @@ bool write_block_to_dev(DCR *dcr)
     *  I/O errors, or from the OS telling us it is busy.
     */ 
    int retry = 0;
+   btime_t write_start = dcr->despooling ? 0 : get_current_btime();
    errno = 0;
    stat = 0;
    do {
@@ -551,6 +552,10 @@ bool write_block_to_dev(DCR *dcr)
       stat = dev->write(block->buf, (size_t)wlen);
 
    } while (stat == -1 && (errno == EBUSY || errno == EIO) && retry++ < 3);
+   /* The writes done while despooling are in the despool stage */
+   if (!dcr->despooling) {
+      jcr->add_stage(JOB_STAGE_DEV_WRITE, write_start, stat > 0 ? stat : 0);
+   }
 
 #ifdef DEBUG_BLOCK_ZEROING
    if (bp[0] == 0 && bp[1] == 0 && bp[2] == 0 && block->buf[12] == 0) {
@@ -541,6 +541,8 @@ public:
    int Copy;                          /* identical copy number */
    int Stripe;                        /* RAIT stripe */
    VOLUME_CAT_INFO VolCatInfo;        /* Catalog info for desired volume */
+   bool (*block_cb)(DCR *dcr, DEV_BLOCK *block); /* called by read_records() for each block */
+   void *block_ctx;                   /* private data of block_cb */
 
    /* Methods */
    bool found_in_use() const { return m_found_in_use; };
@@ -69,6 +69,7 @@ extern bool use_cmd(JCR *jcr);
 extern bool run_cmd(JCR *jcr);
 extern bool status_cmd(JCR *sjcr);
 extern bool qstatus_cmd(JCR *jcr);
+extern bool stats_cmd(JCR *jcr);
 //extern bool query_cmd(JCR *jcr);
 
 /* Forward referenced functions */
@@ -116,6 +117,7 @@ static struct s_cmds cmds[] = {
    {"setdebug=",   setdebug_cmd,    0},     /* set debug level */
    {"status",      status_cmd,      1},
    {".status",     qstatus_cmd,     1},
+   {".stats",      stats_cmd,       1},
    {"unmount",     unmount_cmd,     0},
 //   {"action_on_purge",  action_on_purge_cmd,    0},
    {"use storage=", use_cmd,        0},
@@ -85,6 +85,7 @@ static struct s_cmds fd_cmds[] = {
 
 /* Commands from the File daemon that require additional scanning */
 static char read_open[]       = "read open session = %127s %ld %ld %ld %ld %ld %ld\n";
+static char append_open[]     = "append open session proto=%d\n";
 
 /* Responses sent to the File daemon */
 static char NO_open[]         = "3901 Error session already open\n";
@@ -92,6 +93,7 @@ static char NOT_opened[]      = "3902 Error session not opened\n";
 static char OK_end[]          = "3000 OK end\n";
 static char OK_close[]        = "3000 OK close Status = %d\n";
 static char OK_open[]         = "3000 OK open ticket = %d\n";
+static char OK_open_proto[]   = "3000 OK open ticket = %d proto=%d\n";
 static char ERROR_append[]    = "3903 Error append data\n";
 
 /* Information sent to the Director */
@@ -235,6 +237,7 @@ static bool append_end_session(JCR *jcr)
 static bool append_open_session(JCR *jcr)
 {
    BSOCK *fd = jcr->file_bsock;
+   int32_t proto;
 
    Dmsg1(120, "Append open session: %s", fd->msg);
    if (jcr->session_opened) {
@@ -245,8 +248,20 @@ static bool append_open_session(JCR *jcr)
 
    jcr->session_opened = true;
 
-   /* Send "Ticket" to File Daemon */
-   fd->fsend(OK_open, jcr->VolSessionId);
+   /*
+    * Newer File daemons tell us the highest stream protocol they
+    *  know, we answer with the level both of us will use. Older ones
+    *  send no proto and get the old text stream headers.
+    */
+   jcr->stream_proto = STREAM_PROTO_TEXT;
+   if (sscanf(fd->msg, append_open, &proto) == 1) {
+      jcr->stream_proto = MIN(MAX(proto, STREAM_PROTO_TEXT), STREAM_PROTO_MAX);
+      /* Send "Ticket" and protocol to File Daemon */
+      fd->fsend(OK_open_proto, jcr->VolSessionId, jcr->stream_proto);
+   } else {
+      /* Send "Ticket" to File Daemon */
+      fd->fsend(OK_open, jcr->VolSessionId);
+   }
    Dmsg1(110, ">filed: %s", fd->msg);
 
    return true;
@@ -41,6 +41,95 @@ extern char Job_end[];
 
 /* Forward referenced subroutines */
 static bool record_cb(DCR *dcr, DEV_RECORD *rec);
+static bool block_cb(DCR *dcr, DEV_BLOCK *block);
+
+/*
+ * When a Copy or Migration job takes one whole session, the blocks
+ *  of this session are written out as they were read, only the
+ *  block header is rebuilt for the new session.  Their records
+ *  are still passed to record_cb() to count the files and to send
+ *  the attributes to the Director, but they are not repacked, so
+ *  they keep their FileIndex.  This is only right when the session
+ *  is read from FileIndex 1 with no hole: record_cb() then gives
+ *  the same numbers to the records it repacks.
+ */
+struct MAC_CTX {
+   bool copy_blocks;                  /* session copied block by block */
+   uint32_t VolSessionId;             /* the session */
+   uint32_t VolSessionTime;
+   int32_t LastIndex;                 /* last FileIndex selected */
+   bool block_copied;                 /* records of the last block copied */
+   bool session_copied;               /* last block of the session copied */
+   uint32_t copied_blocks;            /* blocks copied as they were read */
+};
+
+/*
+ * A bsr takes a session when it selects nothing but one session
+ *  and one range of FileIndexes, this is what the Director writes
+ *  for Copy and Migration jobs.
+ */
+static bool is_session_bsr(BSR *bsr)
+{
+   return bsr->sessid && !bsr->sessid->next &&
+          bsr->sessid->sessid == bsr->sessid->sessid2 &&
+          bsr->sesstime && !bsr->sesstime->next &&
+          (!bsr->FileIndex || !bsr->FileIndex->next) &&
+          !bsr->JobId && !bsr->job && !bsr->client &&
+          !bsr->JobType && !bsr->JobLevel && !bsr->stream &&
+          !bsr->fileregex;
+}
+
+/*
+ * See if the bsr takes exactly one session, from FileIndex 1 with
+ *  no hole (a Job spanning Volumes has one bsr per Volume), and if
+ *  so copy it block by block.  A Virtual Backup renumbers the
+ *  FileIndexes of all its Jobs, so it always repacks the records,
+ *  and so does any bsr that filters the content of a session.  The
+ *  blocks with FileIndexes past the last one selected are repacked,
+ *  see block_cb().
+ */
+static void find_copied_session(JCR *jcr, MAC_CTX *ctx)
+{
+   BSR *bsr;
+   int32_t last = 0;
+
+   ctx->copy_blocks = false;
+   if (jcr->getJobType() != JT_COPY && jcr->getJobType() != JT_MIGRATE) {
+      return;
+   }
+   if (jcr->read_dcr->dev->max_block_size > jcr->dcr->block->buf_len) {
+      Dmsg2(100, "Read block size %u > write block size %u, no block copy\n",
+            jcr->read_dcr->dev->max_block_size, jcr->dcr->block->buf_len);
+      return;
+   }
+   for (bsr = jcr->bsr; bsr; bsr = bsr->next) {
+      if (!is_session_bsr(bsr)) {
+         Dmsg0(100, "Partial session selected, no block copy\n");
+         return;
+      }
+      if (bsr != jcr->bsr && (bsr->sessid->sessid != ctx->VolSessionId ||
+                              bsr->sesstime->sesstime != ctx->VolSessionTime)) {
+         Dmsg0(100, "Several sessions selected, no block copy\n");
+         return;
+      }
+      ctx->VolSessionId = bsr->sessid->sessid;
+      ctx->VolSessionTime = bsr->sesstime->sesstime;
+      if (!bsr->FileIndex) {
+         last = INT32_MAX;
+      } else if (bsr->FileIndex->findex > last + 1) {
+         Dmsg1(100, "FileIndex %d not selected, no block copy\n", last + 1);
+         return;
+      } else if (bsr->FileIndex->findex2 > last) {
+         last = bsr->FileIndex->findex2;
+      }
+   }
+   if (last > 0) {
+      ctx->copy_blocks = true;
+      ctx->LastIndex = last;
+      Dmsg3(100, "Copy blocks of SessId=%u SessTime=%u up to FI=%d\n",
+            ctx->VolSessionId, ctx->VolSessionTime, ctx->LastIndex);
+   }
+}
 
 
 /*
@@ -55,6 +144,7 @@ bool do_mac(JCR *jcr)
    const char *Type;
    char ec1[50];
    DEVICE *dev;
+   MAC_CTX ctx;
 
    switch(jcr->getJobType()) {
    case JT_MIGRATE:
@@ -110,7 +200,20 @@ bool do_mac(JCR *jcr)
    set_start_vol_position(jcr->dcr);
 
    jcr->JobFiles = 0;
+   ctx.block_copied = ctx.session_copied = false;
+   ctx.copied_blocks = 0;
+   find_copied_session(jcr, &ctx);
+   if (ctx.copy_blocks) {
+      jcr->read_dcr->block_cb = block_cb;
+   }
+   jcr->read_dcr->block_ctx = &ctx;
    ok = read_records(jcr->read_dcr, record_cb, mount_next_read_volume);
+   jcr->read_dcr->block_cb = NULL;
+   jcr->read_dcr->block_ctx = NULL;
+   if (ctx.copied_blocks > 0) {
+      Jmsg(jcr, M_INFO, 0, _("%u blocks copied without repacking their records.\n"),
+           ctx.copied_blocks);
+   }
    goto ok_out;
 
 bail_out:
@@ -177,6 +280,109 @@ ok_out:
    return ok;
 }
 
+/*
+ * Called here by read_records() for each block read. The blocks
+ *  of the session that we copy are written out directly with a
+ *  new block header (session, block number and checksum).  The
+ *  first block with a FileIndex past the selection ends the copy.
+ *  A record split over two blocks is either copied or repacked
+ *  as a whole.
+ *  Returns: true if OK
+ *           false if error
+ */
+static bool block_cb(DCR *dcr, DEV_BLOCK *block)
+{
+   JCR *jcr = dcr->jcr;
+   MAC_CTX *ctx = (MAC_CTX *)dcr->block_ctx;
+   DEVICE *dev = jcr->dcr->dev;
+   DEV_BLOCK *wblock = jcr->dcr->block;
+   uint32_t len;
+   int32_t FileIndex, Stream, FirstIndex = 0, LastIndex = 0;
+   uint32_t data_len;
+   bool cont = false, last = false;
+   char *p, *end;
+   ser_declare;
+
+   /* record_cb() repacks the records unless we copy the block */
+   ctx->block_copied = false;
+   if (!ctx->copy_blocks || block->BlockVer < 2 ||
+       block->VolSessionId != ctx->VolSessionId ||
+       block->VolSessionTime != ctx->VolSessionTime) {
+      return true;
+   }
+
+   /* Walk the record headers for the JobMedia FileIndexes */
+   p = block->buf + BLKHDR2_LENGTH;
+   end = block->buf + block->block_len;
+   while (end - p >= WRITE_RECHDR_LENGTH) {
+      unser_begin(p, WRITE_RECHDR_LENGTH);
+      unser_int32(FileIndex);
+      unser_int32(Stream);
+      unser_uint32(data_len);
+      /* A negative Stream continues the record of the previous block */
+      if (p == block->buf + BLKHDR2_LENGTH && Stream < 0) {
+         if (!ctx->session_copied) {
+            return true;              /* its start was repacked */
+         }
+         cont = true;                 /* its start was copied */
+      }
+      if (FileIndex > ctx->LastIndex) {
+         Dmsg1(100, "FI=%d not selected, end of the block copy\n", FileIndex);
+         if (!cont) {
+            ctx->copy_blocks = ctx->session_copied = false;
+            return true;
+         }
+         last = true;
+      }
+      if (FileIndex > 0) {
+         if (FirstIndex == 0) {
+            FirstIndex = FileIndex;
+         }
+         LastIndex = FileIndex;
+      }
+      if (data_len > (uint32_t)(end - p) - WRITE_RECHDR_LENGTH) {
+         break;                       /* continued in the next block */
+      }
+      p += WRITE_RECHDR_LENGTH + data_len;
+   }
+
+   if (block->block_len > wblock->buf_len) {
+      Jmsg3(jcr, M_FATAL, 0, _("Block of %u bytes too big for the %u bytes blocks of device %s.\n"),
+            block->block_len, wblock->buf_len, dev->print_name());
+      return false;
+   }
+
+   /* Flush out what was written with records */
+   if (wblock->binbuf > WRITE_BLKHDR_LENGTH && !write_block_to_device(jcr->dcr)) {
+      Jmsg2(jcr, M_FATAL, 0, _("Fatal append error on device %s: ERR=%s\n"),
+            dev->print_name(), dev->bstrerror());
+      return false;
+   }
+
+   len = block->block_len - BLKHDR2_LENGTH;
+   memcpy(wblock->buf + WRITE_BLKHDR_LENGTH, block->buf + BLKHDR2_LENGTH, len);
+   wblock->binbuf = WRITE_BLKHDR_LENGTH + len;
+   wblock->bufp = wblock->buf + wblock->binbuf;
+   wblock->VolSessionId = jcr->VolSessionId;
+   wblock->VolSessionTime = jcr->VolSessionTime;
+   if (FirstIndex > 0) {
+      wblock->FirstIndex = FirstIndex;
+      wblock->LastIndex = LastIndex;
+   }
+
+   Dmsg4(200, "Copy block %u SessId=%u len=%u FI=%d\n", block->BlockNumber,
+         block->VolSessionId, block->block_len, wblock->FirstIndex);
+   if (!write_block_to_device(jcr->dcr)) {
+      Jmsg2(jcr, M_FATAL, 0, _("Fatal append error on device %s: ERR=%s\n"),
+            dev->print_name(), dev->bstrerror());
+      return false;
+   }
+   ctx->copied_blocks++;
+   ctx->block_copied = ctx->session_copied = true;
+   ctx->copy_blocks = !last;
+   return true;
+}
+
 /*
  * Called here for each record from read_records()
  *  Returns: true if OK
@@ -186,6 +392,8 @@ static bool record_cb(DCR *dcr, DEV_RECORD *rec)
 {
    JCR *jcr = dcr->jcr;
    DEVICE *dev = jcr->dcr->dev;
+   MAC_CTX *ctx = (MAC_CTX *)dcr->block_ctx;
+   bool copied;
    char buf1[100], buf2[100];
    
 #ifdef xxx
@@ -206,6 +414,8 @@ static bool record_cb(DCR *dcr, DEV_RECORD *rec)
    case EOM_LABEL:
       return true;                    /* don't write vol labels */
    }
+   /* The record is already in a block written by block_cb() */
+   copied = dcr->block_cb && ctx->block_copied;
 //   if (jcr->getJobType() == JT_BACKUP) {
       /*
        * For normal migration jobs, FileIndex values are sequential because
@@ -225,9 +435,19 @@ static bool record_cb(DCR *dcr, DEV_RECORD *rec)
             rec->last_VolSessionTime = rec->VolSessionTime;
             rec->last_FileIndex = rec->FileIndex;
          }
-         rec->FileIndex = jcr->JobFiles;     /* set sequential output FileIndex */
+         if (!copied) {
+            rec->FileIndex = jcr->JobFiles;  /* set sequential output FileIndex */
+         }
       }
 //   }
+   if (copied) {
+      if (rec->FileIndex < 0) {
+         return true;                 /* don't send LABELs to Dir */
+      }
+      jcr->JobBytes += rec->data_len;
+      send_attrs_to_dir(jcr, rec);
+      return true;
+   }
    /*
     * Modify record SessionId and SessionTime to correspond to
     * output.
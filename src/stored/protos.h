@@ -295,6 +295,10 @@ bool    discard_attribute_spool   (JCR *jcr);
 bool    commit_attribute_spool    (JCR *jcr);
 bool    write_block_to_spool_file (DCR *dcr);
 void    list_spool_stats          (void sendit(const char *msg, int len, void *sarg), void *arg);
+void    update_spool_bstats       ();
+
+/* From status.c */
+void    update_device_bstats      ();
 
 /* From wait.c */
 int wait_for_sysop(DCR *dcr);
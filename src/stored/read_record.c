@@ -58,6 +58,9 @@ static const int no_FileIndex = -999999;
  * This subroutine reads all the records and passes them back to your
  *  callback routine (also mount routine at EOM).
  * You must not change any values in the DEV_RECORD packet
+ *
+ * If dcr->block_cb is set, it is called with each block read
+ *  before the records of the block are passed to record_cb.
  */
 bool read_records(DCR *dcr,
        bool record_cb(DCR *dcr, DEV_RECORD *rec),
@@ -163,6 +166,11 @@ bool read_records(DCR *dcr,
          }
       }
       Dmsg2(dbglvl, "Read new block at pos=%u:%u\n", dev->file, dev->block_num);
+      /* Let the caller see the whole block before its records */
+      if (dcr->block_cb && !dcr->block_cb(dcr, block)) {
+         ok = false;
+         break;
+      }
 #ifdef if_and_when_FAST_BLOCK_REJECTION_is_working
       /* this does not stop when file/block are too big */
       if (!match_bsr_block(jcr->bsr, block)) {
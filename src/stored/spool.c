@@ -74,6 +74,21 @@ enum {
    RB_OK
 };
 
+/*
+ * Spool usage for the daemon statistics
+ */
+void update_spool_bstats()
+{
+   P(mutex);
+   bstat_set(bstat_register("spool.data.jobs", BSTAT_GAUGE), spool_stats.data_jobs);
+   bstat_set(bstat_register("spool.data.bytes", BSTAT_GAUGE), spool_stats.data_size);
+   bstat_set(bstat_register("spool.data.max_bytes", BSTAT_GAUGE), spool_stats.max_data_size);
+   bstat_set(bstat_register("spool.attr.jobs", BSTAT_GAUGE), spool_stats.attr_jobs);
+   bstat_set(bstat_register("spool.attr.bytes", BSTAT_GAUGE), spool_stats.attr_size);
+   bstat_set(bstat_register("spool.attr.max_bytes", BSTAT_GAUGE), spool_stats.max_attr_size);
+   V(mutex);
+}
+
 void list_spool_stats(void sendit(const char *msg, int len, void *sarg), void *arg)
 {
    char ed1[30], ed2[30];
@@ -280,6 +295,7 @@ static bool despool_data(DCR *dcr, bool commit)
 
    /* Add run time, to get current wait time */
    int32_t despool_start = time(NULL) - jcr->run_time;
+   btime_t stage_start = get_current_btime();
 
    set_new_file_parameters(dcr);
 
@@ -306,6 +322,7 @@ static bool despool_data(DCR *dcr, bool commit)
       }
       Dmsg3(800, "Write block ok=%d FI=%d LI=%d\n", ok, block->FirstIndex, block->LastIndex);
    }
+   jcr->add_stage(JOB_STAGE_DESPOOL, stage_start, jcr->dcr->job_spool_size);
 
    /*
     * If this Job is incomplete, we need to backup the FileIndex
@@ -570,7 +587,9 @@ static bool write_spool_data(DCR *dcr)
 
    /* Write data */
    for (int retry=0; retry<=1; retry++) {
+      btime_t start = get_current_btime();
       stat = write(dcr->spool_fd, block->buf, (size_t)block->binbuf);
+      jcr->add_stage(JOB_STAGE_SPOOL_WRITE, start, stat > 0 ? stat : 0);
       if (stat == -1) {
          berrno be;
          Jmsg(jcr, M_FATAL, 0, _("Error writing data to spool file. ERR=%s\n"),
@@ -452,6 +452,9 @@ static void list_running_jobs(STATUS_PKT *sp)
             edit_uint64_with_commas(jcr->JobBytes, b2),
             edit_uint64_with_commas(bps, b3));
          sendit(msg, len, sp);
+         if (*edit_job_stages(jcr, msg.addr())) {
+            sendit(msg, strlen(msg.c_str()), sp);
+         }
          found = true;
 #ifdef DEBUG
          if (jcr->file_bsock) {
@@ -739,6 +742,10 @@ bool qstatus_cmd(JCR *jcr)
    } else if (strcasecmp(cmd.c_str(), "terminated") == 0) {
        sp.api = true;
        list_terminated_jobs(&sp);
+   } else if (strcasecmp(cmd.c_str(), "locks") == 0) {
+       lmgr_edit_profile(dir->msg);
+       dir->msglen = strlen(dir->msg);
+       dir->send();
    } else {
       pm_strcpy(jcr->errmsg, dir->msg);
       Jmsg1(jcr, M_FATAL, 0, _("Bad .status command: %s\n"), jcr->errmsg);
@@ -750,6 +757,63 @@ bool qstatus_cmd(JCR *jcr)
    return true;
 }
 
+/*
+ * .stats command, the daemon statistics as key=value
+ *  lines, or as a JSON object with ".stats json"
+ */
+bool stats_cmd(JCR *jcr)
+{
+   BSOCK *dir = jcr->dir_bsock;
+   bool json = strncmp(dir->msg, ".stats json", 11) == 0;
+
+   bstat_edit(dir->msg, json);
+   dir->msglen = strlen(dir->msg);
+   dir->send();
+   dir->signal(BNET_EOD);
+   return true;
+}
+
+/*
+ * Device usage for the daemon statistics. The write rate
+ *  is the sum of the rates of the jobs writing on the device.
+ */
+void update_device_bstats()
+{
+   char name[MAX_NAME_LENGTH + 50];
+   DEVRES *device;
+   DEVICE *dev;
+   JCR *jcr;
+   int64_t rate;
+   int jobs;
+   time_t now = time(NULL);
+
+   foreach_res(device, R_DEVICE) {
+      dev = device->dev;
+      if (!dev) {
+         continue;
+      }
+      rate = 0;
+      jobs = 0;
+      foreach_jcr(jcr) {
+         if (jcr->JobId > 0 && jcr->dcr && jcr->dcr->dev == dev) {
+            jobs++;
+            if (now > jcr->run_time) {
+               rate += jcr->JobBytes / (now - jcr->run_time);
+            }
+         }
+      }
+      endeach_jcr(jcr);
+      bsnprintf(name, sizeof(name), "device.%s.jobs", device->hdr.name);
+      bstat_set(bstat_register(name, BSTAT_GAUGE), jobs);
+      bsnprintf(name, sizeof(name), "device.%s.write_rate", device->hdr.name);
+      bstat_set(bstat_register(name, BSTAT_GAUGE), rate);
+      bsnprintf(name, sizeof(name), "device.%s.write_bytes", device->hdr.name);
+      bstat_set(bstat_register(name, BSTAT_COUNTER), dev->DevWriteBytes);
+      bsnprintf(name, sizeof(name), "device.%s.read_bytes", device->hdr.name);
+      bstat_set(bstat_register(name, BSTAT_COUNTER), dev->DevReadBytes);
+   }
+}
+
 #if defined(HAVE_WIN32)
 int bacstat = 0;
 
@@ -280,6 +280,11 @@ int main (int argc, char *argv[])
    start_watchdog();                  /* start watchdog thread */
    init_jcr_subsystem();              /* start JCR watchdogs etc. */
 
+   bstat_add_update_handler(update_spool_bstats);
+   bstat_add_update_handler(update_device_bstats);
+   start_bstat_thread(me->stats_file, me->stats_interval);
+   start_msg_delivery_thread();       /* deliver messages in the background */
+
    /* Single server used for Director and File daemon */
    bnet_thread_server(me->sdaddrs, me->max_concurrent_jobs * 2 + 1,
                       &dird_workq, handle_connection_request);
@@ -571,6 +576,7 @@ void terminate_stored(int sig)
    in_here = true;
    debug_level = 0;                   /* turn off any debug */
    stop_watchdog();
+   stop_bstat_thread();
 
    if (sig == SIGTERM) {              /* normal shutdown request? */
       /*
@@ -88,6 +88,8 @@ static RES_ITEM store_items[] = {
    {"tlsdhfile",             store_dir,       ITEM(res_store.tls_dhfile), 0, 0, 0},
    {"tlsallowedcn",          store_alist_str, ITEM(res_store.tls_allowed_cns), 0, 0, 0},
    {"clientconnectwait",     store_time,  ITEM(res_store.client_wait), 0, ITEM_DEFAULT, 30 * 60},
+   {"statisticsfile",        store_dir,   ITEM(res_store.stats_file), 0, 0, 0},
+   {"statisticsinterval",    store_time,  ITEM(res_store.stats_interval), 0, ITEM_DEFAULT, 5 * 60},
    {"verid",                 store_str,       ITEM(res_store.verid), 0, 0, 0},
    {NULL, NULL, {0}, 0, 0, 0}
 };
@@ -481,6 +483,9 @@ void free_resource(RES *sres, int type)
       if (res->res_store.scripts_directory) {
          free(res->res_store.scripts_directory);
       }
+      if (res->res_store.stats_file) {
+         free(res->res_store.stats_file);
+      }
       if (res->res_store.tls_ctx) { 
          free_tls_context(res->res_store.tls_ctx);
       }
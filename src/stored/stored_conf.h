@@ -88,6 +88,8 @@ public:
    MSGS *messages;                    /* Daemon message handler */
    utime_t heartbeat_interval;        /* Interval to send hb to FD */
    utime_t client_wait;               /* Time to wait for FD to connect */
+   char *stats_file;                  /* Daemon statistics file */
+   utime_t stats_interval;            /* Interval to append to stats_file */
    bool tls_authenticate;             /* Authenticate with TLS */
    bool tls_enable;                   /* Enable TLS */
    bool tls_require;                  /* Require TLS */
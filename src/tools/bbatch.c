@@ -50,6 +50,16 @@
    j=$(($j+1))
    echo "$j;$a;xxxLSTATxxxx;xxxxxxxMD5xxxxxx"
   done > dat1
+
+  With -j, no datafile is needed, bbatch generates the load of
+  concurrent backup jobs itself:
+
+  bbatch -w /path/to/workdir -j 100 -F 20000 -l 3 -p 10 -V 10
+
+  runs 100 jobs at the same time, each one inserting 3 times the
+  20000 files of its client through the batch insert, while old
+  jobs are pruned and the bvfs cache is updated every 10 seconds.
+  The latency percentiles of each phase are printed at the end.
  */
 
 #include "bacula.h"
@@ -57,9 +67,11 @@
 #include "findlib/find.h"
 #include "cats/cats.h"
 #include "cats/sql_glue.h"
+#include "cats/bvfs.h"
  
 /* Forward referenced functions */
 static void *do_batch(void *);
+static int do_load();
 
 
 /* Local variables */
@@ -69,6 +81,16 @@ static const char *db_name = "bacula";
 static const char *db_user = "bacula";
 static const char *db_password = "";
 static const char *db_host = NULL;
+static const char *db_driver = NULL;
+
+/* Load generator parameters */
+static int load_jobs = 0;               /* concurrent jobs */
+static int load_files = 10000;          /* files per job */
+static int load_loops = 1;              /* backups per job */
+static int load_clients = 10;           /* simulated clients */
+static int prune_interval = 0;          /* secs between prunings */
+static int prune_keep = 0;              /* jobs kept by the pruning */
+static int bvfs_interval = 0;           /* secs between bvfs updates */
 
 static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 
@@ -89,10 +111,18 @@ PROG_COPYRIGHT
 "       -u <user>         specify database user name (default bacula)\n"
 "       -P <password      specify database password (default none)\n"
 "       -h <host>         specify database host (default NULL)\n"
+"       -D <driver>       specify the database driver\n"
 "       -w <working>      specify working directory\n"
 "       -r <jobids>       call restore code with given jobids\n"
 "       -v                verbose\n"
 "       -f <file>         specify data file\n"
+"       -j <nb>           generate the load of <nb> concurrent jobs\n"
+"       -F <nb>           files per job (default 10000)\n"
+"       -l <nb>           backups done by each job (default 1)\n"
+"       -C <nb>           number of simulated clients (default 10)\n"
+"       -p <secs>         prune the old jobs every <secs>\n"
+"       -k <nb>           jobs kept by the pruning (default -j)\n"
+"       -V <secs>         update the bvfs cache every <secs>\n"
 "       -?                print this message\n\n"), 2001, VERSION, BDATE);
    exit(1);
 }
@@ -125,8 +155,40 @@ int main (int argc, char *argv[])
 
    OSDependentInit();
 
-   while ((ch = getopt(argc, argv, "bBh:c:d:n:P:Su:vf:w:r:?")) != -1) {
+   while ((ch = getopt(argc, argv, "bBh:c:d:D:n:P:Su:vf:w:r:j:F:l:C:p:k:V:?")) != -1) {
       switch (ch) {
+      case 'D':
+         db_driver = optarg;
+         break;
+
+      case 'j':
+         load_jobs = atoi(optarg);
+         break;
+
+      case 'F':
+         load_files = MAX(atoi(optarg), 1);
+         break;
+
+      case 'l':
+         load_loops = MAX(atoi(optarg), 1);
+         break;
+
+      case 'C':
+         load_clients = MAX(atoi(optarg), 1);
+         break;
+
+      case 'p':
+         prune_interval = atoi(optarg);
+         break;
+
+      case 'k':
+         prune_keep = atoi(optarg);
+         break;
+
+      case 'V':
+         bvfs_interval = atoi(optarg);
+         break;
+
       case 'r':
          restore_list=bstrdup(optarg);
          break;
@@ -191,6 +253,10 @@ int main (int argc, char *argv[])
       usage();
    }
 
+   if (load_jobs > 0) {
+      return do_load();
+   }
+
    if (restore_list) {
       uint64_t nb_file=0;
       btime_t start, end;
@@ -340,3 +406,416 @@ static void *do_batch(void *jcr)
    pthread_exit(NULL);
    return NULL;
 }
+
+/*
+ * Catalog load generator
+ *
+ *  Each simulated job creates its Job record, inserts the files of
+ *  its client with db_create_attributes_record(), moves them to the
+ *  File table with db_write_batch_file_records() and terminates the
+ *  Job record. The files of a client are the same from one backup
+ *  to the other, so the Path and Filename records are mostly found.
+ *  Pruning and bvfs cache updates run at the same time in their own
+ *  threads, each one with its own connection.
+ */
+enum {
+   PH_JOB,                      /* Job record create and update */
+   PH_ATTR,                     /* one db_create_attributes_record() */
+   PH_BATCH,                    /* db_write_batch_file_records() */
+   PH_PRUNE,                    /* one pruning of the old jobs */
+   PH_BVFS,                     /* bvfs_update_cache() */
+   PH_MAX
+};
+
+typedef struct {
+   const char *name;
+   btime_t *samples;            /* latencies in usecs */
+   int nb;
+   int size;
+} load_phase;
+
+static load_phase phases[PH_MAX] = {
+   { "job record" }, { "attributes" }, { "batch" }, { "prune" }, { "bvfs" }
+};
+
+static int load_running = 0;    /* jobs still running */
+
+static const char *top_dirs[] = {
+   "/home/user%d", "/usr/share", "/var/lib", "/etc", "/srv/www/site%d", "/opt"
+};
+
+static const char *dir_names[] = {
+   "src", "doc", "lib", "include", "data", "backup", "tmp", "cache",
+   "images", "config", "test", "build", "log", "mail", "projects", "misc"
+};
+
+static const char *common_names[] = {
+   "Makefile", "README", "index.html", "config.h", "__init__.py",
+   "CMakeLists.txt", "main.c", "style.css", "LICENSE", ".gitignore",
+   "setup.py", "index.php", "package.json", "Makefile.in", "favicon.ico",
+   "ChangeLog"
+};
+
+static const char *extensions[] = {
+   "c", "h", "txt", "jpg", "png", "pdf", "html", "o", "py", "gz",
+   "doc", "xml", "log", "so", "conf", "mp3"
+};
+
+#define NB(x) ((int)(sizeof(x)/sizeof(x[0])))
+
+static inline uint64_t load_rand(uint64_t *state)
+{
+   *state ^= *state >> 12;
+   *state ^= *state << 25;
+   *state ^= *state >> 27;
+   return *state * 2685821657736338717ULL;
+}
+
+static void add_samples(int phase, btime_t *t, int nb)
+{
+   load_phase *ph = &phases[phase];
+   P(mutex);
+   if (ph->nb + nb > ph->size) {
+      ph->size = MAX(ph->size * 2, ph->nb + nb);
+      ph->samples = (btime_t *)realloc(ph->samples, ph->size * sizeof(btime_t));
+   }
+   memcpy(ph->samples + ph->nb, t, nb * sizeof(btime_t));
+   ph->nb += nb;
+   V(mutex);
+}
+
+static void add_sample(int phase, btime_t start)
+{
+   btime_t t = get_current_btime() - start;
+   add_samples(phase, &t, 1);
+}
+
+/*
+ * Make the name of file number k of a client. Most of the files
+ *  are in the first (less deep) directories, and about one name
+ *  out of four is a name found in any directory.
+ */
+static void make_file_name(POOL_MEM &fname, int client, int k)
+{
+   uint64_t state = ((uint64_t)(client + 1) << 32) ^ (k * 2654435761ULL) ^ 0x9E3779B9;
+   uint64_t r;
+   uint32_t ndirs = MAX(load_files / 20, 1);
+   uint32_t dir, u;
+   char comp[64];
+
+   load_rand(&state);
+   r = load_rand(&state);
+   u = (uint32_t)(r & 0xFFFF);
+   dir = (uint32_t)(((uint64_t)ndirs * u * u) >> 32);
+
+   Mmsg(fname, top_dirs[dir % NB(top_dirs)], client);
+   for (uint32_t d = dir / NB(top_dirs); ; d /= NB(dir_names)) {
+      bsnprintf(comp, sizeof(comp), "/%s", dir_names[d % NB(dir_names)]);
+      pm_strcat(fname, comp);
+      if (d < (uint32_t)NB(dir_names)) {
+         break;
+      }
+   }
+   r = load_rand(&state);
+   if (r % 4 == 0) {
+      bsnprintf(comp, sizeof(comp), "/%s", common_names[(r >> 8) % NB(common_names)]);
+   } else {
+      bsnprintf(comp, sizeof(comp), "/%s%d.%s", dir_names[(r >> 8) % NB(dir_names)],
+                k, extensions[(r >> 16) % NB(extensions)]);
+   }
+   pm_strcat(fname, comp);
+}
+
+/* Something that looks like an encoded stat packet and a MD5 */
+static void make_lstat(char *lstat, char *digest, int k)
+{
+   char ed1[30], ed2[30], ed3[30], ed4[30];
+   uint64_t state = (uint64_t)k * 40503 + 1;
+   load_rand(&state);
+   to_base64(load_rand(&state) % 10000000, ed1);
+   to_base64(1300000000 + load_rand(&state) % 30000000, ed2);
+   bsnprintf(lstat, 100, "gB %s IGk B Po Po A %s BAA Y %s %s %s A A L",
+             ed1, ed1, ed2, ed2, ed2);
+   to_base64(load_rand(&state) & 0x7FFFFFFFFFFFLL, ed3);
+   to_base64(load_rand(&state) & 0x7FFFFFFFFFFFLL, ed4);
+   bsnprintf(digest, 50, "%s%s", ed3, ed4);
+}
+
+static B_DB *open_load_db(JCR *jcr)
+{
+   B_DB *mdb = db_init_database(jcr, db_driver, db_name, db_user, db_password,
+                                db_host, 0, NULL, true, false);
+   if (!mdb) {
+      Emsg0(M_ERROR_TERM, 0, _("Could not init Bacula database\n"));
+   }
+   if (!db_open_database(jcr, mdb)) {
+      Emsg0(M_ERROR_TERM, 0, db_strerror(mdb));
+   }
+   return mdb;
+}
+
+static JCR *new_load_jcr()
+{
+   JCR *jcr = new_jcr(sizeof(JCR), NULL);
+   jcr->setJobType(JT_BACKUP);
+   jcr->setJobLevel(L_FULL);
+   jcr->JobStatus = JS_Running;
+   jcr->db = open_load_db(jcr);
+   return jcr;
+}
+
+static void free_load_jcr(JCR *jcr)
+{
+   if (jcr->db_batch) {
+      db_close_database(jcr, jcr->db_batch);
+      jcr->db_batch = NULL;
+   }
+   db_close_database(jcr, jcr->db);
+   jcr->db = NULL;
+   free_jcr(jcr);
+}
+
+static void *do_load_job(void *arg)
+{
+   int slot = (int)(intptr_t)arg;
+   int client = slot % load_clients;
+   JCR *jcr = new_load_jcr();
+   POOL_MEM fname(PM_FNAME);
+   char lstat[100], digest[50];
+   btime_t *lat = (btime_t *)malloc(load_files * sizeof(btime_t));
+   btime_t start;
+   JOB_DBR jr;
+   ATTR_DBR ar;
+
+   for (int loop=0; loop < load_loops; loop++) {
+      memset(&jr, 0, sizeof(jr));
+      bstrncpy(jr.Name, "bbatch-load", sizeof(jr.Name));
+      bsnprintf(jr.Job, sizeof(jr.Job), "bbatch-load.%d.%d.%d",
+                (int)getpid(), slot, loop);
+      jr.JobType = JT_BACKUP;
+      jr.JobLevel = L_FULL;
+      jr.JobStatus = JS_Running;
+      jr.SchedTime = time(NULL);
+      jr.ClientId = client + 1;
+
+      start = get_current_btime();
+      if (!db_create_job_record(jcr, jcr->db, &jr)) {
+         Emsg1(M_ERROR_TERM, 0, "%s", db_strerror(jcr->db));
+      }
+      add_sample(PH_JOB, start);
+      jcr->JobId = jr.JobId;
+
+      for (int k=0; k < load_files; k++) {
+         make_file_name(fname, client, k);
+         make_lstat(lstat, digest, client * load_files + k);
+         memset(&ar, 0, sizeof(ar));
+         ar.Stream = STREAM_UNIX_ATTRIBUTES;
+         ar.FileType = FT_REG;
+         ar.FileIndex = k + 1;
+         ar.JobId = jr.JobId;
+         ar.fname = fname.c_str();
+         ar.attr = lstat;
+         ar.Digest = digest;
+         start = get_current_btime();
+         if (!db_create_attributes_record(jcr, jcr->db, &ar)) {
+            Emsg0(M_ERROR_TERM, 0, _("Error while inserting file\n"));
+         }
+         lat[k] = get_current_btime() - start;
+      }
+      add_samples(PH_ATTR, lat, load_files);
+
+      start = get_current_btime();
+      if (!db_write_batch_file_records(jcr)) {
+         Emsg0(M_ERROR_TERM, 0, _("Error while inserting the batch\n"));
+      }
+      add_sample(PH_BATCH, start);
+
+      jr.JobStatus = JS_Terminated;
+      jr.EndTime = time(NULL);
+      jr.JobFiles = load_files;
+      jr.ClientId = client + 1;
+      start = get_current_btime();
+      if (!db_update_job_end_record(jcr, jcr->db, &jr)) {
+         Emsg1(M_ERROR_TERM, 0, "%s", db_strerror(jcr->db));
+      }
+      add_sample(PH_JOB, start);
+      if (verbose) {
+         Pmsg3(0, _("Job %d backup %d done JobId=%d\n"), slot, loop, (int)jr.JobId);
+      }
+   }
+   free(lat);
+   free_load_jcr(jcr);
+
+   P(mutex);
+   load_running--;
+   V(mutex);
+   return NULL;
+}
+
+/* Sleep secs, returns false when all the jobs are done */
+static bool load_sleep(int secs)
+{
+   for (int i=0; i < secs * 10; i++) {
+      if (load_running == 0) {
+         return false;
+      }
+      bmicrosleep(0, 100000);
+   }
+   return load_running > 0;
+}
+
+static int prune_max = 0;        /* jobs to prune */
+
+/* Keep only the first prune_max JobIds of the result */
+static int prune_list_handler(void *ctx, int num_fields, char **row)
+{
+   db_list_ctx *list = (db_list_ctx *)ctx;
+   if (list->count >= prune_max) {
+      return 0;
+   }
+   return db_list_handler(ctx, num_fields, row);
+}
+
+/*
+ * Prune the files of the oldest terminated jobs, the same way as
+ *  the Director does, so only the last prune_keep jobs have files.
+ */
+static void prune_load_jobs(JCR *jcr, B_DB *mdb)
+{
+   POOL_MEM query(PM_MESSAGE);
+   db_int64_ctx nb;
+   db_list_ctx list;
+   const char *where = "FROM Job WHERE Name='bbatch-load' AND JobStatus='T' "
+                       "AND PurgedFiles=0";
+   bool partitioned = db_get_file_partition_size(mdb) > 0;
+
+   Mmsg(query, "SELECT COUNT(*) %s", where);
+   if (!db_sql_query(mdb, query.c_str(), db_int64_handler, &nb) ||
+       nb.value <= prune_keep) {
+      return;
+   }
+   Mmsg(query, "SELECT JobId %s ORDER BY JobId", where);
+   prune_max = nb.value - prune_keep;
+   db_sql_query(mdb, query.c_str(), prune_list_handler, &list);
+   if (list.count == 0) {
+      return;
+   }
+   Mmsg(query, "DELETE FROM %sFile WHERE JobId IN (%s)",
+        partitioned ? "ONLY " : "", list.list);
+   db_sql_query(mdb, query.c_str(), NULL, NULL);
+   Mmsg(query, "UPDATE Job SET PurgedFiles=1 WHERE JobId IN (%s)", list.list);
+   db_sql_query(mdb, query.c_str(), NULL, NULL);
+   if (partitioned) {
+      db_purge_file_partitions(jcr, mdb, list.list);
+      db_prune_file_partitions(jcr, mdb);
+   }
+   if (verbose) {
+      Pmsg1(0, _("Pruned %d jobs\n"), list.count);
+   }
+}
+
+static void *do_load_prune(void *arg)
+{
+   JCR *jcr = new_load_jcr();
+   btime_t start;
+
+   while (load_sleep(prune_interval)) {
+      start = get_current_btime();
+      prune_load_jobs(jcr, jcr->db);
+      add_sample(PH_PRUNE, start);
+   }
+   free_load_jcr(jcr);
+   return NULL;
+}
+
+static void *do_load_bvfs(void *arg)
+{
+   JCR *jcr = new_load_jcr();
+   btime_t start;
+
+   while (load_sleep(bvfs_interval)) {
+      start = get_current_btime();
+      bvfs_update_cache(jcr, jcr->db);
+      add_sample(PH_BVFS, start);
+   }
+   free_load_jcr(jcr);
+   return NULL;
+}
+
+static int btime_cmp(const void *a, const void *b)
+{
+   btime_t t1 = *(const btime_t *)a;
+   btime_t t2 = *(const btime_t *)b;
+   return (t1 > t2) - (t1 < t2);
+}
+
+/* Latency at percentile pct of a sorted phase, in msecs */
+static double percentile(load_phase *ph, int pct)
+{
+   int i = (int)(((int64_t)ph->nb * pct + 99) / 100) - 1;
+   return ph->samples[MAX(i, 0)] / 1000.0;
+}
+
+static int do_load()
+{
+   pthread_t *jobs, prune_id, bvfs_id;
+   btime_t start, elapsed;
+   uint64_t nb_files;
+   load_phase *ph;
+   JCR *jcr;
+
+   if (prune_keep <= 0) {
+      prune_keep = load_jobs;
+   }
+   jcr = new_load_jcr();
+   printf(_("Database driver %s, %d jobs of %d files, %d backups each\n"),
+          db_get_type(jcr->db), load_jobs, load_files, load_loops);
+   free_load_jcr(jcr);
+
+   jobs = (pthread_t *)malloc(load_jobs * sizeof(pthread_t));
+   load_running = load_jobs;
+   start = get_current_btime();
+   for (int i=0; i < load_jobs; i++) {
+      pthread_create(&jobs[i], NULL, do_load_job, (void *)(intptr_t)i);
+   }
+   if (prune_interval > 0) {
+      pthread_create(&prune_id, NULL, do_load_prune, NULL);
+   }
+   if (bvfs_interval > 0) {
+      pthread_create(&bvfs_id, NULL, do_load_bvfs, NULL);
+   }
+   for (int i=0; i < load_jobs; i++) {
+      pthread_join(jobs[i], NULL);
+   }
+   elapsed = get_current_btime() - start;
+   if (prune_interval > 0) {
+      pthread_join(prune_id, NULL);
+   }
+   if (bvfs_interval > 0) {
+      pthread_join(bvfs_id, NULL);
+   }
+   free(jobs);
+
+   nb_files = (uint64_t)load_jobs * load_files * load_loops;
+   printf(_("Inserted %llu files in %.2f secs, %.0f files/s\n"),
+          (unsigned long long)nb_files, elapsed / 1000000.0,
+          nb_files * 1000000.0 / MAX(elapsed, 1));
+   printf("%-12s %10s %10s %10s %10s %10s %10s\n", _("Phase"), _("Count"),
+          _("Total(s)"), _("p50(ms)"), _("p90(ms)"), _("p99(ms)"), _("Max(ms)"));
+   for (int i=0; i < PH_MAX; i++) {
+      ph = &phases[i];
+      if (ph->nb == 0) {
+         continue;
+      }
+      btime_t total = 0;
+      for (int j=0; j < ph->nb; j++) {
+         total += ph->samples[j];
+      }
+      qsort(ph->samples, ph->nb, sizeof(btime_t), btime_cmp);
+      printf("%-12s %10d %10.2f %10.3f %10.3f %10.3f %10.3f\n", ph->name, ph->nb,
+             total / 1000000.0, percentile(ph, 50), percentile(ph, 90),
+             percentile(ph, 99), ph->samples[ph->nb - 1] / 1000.0);
+      free(ph->samples);
+   }
+   return 0;
+}
@@ -0,0 +1,396 @@
+#!/bin/sh
+#
+# Bacula throughput benchmark
+#
+#  Starts a Director, a File daemon and a Storage daemon from this
+#  build tree on 127.0.0.1 with a SQLite catalog, creates synthetic
+#  trees with bgentree, then runs Full, Incremental, Accurate,
+#  Restore and Copy jobs on each of them. For each job, one line is
+#  appended to the results file with the number of files and bytes,
+#  the elapsed time, files/s, MB/s, and the CPU time and the peak
+#  RSS of each daemon (taken in /proc, so Linux only).
+#
+#  The elapsed time is taken from the StartTime and EndTime of the
+#  Job record, so it is in seconds: use data sets big enough for
+#  jobs of some tens of seconds when comparing builds.
+#
+#  The build must be configured with --with-sqlite3, and the tools
+#  made (cd src/tools; make).
+#
+#  Usage:
+#    bbench.sh [options]            run the benchmark
+#    bbench.sh -c <old> <new>       compare two results files
+#
+
+usage()
+{
+   cat <<EOF
+Usage: bbench.sh [options]
+       bbench.sh -c <old-results> <new-results>
+   -w <dir>      working directory (default /tmp/bbench)
+   -r <file>     results file (default bbench.results)
+   -n <name>     name of the build in the results (default version-date)
+   -s <sets>     data sets among "small big sparse text" (default all)
+   -j <jobs>     jobs among "full incr accurate restore copy" (default all)
+   -d <type>     storage device, file or vtape (default file)
+   -f <nb>       number of files of the small set (default 20000)
+   -b <size>     size of the files of the big set (default 256m)
+   -z            use GZIP compression in the FileSets
+   -p <port>     first of the three ports to use (default 19101)
+   -k            keep the daemons running at the end
+EOF
+   exit 1
+}
+
+srcdir=`cd \`dirname $0\`/..; pwd`
+work=/tmp/bbench
+results=`pwd`/bbench.results
+version=`sed -n 's/^#define VERSION "\(.*\)"/\1/p' $srcdir/version.h`
+name="$version-`date +%Y%m%d%H%M`"
+sets="small big sparse text"
+jobs="full incr accurate restore copy"
+devtype=file
+nsmall=20000
+bigsize=256m
+compress=""
+port=19101
+keep=no
+
+#
+# Compare two results files, the last line of each set/job is used
+#
+compare()
+{
+   awk '
+   FNR == 1 { nfile++ }
+   /^#/ { next }
+   {
+      key = $2 " " $3
+      if (nfile == 1) { old_fs[key] = $7; old_mb[key] = $8; old_name = $1 }
+      else { new_fs[key] = $7; new_mb[key] = $8; new_name = $1; order[++n] = key; seen[key]++ }
+   }
+   function pct(o, v) { return o > 0 ? sprintf("%+.1f%%", (v - o) * 100 / o) : "-" }
+   END {
+      printf("old=%s new=%s\n", old_name, new_name)
+      printf("%-8s %-9s %10s %10s %8s %10s %10s %8s\n", "set", "job",
+             "old f/s", "new f/s", "", "old MB/s", "new MB/s", "")
+      for (i = 1; i <= n; i++) {
+         key = order[i]
+         if (--seen[key] > 0 || !(key in old_fs)) continue
+         split(key, k, " ")
+         printf("%-8s %-9s %10s %10s %8s %10s %10s %8s\n", k[1], k[2],
+                old_fs[key], new_fs[key], pct(old_fs[key], new_fs[key]),
+                old_mb[key], new_mb[key], pct(old_mb[key], new_mb[key]))
+      }
+   }' "$1" "$2"
+}
+
+while getopts "w:r:n:s:j:d:f:b:zp:kc" opt; do
+   case $opt in
+   w) work=$OPTARG ;;
+   r) results=$OPTARG ;;
+   n) name=$OPTARG ;;
+   s) sets=$OPTARG ;;
+   j) jobs=$OPTARG ;;
+   d) devtype=$OPTARG ;;
+   f) nsmall=$OPTARG ;;
+   b) bigsize=$OPTARG ;;
+   z) compress="; compression=GZIP" ;;
+   p) port=$OPTARG ;;
+   k) keep=yes ;;
+   c) shift `expr $OPTIND - 1`
+      [ $# -eq 2 ] || usage
+      compare $1 $2
+      exit 0 ;;
+   *) usage ;;
+   esac
+done
+
+case $devtype in
+file|vtape) ;;
+*) usage ;;
+esac
+
+for f in dird/bacula-dir filed/bacula-fd stored/bacula-sd console/bconsole \
+         tools/bgentree cats/make_sqlite3_tables; do
+   if [ ! -x $srcdir/$f ] && [ ! -f $srcdir/$f ]; then
+      echo "$srcdir/$f not found, build Bacula and the tools first."
+      exit 1
+   fi
+done
+
+dirport=$port
+fdport=`expr $port + 1`
+sdport=`expr $port + 2`
+conf=$work/conf
+clk_tck=`getconf CLK_TCK 2>/dev/null || echo 100`
+
+#
+# Helpers
+#
+# CPU time in msecs (user+system) of a process
+cpu_ms()
+{
+   awk -v hz=$clk_tck '{ printf("%d\n", ($14 + $15) * 1000 / hz) }' /proc/$1/stat 2>/dev/null || echo 0
+}
+
+# Peak resident size in KB of a process
+rss_kb()
+{
+   awk '/^VmHWM:/ { print $2 }' /proc/$1/status 2>/dev/null || echo 0
+}
+
+bconsole()
+{
+   $srcdir/console/bconsole -c $conf/bconsole.conf
+}
+
+# Print the files, bytes, status and elapsed seconds of a job from
+#  the catalog, $1=jobid
+job_info()
+{
+   echo ".sql query=\"SELECT JobFiles, JobBytes, JobStatus, strftime('%s', EndTime) - strftime('%s', StartTime) FROM Job WHERE JobId=$1\"" \
+      | bconsole | awk -F'\t' 'NF >= 4 && $1 ~ /^[0-9]+$/ { print $1, $2, $3, $4 }' | tail -1
+}
+
+stop_daemons()
+{
+   for p in $dir_pid $fd_pid $sd_pid; do
+      kill $p 2>/dev/null
+   done
+   wait 2>/dev/null
+}
+
+#
+# Run a job with the bconsole command $3, wait for the end, and append
+#  the result to the results file. $1=set $2=job
+#  The files and bytes are taken from the job $4 if given (copy).
+#
+run_job()
+{
+   set_name=$1; job_name=$2; cmd=$3; ref_jobid=$4
+   c1=`cpu_ms $dir_pid`; c2=`cpu_ms $fd_pid`; c3=`cpu_ms $sd_pid`
+   printf "$cmd\nwait\nmessages\n" | bconsole > $work/bconsole.out 2>&1
+   d1=`cpu_ms $dir_pid`; d2=`cpu_ms $fd_pid`; d3=`cpu_ms $sd_pid`
+   jobid=`sed -n 's/.*Job queued. JobId=\([0-9]*\).*/\1/p' $work/bconsole.out | head -1`
+   if [ x$jobid = x ]; then
+      echo "Job $set_name/$job_name was not started, see $work/bconsole.out"
+      cat $work/bconsole.out >> $work/log
+      return 1
+   fi
+   cat $work/bconsole.out >> $work/log
+   job_info $jobid > $work/job.out
+   read files bytes status secs < $work/job.out
+   if [ x$status != xT ]; then
+      echo "Job $set_name/$job_name JobId=$jobid terminated with status $status"
+   fi
+   if [ x$ref_jobid != x ]; then
+      job_info $ref_jobid > $work/job.out
+      read files bytes status ref_secs < $work/job.out
+   fi
+   # A job shorter than the one second resolution counts for one second
+   msecs=`expr ${secs:-0} \* 1000`
+   [ $msecs -gt 0 ] || msecs=1000
+   awk -v name="$name" -v set=$set_name -v job=$job_name -v files=${files:-0} \
+       -v bytes=${bytes:-0} -v ms=$msecs \
+       -v c1=`expr $d1 - $c1` -v c2=`expr $d2 - $c2` -v c3=`expr $d3 - $c3` \
+       -v r1=`rss_kb $dir_pid` -v r2=`rss_kb $fd_pid` -v r3=`rss_kb $sd_pid` \
+     'BEGIN { printf("%s %s %s %d %.0f %d %.1f %.2f %d %d %d %d %d %d\n",
+              name, set, job, files, bytes, ms, files * 1000 / ms,
+              bytes * 1000 / ms / 1048576, c1, c2, c3, r1, r2, r3) }' \
+       | tee -a $results
+   last_jobid=$jobid
+   return 0
+}
+
+#
+# Generate the data of a set, $1=set, $2 = extra bgentree options
+#
+gen_set()
+{
+   case $1 in
+   small)  opts="-n $nsmall -m 1k -M 16k -t random" ;;
+   big)    opts="-n 4 -m $bigsize -M $bigsize -t random" ;;
+   sparse) opts="-n 4 -m 1g -M 1g -t sparse" ;;
+   text)   opts="-n 2000 -m 16k -M 256k -t text" ;;
+   *)      echo "Unknown data set $1"; exit 1 ;;
+   esac
+   $srcdir/tools/bgentree $opts $2 $work/data/$1 > /dev/null || exit 1
+   sleep 1                      # the catalog times are in seconds
+}
+
+#
+# Setup the working directory, the catalog and the configuration
+#
+if [ -d $work ]; then
+   rm -rf $work/working $work/storage $work/restore $work/data $work/conf
+fi
+mkdir -p $work/working $work/storage $work/restore $work/data $conf
+: > $work/log
+
+sed -e "s#^cd .*#cd $work/working#" $srcdir/cats/make_sqlite3_tables > $work/working/make_tables
+sh $work/working/make_tables > /dev/null 2>&1
+if [ ! -f $work/working/bacula.db ]; then
+   echo "Could not create the SQLite catalog in $work/working"
+   exit 1
+fi
+
+if [ $devtype = vtape ]; then
+   : > $work/storage/tape0
+   : > $work/storage/tape1
+   dev1="Device Type = vtape; Archive Device = $work/storage/tape0; Media Type = VTape"
+   dev2="Device Type = vtape; Archive Device = $work/storage/tape1; Media Type = VTape"
+   media="VTape"
+else
+   dev1="Archive Device = $work/storage; Media Type = File"
+   dev2="Archive Device = $work/storage; Media Type = File"
+   media="File"
+fi
+
+# The restore and copy jobs need a FileSet, use the one of the first set
+for first in $sets; do break; done
+
+cat > $conf/bacula-dir.conf <<EOF
+Director {
+  Name = bench-dir; DIRport = $dirport; DirAddress = 127.0.0.1
+  QueryFile = "$srcdir/dird/query.sql"
+  WorkingDirectory = $work/working; PidDirectory = $work/working
+  Maximum Concurrent Jobs = 10; Password = "bench"; Messages = Bench
+}
+Client {
+  Name = bench-fd; Address = 127.0.0.1; FDPort = $fdport; Catalog = Bench
+  Password = "bench"; File Retention = 1 year; Job Retention = 1 year
+}
+Storage {
+  Name = Bench1; Address = 127.0.0.1; SDPort = $sdport; Password = "bench"
+  Device = Bench1; Media Type = $media
+}
+Storage {
+  Name = Bench2; Address = 127.0.0.1; SDPort = $sdport; Password = "bench"
+  Device = Bench2; Media Type = $media
+}
+Catalog { Name = Bench; dbname = "bacula"; dbuser = ""; dbpassword = "" }
+Messages {
+  Name = Bench
+  append = "$work/log" = all, !skipped, !saved
+  catalog = all, !skipped, !saved
+}
+Pool { Name = Default; Pool Type = Backup; Storage = Bench1; Next Pool = Copy; Maximum Volume Bytes = 100g; }
+Pool { Name = Copy; Pool Type = Backup; Storage = Bench2; Maximum Volume Bytes = 100g; }
+JobDefs {
+  Name = BenchDefs; Type = Backup; Level = Full; Client = bench-fd
+  Storage = Bench1; Pool = Default; Messages = Bench; Spool Attributes = yes
+  Write Bootstrap = "$work/working/%n.bsr"
+}
+Job { Name = RestoreFiles; Type = Restore; Client = bench-fd; FileSet = FS-$first
+  Storage = Bench1; Pool = Default; Messages = Bench; Where = $work/restore }
+Job { Name = CopyJob; Type = Copy; JobDefs = BenchDefs; FileSet = FS-$first
+  Selection Type = PoolUncopiedJobs }
+EOF
+for s in $sets; do
+   opts=""
+   [ $s = sparse ] && opts="; sparse=yes"
+   cat >> $conf/bacula-dir.conf <<EOF
+FileSet { Name = FS-$s; Include { Options { signature = MD5 $opts $compress } File = $work/data/$s } }
+Job { Name = Bench-$s; JobDefs = BenchDefs; FileSet = FS-$s }
+EOF
+done
+
+cat > $conf/bacula-fd.conf <<EOF
+FileDaemon {
+  Name = bench-fd; FDport = $fdport; FDAddress = 127.0.0.1
+  WorkingDirectory = $work/working; Pid Directory = $work/working
+  Maximum Concurrent Jobs = 10
+}
+Director { Name = bench-dir; Password = "bench" }
+Messages { Name = Bench; director = bench-dir = all, !skipped, !restored }
+EOF
+
+cat > $conf/bacula-sd.conf <<EOF
+Storage {
+  Name = bench-sd; SDPort = $sdport; SDAddress = 127.0.0.1
+  WorkingDirectory = $work/working; Pid Directory = $work/working
+  Maximum Concurrent Jobs = 10
+}
+Director { Name = bench-dir; Password = "bench" }
+Device { Name = Bench1; $dev1; LabelMedia = yes; Random Access = yes
+  AutomaticMount = yes; RemovableMedia = no; AlwaysOpen = no }
+Device { Name = Bench2; $dev2; LabelMedia = yes; Random Access = yes
+  AutomaticMount = yes; RemovableMedia = no; AlwaysOpen = no }
+Messages { Name = Bench; director = bench-dir = all }
+EOF
+
+cat > $conf/bconsole.conf <<EOF
+Director { Name = bench-dir; DIRport = $dirport; Address = 127.0.0.1; Password = "bench" }
+EOF
+
+$srcdir/stored/bacula-sd -f -c $conf/bacula-sd.conf > $work/working/sd.out 2>&1 &
+sd_pid=$!
+$srcdir/filed/bacula-fd -f -c $conf/bacula-fd.conf > $work/working/fd.out 2>&1 &
+fd_pid=$!
+$srcdir/dird/bacula-dir -f -c $conf/bacula-dir.conf > $work/working/dir.out 2>&1 &
+dir_pid=$!
+trap 'stop_daemons; exit 1' INT TERM
+sleep 2
+for d in dir:$dir_pid fd:$fd_pid sd:$sd_pid; do
+   if ! kill -0 ${d#*:} 2>/dev/null; then
+      echo "The ${d%:*} daemon did not start:"
+      cat $work/working/${d%:*}.out
+      stop_daemons
+      exit 1
+   fi
+done
+
+printf "label storage=Bench1 volume=Bench-0001 pool=Default\nlabel storage=Bench2 volume=Copy-0001 pool=Copy\n" \
+   | bconsole >> $work/log 2>&1
+
+if [ ! -f $results ]; then
+   echo "# build set job files bytes msecs files/s MB/s dir_cpu_ms fd_cpu_ms sd_cpu_ms dir_rss_kb fd_rss_kb sd_rss_kb" > $results
+fi
+echo "# `uname -n` `uname -sr` device=$devtype$compress" >> $results
+
+for s in $sets; do
+   gen_set $s
+   full_jobid=""
+   for j in $jobs; do
+      case $j in
+      full)
+         run_job $s full "run job=Bench-$s level=Full yes" && full_jobid=$last_jobid
+         ;;
+      incr)
+         gen_set $s "-u 10"
+         run_job $s incr "run job=Bench-$s level=Incremental yes"
+         ;;
+      accurate)
+         gen_set $s "-u 10"
+         run_job $s accurate "run job=Bench-$s level=Incremental accurate=yes yes"
+         ;;
+      restore)
+         if [ x$full_jobid = x ]; then
+            echo "No Full backup of $s to restore, skipping restore"
+            continue
+         fi
+         rm -rf $work/restore
+         run_job $s restore "restore jobid=$full_jobid where=$work/restore all done yes"
+         ;;
+      copy)
+         if [ x$full_jobid = x ]; then
+            echo "No Full backup of $s to copy, skipping copy"
+            continue
+         fi
+         run_job $s copy "run job=CopyJob jobid=$full_jobid yes" $full_jobid
+         ;;
+      *)
+         echo "Unknown job $j"
+         ;;
+      esac
+   done
+   rm -rf $work/data/$s $work/restore
+done
+
+if [ $keep = yes ]; then
+   echo "Daemons left running, use: $srcdir/console/bconsole -c $conf/bconsole.conf"
+else
+   stop_daemons
+fi
+exit 0
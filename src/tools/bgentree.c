@@ -0,0 +1,294 @@
+/*
+ * Create a synthetic tree of files for the benchmarks
+ *
+ *  The content only depends on the seed, the file number and the
+ *  generation, so two runs with the same arguments create the same
+ *  tree, and a run with -u changes the same files.
+ *
+ */
+/*
+   Bacula® - The Network Backup Solution
+
+   Copyright (C) 2012-2012 Free Software Foundation Europe e.V.
+
+   The main author of Bacula is Kern Sibbald, with contributions from
+   many others, a complete list can be found in the file AUTHORS.
+   This program is Free Software; you can redistribute it and/or
+   modify it under the terms of version three of the GNU Affero General Public
+   License as published by the Free Software Foundation and included
+   in the file LICENSE.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU Affero General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+   02110-1301, USA.
+
+   Bacula® is a registered trademark of Kern Sibbald.
+   The licensor of Bacula is the Free Software Foundation Europe
+   (FSFE), Fiduciary Program, Sumatrastrasse 25, 8006 Zürich,
+   Switzerland, email:ftf@fsfeurope.org.
+*/
+
+#ifdef __GNUC__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#ifndef _FILE_OFFSET_BITS
+#define _FILE_OFFSET_BITS 64
+#endif
+#endif
+
+#include "bacula.h"
+
+enum {
+   GEN_RANDOM,                  /* incompressible data */
+   GEN_TEXT,                    /* compressible data */
+   GEN_SPARSE                   /* data blocks separated by holes */
+};
+
+#define GEN_BUFSIZE   (64 * 1024)
+#define SPARSE_BLOCKS 16        /* data blocks in a sparse file */
+
+static const char *words[] = {
+   "backup", "restore", "volume", "catalog", "director", "storage",
+   "client", "fileset", "schedule", "pool", "media", "label", "mount",
+   "the", "a", "of", "to", "and", "is", "with", "for", "on", "job",
+   "incremental", "differential", "full", "tape", "disk", "file", NULL
+};
+
+static int type = GEN_RANDOM;
+static uint64_t seed = 1;
+static int generation = 0;
+static char *buf;
+
+static void usage()
+{
+   fprintf(stderr, _(
+"\n"
+"Usage: bgentree [options] <directory>\n"
+"       -n <nb>     number of files (default 1000)\n"
+"       -m <size>   minimum file size (default 1k)\n"
+"       -M <size>   maximum file size (default 16k)\n"
+"       -t <type>   random, text or sparse (default random)\n"
+"       -w <nb>     files per directory (default 100)\n"
+"       -s <seed>   seed of the content (default 1)\n"
+"       -u <pct>    update pct%% of the files of an existing tree\n"
+"       -?          print this message.\n"
+"\n"
+"       Sizes accept the k, m and g suffixes.\n"
+"\n"));
+   exit(1);
+}
+
+/* xorshift64*, fast enough to not be the bottleneck */
+static inline uint64_t next_rand(uint64_t *state)
+{
+   *state ^= *state >> 12;
+   *state ^= *state << 25;
+   *state ^= *state >> 27;
+   return *state * 2685821657736338717ULL;
+}
+
+/* Fill buf with len bytes of the requested type */
+static void fill_buffer(uint64_t *state, int len)
+{
+   int i, wlen;
+   uint64_t r;
+
+   if (type != GEN_TEXT) {
+      for (i=0; i + 8 <= len; i += 8) {
+         r = next_rand(state);
+         memcpy(buf + i, &r, 8);
+      }
+      for ( ; i < len; i++) {
+         buf[i] = (char)next_rand(state);
+      }
+      return;
+   }
+   for (i=0; i < len; ) {
+      r = next_rand(state);
+      const char *w = words[r % (sizeof(words)/sizeof(words[0]) - 1)];
+      wlen = MIN((int)strlen(w), len - i);
+      memcpy(buf + i, w, wlen);
+      i += wlen;
+      if (i < len) {
+         buf[i++] = (r >> 32) % 12 ? ' ' : '\n';
+      }
+   }
+}
+
+static bool write_all(int fd, int len, const char *fname)
+{
+   if (write(fd, buf, len) != len) {
+      berrno be;
+      Pmsg2(0, _("Could not write %s. ERR=%s\n"), fname, be.bstrerror());
+      return false;
+   }
+   return true;
+}
+
+/*
+ * Create file number i, sparse files get SPARSE_BLOCKS blocks of
+ *  data spread over the size, the rest is holes.
+ */
+static bool make_file(const char *fname, int64_t size, uint64_t i)
+{
+   uint64_t state = (seed * 1000003) ^ (i * 7919) ^ ((uint64_t)generation << 40);
+   int64_t done = 0, step;
+   int fd, len;
+   bool ok = true;
+
+   next_rand(&state);
+   fd = open(fname, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+   if (fd < 0) {
+      berrno be;
+      Pmsg2(0, _("Could not create %s. ERR=%s\n"), fname, be.bstrerror());
+      return false;
+   }
+   if (type == GEN_SPARSE) {
+      step = size / SPARSE_BLOCKS;
+      for (int b=0; ok && b < SPARSE_BLOCKS; b++) {
+         len = (int)MIN((int64_t)GEN_BUFSIZE, size - b * step);
+         if (len <= 0) {
+            break;
+         }
+         fill_buffer(&state, len);
+         lseek(fd, b * step, SEEK_SET);
+         ok = write_all(fd, len, fname);
+      }
+      if (ok && ftruncate(fd, size) != 0) {
+         berrno be;
+         Pmsg2(0, _("Could not truncate %s. ERR=%s\n"), fname, be.bstrerror());
+         ok = false;
+      }
+   } else {
+      while (ok && done < size) {
+         len = (int)MIN((int64_t)GEN_BUFSIZE, size - done);
+         fill_buffer(&state, len);
+         ok = write_all(fd, len, fname);
+         done += len;
+      }
+   }
+   close(fd);
+   return ok;
+}
+
+static bool make_dir(const char *dname)
+{
+   if (mkdir(dname, 0755) != 0 && errno != EEXIST) {
+      berrno be;
+      Pmsg2(0, _("Could not create directory %s. ERR=%s\n"), dname, be.bstrerror());
+      return false;
+   }
+   return true;
+}
+
+int main(int argc, char *const *argv)
+{
+   POOL_MEM fname(PM_FNAME), dname(PM_FNAME);
+   uint64_t nb_files = 1000, width = 100, i, state;
+   uint64_t min_size = 1024, max_size = 16 * 1024;
+   uint64_t total = 0, nb_done = 0;
+   int64_t size;
+   int update = 0;
+   int ch;
+   btime_t start;
+   char ed1[50], ed2[50], ed3[50];
+
+   setlocale(LC_ALL, "");
+   bindtextdomain("bacula", LOCALEDIR);
+   textdomain("bacula");
+
+   while ((ch = getopt(argc, argv, "n:m:M:t:w:s:u:?")) != -1) {
+      switch (ch) {
+      case 'n':
+         nb_files = str_to_uint64(optarg);
+         break;
+      case 'm':
+         if (!size_to_uint64(optarg, strlen(optarg), &min_size)) {
+            usage();
+         }
+         break;
+      case 'M':
+         if (!size_to_uint64(optarg, strlen(optarg), &max_size)) {
+            usage();
+         }
+         break;
+      case 't':
+         if (strcasecmp(optarg, "random") == 0) {
+            type = GEN_RANDOM;
+         } else if (strcasecmp(optarg, "text") == 0) {
+            type = GEN_TEXT;
+         } else if (strcasecmp(optarg, "sparse") == 0) {
+            type = GEN_SPARSE;
+         } else {
+            usage();
+         }
+         break;
+      case 'w':
+         width = MAX(str_to_uint64(optarg), (uint64_t)1);
+         break;
+      case 's':
+         seed = str_to_uint64(optarg);
+         break;
+      case 'u':
+         update = atoi(optarg);
+         if (update <= 0 || update > 100) {
+            usage();
+         }
+         break;
+      case '?':
+      default:
+         usage();
+      }
+   }
+   argc -= optind;
+   argv += optind;
+
+   if (argc != 1 || min_size > max_size) {
+      usage();
+   }
+   OSDependentInit();
+   if (!make_dir(argv[0])) {
+      exit(1);
+   }
+   buf = (char *)malloc(GEN_BUFSIZE);
+   start = get_current_btime();
+
+   /* With -u, the same files are picked at each run, with new content */
+   if (update) {
+      generation = (int)time(NULL);
+   }
+   for (i=0; i < nb_files; i++) {
+      if (update && (i * 7 % 100) >= (uint64_t)update) {
+         continue;
+      }
+      state = (seed * 1000003) ^ (i * 104729);
+      next_rand(&state);
+      size = min_size;
+      if (max_size > min_size) {
+         size += next_rand(&state) % (max_size - min_size + 1);
+      }
+      Mmsg(dname, "%s/d%llu", argv[0], (unsigned long long)(i / width));
+      if (i % width == 0 && !make_dir(dname.c_str())) {
+         exit(1);
+      }
+      Mmsg(fname, "%s/f%llu", dname.c_str(), (unsigned long long)i);
+      if (!make_file(fname.c_str(), size, i)) {
+         exit(1);
+      }
+      total += size;
+      nb_done++;
+   }
+   free(buf);
+   printf(_("%s files, %s bytes in %s msecs\n"),
+          edit_uint64_with_commas(nb_done, ed1),
+          edit_uint64_with_commas(total, ed2),
+          edit_uint64((get_current_btime() - start) / 1000, ed3));
+   exit(0);
+}
@@ -98,6 +98,15 @@
  * dozens of thread, so turn this only for debugging.
  */
 /* #define USE_LOCKMGR_SAFEKILL */
+
+/*
+ * Enable lock contention profiling by acquisition site,
+ *  see ".status dir|client|storage locks"
+ *
+ * Note, each lock reads the clock twice, so turn this on
+ *  only to find the locks that limit the scaling.
+ */
+/* #define USE_LOCKMGR_PROFILE */
 #endif  /* DEVELOPER */
 
 #if !HAVE_LINUX_OS && !HAVE_SUN_OS && !HAVE_DARWIN_OS && !HAVE_FREEBSD_OS